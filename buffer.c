@@ -0,0 +1,51 @@
+/*
+    Buffers for building binary files in memory before they are written.
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "logging.h"
+#include "hash_table.h"
+#include "buffer.h"
+
+void buffer_add(buffer_t *b, const void *data, size_t size)
+{
+    if (b->len + size > b->cap)
+    {
+        while (b->len + size > b->cap)
+            b->cap = (b->cap == 0) ? 1024 : b->cap * 2;
+        if (NULL == (b->buf = realloc(b->buf, b->cap)))
+            FATAL("cannot allocate memory for buffer");
+    }
+    memcpy(&b->buf[b->len], data, size);
+    b->len += size;
+}
+
+void buffer_free(buffer_t *b)
+{
+    free(b->buf);
+    b->buf = NULL;
+    b->len = b->cap = 0;
+}
+
+/*
+    Return the offset of the string in the pool, adding it if it's not
+    already there. The table maps strings to their offset plus one so that
+    a NULL return means that the string was not found.
+*/
+uint32_t pool_add(buffer_t *pool, ht_handle_t strs, const char *str)
+{
+    uintptr_t offset;
+
+    offset = (uintptr_t)hash_find(strs, str);
+    if (offset == 0)
+    {
+        offset = pool->len;
+        buffer_add(pool, str, strlen(str) + 1);
+        hash_save(strs, str, (void *)(offset + 1));
+        return (uint32_t)offset;
+    }
+    return (uint32_t)(offset - 1);
+}
@@ -0,0 +1,22 @@
+#ifndef _BUFFER_H_
+#define _BUFFER_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include "hash_table.h"
+
+/*
+    Growable byte buffer used to build the binary files.
+*/
+typedef struct
+{
+    char *buf;
+    size_t len;
+    size_t cap;
+} buffer_t;
+
+void buffer_add(buffer_t *b, const void *data, size_t size);
+void buffer_free(buffer_t *b);
+uint32_t pool_add(buffer_t *pool, ht_handle_t strs, const char *str);
+
+#endif /* _BUFFER_H_ */
@@ -0,0 +1,630 @@
+/*
+    Bytecode files.
+
+    When a module has been parsed without errors, its program is written
+    to a bytecode file next to the source, with the extension replaced by
+    ".tbc". The next time that the module is loaded, the file is mapped
+    into memory and, if the hash of the source matches the one that was
+    saved, the program runs where it is mapped. Nothing in it is copied or
+    relocated, since a program has no pointers inside it. See bytecode.h.
+
+        header
+        functions   vm_func_t[num_funcs]
+        constants   vm_value_t[num_consts]
+        strings     the string constants, vm_str_t, each aligned to 8
+        code        uint32_t[code_len]
+        sites       vm_site_t[num_sites]
+        registers   uint8_t[str_regs_size], the string and object registers
+        names       nul terminated names of the functions and the sites
+
+    Each section is aligned for what is in it because of the order. The
+    file is in the byte order of the machine that wrote it.
+
+    The header has the XXH64 of everything after it, and every function is
+    verified before the program is used, so a file that is damaged or
+    written by another version is parsed again instead of being run. The
+    inline caches of the sites are not in the file, they are made empty
+    when it is loaded.
+*/
+#define LOG_MODULE LOG_MOD_VM
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "logging.h"
+#include "xxhash.h"
+#include "modules.h"
+#include "codegen.h"
+#include "bytecode.h"
+
+#define BYTECODE_MAGIC "TOIB"
+#define BYTECODE_VERSION 2
+#define BYTECODE_EXT ".tbc"
+#define BYTE_ORDER_MARK 0x01020304
+#define FNAME_SIZE 1024
+
+typedef struct
+{
+    char magic[4];
+    uint32_t version;
+    uint32_t byte_order; // BYTE_ORDER_MARK as it was written
+    uint32_t num_funcs;
+    uint64_t source_hash; // XXH64 of the module source, see file_hash()
+    uint64_t checksum; // XXH64 of the rest of the file
+    uint32_t num_consts;
+    uint32_t strs_size;
+    uint32_t code_len;
+    uint32_t str_regs_size;
+    uint32_t names_size;
+    uint32_t num_sites;
+} bc_header_t;
+
+static int use_bytecode_files = 1;
+
+void set_bytecode_files(int flag)
+{
+    use_bytecode_files = flag;
+}
+
+/*
+    The verifier. A function that passes cannot make the VM read or write
+    outside of its registers, the registers of its calls, its code, the
+    constants or its sites, and never treats a number as a string or an
+    object. The stack and the depth of the calls are checked as the code
+    runs, and so is the method that a site finds.
+*/
+enum
+{
+    REG_NUM,
+    REG_STR,
+    REG_OBJ,
+};
+
+static int type_kind(int type)
+{
+    return (type == VM_STR) ? REG_STR : (type == VM_OBJ) ? REG_OBJ : REG_NUM;
+}
+
+static int check_func(const vm_program_t *prog, const vm_func_t *fn, uint8_t *kind)
+{
+    uint32_t i, num = fn->num_str_regs + fn->num_obj_regs;
+    uint8_t r;
+
+    if (fn->name >= prog->names_size ||
+        fn->code > prog->code_len || fn->code_len == 0 || fn->code_len > prog->code_len - fn->code ||
+        fn->num_inputs > fn->num_regs || fn->num_regs > MAX_REGS ||
+        fn->str_regs > prog->str_regs_size || num > prog->str_regs_size - fn->str_regs ||
+        fn->sites > prog->num_sites || fn->num_sites > prog->num_sites - fn->sites ||
+        fn->result_type > VM_OBJ)
+        return 0;
+
+    memset(kind, REG_NUM, MAX_REGS);
+    for (i = 0; i < num; i++)
+    {
+        if ((r = prog->str_regs[fn->str_regs + i]) >= fn->num_regs || kind[r] != REG_NUM)
+            return 0;
+        kind[r] = (i < fn->num_str_regs) ? REG_STR : REG_OBJ;
+    }
+
+    if (fn->result_type != VM_NONE &&
+        (fn->result >= fn->num_regs || kind[fn->result] != type_kind(fn->result_type)))
+        return 0;
+    return 1;
+}
+
+/*
+    The kinds of the inputs in the name of a method site, as area(float).
+    Returns the number of inputs or -1.
+*/
+static int site_inputs(const char *key, uint8_t *kinds)
+{
+    const char *ptr = strchr(key, '(');
+    size_t len;
+    int n = 0;
+
+    if (ptr == NULL)
+        return -1;
+    for (ptr++; *ptr != ')' && *ptr != 0; ptr += len + (ptr[len] == ','))
+    {
+        if (n == MAX_REGS || 0 == (len = strcspn(ptr, ",)")))
+            return -1;
+        if (len == 3 && !strncmp(ptr, "str", 3))
+            kinds[n++] = REG_STR;
+        else if ((len == 3 && !strncmp(ptr, "int", 3)) || (len == 4 && !strncmp(ptr, "uint", 4)) ||
+                 (len == 5 && !strncmp(ptr, "float", 5)))
+            kinds[n++] = REG_NUM;
+        else
+            kinds[n++] = REG_OBJ;
+    }
+    return (*ptr == ')' && ptr[1] == 0) ? n : -1;
+}
+
+static int check_site(const vm_program_t *prog, const vm_site_t *site)
+{
+    return site->name < prog->names_size &&
+           site->name + strnlen(VM_SITE_NAME(prog, site), prog->names_size - site->name) < prog->names_size &&
+           site->kind <= SITE_METHOD && site->type <= VM_OBJ &&
+           (site->kind != SITE_CLASS || site->type == VM_OBJ) &&
+           (site->kind != SITE_FIELD || site->type != VM_NONE);
+}
+
+/*
+    Return the index of the function with the decorated name in the
+    program, or -1. A program that was mapped from its file has no index of
+    its functions, so they are searched in order.
+*/
+int find_program_function(const vm_program_t *prog, const char *name)
+{
+    uint32_t i;
+
+    for (i = 0; i < prog->num_funcs; i++)
+        if (!strcmp(VM_FUNC_NAME(prog, &prog->funcs[i]), name))
+            return (int)i;
+    return -1;
+}
+
+/*
+    Whether the function of the program that a method site of the program
+    from found can be called from it, with the inputs in the name of the
+    site and the output that it gives.
+*/
+int check_method(const vm_program_t *prog, uint32_t func, const vm_program_t *from, const vm_site_t *site)
+{
+    const vm_func_t *fn;
+    uint8_t kind[MAX_REGS], inputs[MAX_REGS];
+    int i, n;
+
+    if (func >= prog->num_funcs || !check_func(prog, fn = &prog->funcs[func], kind) ||
+        (n = site_inputs(VM_SITE_NAME(from, site), inputs)) != fn->num_inputs || fn->result_type != site->type)
+        return 0;
+    for (i = 0; i < n; i++)
+        if (kind[i] != inputs[i])
+            return 0;
+    return 1;
+}
+
+static int check_str_const(const vm_program_t *prog, uint32_t index)
+{
+    const vm_str_t *s;
+    uint64_t off;
+
+    if (index >= prog->num_consts)
+        return 0;
+    off = prog->consts[index].u;
+    if (off % 8 != 0 || prog->strs_size < sizeof(vm_str_t) || off > prog->strs_size - sizeof(vm_str_t))
+        return 0;
+    s = (const vm_str_t *)&prog->strs[off];
+    return s->refs < 0 && s->len < prog->strs_size - off - sizeof(vm_str_t);
+}
+
+int verify_function(const vm_program_t *prog, uint32_t func)
+{
+    const vm_func_t *fn, *callee;
+    const vm_site_t *site;
+    const uint32_t *code;
+    uint8_t kind[MAX_REGS], callee_kind[MAX_REGS], inputs[MAX_REGS];
+    uint8_t args[MAX_REGS]; // the kind of each input set by ARG, plus one
+    uint8_t *targets;
+    uint32_t i, ins, k, first_arg;
+    int64_t target;
+    int a, b, c, n, ok = 0;
+
+#define NUM(r) ((r) < fn->num_regs && kind[r] == REG_NUM)
+#define STR(r) ((r) < fn->num_regs && kind[r] == REG_STR)
+#define OBJ(r) ((r) < fn->num_regs && kind[r] == REG_OBJ)
+#define SITE(s, k) ((s) < fn->num_sites && (site = &prog->sites[fn->sites + (s)])->kind == (k))
+#define NUM_TYPE(t) ((t) == VM_INT || (t) == VM_UINT || (t) == VM_FLOAT)
+
+    if (func >= prog->num_funcs || !check_func(prog, fn = &prog->funcs[func], kind) ||
+        fn->name + strnlen(VM_FUNC_NAME(prog, fn), prog->names_size - fn->name) >= prog->names_size)
+        return 0;
+    for (i = 0; i < fn->num_sites; i++)
+        if (!check_site(prog, &prog->sites[fn->sites + i]))
+            return 0;
+
+    code = &prog->code[fn->code];
+    switch (OPCODE(code[fn->code_len - 1]))
+    {
+    case OP_RET:
+    case OP_RET0:
+    case OP_JMP:
+        break;
+    default:
+        return 0; // it could run off the end
+    }
+
+    // nothing can jump in between the arguments of a call and the call
+    if (NULL == (targets = calloc(fn->code_len, 1)))
+        FATAL("cannot allocate memory to verify %s", VM_FUNC_NAME(prog, fn));
+    for (i = 0; i < fn->code_len; i++)
+    {
+        target = (int64_t)i + 1 + ARG_SBX(code[i]);
+        switch (OPCODE(code[i]))
+        {
+        case OP_JMP:
+        case OP_JMPF:
+        case OP_JMPT:
+        case OP_TRY:
+            if (target < 0 || target >= fn->code_len)
+                goto done;
+            targets[target] = 1;
+            break;
+        }
+    }
+
+    memset(args, 0, sizeof(args));
+    first_arg = 0;
+    for (i = 0; i < fn->code_len; i++)
+    {
+        ins = code[i];
+        a = ARG_A(ins);
+        b = ARG_B(ins);
+        c = ARG_C(ins);
+
+        switch (OPCODE(ins))
+        {
+        case OP_NOP:
+        case OP_RET0:
+            break;
+        case OP_MOVE:
+        case OP_ADDIK:
+        case OP_NEGI:
+        case OP_NEGF:
+        case OP_NOT:
+        case OP_BNOT:
+        case OP_ITOF:
+        case OP_UTOF:
+        case OP_FTOI:
+            if (!NUM(a) || !NUM(b))
+                goto done;
+            break;
+        case OP_MOVES:
+            if (!STR(a) || !STR(b))
+                goto done;
+            break;
+        case OP_MOVEO:
+            if (!OBJ(a) || !OBJ(b))
+                goto done;
+            break;
+        case OP_LOADI:
+        case OP_ENDTRY:
+            if (!NUM(a))
+                goto done;
+            break;
+        case OP_LOADK:
+            if (!NUM(a) || ARG_BX(ins) >= prog->num_consts)
+                goto done;
+            break;
+        case OP_LOADS:
+            if (!STR(a) || !check_str_const(prog, ARG_BX(ins)))
+                goto done;
+            break;
+        case OP_EQS:
+        case OP_NES:
+        case OP_LTS:
+        case OP_LES:
+            if (!NUM(a) || !STR(b) || !STR(c))
+                goto done;
+            break;
+        case OP_ITOS:
+        case OP_UTOS:
+        case OP_FTOS:
+            if (!STR(a) || !NUM(b))
+                goto done;
+            break;
+        case OP_CONCAT:
+            if (!STR(a) || !STR(b) || !STR(c))
+                goto done;
+            break;
+        case OP_JMP:
+            break;
+        case OP_JMPF:
+        case OP_JMPT:
+        case OP_TRY:
+            if (!NUM(a))
+                goto done;
+            break;
+        case OP_ARG:
+        case OP_ARGS:
+        case OP_ARGO:
+            n = (OPCODE(ins) == OP_ARG) ? REG_NUM : (OPCODE(ins) == OP_ARGS) ? REG_STR : REG_OBJ;
+            if (a >= fn->num_regs || kind[a] != n)
+                goto done;
+            if (first_arg == 0)
+                first_arg = i + 1;
+            args[b] = n + 1;
+            break;
+        case OP_CALL:
+        case OP_CALLM:
+            // the arguments are set just before the call
+            if (OPCODE(ins) == OP_CALL)
+            {
+                if (ARG_BX(ins) >= prog->num_funcs ||
+                    !check_func(prog, callee = &prog->funcs[ARG_BX(ins)], callee_kind))
+                    goto done;
+                for (k = 0; k < callee->num_inputs; k++)
+                    if (args[k] != callee_kind[k] + 1)
+                        goto done;
+                n = callee->result_type;
+            }
+            else
+            {
+                if (!OBJ(b) || !SITE(c, SITE_METHOD) || (n = site_inputs(VM_SITE_NAME(prog, site), inputs)) < 0)
+                    goto done;
+                for (k = 0; k < (uint32_t)n; k++)
+                    if (args[k] != inputs[k] + 1)
+                        goto done;
+                n = site->type;
+            }
+            if (n != VM_NONE && (a >= fn->num_regs || kind[a] != type_kind(n)))
+                goto done;
+            for (k = first_arg; k != 0 && k <= i; k++)
+                if (targets[k])
+                    goto done;
+            memset(args, 0, sizeof(args));
+            first_arg = 0;
+            break;
+        case OP_NEW:
+            if (!OBJ(a) || !SITE(ARG_BX(ins), SITE_CLASS))
+                goto done;
+            break;
+        case OP_GETF:
+        case OP_GETFS:
+        case OP_GETFO:
+            if (!OBJ(b) || !SITE(c, SITE_FIELD) || a >= fn->num_regs || kind[a] != type_kind(site->type) ||
+                (OPCODE(ins) == OP_GETF) != NUM_TYPE(site->type) ||
+                (OPCODE(ins) == OP_GETFS) != (site->type == VM_STR))
+                goto done;
+            break;
+        case OP_SETF:
+        case OP_SETFS:
+        case OP_SETFO:
+            if (!OBJ(a) || !SITE(c, SITE_FIELD) || b >= fn->num_regs || kind[b] != type_kind(site->type) ||
+                (OPCODE(ins) == OP_SETF) != NUM_TYPE(site->type) ||
+                (OPCODE(ins) == OP_SETFS) != (site->type == VM_STR))
+                goto done;
+            break;
+        case OP_RET:
+            if (fn->result_type == VM_NONE || a != fn->result)
+                goto done;
+            break;
+        default:
+            // the rest are "A = B op C" on numbers
+            if (OPCODE(ins) >= NUM_OPCODES || !NUM(a) || !NUM(b) || !NUM(c))
+                goto done;
+            break;
+        }
+    }
+    ok = 1;
+
+done:
+    free(targets);
+    return ok;
+
+#undef NUM
+#undef STR
+#undef OBJ
+#undef SITE
+#undef NUM_TYPE
+}
+
+int verify_program(const vm_program_t *prog)
+{
+    uint32_t i;
+
+    for (i = 0; i < prog->num_funcs; i++)
+        if (!verify_function(prog, i))
+            return 0;
+    return 1;
+}
+
+static void bytecode_name(const char *fname, char *buf)
+{
+    char *ext;
+
+    if (strlen(fname) + strlen(BYTECODE_EXT) >= FNAME_SIZE)
+        FATAL("bytecode file name is too long: %s", fname);
+
+    strcpy(buf, fname);
+    ext = strrchr(buf, '.');
+    if (ext != NULL && strchr(ext, '/') == NULL)
+        *ext = 0;
+    strcat(buf, BYTECODE_EXT);
+}
+
+/*
+    Write the bytecode file for a module that has been parsed. Failure to
+    write the file is not an error because the module can always be parsed
+    again.
+*/
+void save_bytecode(module_t *mod)
+{
+    static const vm_program_t none = {0};
+    char bname[FNAME_SIZE];
+    char tname[FNAME_SIZE + 8];
+    const vm_program_t *prog;
+    bc_header_t hdr;
+    XXH64_state_t *state;
+    FILE *fp;
+    int failed, fd;
+
+    ENTER();
+    if (!use_bytecode_files)
+        RET();
+    if (NULL == (prog = module_program(mod->name)))
+        prog = &none;
+
+    memset(&hdr, 0, sizeof(hdr));
+    memcpy(hdr.magic, BYTECODE_MAGIC, sizeof(hdr.magic));
+    hdr.version = BYTECODE_VERSION;
+    hdr.byte_order = BYTE_ORDER_MARK;
+    hdr.source_hash = mod->hash;
+    hdr.num_funcs = prog->num_funcs;
+    hdr.num_consts = prog->num_consts;
+    hdr.strs_size = prog->strs_size;
+    hdr.code_len = prog->code_len;
+    hdr.str_regs_size = prog->str_regs_size;
+    hdr.names_size = prog->names_size;
+    hdr.num_sites = prog->num_sites;
+
+    if (NULL == (state = XXH64_createState()))
+        FATAL("cannot allocate memory for hash state");
+    XXH64_reset(state, 0);
+    XXH64_update(state, prog->funcs, (size_t)prog->num_funcs * sizeof(vm_func_t));
+    XXH64_update(state, prog->consts, (size_t)prog->num_consts * sizeof(vm_value_t));
+    XXH64_update(state, prog->strs, prog->strs_size);
+    XXH64_update(state, prog->code, (size_t)prog->code_len * sizeof(uint32_t));
+    XXH64_update(state, prog->sites, (size_t)prog->num_sites * sizeof(vm_site_t));
+    XXH64_update(state, prog->str_regs, prog->str_regs_size);
+    XXH64_update(state, prog->names, prog->names_size);
+    hdr.checksum = XXH64_digest(state);
+    XXH64_freeState(state);
+
+    // write to a temporary file and rename it, like an interface file
+    bytecode_name(mod->fname, bname);
+    sprintf(tname, "%s.XXXXXX", bname);
+    fp = NULL;
+    if ((fd = mkstemp(tname)) >= 0)
+    {
+        fchmod(fd, 0644);
+        if (NULL == (fp = fdopen(fd, "wb")))
+        {
+            close(fd);
+            remove(tname);
+        }
+    }
+
+    if (fp == NULL)
+        ERROR("cannot write bytecode file %s: %s", tname, strerror(errno));
+    else
+    {
+        fwrite(&hdr, sizeof(hdr), 1, fp);
+        fwrite(prog->funcs, sizeof(vm_func_t), prog->num_funcs, fp);
+        fwrite(prog->consts, sizeof(vm_value_t), prog->num_consts, fp);
+        fwrite(prog->strs, 1, prog->strs_size, fp);
+        fwrite(prog->code, sizeof(uint32_t), prog->code_len, fp);
+        fwrite(prog->sites, sizeof(vm_site_t), prog->num_sites, fp);
+        fwrite(prog->str_regs, 1, prog->str_regs_size, fp);
+        fwrite(prog->names, 1, prog->names_size, fp);
+        failed = ferror(fp);
+        if (fclose(fp) != 0)
+            failed = 1;
+
+        if (failed || rename(tname, bname) != 0)
+        {
+            ERROR("cannot write bytecode file %s: %s", bname, strerror(errno));
+            remove(tname);
+        }
+        else
+            INFO("wrote bytecode file: %s", bname);
+    }
+    RET();
+}
+
+/*
+    Point the program at the sections of the file if they fit in it.
+*/
+static int map_program(const char *base, size_t size, vm_program_t *prog)
+{
+    const bc_header_t *hdr = (const bc_header_t *)base;
+    size_t need;
+
+    if (size < sizeof(bc_header_t))
+        return 0;
+
+    if (memcmp(hdr->magic, BYTECODE_MAGIC, sizeof(hdr->magic)) || hdr->version != BYTECODE_VERSION ||
+        hdr->byte_order != BYTE_ORDER_MARK || hdr->strs_size % 8 != 0)
+        return 0;
+
+    need = sizeof(bc_header_t) +
+           (size_t)hdr->num_funcs * sizeof(vm_func_t) +
+           (size_t)hdr->num_consts * sizeof(vm_value_t) +
+           hdr->strs_size +
+           (size_t)hdr->code_len * sizeof(uint32_t) +
+           (size_t)hdr->num_sites * sizeof(vm_site_t) +
+           hdr->str_regs_size + hdr->names_size;
+    if (need != size)
+        return 0;
+
+    prog->funcs = (const vm_func_t *)(hdr + 1);
+    prog->num_funcs = hdr->num_funcs;
+    prog->consts = (const vm_value_t *)(prog->funcs + hdr->num_funcs);
+    prog->num_consts = hdr->num_consts;
+    prog->strs = (const char *)(prog->consts + hdr->num_consts);
+    prog->strs_size = hdr->strs_size;
+    prog->code = (const uint32_t *)(prog->strs + hdr->strs_size);
+    prog->code_len = hdr->code_len;
+    prog->sites = (const vm_site_t *)(prog->code + hdr->code_len);
+    prog->num_sites = hdr->num_sites;
+    prog->str_regs = (const uint8_t *)(prog->sites + hdr->num_sites);
+    prog->str_regs_size = hdr->str_regs_size;
+    prog->names = (const char *)(prog->str_regs + hdr->str_regs_size);
+    prog->names_size = hdr->names_size;
+    prog->caches = NULL; // made by set_module_program()
+    return 1;
+}
+
+/*
+    Map the module's bytecode file and make it the program of the module.
+    Returns 1 if the program was loaded or 0 if the module must be parsed.
+*/
+int load_bytecode(module_t *mod)
+{
+    char bname[FNAME_SIZE];
+    const bc_header_t *hdr;
+    vm_program_t prog;
+    struct stat st;
+    void *base;
+    int fd;
+
+    ENTER();
+    if (!use_bytecode_files)
+        VRET(0);
+
+    bytecode_name(mod->fname, bname);
+    if ((fd = open(bname, O_RDONLY)) < 0)
+        VRET(0);
+
+    if (fstat(fd, &st) < 0 || st.st_size == 0)
+    {
+        close(fd);
+        VRET(0);
+    }
+
+    base = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (base == MAP_FAILED)
+        VRET(0);
+
+    hdr = (const bc_header_t *)base;
+    if (!map_program(base, st.st_size, &prog))
+    {
+        INFO("bytecode file %s is not valid", bname);
+        munmap(base, st.st_size);
+        VRET(0);
+    }
+
+    if (hdr->source_hash != mod->hash)
+    {
+        INFO("bytecode file %s is out of date", bname);
+        munmap(base, st.st_size);
+        VRET(0);
+    }
+
+    if (XXH64(hdr + 1, st.st_size - sizeof(bc_header_t), 0) != hdr->checksum || !verify_program(&prog))
+    {
+        INFO("bytecode file %s does not verify", bname);
+        munmap(base, st.st_size);
+        VRET(0);
+    }
+
+    INFO("loaded %u functions from %s", prog.num_funcs, bname);
+    set_module_program(mod->name, &prog, base, st.st_size);
+    VRET(1);
+}
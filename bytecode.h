@@ -0,0 +1,273 @@
+#ifndef _BYTECODE_H_
+#define _BYTECODE_H_
+
+#include <stdint.h>
+
+#include "modules.h"
+
+/*
+    The bytecode of the functions. See codegen.c, vm.c and bytecode.c.
+
+    An instruction is 32 bits, so a cache line holds 16 of them. The low 8
+    bits are the opcode and the rest is one of
+
+        A B C   three registers
+        A Bx    a register and a 16 bit number, as the index of a constant
+        A sBx   a register and a signed 16 bit number, as a jump
+        A B sC  two registers and a signed 8 bit number
+
+    A jump is relative to the instruction after it.
+*/
+#define OPCODE(i) ((i) & 0xff)
+#define ARG_A(i) (((i) >> 8) & 0xff)
+#define ARG_B(i) (((i) >> 16) & 0xff)
+#define ARG_C(i) ((i) >> 24)
+#define ARG_BX(i) ((i) >> 16)
+#define ARG_SBX(i) ((int32_t)(i) >> 16)
+#define ARG_SC(i) ((int32_t)(i) >> 24)
+
+#define MAKE_ABC(op, a, b, c) \
+    ((uint32_t)(op) | ((uint32_t)(a) << 8) | ((uint32_t)(b) << 16) | ((uint32_t)(uint8_t)(c) << 24))
+#define MAKE_ABX(op, a, bx) ((uint32_t)(op) | ((uint32_t)(a) << 8) | ((uint32_t)(uint16_t)(bx) << 16))
+
+#define MAX_REGS 256
+#define MAX_SBX 32767
+#define MIN_SBX -32768
+
+/*
+    The registers are typed by the instructions that use them. Int and
+    uint share the instructions that give the same bits for both. A string
+    register holds a reference to the string and an object register holds
+    a reference to the object, or NULL.
+
+    A member of an object is found by its name when it is used, because the
+    object can be of a class that inherits the class that the code was
+    compiled for. The C of those instructions, and the Bx of NEW, is a site
+    of the function, which has the name and an inline cache. See vm.c.
+*/
+#define OPCODES(X) \
+    X(NOP)                                        \
+    X(MOVE)   /* A = B */                         \
+    X(MOVES)  /* A = B, strings */                \
+    X(MOVEO)  /* A = B, objects */                \
+    X(LOADI)  /* A = sBx */                       \
+    X(LOADK)  /* A = the constant Bx */           \
+    X(LOADS)  /* A = the string constant Bx */    \
+    X(ADDI)   /* A = B + C, int and uint */       \
+    X(SUBI)                                       \
+    X(MULI)                                       \
+    X(DIVI)                                       \
+    X(MODI)                                       \
+    X(DIVU)                                       \
+    X(MODU)                                       \
+    X(ADDIK)  /* A = B + sC */                    \
+    X(ADDF)                                       \
+    X(SUBF)                                       \
+    X(MULF)                                       \
+    X(DIVF)                                       \
+    X(NEGI)   /* A = -B */                        \
+    X(NEGF)                                       \
+    X(NOT)    /* A = !B */                        \
+    X(BNOT)   /* A = ~B */                        \
+    X(BAND)                                       \
+    X(BOR)                                        \
+    X(BXOR)                                       \
+    X(SHL)                                        \
+    X(SHRI)                                       \
+    X(SHRU)                                       \
+    X(LAND)   /* A = B && C */                    \
+    X(LOR)                                        \
+    X(EQI)    /* A = B == C, int and uint */      \
+    X(NEI)                                        \
+    X(LTI)                                        \
+    X(LEI)                                        \
+    X(LTU)                                        \
+    X(LEU)                                        \
+    X(EQF)                                        \
+    X(NEF)                                        \
+    X(LTF)                                        \
+    X(LEF)                                        \
+    X(EQS)                                        \
+    X(NES)                                        \
+    X(LTS)                                        \
+    X(LES)                                        \
+    X(ITOF)   /* A = (float)B */                  \
+    X(UTOF)                                       \
+    X(FTOI)                                       \
+    X(ITOS)   /* A = B as a string */             \
+    X(UTOS)                                       \
+    X(FTOS)                                       \
+    X(CONCAT) /* A = B + C, strings */            \
+    X(JMP)    /* jump sBx */                      \
+    X(JMPF)   /* jump sBx if A is 0 */            \
+    X(JMPT)   /* jump sBx if A is not 0 */        \
+    X(ARG)    /* input B of the next call = A */  \
+    X(ARGS)                                       \
+    X(ARGO)                                       \
+    X(CALL)   /* A = call the function Bx */      \
+    X(CALLM)  /* A = call the method C of B */    \
+    X(NEW)    /* A = a new object, site Bx */     \
+    X(GETF)   /* A = the field C of B */          \
+    X(GETFS)                                      \
+    X(GETFO)                                      \
+    X(SETF)   /* the field C of A = B */          \
+    X(SETFS)                                      \
+    X(SETFO)                                      \
+    X(RET)    /* return A */                      \
+    X(RET0)   /* return nothing */                \
+    X(TRY)    /* A = the handler, handler = sBx */ \
+    X(ENDTRY) /* handler = A */
+
+#define OPCODE_ENUM(name) OP_##name,
+typedef enum
+{
+    OPCODES(OPCODE_ENUM)
+    NUM_OPCODES,
+} opcode_t;
+#undef OPCODE_ENUM
+
+typedef enum
+{
+    VM_NONE,
+    VM_INT,
+    VM_UINT,
+    VM_FLOAT,
+    VM_STR,
+    VM_OBJ,
+} vm_type_t;
+
+/*
+    A string is counted and the characters follow it. A constant string
+    has a negative count and is never changed or freed.
+*/
+typedef struct
+{
+    int32_t refs;
+    uint32_t len;
+    uint32_t cap;
+    char data[];
+} vm_str_t;
+
+struct vm_obj_t;
+
+typedef union
+{
+    int64_t i;
+    uint64_t u;
+    double f;
+    vm_str_t *s;
+    struct vm_obj_t *o;
+} vm_value_t;
+
+/*
+    An object is counted like a string. Its fields are where the layout of
+    its class puts them, see layout.c.
+*/
+typedef struct vm_obj_t
+{
+    int32_t refs;
+    uint32_t num_fields;
+    const struct class_layout_t *cls;
+    vm_value_t fields[];
+} vm_obj_t;
+
+typedef enum
+{
+    SITE_CLASS,  // the name of a class, for NEW
+    SITE_FIELD,  // the name of a field
+    SITE_METHOD, // the name and the inputs of a method, as area(float)
+} vm_site_kind_t;
+
+/*
+    A site names what an instruction finds when it runs.
+*/
+typedef struct
+{
+    uint32_t name; // offset in the names
+    uint8_t kind;  // vm_site_kind_t
+    uint8_t type;  // the vm_type_t of the field or of the output of the method
+    uint16_t reserved;
+} vm_site_t;
+
+/*
+    The inline cache of a site has the classes that it has seen, up to
+    CACHE_WAYS of them, with the index of the field or of the function that
+    was found for each one. The function of a method can be in the program
+    of another module, the one that defines the class that has it, so the
+    cache keeps the program too. A site that sees more classes than that
+    looks the member up every time. The entries for a class are cleared
+    when the class is defined again, since its layout is made again in the
+    same place. The caches are made when the program is made or loaded,
+    they are not in the bytecode file.
+*/
+#define CACHE_WAYS 4
+
+struct vm_program_t;
+
+typedef struct
+{
+    const struct class_layout_t *cls[CACHE_WAYS];
+    uint32_t slot[CACHE_WAYS];
+    const struct vm_program_t *prog[CACHE_WAYS]; // the program of a method
+    uint32_t num;
+    uint32_t hits;
+    uint32_t misses;
+} vm_cache_t;
+
+/*
+    A program is the functions of one module. It has no pointers inside
+    it. A function refers to its name, its code, its string registers and
+    its sites by offsets, and a string constant is an offset in the
+    strings, so a program is the same in memory as in its file and runs
+    where the file is mapped. See bytecode.c.
+*/
+typedef struct
+{
+    uint32_t name;     // offset of the decorated name in the names
+    uint32_t code;     // the first instruction in the code
+    uint32_t code_len;
+    uint16_t num_inputs;
+    uint16_t num_regs;
+    uint8_t result;      // the register of the first output
+    uint8_t result_type; // the vm_type_t of the first output
+    uint16_t num_str_regs;
+    uint32_t str_regs; // offset of the registers that hold strings, then objects
+    uint16_t num_obj_regs;
+    uint16_t num_sites;
+    uint32_t sites;    // the first site of the function
+} vm_func_t;
+
+typedef struct vm_program_t
+{
+    const vm_func_t *funcs;
+    uint32_t num_funcs;
+    const uint32_t *code;
+    uint32_t code_len;
+    const vm_value_t *consts;
+    uint32_t num_consts;
+    const char *strs; // the string constants as vm_str_t, each aligned to 8
+    uint32_t strs_size;
+    const uint8_t *str_regs;
+    uint32_t str_regs_size;
+    const char *names;
+    uint32_t names_size;
+    const vm_site_t *sites;
+    uint32_t num_sites;
+    vm_cache_t *caches; // one for each site
+} vm_program_t;
+
+#define VM_FUNC_NAME(prog, fn) (&(prog)->names[(fn)->name])
+#define VM_STR_CONST(prog, val) ((vm_str_t *)(uintptr_t)&(prog)->strs[(val).u])
+#define VM_SITE_NAME(prog, site) (&(prog)->names[(site)->name])
+
+extern const char *const opcode_names[];
+
+int verify_function(const vm_program_t *prog, uint32_t func);
+int find_program_function(const vm_program_t *prog, const char *name);
+int check_method(const vm_program_t *prog, uint32_t func, const vm_program_t *from, const vm_site_t *site);
+int verify_program(const vm_program_t *prog);
+void set_bytecode_files(int flag);
+void save_bytecode(module_t *mod);
+int load_bytecode(module_t *mod);
+
+#endif /* _BYTECODE_H_ */
@@ -1,7 +1,9 @@
 /*
     Handle a class definition.
 */
+#define LOG_MODULE LOG_MOD_PARSER
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 
 #include "logging.h"
@@ -11,6 +13,17 @@
 #include "symbols.h"
 #include "file_io.h"
 #include "sym_attrs.h"
+#include "parse.h"
+#include "ll_parse.h"
+#include "buffer.h"
+#include "expr.h"
+#include "signature.h"
+#include "locals.h"
+#include "class_def.h"
+#include "stmt_def.h"
+#include "codegen.h"
+#include "layout.h"
+#include "modules.h"
 
 /*
     The next token should be the name of the var to define.
@@ -49,80 +62,228 @@ static void get_object_def(const char *name)
 }
 
 /*
-    When this is called, the open paren for the parameter tuples has already
-    been seen.
+    The class that is being parsed. The actions for the rules in
+    toi.grammar fill it in as the parts of the class are read.
 */
-static void get_func_def(void)
+typedef struct
 {
-    INFO("function definition: %s", "func");
+    char *str;      // the name of the class as it was read
+    char *name;     // the name of the class in its context
+    char *var_name; // the class variable that is being defined
+    sym_attr_val_t type;
+    char complex[1024];
+    char base[1024]; // the class that is being inherited, as it was written
+    int base_line;   // where the base starts
+    int base_index;
+    // the function that is being defined
+    char *func_name;
+    sym_attr_val_t func_scope;
+    int func_open;   // the context of the function has been pushed
+    int first_param; // the next parameter is the first in its list
+    uint32_t param_name;
+    buffer_t sig;
+    buffer_t params;
+    buffer_t param_strs;
+    buffer_t bases;   // the classes that it inherits, nul separated
+    buffer_t members; // the names of its members, nul separated
+    buffer_t errors;  // inherit_error_t
+} class_state_t;
+
+/*
+    An error in the list of classes that a class inherits.
+*/
+typedef struct
+{
+    int line;
+    int index;
+    int warn; // a warning rather than an error
+    char msg[256];
+} inherit_error_t;
+
+/*
+    A parameter of the function that is being defined. The strings are
+    offsets in param_strs.
+*/
+typedef struct
+{
+    uint32_t name;
+    uint32_t complex;
+    sym_attr_val_t type;
+} param_t;
+
+static _Thread_local class_state_t cls;
+
+static void set_attr(const char *name, sym_attr_t type, sym_attr_val_t val)
+{
+    add_symbol_attr(name, type, (void*)&val, sizeof(sym_attr_val_t));
 }
 
 /*
- * Note that the void pointer needs to point to something that is
- * memcpy()-able. Bsically, this reads a list of symbols seprated by '.' and
- * returns it exactly as read.
- *
- * The name parameter is the first item in the symbol and it's volitile to the
- * scanner.
- */
-static void *get_complex_type(const char *name, unsigned int *size) {
+    An error in the list of classes that a class inherits is reported after
+    the class has been parsed. Reporting it from the action would make the
+    parser recover, which would skip the rest of the list. The diagnostics
+    are sorted when they are printed, so it comes out in its place.
+*/
+static void inherit_error(int warn, const char *fmt, const char *name)
+{
+    inherit_error_t err;
 
-    // TODO: semantics: Verify that the name given is accessible and that it's
-    // defined as a class.
-    static char buff[1024]; // ugly....
-    int finished = 0;
-    int state = 0; // entry state is expecting to see a '.'
-    token_t tok;
+    err.line = cls.base_line;
+    err.index = cls.base_index;
+    err.warn = warn;
+    snprintf(err.msg, sizeof(err.msg), fmt, name);
+    buffer_add(&cls.errors, &err, sizeof(err));
+}
 
-    memset(buff, 0, sizeof(buff));
-    strcpy(buff, name);
-
-    while(!finished) {
-        tok = get_token();
-        switch(state) {
-            case 0:
-                if(tok == DOT_TOK) {
-                    strcat(buff, ".");
-                    state = 1;
-                }
-                else {
-                    unget_token();
-                    finished++;
-                }
-                break;
-            case 1:
-                if(tok == SYMBOL_TOK) {
-                    strcat(buff, get_token_string());
-                    state = 0;
-                }
-                else {
-                    unget_token();
-                    finished++;
-                }
-                break;
-            default:
-                // should never happen
-                FATAL("invalid state in get_complex_type()");
-                return NULL;
+/*
+    Return the class that a base refers to. A plain name is looked for in
+    the module first and then in the modules that it imports, and a name
+    such as geo.point names the module. A class from another module must be
+    public.
+*/
+static const char *find_base_class(const char *name)
+{
+    const module_t *mod = current_module();
+    const sym_attr_val_t *scope;
+    const char *base;
+    char qual[1024];
+    int i, imported = 0;
+
+    if (NULL == (base = find_class(name)) && mod != NULL && strchr(name, '.') == NULL)
+    {
+        for (i = 0; i < mod->num_imports && base == NULL; i++)
+        {
+            snprintf(qual, sizeof(qual), "%s.%s", mod->imports[i]->name, name);
+            base = find_class(qual);
         }
     }
+    if (base == NULL || mod == NULL)
+        return base;
 
-    INFO("complex symbol: %s", buff);
-    *size = strlen(buff)+1;
-    return (void*)buff;
+    // a class in an imported module is in @@name@
+    for (i = 0; i < mod->num_imports && !imported; i++)
+    {
+        snprintf(qual, sizeof(qual), "@@%s@", mod->imports[i]->name);
+        imported = !strncmp(base, qual, strlen(qual));
+    }
+    if (!imported)
+        return base;
+    scope = get_symbol_attr(base, SYMBOL_SCOPE_ATTR);
+    return (scope != NULL && *scope == PUBLIC_SCOPE) ? base : NULL;
 }
 
-static void* get_class_var_assignment(unsigned int* size) {
-    // TODO: call the expression parser
-    token_t tok;
-    char *estr;
+/*
+    Add a class to the classes that the current class inherits. A class that
+    cannot be found is left out with a warning, as it may be defined later.
+    The members that it brings are found through its layout, see layout.c.
+*/
+static void get_inheritance_class(const char *name)
+{
+    const class_layout_t *layout, *other;
+    const char *base, *ptr;
+
+    INFO("getting class %s for inheritance", name);
+    if (NULL == (base = find_base_class(name)))
+    {
+        inherit_error(1, "class %s is not defined or cannot be seen", name);
+        return;
+    }
+    if (!strcmp(base, cls.name))
+    {
+        inherit_error(0, "class %s cannot inherit itself", name);
+        return;
+    }
+
+    layout = get_class_layout(base);
+    for (ptr = cls.bases.buf; ptr < cls.bases.buf + cls.bases.len; ptr += strlen(ptr) + 1)
+    {
+        if (!strcmp(ptr, base))
+        {
+            inherit_error(0, "class %s is inherited twice", name);
+            return;
+        }
+        if (layout != NULL && NULL != (other = get_class_layout(ptr)) && class_inherits(other, layout))
+            INFO("class %s is already inherited through %s", base, ptr);
+    }
+
+    buffer_add(&cls.bases, base, strlen(base) + 1);
+    add_symbol_attr(cls.name, CLASS_BASES_ATTR, cls.bases.buf, cls.bases.len);
+}
+
+static void add_member(const char *name)
+{
+    buffer_add(&cls.members, name, strlen(name) + 1);
+}
+
+/*
+    The actions for the class definition in toi.grammar. The token that an
+    action follows is the last one that was read.
+*/
+void act_class_name(void)
+{
+    cls.str = strdup(get_token_string());
+    cls.name = strdup(make_context(cls.str));
+    cls.bases.len = cls.members.len = cls.errors.len = 0;
+    TRACE_BEGIN(TRACE_CLASS, cls.name);
+    push_context(cls.str);
+    add_symbol(cls.name);
+    set_attr(cls.name, SYMBOL_TYPE_ATTR, CLASS_SYMBOL);
 
-    tok = get_token();
-    estr = strdup(get_token_string());
-    *size = strlen(estr)+1;
-    INFO("assignment var: %s, %d", estr, *size);
-    return (void*)estr;
+    // TODO: semantics: check for duplicate class names and perform
+    // redefinition if needed.
 }
+
+/*
+    The span of the class is ended here rather than in do_class() so that it
+    is in the frame of ll_parse() that began it.
+*/
+void act_class_end(void)
+{
+    TRACE_END(cls.name);
+}
+
+void act_class_default_scope(void)
+{
+    INFO("no scope operator, scope is PRIVATE");
+    set_attr(cls.name, SYMBOL_SCOPE_ATTR, PRIVATE_SCOPE);
+}
+
+void act_class_public(void)
+{
+    INFO("class is PUBLIC scope");
+    set_attr(cls.name, SYMBOL_SCOPE_ATTR, PUBLIC_SCOPE);
+}
+
+void act_class_private(void)
+{
+    INFO("class is PRIVATE scope");
+    set_attr(cls.name, SYMBOL_SCOPE_ATTR, PRIVATE_SCOPE);
+}
+
+void act_base_name(void)
+{
+    cls.base_line = line_number();
+    cls.base_index = line_index();
+    snprintf(cls.base, sizeof(cls.base), "%s", get_token_string());
+}
+
+void act_base_part(void)
+{
+    size_t len = strlen(cls.base);
+
+    snprintf(&cls.base[len], sizeof(cls.base) - len, ".%s", get_token_string());
+}
+
+void act_inherit(void)
+{
+    get_inheritance_class(cls.base);
+}
+
+void act_no_params(void)
+{
+    INFO("empty class parameter list");
+}
+
 /*
  * For class var defs the assignment expression is optional, unlike local
  * variable definitions.
@@ -134,269 +295,341 @@ static void* get_class_var_assignment(unsigned int* size) {
  * must be assigned in the constructor if it is not assigned in the
  * declaration.
  */
-static void get_class_var_def(void)
-{
-    token_t tok;
-    const char *name;
-    sym_attr_val_t attr = CLASS_VAR_SYMBOL;
-    int state = 0;
-    int finished = 0;
-    void* str;
-    unsigned int size;
+static void end_function(void);
 
+void act_var_start(void)
+{
+    // a var def or a function that had a syntax error does not get to its end
+    end_function();
+    free(cls.var_name);
+    cls.var_name = NULL;
     INFO("getting class var symbol");
+}
 
-    // get the symbol name, mandtory
-    tok = get_token();
-    if(tok != SYMBOL_TOK) {
-        syntax("expected name of a variable but got %s", token_to_msg(tok));
-        RET(); // restart parsing
-    }
+void act_var_name(void)
+{
+    const char *name = get_token_string();
+    const class_member_t *m;
 
     // TODO: symantics: Make sure that this symbol name does not already exist
     // in this context.
 
-    name = strdup(get_token_string());
-    add_symbol(name);
-    add_symbol_attr(name, SYMBOL_TYPE_ATTR, (void*)&attr, sizeof(sym_attr_val_t));
-    INFO("class var symbol name is %s", name);
+    // an object has one place for each name
+    if (NULL != (m = find_inherited(cls.name, name)))
+        syntax("%s is already defined in class %s", name, m->owner->name);
 
-    // get the symbol type specifier, type is mandatory.
-    tok = get_token();
-    if(tok != COLON_TOK) {
-        syntax("expected :type but got %s", token_to_msg(tok));
-        RET(); // restart parsing
-    }
+    // symbols are stored under the context where they are defined.
+    cls.var_name = strdup(make_context(name));
+    if (add_symbol(cls.var_name) == 0)
+        add_member(name);
+    set_attr(cls.var_name, SYMBOL_TYPE_ATTR, CLASS_VAR_SYMBOL);
+    INFO("class var symbol name is %s", cls.var_name);
+}
 
-    tok = get_token();
-    switch(tok) {
-        case UINT_DEF_TOK:
-            INFO("var type is unsigned int");
-            attr = TYPEOF_UINT;
-            add_symbol_attr(name, SYM_TYPEOF_ATTR, (void*)&attr, sizeof(sym_attr_val_t));
-            break;
-        case INT_DEF_TOK:
-            INFO("var type is signed int");
-            attr = TYPEOF_INT;
-            add_symbol_attr(name, SYM_TYPEOF_ATTR, (void*)&attr, sizeof(sym_attr_val_t));
-            break;
-        case FLOAT_DEF_TOK:
-            INFO("var type is float");
-            attr = TYPEOF_FLOAT;
-            add_symbol_attr(name, SYM_TYPEOF_ATTR, (void*)&attr, sizeof(sym_attr_val_t));
-            break;
-        case STR_DEF_TOK:
-            INFO("var type is string");
-            attr = TYPEOF_STR;
-            add_symbol_attr(name, SYM_TYPEOF_ATTR, (void*)&attr, sizeof(sym_attr_val_t));
-            break;
-        case SYMBOL_TOK:
-            INFO("var type is complex symbol");
-            attr = TYPEOF_COMPLEX;
-            add_symbol_attr(name, SYM_TYPEOF_ATTR, (void*)&attr, sizeof(sym_attr_val_t));
-            unsigned int size = 0;
-            add_symbol_attr(name, COMPLEX_TYPEOF_ATTR,
-                            get_complex_type(get_token_string(), &size), size);
-            break;
-        default:
-            syntax("expected type definition but got %s", token_to_msg(tok));
-            return;
-    }
+void act_var_end(void)
+{
+    free(cls.var_name);
+    cls.var_name = NULL;
+}
 
-    // get the symbol scope and/or assignment, optional.
-    while(!finished) {
-        tok = get_token();
-        switch(state) {
-            case 0:
-                // could be a ':', '=', or ';'
-                switch(tok) {
-                    case SEMI_TOK:
-                        INFO("var has no scope operator or assignment, is PRIVATE scope");
-                        attr = PRIVATE_SCOPE;
-                        add_symbol_attr(name, SYMBOL_SCOPE_ATTR, (void*)&attr, sizeof(sym_attr_val_t));
-                        finished++;
-                        break;
-                    case ASSIGN_TOK:
-                        INFO("var has no scope operator, is PRIVATE scope");
-                        attr = PRIVATE_SCOPE;
-                        add_symbol_attr(name, SYMBOL_SCOPE_ATTR, (void*)&attr, sizeof(sym_attr_val_t));
-                        str = get_class_var_assignment(&size);
-                        add_symbol_attr(name, SYMBOL_ASSIGMENT_EXPR_ATTR, str, size);
-                        state = 5;
-                        break;
-                    case COLON_TOK:
-                        state = 2;
-                        break;
-                    default:
-                        syntax("expected scope, assignment or statement end, but got %s", token_to_msg(tok));
-                }
-                break;
-            case 1:
-                // statement end
-                finished++;
-                break;
-            case 2:
-                // get the scope operator
-                switch(tok) {
-                    case PUBLIC_TOK:
-                        INFO("var is PUBLIC scope");
-                        attr = PUBLIC_SCOPE;
-                        add_symbol_attr(name, SYMBOL_SCOPE_ATTR, (void*)&attr, sizeof(sym_attr_val_t));
-                        break;
-                    case PRIVATE_TOK:
-                        INFO("var is PRIVATE scope");
-                        attr = PRIVATE_SCOPE;
-                        add_symbol_attr(name, SYMBOL_SCOPE_ATTR, (void*)&attr, sizeof(sym_attr_val_t));
-                        break;
-                    case PROTECTED_TOK:
-                        INFO("var is PROTECTED scope");
-                        attr = PROTECTED_SCOPE;
-                        add_symbol_attr(name, SYMBOL_SCOPE_ATTR, (void*)&attr, sizeof(sym_attr_val_t));
-                        break;
-                    default:
-                        syntax("expected a scope operator but got %s", token_to_msg(tok));
-                        RET();
-                }
-                state = 3;
-                break;
-            case 3:
-                // have the scope operator, could be an assignement or statement end
-                switch(tok) {
-                    case SEMI_TOK:
-                        INFO("var has no assignment");
-                        finished++;
-                        break;
-                    case ASSIGN_TOK:
-                        str = get_class_var_assignment(&size);
-                        add_symbol_attr(name, SYMBOL_ASSIGMENT_EXPR_ATTR, str, size);
-                        state = 5;
-                        break;
-                    default:
-                        syntax("expected assignment or statement end, but got %s", token_to_msg(tok));
-                        RET();
-                }
-                break;
-            case 5:
-                if(tok != SEMI_TOK)
-                    syntax("expected end of statement but got %s", token_to_msg(tok));
-                else
-                    finished++;
-                break;
-            default:
-                FATAL("invalid state in get_class_var(): %d", state);
-        }
-    }
+void act_type_uint(void)
+{
+    INFO("var type is unsigned int");
+    cls.type = TYPEOF_UINT;
+}
 
-    free(name);
+void act_type_int(void)
+{
+    INFO("var type is signed int");
+    cls.type = TYPEOF_INT;
+}
+
+void act_type_float(void)
+{
+    INFO("var type is float");
+    cls.type = TYPEOF_FLOAT;
+}
+
+void act_type_str(void)
+{
+    INFO("var type is string");
+    cls.type = TYPEOF_STR;
+}
+
+/*
+ * A complex type is a list of symbols separated by '.' and it is stored
+ * exactly as read. The size is not known until the type has been read.
+ */
+void act_type_complex(void)
+{
+    // TODO: semantics: Verify that the name given is accessible and that it's
+    // defined as a class.
+    INFO("var type is complex symbol");
+    cls.type = TYPEOF_COMPLEX;
+    snprintf(cls.complex, sizeof(cls.complex), "%s", get_token_string());
 }
 
 /*
-    The class body can have variable definitions and function definitions.
-    Class definitions can be empty.
+    The type that was read by the last var_type in the grammar. The name of
+    a complex type is only good until the next type is read.
 */
-static void get_class_body(void)
+sym_attr_val_t get_var_type(const char **complex)
 {
-    token_t tok;
-    int finished = 0;
-    int state = 0;
+    *complex = (cls.type == TYPEOF_COMPLEX) ? cls.complex : NULL;
+    return cls.type;
+}
+
+void act_complex_part(void)
+{
+    size_t len = strlen(cls.complex);
+
+    snprintf(&cls.complex[len], sizeof(cls.complex) - len, ".%s", get_token_string());
+}
 
-    tok = get_token();
-    if (tok != OCURLY_TOK)
-        expect_token(OCURLY_TOK, tok, "");
+void act_complex_end(void)
+{
+    INFO("complex symbol: %s", cls.complex);
+}
+
+/*
+    The type of a variable is stored when all of it has been read.
+*/
+void act_var_type_end(void)
+{
+    set_attr(cls.var_name, SYM_TYPEOF_ATTR, cls.type);
+    if (cls.type == TYPEOF_COMPLEX)
+        add_symbol_attr(cls.var_name, COMPLEX_TYPEOF_ATTR, (void*)cls.complex, strlen(cls.complex)+1);
+}
+
+void act_var_no_scope(void)
+{
+    INFO("var has no scope operator or assignment, is PRIVATE scope");
+    set_attr(cls.var_name, SYMBOL_SCOPE_ATTR, PRIVATE_SCOPE);
+}
+
+void act_var_default_scope(void)
+{
+    INFO("var has no scope operator, is PRIVATE scope");
+    set_attr(cls.var_name, SYMBOL_SCOPE_ATTR, PRIVATE_SCOPE);
+}
 
-    while (!finished)
+void act_assignment(void)
+{
+    expr_t *expr;
+    buffer_t text = {0};
+
+    if (NULL == (expr = parse_expression()))
+        return;
+
+    if (LOG_ON(1))
     {
-        tok = get_token();
-        switch (tok) {
-            case CCURLY_TOK:
-                finished++;
-                break;
-
-            case VAR_TOK:
-                get_class_var_def();
-                break;
-
-            case FUNC_TOK:
-                get_func_def();
-                break;
-
-            case END_OF_FILE:
-            case END_OF_INPUT:
-                syntax("unexpected end of input in class definition");
-                RET();
-
-            default:
-                syntax("expected a function or a variable definition but got %s", token_to_msg(tok));
-                break;
-        }
+        expr_to_str(expr, &text);
+        INFO("assignment expression: %s", text.buf);
+        buffer_free(&text);
     }
+    add_symbol_attr(cls.var_name, SYMBOL_ASSIGMENT_EXPR_ATTR, (void*)expr, EXPR_SIZE(expr));
+}
+
+void act_var_public(void)
+{
+    INFO("var is PUBLIC scope");
+    set_attr(cls.var_name, SYMBOL_SCOPE_ATTR, PUBLIC_SCOPE);
+}
+
+void act_var_private(void)
+{
+    INFO("var is PRIVATE scope");
+    set_attr(cls.var_name, SYMBOL_SCOPE_ATTR, PRIVATE_SCOPE);
+}
+
+void act_var_protected(void)
+{
+    INFO("var is PROTECTED scope");
+    set_attr(cls.var_name, SYMBOL_SCOPE_ATTR, PROTECTED_SCOPE);
+}
+
+void act_var_no_assignment(void)
+{
+    INFO("var has no assignment");
 }
 
 /*
-    Add the symbols currently defined for this class name to
-    the definition of the current class.
+    A function definition has the form
+    func name:scope(inputs)(outputs) {function body}
+
+    The function is stored under its name decorated with its signature,
+    which is the types of the inputs and the outputs, and the function
+    body is parsed in that context. The parameters are symbols in the
+    context of the function, and they are also the first locals of the
+    function. See signature.c, stmt_def.c and locals.c.
 */
-static void get_inheritance_class(const char *name)
+static void end_function(void)
 {
-    // TODO: semantics: Verify that the symbol is defined as a class and that
-    // it's acssesible. Add the specified class's richness to this class as a
-    // stand-alone class.
-    INFO("getting class %s for inheritance", name);
+    // a function that had a syntax error does not get to its end
+    if (cls.func_open)
+    {
+        end_code();
+        end_statements();
+        end_locals();
+        pop_context();
+    }
+    cls.func_open = 0;
+    free(cls.func_name);
+    cls.func_name = NULL;
 }
 
-static void get_class_parameters(void)
+static const char *type_name(sym_attr_val_t type)
 {
-    token_t tok;
-    int finished = 0;
-    int state = 0;
+    switch (type)
+    {
+    case TYPEOF_UINT:
+        return "uint";
+    case TYPEOF_INT:
+        return "int";
+    case TYPEOF_FLOAT:
+        return "float";
+    case TYPEOF_STR:
+        return "str";
+    default:
+        return cls.complex;
+    }
+}
 
-    tok = get_token();
-    if (tok != OPAREN_TOK)
-        expect_token(OPAREN_TOK, tok, "");
+void act_func_start(void)
+{
+    end_function();
+    free(cls.var_name);
+    cls.var_name = NULL;
+    INFO("getting class function symbol");
+}
 
-    while (!finished)
+void act_func_name(void)
+{
+    cls.func_name = strdup(get_token_string());
+    cls.first_param = 1;
+    cls.sig.len = cls.params.len = cls.param_strs.len = 0;
+    buffer_add(&cls.sig, "(", 1);
+}
+
+void act_func_default_scope(void)
+{
+    INFO("function has no scope operator, is PRIVATE scope");
+    cls.func_scope = PRIVATE_SCOPE;
+}
+
+void act_func_public(void)
+{
+    INFO("function is PUBLIC scope");
+    cls.func_scope = PUBLIC_SCOPE;
+}
+
+void act_func_private(void)
+{
+    INFO("function is PRIVATE scope");
+    cls.func_scope = PRIVATE_SCOPE;
+}
+
+void act_func_protected(void)
+{
+    INFO("function is PROTECTED scope");
+    cls.func_scope = PROTECTED_SCOPE;
+}
+
+void act_param_name(void)
+{
+    const char *str = get_token_string();
+
+    cls.param_name = cls.param_strs.len;
+    buffer_add(&cls.param_strs, str, strlen(str) + 1);
+}
+
+void act_param_type(void)
+{
+    param_t param;
+    const char *str = type_name(cls.type);
+
+    param.name = cls.param_name;
+    param.type = cls.type;
+    param.complex = cls.param_strs.len;
+    buffer_add(&cls.param_strs, cls.complex, (cls.type == TYPEOF_COMPLEX) ? strlen(cls.complex) + 1 : 1);
+    buffer_add(&cls.params, &param, sizeof(param));
+
+    if (!cls.first_param)
+        buffer_add(&cls.sig, ",", 1);
+    buffer_add(&cls.sig, str, strlen(str));
+    cls.first_param = 0;
+}
+
+void act_func_outputs(void)
+{
+    buffer_add(&cls.sig, ")(", 2);
+    cls.first_param = 1;
+}
+
+void act_func_signature(void)
+{
+    const signature_t *sig;
+    const param_t *param;
+    char *local, *name, *func;
+    size_t i;
+    int errors = error_count();
+
+    buffer_add(&cls.sig, ")", 2);
+    sig = intern_signature(cls.sig.buf);
+
+    if (NULL == (local = malloc(strlen(cls.func_name) + strlen(sig->str) + 1)))
+        FATAL("cannot allocate memory for function name");
+    strcpy(local, cls.func_name);
+    strcat(local, sig->str);
+    name = strdup(make_context(local));
+    func = strdup(name);
+
+    if (add_symbol(name) != 0)
+        syntax("function %s is already defined", local);
+    else
+        add_member(local);
+    set_attr(name, SYMBOL_TYPE_ATTR, FUNC_SYMBOL);
+    set_attr(name, SYMBOL_SCOPE_ATTR, cls.func_scope);
+    add_symbol_attr(name, FUNC_SIGNATURE_ATTR, (void*)sig->str, strlen(sig->str)+1);
+    add_overload(name, sig);
+    INFO("function definition: %s", name);
+    free(name);
+
+    push_context(local);
+    begin_locals();
+    cls.func_open = 1;
+    free(local);
+
+    for (i = 0; i < cls.params.len / sizeof(param_t); i++)
     {
-        tok = get_token();
-        switch (state)
-        {
-        case 0:
-            switch (tok)
-            {
-            case SYMBOL_TOK:
-                get_inheritance_class(get_token_string());
-                state = 1;
-                break;
-            case CPAREN_TOK:
-                INFO("empty class parameter list");
-                finished++;
-                break;
-            default:
-                syntax("expected a symbol or a close paren but got %s", token_to_msg(tok));
-                finished++;
-                break;
-            }
-            break;
-        case 1:
-            switch (tok)
-            {
-            case COMMA_TOK:
-                state = 0;
-                break;
-            case CPAREN_TOK:
-                finished++;
-                break;
-            default:
-                syntax("expected a comma or a close paren but got %s", token_to_msg(tok));
-                finished++;
-                break;
-            }
-            break;
-        default:
-            syntax("expected a symbol or a close paren but got %s", token_to_msg(tok));
-            finished++;
-            break;
-        }
+        param = &((const param_t *)cls.params.buf)[i];
+        name = strdup(make_context(&cls.param_strs.buf[param->name]));
+        add_symbol(name);
+        set_attr(name, SYMBOL_TYPE_ATTR, VAR_SYMBOL);
+        set_attr(name, SYM_TYPEOF_ATTR, param->type);
+        if (param->type == TYPEOF_COMPLEX)
+            add_symbol_attr(name, COMPLEX_TYPEOF_ATTR, (void*)&cls.param_strs.buf[param->complex],
+                            strlen(&cls.param_strs.buf[param->complex]) + 1);
+        INFO("function parameter %s", name);
+        free(name);
+        if (add_local(&cls.param_strs.buf[param->name], param->type, &cls.param_strs.buf[param->complex]) < 0)
+            syntax("parameter %s is already defined", &cls.param_strs.buf[param->name]);
     }
+
+    if (error_count() == errors)
+    {
+        // the code can use the members of the class that are defined so far
+        if (cls.members.len > 0)
+            add_symbol_attr(cls.name, CLASS_MEMBERS_ATTR, cls.members.buf, cls.members.len);
+        invalidate_layout(cls.name);
+        begin_code(func, cls.name, sig);
+    }
+    free(func);
+}
+
+void act_func_end(void)
+{
+    end_function();
 }
 
 /*
@@ -408,76 +641,55 @@ static void get_class_parameters(void)
     name(inherit1, inherit2, ...) {class body}
 
     The inherited classes must already have a definition. The class body
-    consists of variable definitions and function definitions.
+    consists of variable definitions and function definitions. The syntax
+    is in toi.grammar and the parts of the class are handled by the actions
+    above.
 */
 void do_class(void)
 {
-    token_t tok;
-    const char* str;
-    sym_attr_val_t attr = CLASS_SYMBOL;
+    const inherit_error_t *err;
+    size_t i;
 
     ENTER();
-
-    tok = get_token();
-    if(tok != SYMBOL_TOK) {
-        syntax("expected name of class but got %s", token_to_msg(tok));
-        RET(); // restart parsing
+    ll_parse(NT_CLASS_DEF);
+    end_function();
+    for (i = 0; i < cls.errors.len / sizeof(inherit_error_t); i++)
+    {
+        err = &((const inherit_error_t *)cls.errors.buf)[i];
+        if (err->warn)
+            warning_at(file_name(), err->line, err->index, "%s", err->msg);
+        else
+            syntax_at(file_name(), err->line, err->index, "%s", err->msg);
     }
+    cls.errors.len = 0;
 
-    str = strdup(get_token_string());
-    push_context(str);
-    add_symbol(str);
-    add_symbol_attr(str, SYMBOL_TYPE_ATTR, (void*)&attr, sizeof(sym_attr_val_t));
-
-    // TODO: semantics: check for duplicate class names and perform
-    // redefinition if needed.
-
-    tok = get_token();
-    switch(tok) {
-        case COLON_TOK:
-            tok = get_token();
-            if(tok == PUBLIC_TOK) {
-                // store the attrib in the symbol
-                INFO("class is PUBLIC scope");
-                attr = PUBLIC_SCOPE;
-                add_symbol_attr(str, SYMBOL_SCOPE_ATTR, (void*)&attr, sizeof(sym_attr_val_t));
-            }
-            else if(tok == PRIVATE_TOK) {
-                // store the attrib
-                INFO("class is PRIVATE scope");
-                attr = PRIVATE_SCOPE;
-                add_symbol_attr(str, SYMBOL_SCOPE_ATTR, (void*)&attr, sizeof(sym_attr_val_t));
-            }
-            else {
-                syntax("expected a scope operator but got %s", token_to_msg(tok));
-                pop_context();
-                free(str);
-                RET(); // restart paring
-            }
-            get_class_parameters();
-            get_class_body();
-            break;
-
-        case OPAREN_TOK:
-            // save the scope as private
-            INFO("no scope operator, scope is PRIVATE");
-            attr = PRIVATE_SCOPE;
-            add_symbol_attr(str, SYMBOL_SCOPE_ATTR, (void*)&attr, sizeof(sym_attr_val_t));
-            unget_char('(');
-            get_class_parameters();
-            get_class_body();
-            break;
-        case END_OF_FILE:
-        case END_OF_INPUT:
-            syntax("unexpected end of file");
-            break;
-        default:
-            syntax("expected class parameters or scope operator but got %s", token_to_msg(tok));
-            break;
+    // the class name is not known if it had a syntax error
+    if (cls.name != NULL)
+    {
+        // the layout is made from the members when it is needed
+        if (cls.members.len > 0)
+            add_symbol_attr(cls.name, CLASS_MEMBERS_ATTR, cls.members.buf, cls.members.len);
+        invalidate_layout(cls.name);
+        pop_context();
     }
-
-    pop_context();
-    free(str);
+    free(cls.var_name);
+    free(cls.str);
+    free(cls.name);
+    cls.var_name = cls.str = cls.name = NULL;
     RET();
 }
 
+/*
+    Free the buffers of the class state of the thread.
+*/
+void destroy_class_def(void)
+{
+    ENTER();
+    buffer_free(&cls.sig);
+    buffer_free(&cls.params);
+    buffer_free(&cls.param_strs);
+    buffer_free(&cls.bases);
+    buffer_free(&cls.members);
+    buffer_free(&cls.errors);
+    RET();
+}
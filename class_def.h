@@ -1,6 +1,10 @@
 #ifndef _CLASS_DEF_H_
 #define _CLASS_DEF_H_
 
+#include "sym_attrs.h"
+
 void do_class(void);
+sym_attr_val_t get_var_type(const char **complex);
+void destroy_class_def(void);
 
-#endif /* _CLASS_DEF_H_ */
\ No newline at end of file
+#endif /* _CLASS_DEF_H_ */
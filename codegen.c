@@ -0,0 +1,2176 @@
+/*
+    Compile the bodies of functions to bytecode.
+
+    The code is made while the statements are parsed. The actions in
+    stmt_def.c call the functions here, and an expression is compiled from
+    its nodes, which are already in the order that they run in, so there
+    is no tree. See bytecode.h for the instructions and vm.c for the VM.
+
+    A local variable has a register for as long as it is in scope, and an
+    expression takes temporary registers for the values in the middle of
+    it. A register holds numbers, strings or objects for the whole
+    function, so the VM knows which registers to release at the end of a
+    call without a tag on every value. A value that is computed into a
+    temporary and then assigned is written straight into the variable
+    instead.
+
+    A variable of a class type holds an object, and starts as a new object
+    of the class. A member of an object is checked against the class that
+    the variable has here, but it is found by name when the code runs, so
+    it works on an object of a class that inherits that one. Each use of a
+    member is a site of the function, with its own inline cache in the VM.
+    A method is called without the object, so it can only use its inputs.
+
+    The test of a loop is at the bottom, so each time around a loop runs
+    one jump. The test of a while and the step of a for are read before the
+    body, so they are copied and compiled after it.
+
+    A function that uses something that cannot be compiled yet, such as a
+    function that a class inherits from another module called without an
+    object, is left out of the program without an error. So is a function
+    with a syntax error. A method of an object can be one from another
+    module, since the VM finds it in the program of that module.
+*/
+#define LOG_MODULE LOG_MOD_VM
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdarg.h>
+#include <string.h>
+#include <sys/mman.h>
+
+#include "logging.h"
+#include "errors.h"
+#include "hash_table.h"
+#include "buffer.h"
+#include "sym_attrs.h"
+#include "locals.h"
+#include "layout.h"
+#include "codegen.h"
+
+#define OPCODE_NAME(name) #name,
+const char *const opcode_names[] = {OPCODES(OPCODE_NAME)};
+#undef OPCODE_NAME
+
+typedef enum
+{
+    OPND_REG,   // in a register
+    OPND_CONST, // a literal that is not loaded yet
+    OPND_NAME,  // a name that is not a local, as a function to call
+    OPND_NONE,  // no value
+    OPND_MEMBER, // a member of the object in the register, not loaded yet
+} operand_kind_t;
+
+typedef struct
+{
+    uint8_t kind;
+    uint8_t type;  // vm_type_t, VM_NONE for a member that is not a field
+    uint8_t reg;
+    uint8_t temp;  // the register is freed when the value is used
+    const char *str; // the name, the string literal or the member
+    vm_value_t val;
+    const class_layout_t *layout; // the class of an object, or of the object
+                                  // of a member that is not a field
+} operand_t;
+
+typedef enum
+{
+    CTRL_IF,
+    CTRL_LOOP,
+    CTRL_SWITCH,
+    CTRL_TRY,
+} ctrl_kind_t;
+
+/*
+    A statement that has jumps to patch when its end is reached.
+*/
+typedef struct
+{
+    ctrl_kind_t kind;
+    int jump;        // the false branch of an if, the next case, the jump
+                     // into the test of a loop or the TRY
+    int top;         // the body of a loop
+    int reg;         // the value of a switch or the outer handler of a try
+    vm_type_t type;  // of the value of a switch
+    expr_t *test;    // the test of a loop
+    expr_t *step;    // the step of a for
+    buffer_t ends;   // jumps to the end, int
+    buffer_t conts;  // jumps to the step or the test of a loop, int
+} ctrl_t;
+
+/*
+    The function that is being compiled.
+*/
+typedef struct
+{
+    int active;
+    int failed;
+    int errors; // error_count() when it started
+    char *name;
+    char *cls;
+    int index;  // in the program
+    const signature_t *sig;
+    buffer_t code;
+    int last; // the instruction that wrote a new temporary last, or -1
+    int num_regs;
+    uint8_t reg_kind[MAX_REGS]; // VM_INT for numbers, VM_STR or VM_OBJ
+    uint8_t reg_used[MAX_REGS];
+    uint8_t local_regs[MAX_REGS];
+    uint8_t local_types[MAX_REGS];
+    const class_layout_t *local_layouts[MAX_REGS];
+    uint8_t result;
+    vm_type_t result_type;
+    const class_layout_t *result_layout;
+    buffer_t sites;      // vm_site_t, with the names in site_names
+    buffer_t site_names;
+    buffer_t scopes;  // num_locals() when each block started, int
+    buffer_t ctrls;   // ctrl_t
+    buffer_t stack;   // operand_t
+    const expr_t *expr; // the expression that is being compiled
+} gen_state_t;
+
+/*
+    The program of a module. It is made in the buffers, or it is in the
+    bytecode file of the module.
+*/
+typedef struct
+{
+    vm_program_t prog;
+    buffer_t funcs;    // vm_func_t
+    buffer_t code;     // uint32_t
+    buffer_t consts;   // vm_value_t
+    buffer_t strs;
+    buffer_t str_regs;
+    buffer_t names;
+    buffer_t sites;    // vm_site_t
+    buffer_t caches;   // vm_cache_t, one for each site
+    ht_handle_t func_index; // the index of each function, plus one
+    ht_handle_t str_index;  // the index of each string constant, plus one
+    void *map;              // the mapped bytecode file, or NULL
+    size_t map_size;
+} program_state_t;
+
+// each thread compiles its own programs
+static _Thread_local gen_state_t gen;
+static _Thread_local ht_handle_t programs = NULL; // the program of each module
+static _Thread_local program_state_t *pgm = NULL; // the program being compiled
+
+void init_codegen(void)
+{
+    ENTER();
+    programs = create_hash_table(127);
+    pgm = NULL;
+    RET();
+}
+
+static void free_ctrl(ctrl_t *c)
+{
+    free(c->test);
+    free(c->step);
+    buffer_free(&c->ends);
+    buffer_free(&c->conts);
+}
+
+static void free_program_data(program_state_t *p)
+{
+    buffer_free(&p->funcs);
+    buffer_free(&p->code);
+    buffer_free(&p->consts);
+    buffer_free(&p->strs);
+    buffer_free(&p->str_regs);
+    buffer_free(&p->names);
+    buffer_free(&p->sites);
+    buffer_free(&p->caches);
+    destroy_hash_table(p->func_index);
+    destroy_hash_table(p->str_index);
+    if (p->map != NULL)
+        munmap(p->map, p->map_size);
+    memset(p, 0, sizeof(*p));
+}
+
+static void free_program(const char *key, void *data, void *arg)
+{
+    (void)key;
+    (void)arg;
+    free_program_data((program_state_t *)data);
+    free(data);
+}
+
+void destroy_codegen(void)
+{
+    ENTER();
+    hash_foreach(programs, free_program, NULL);
+    destroy_hash_table(programs);
+    programs = NULL;
+    pgm = NULL;
+
+    free(gen.name);
+    free(gen.cls);
+    buffer_free(&gen.code);
+    buffer_free(&gen.scopes);
+    buffer_free(&gen.ctrls);
+    buffer_free(&gen.stack);
+    buffer_free(&gen.sites);
+    buffer_free(&gen.site_names);
+    memset(&gen, 0, sizeof(gen));
+    RET();
+}
+
+/*
+    Return the program of the module, with no functions in it yet.
+*/
+static program_state_t *new_program(const char *module)
+{
+    program_state_t *p;
+
+    if (NULL == (p = hash_find(programs, module)))
+    {
+        if (NULL == (p = calloc(1, sizeof(program_state_t))))
+            FATAL("cannot allocate memory for a program");
+        hash_save(programs, module, p);
+    }
+    else
+        free_program_data(p);
+    p->func_index = create_hash_table(127);
+    p->str_index = create_hash_table(127);
+    if (pgm == p)
+        pgm = NULL;
+    return p;
+}
+
+/*
+    The module is about to be parsed, so the functions that were compiled
+    for it before are thrown away.
+*/
+void begin_module_code(const char *module)
+{
+    new_program(module);
+}
+
+/*
+    The program of the module is in the bytecode file that is mapped at
+    map. The program points into the map, which is unmapped when the
+    program is thrown away.
+*/
+void set_module_program(const char *module, const vm_program_t *prog, void *map, size_t map_size)
+{
+    static const vm_cache_t empty; // all 0
+    program_state_t *p = new_program(module);
+    uint32_t i;
+
+    p->prog = *prog;
+    p->map = map;
+    p->map_size = map_size;
+    for (i = 0; i < prog->num_sites; i++)
+        buffer_add(&p->caches, &empty, sizeof(empty));
+}
+
+static void forget_program_caches(const char *key, void *data, void *arg)
+{
+    program_state_t *p = (program_state_t *)data;
+    vm_cache_t *cache;
+    size_t i;
+    uint32_t j, k;
+
+    (void)key;
+    for (i = 0; i < p->caches.len / sizeof(vm_cache_t); i++)
+    {
+        cache = &((vm_cache_t *)p->caches.buf)[i];
+        for (j = k = 0; j < cache->num; j++)
+        {
+            if (cache->cls[j] == (const class_layout_t *)arg)
+                continue;
+            cache->cls[k] = cache->cls[j];
+            cache->slot[k++] = cache->slot[j];
+        }
+        for (j = k; j < cache->num; j++)
+            cache->cls[j] = NULL;
+        cache->num = k;
+    }
+}
+
+/*
+    Forget what the inline caches of all of the programs found in the
+    layout, which is being made again.
+*/
+void forget_class_caches(const class_layout_t *layout)
+{
+    if (programs != NULL)
+        hash_foreach(programs, forget_program_caches, (void *)layout);
+}
+
+/*
+    Point the program at its buffers, which move as they grow.
+*/
+static const vm_program_t *sync_program(program_state_t *p)
+{
+    if (p->map == NULL)
+    {
+        p->prog.funcs = (const vm_func_t *)p->funcs.buf;
+        p->prog.num_funcs = p->funcs.len / sizeof(vm_func_t);
+        p->prog.code = (const uint32_t *)p->code.buf;
+        p->prog.code_len = p->code.len / sizeof(uint32_t);
+        p->prog.consts = (const vm_value_t *)p->consts.buf;
+        p->prog.num_consts = p->consts.len / sizeof(vm_value_t);
+        p->prog.strs = p->strs.buf;
+        p->prog.strs_size = p->strs.len;
+        p->prog.str_regs = (const uint8_t *)p->str_regs.buf;
+        p->prog.str_regs_size = p->str_regs.len;
+        p->prog.names = p->names.buf;
+        p->prog.names_size = p->names.len;
+        p->prog.sites = (const vm_site_t *)p->sites.buf;
+        p->prog.num_sites = p->sites.len / sizeof(vm_site_t);
+    }
+    p->prog.caches = (vm_cache_t *)p->caches.buf;
+    return &p->prog;
+}
+
+/*
+    Return the program of the module, or NULL if none of it was compiled or
+    loaded.
+*/
+const vm_program_t *module_program(const char *module)
+{
+    program_state_t *p;
+
+    if (programs == NULL || NULL == (p = hash_find(programs, module)))
+        return NULL;
+    return sync_program(p);
+}
+
+/*
+    Returns the index of the function with the decorated name in the
+    program that is being compiled, or -1 if it has not been compiled.
+*/
+int find_function(const char *name)
+{
+    if (pgm == NULL)
+        return -1;
+    return (int)(intptr_t)hash_find(pgm->func_index, name) - 1;
+}
+
+static void not_compiled(const char *fmt, ...)
+{
+    va_list args;
+    char buf[256];
+
+    if (!gen.failed)
+    {
+        va_start(args, fmt);
+        vsnprintf(buf, sizeof(buf), fmt, args);
+        va_end(args);
+        INFO("function %s is not compiled: %s", gen.name, buf);
+    }
+    gen.failed = 1;
+}
+
+static const char *type_str(int type)
+{
+    switch (type)
+    {
+    case VM_INT:
+        return "int";
+    case VM_UINT:
+        return "uint";
+    case VM_FLOAT:
+        return "float";
+    case VM_STR:
+        return "str";
+    case VM_OBJ:
+        return "class object";
+    default:
+        return "nothing";
+    }
+}
+
+/*
+    The name of a class as it is written in a signature.
+*/
+static const char *class_str(const class_layout_t *layout)
+{
+    return strrchr(layout->name, '@') + 1;
+}
+
+static vm_type_t reg_kind(vm_type_t type)
+{
+    return (type == VM_STR || type == VM_OBJ) ? type : VM_INT;
+}
+
+static vm_type_t vm_type(sym_attr_val_t type)
+{
+    switch (type)
+    {
+    case TYPEOF_INT:
+        return VM_INT;
+    case TYPEOF_UINT:
+        return VM_UINT;
+    case TYPEOF_FLOAT:
+        return VM_FLOAT;
+    case TYPEOF_STR:
+        return VM_STR;
+    case TYPEOF_COMPLEX:
+        return VM_OBJ;
+    default:
+        return VM_NONE;
+    }
+}
+
+/*
+    The constants.
+*/
+static uint32_t add_const(vm_value_t val)
+{
+    uint32_t index = pgm->consts.len / sizeof(vm_value_t);
+
+    if (index > UINT16_MAX)
+    {
+        not_compiled("the program has too many constants");
+        return 0;
+    }
+    buffer_add(&pgm->consts, &val, sizeof(val));
+    return index;
+}
+
+/*
+    A string constant is written once in the strings of the program as a
+    vm_str_t that is never freed.
+*/
+static uint32_t str_const(const char *str)
+{
+    static const char zeros[8] = {0};
+    uintptr_t index;
+    vm_value_t val;
+    vm_str_t hdr;
+    size_t len = strlen(str);
+
+    if (0 != (index = (uintptr_t)hash_find(pgm->str_index, str)))
+        return index - 1;
+
+    val.u = pgm->strs.len;
+    index = add_const(val);
+    if (gen.failed)
+        return 0;
+    hdr.refs = -1;
+    hdr.len = hdr.cap = len;
+    buffer_add(&pgm->strs, &hdr, sizeof(hdr));
+    buffer_add(&pgm->strs, str, len + 1);
+    buffer_add(&pgm->strs, zeros, (8 - (sizeof(hdr) + len + 1) % 8) % 8);
+    hash_save(pgm->str_index, str, (void *)(index + 1));
+    return index;
+}
+
+/*
+    The instructions.
+*/
+#define CODE(p) (((uint32_t *)gen.code.buf)[p])
+
+static int here(void)
+{
+    return gen.code.len / sizeof(uint32_t);
+}
+
+static void emit(uint32_t ins)
+{
+    buffer_add(&gen.code, &ins, sizeof(ins));
+    gen.last = -1;
+}
+
+// A is a new temporary
+static void emit_dst(uint32_t ins)
+{
+    emit(ins);
+    gen.last = here() - 1;
+}
+
+static int emit_jump(opcode_t op, int reg)
+{
+    emit(MAKE_ABX(op, reg, 0));
+    return here() - 1;
+}
+
+static void patch(int at, int target)
+{
+    int offset = target - (at + 1);
+
+    if (at < 0)
+        return;
+    if (offset < MIN_SBX || offset > MAX_SBX)
+    {
+        not_compiled("it is too long to jump across");
+        return;
+    }
+    CODE(at) = (CODE(at) & 0xffff) | ((uint32_t)(uint16_t)offset << 16);
+}
+
+static void patch_list(buffer_t *list, int target)
+{
+    size_t i;
+
+    for (i = 0; i < list->len / sizeof(int); i++)
+        patch(((int *)list->buf)[i], target);
+    list->len = 0;
+}
+
+/*
+    The registers.
+*/
+static int alloc_reg(vm_type_t type)
+{
+    int r, kind = reg_kind(type);
+
+    for (r = 0; r < gen.num_regs; r++)
+    {
+        if (!gen.reg_used[r] && gen.reg_kind[r] == kind)
+        {
+            gen.reg_used[r] = 1;
+            return r;
+        }
+    }
+    if (gen.num_regs == MAX_REGS)
+    {
+        not_compiled("it needs more than %d registers", MAX_REGS);
+        return 0;
+    }
+    r = gen.num_regs++;
+    gen.reg_kind[r] = kind;
+    gen.reg_used[r] = 1;
+    return r;
+}
+
+static void release(const operand_t *o)
+{
+    if ((o->kind == OPND_REG || o->kind == OPND_MEMBER) && o->temp)
+        gen.reg_used[o->reg] = 0;
+}
+
+/*
+    The sites of the members that the function uses. The C of an
+    instruction is the index of its site, so there can be 256 of them.
+*/
+static int add_site(vm_site_kind_t kind, vm_type_t type, const char *name)
+{
+    vm_site_t site;
+    int index = gen.sites.len / sizeof(vm_site_t);
+
+    if (index == MAX_REGS)
+    {
+        not_compiled("it uses more than %d members", MAX_REGS);
+        return 0;
+    }
+    memset(&site, 0, sizeof(site));
+    site.name = gen.site_names.len;
+    site.kind = kind;
+    site.type = type;
+    buffer_add(&gen.sites, &site, sizeof(site));
+    buffer_add(&gen.site_names, name, strlen(name) + 1);
+    return index;
+}
+
+/*
+    The operands of an expression.
+*/
+static void load_const(int reg, const operand_t *o)
+{
+    switch (o->type)
+    {
+    case VM_STR:
+        emit_dst(MAKE_ABX(OP_LOADS, reg, str_const(o->str)));
+        break;
+    case VM_INT:
+    case VM_UINT:
+        if (o->val.i >= MIN_SBX && o->val.i <= MAX_SBX)
+        {
+            emit_dst(MAKE_ABX(OP_LOADI, reg, o->val.i));
+            break;
+        }
+        // fall through
+    default:
+        emit_dst(MAKE_ABX(OP_LOADK, reg, add_const(o->val)));
+        break;
+    }
+}
+
+static void load_field(operand_t *o);
+
+static void load(operand_t *o)
+{
+    int r;
+
+    switch (o->kind)
+    {
+    case OPND_MEMBER:
+        load_field(o);
+        break;
+    case OPND_CONST:
+        r = alloc_reg(o->type);
+        load_const(r, o);
+        o->kind = OPND_REG;
+        o->reg = r;
+        o->temp = 1;
+        break;
+    case OPND_NAME:
+        not_compiled("%s is not a local variable", o->str);
+        break;
+    case OPND_NONE:
+        syntax("the function has no output to use");
+        gen.failed = 1;
+        break;
+    }
+}
+
+static void type_error(const char *what, int type)
+{
+    syntax("%s cannot be %s", what, type_str(type));
+    gen.failed = 1;
+}
+
+static const char *operand_str(vm_type_t type, const class_layout_t *layout)
+{
+    return (type == VM_OBJ && layout != NULL) ? class_str(layout) : type_str(type);
+}
+
+/*
+    Whether the value can be assigned to a variable of the type. An object
+    can be assigned to a variable of its class or of a class that it
+    inherits.
+*/
+static int check_assign(vm_type_t type, const class_layout_t *layout, const operand_t *o)
+{
+    if (o->kind == OPND_NAME || o->kind == OPND_NONE || (reg_kind(type) == reg_kind(o->type) &&
+        (type != VM_OBJ || o->layout == layout || class_inherits(o->layout, layout))))
+        return 1;
+    syntax("a %s cannot be assigned to a %s", operand_str(o->type, o->layout), operand_str(type, layout));
+    gen.failed = 1;
+    return 0;
+}
+
+static void convert(operand_t *o, vm_type_t to)
+{
+    opcode_t op;
+    int r;
+
+    if (o->type == to || o->kind == OPND_NAME || o->kind == OPND_NONE)
+        return;
+
+    if (o->type == VM_STR || o->type == VM_OBJ || to == VM_OBJ)
+    {
+        syntax("a %s cannot be used as %s", type_str(o->type), type_str(to));
+        gen.failed = 1;
+        return;
+    }
+
+    // int and uint have the same bits
+    if ((o->type == VM_INT || o->type == VM_UINT) && (to == VM_INT || to == VM_UINT))
+    {
+        o->type = to;
+        return;
+    }
+
+    if (o->kind == OPND_CONST && to != VM_STR)
+    {
+        if (to == VM_FLOAT)
+            o->val.f = (o->type == VM_UINT) ? (double)o->val.u : (double)o->val.i;
+        else
+            o->val.i = (int64_t)o->val.f;
+        o->type = to;
+        return;
+    }
+
+    if (to == VM_FLOAT)
+        op = (o->type == VM_UINT) ? OP_UTOF : OP_ITOF;
+    else if (to == VM_STR)
+        op = (o->type == VM_FLOAT) ? OP_FTOS : (o->type == VM_UINT) ? OP_UTOS : OP_ITOS;
+    else
+        op = OP_FTOI;
+
+    load(o);
+    release(o);
+    r = alloc_reg(to);
+    emit_dst(MAKE_ABC(op, r, o->reg, 0));
+    o->reg = r;
+    o->temp = 1;
+    o->type = to;
+}
+
+static operand_t value(const expr_node_t *node)
+{
+    operand_t o = {OPND_CONST, VM_INT, 0, 0, NULL, {0}, NULL};
+    const char *str = &EXPR_STRS(gen.expr)[node->arg];
+    int local;
+
+    o.str = str;
+    switch (node->tok)
+    {
+    case SYMBOL_TOK:
+        if ((local = lookup_local(str)) < 0)
+            o.kind = OPND_NAME;
+        else if (local >= MAX_REGS)
+            not_compiled("it has too many locals");
+        else
+        {
+            o.kind = OPND_REG;
+            o.reg = gen.local_regs[local];
+            o.type = gen.local_types[local];
+            o.layout = gen.local_layouts[local];
+        }
+        break;
+    case INT_TOK:
+        o.val.i = strtoll(str, NULL, 10);
+        break;
+    case UINT_TOK:
+        o.type = VM_UINT;
+        o.val.u = strtoull(str, NULL, 0);
+        break;
+    case FLOAT_TOK:
+        o.type = VM_FLOAT;
+        o.val.f = strtod(str, NULL);
+        break;
+    case STRING_TOK:
+        o.type = VM_STR;
+        break;
+    case TRUE_TOK:
+        o.val.i = 1;
+        break;
+    case FALSE_TOK:
+        break;
+    default:
+        not_compiled("%s is not supported yet", str);
+        o.kind = OPND_NONE;
+        break;
+    }
+    return o;
+}
+
+/*
+    Put the value in a register that belongs to a local variable.
+*/
+static void store(int reg, vm_type_t type, const class_layout_t *layout, operand_t *o)
+{
+    uint32_t ins;
+
+    if (!check_assign(type, layout, o))
+        return;
+    convert(o, type);
+    if (o->kind == OPND_CONST)
+    {
+        load_const(reg, o);
+        gen.last = -1;
+        return;
+    }
+    load(o);
+    if (gen.failed)
+        return;
+
+    // the value was just computed, so it is computed into the local
+    if (o->temp && gen.last == here() - 1 && ARG_A(CODE(gen.last)) == o->reg)
+    {
+        ins = CODE(gen.last);
+        CODE(gen.last) = (ins & ~0xff00u) | ((uint32_t)reg << 8);
+        gen.last = -1;
+        release(o);
+        return;
+    }
+    release(o);
+    if (o->reg != reg)
+        emit(MAKE_ABC((type == VM_STR) ? OP_MOVES : (type == VM_OBJ) ? OP_MOVEO : OP_MOVE, reg, o->reg, 0));
+}
+
+/*
+    The members of objects. A member that is not a field is left for the
+    call that follows it, which knows the inputs of the method.
+*/
+static int can_use(const class_member_t *m)
+{
+    const class_layout_t *own;
+
+    if (m->scope == PUBLIC_SCOPE || !strcmp(m->owner->name, gen.cls))
+        return 1;
+    if (m->scope == PROTECTED_SCOPE && NULL != (own = get_class_layout(gen.cls)) && class_inherits(own, m->owner))
+        return 1;
+    syntax("%s is %s in class %s", m->name, (m->scope == PROTECTED_SCOPE) ? "protected" : "private",
+           m->owner->name);
+    gen.failed = 1;
+    return 0;
+}
+
+static void member(operand_t *o, const char *name)
+{
+    const class_member_t *m;
+
+    if (o->kind == OPND_NAME)
+    {
+        not_compiled("%s is not a local variable", o->str);
+        return;
+    }
+    load(o);
+    if (gen.failed)
+        return;
+    if (o->type != VM_OBJ)
+    {
+        syntax("a %s has no members", type_str(o->type));
+        gen.failed = 1;
+        return;
+    }
+
+    o->kind = OPND_MEMBER;
+    o->str = name;
+    o->type = VM_NONE;
+    if (NULL == (m = find_member(o->layout, name)) || m->kind == FUNC_SYMBOL || !can_use(m))
+        return;
+    o->type = vm_type(m->type);
+    o->layout = NULL;
+    if (o->type == VM_OBJ && NULL == (o->layout = get_complex_type(m->complex, m->owner)))
+        not_compiled("%s has a type that is not supported yet", m->sym);
+}
+
+static opcode_t field_op(opcode_t op, vm_type_t type)
+{
+    return op + ((type == VM_STR) ? 1 : (type == VM_OBJ) ? 2 : 0);
+}
+
+/*
+    The object is released first, so a field of an object in a temporary
+    can go into the same register.
+*/
+static void load_field(operand_t *o)
+{
+    int r, site;
+
+    if (o->type == VM_NONE)
+    {
+        syntax("%s is not a field of class %s", o->str, o->layout->name);
+        gen.failed = 1;
+        return;
+    }
+    site = add_site(SITE_FIELD, o->type, o->str);
+    release(o);
+    r = alloc_reg(o->type);
+    emit_dst(MAKE_ABC(field_op(OP_GETF, o->type), r, o->reg, site));
+    o->kind = OPND_REG;
+    o->reg = r;
+    o->temp = 1;
+}
+
+/*
+    An assignment to a field gives the value that was assigned.
+*/
+static void store_field(operand_t *a, operand_t *b)
+{
+    int site;
+
+    if (a->type == VM_NONE)
+    {
+        load_field(a);
+        return;
+    }
+    if (!check_assign(a->type, a->layout, b))
+        return;
+    convert(b, a->type);
+    load(b);
+    if (gen.failed)
+        return;
+    site = add_site(SITE_FIELD, a->type, a->str);
+    emit(MAKE_ABC(field_op(OP_SETF, a->type), a->reg, b->reg, site));
+    release(a);
+    *a = *b;
+}
+
+static int is_local(const operand_t *o)
+{
+    return o->kind == OPND_REG && !o->temp;
+}
+
+static vm_type_t common_type(vm_type_t a, vm_type_t b)
+{
+    if (a == VM_OBJ || b == VM_OBJ)
+        return VM_OBJ;
+    if (a == VM_STR || b == VM_STR)
+        return VM_STR;
+    if (a == VM_FLOAT || b == VM_FLOAT)
+        return VM_FLOAT;
+    if (a == VM_UINT || b == VM_UINT)
+        return VM_UINT;
+    return VM_INT;
+}
+
+/*
+    Emit "A = B op C" with the operands, leaving the result in a.
+*/
+static void emit_op(opcode_t op, vm_type_t type, operand_t *a, operand_t *b)
+{
+    int r;
+
+    load(a);
+    load(b);
+    if (gen.failed)
+        return;
+
+    // a temporary on the left is reused, so strings are appended in place
+    if (a->temp && (a->type == VM_STR) == (type == VM_STR))
+    {
+        r = a->reg;
+        release(b);
+    }
+    else
+    {
+        release(a);
+        release(b);
+        r = alloc_reg(type);
+    }
+    emit_dst(MAKE_ABC(op, r, a->reg, b->reg));
+    a->kind = OPND_REG;
+    a->reg = r;
+    a->temp = 1;
+    a->type = type;
+}
+
+static int fold(int tok, operand_t *a, const operand_t *b)
+{
+    if (a->kind != OPND_CONST || b->kind != OPND_CONST || a->type == VM_STR || a->type != b->type)
+        return 0;
+
+    if (a->type == VM_FLOAT)
+    {
+        switch (tok)
+        {
+        case PLUS_TOK:
+            a->val.f += b->val.f;
+            return 1;
+        case MINUS_TOK:
+            a->val.f -= b->val.f;
+            return 1;
+        case MUL_TOK:
+            a->val.f *= b->val.f;
+            return 1;
+        default:
+            return 0;
+        }
+    }
+
+    switch (tok)
+    {
+    case PLUS_TOK:
+        a->val.u += b->val.u;
+        return 1;
+    case MINUS_TOK:
+        a->val.u -= b->val.u;
+        return 1;
+    case MUL_TOK:
+        a->val.u *= b->val.u;
+        return 1;
+    default:
+        return 0;
+    }
+}
+
+static void arith(int tok, operand_t *a, operand_t *b)
+{
+    vm_type_t type = common_type(a->type, b->type);
+    int64_t imm;
+    int r;
+    opcode_t op = OP_NOP;
+
+    if (type == VM_OBJ)
+    {
+        type_error("the operand of an arithmetic operator", VM_OBJ);
+        return;
+    }
+    if (type == VM_STR)
+    {
+        if (tok != PLUS_TOK)
+        {
+            type_error("the operand of an arithmetic operator", VM_STR);
+            return;
+        }
+        convert(a, VM_STR);
+        convert(b, VM_STR);
+        emit_op(OP_CONCAT, VM_STR, a, b);
+        return;
+    }
+
+    convert(a, type);
+    convert(b, type);
+    if (fold(tok, a, b))
+        return;
+
+    // a small number is added by the instruction
+    if (type != VM_FLOAT && (tok == PLUS_TOK || tok == MINUS_TOK))
+    {
+        if (tok == PLUS_TOK && a->kind == OPND_CONST && b->kind != OPND_CONST)
+        {
+            operand_t t = *a;
+            *a = *b;
+            *b = t;
+        }
+        if (b->kind == OPND_CONST)
+        {
+            imm = (tok == PLUS_TOK) ? b->val.i : -b->val.i;
+            if (imm >= -128 && imm <= 127)
+            {
+                load(a);
+                if (gen.failed)
+                    return;
+                release(a);
+                r = alloc_reg(type);
+                emit_dst(MAKE_ABC(OP_ADDIK, r, a->reg, imm));
+                a->reg = r;
+                a->temp = 1;
+                return;
+            }
+        }
+    }
+
+    switch (tok)
+    {
+    case PLUS_TOK:
+        op = (type == VM_FLOAT) ? OP_ADDF : OP_ADDI;
+        break;
+    case MINUS_TOK:
+        op = (type == VM_FLOAT) ? OP_SUBF : OP_SUBI;
+        break;
+    case MUL_TOK:
+        op = (type == VM_FLOAT) ? OP_MULF : OP_MULI;
+        break;
+    case DIV_TOK:
+        op = (type == VM_FLOAT) ? OP_DIVF : (type == VM_UINT) ? OP_DIVU : OP_DIVI;
+        break;
+    case MOD_TOK:
+        if (type == VM_FLOAT)
+        {
+            type_error("the operand of %", VM_FLOAT);
+            return;
+        }
+        op = (type == VM_UINT) ? OP_MODU : OP_MODI;
+        break;
+    }
+    emit_op(op, type, a, b);
+}
+
+static void compare(int tok, operand_t *a, operand_t *b)
+{
+    vm_type_t type = common_type(a->type, b->type);
+    operand_t t;
+    opcode_t op;
+    int swap = (tok == GREATER_TOK || tok == GREATER_OR_EQUAL_TOK);
+
+    if (type == VM_OBJ)
+    {
+        type_error("the operand of a comparison", VM_OBJ);
+        return;
+    }
+    if (type == VM_STR && (a->type != VM_STR || b->type != VM_STR))
+    {
+        syntax("a str can only be compared with a str");
+        gen.failed = 1;
+        return;
+    }
+    convert(a, type);
+    convert(b, type);
+
+    switch (tok)
+    {
+    case EQUAL_TOK:
+        op = (type == VM_STR) ? OP_EQS : (type == VM_FLOAT) ? OP_EQF : OP_EQI;
+        break;
+    case NEQUAL_TOK:
+        op = (type == VM_STR) ? OP_NES : (type == VM_FLOAT) ? OP_NEF : OP_NEI;
+        break;
+    case LESS_TOK:
+    case GREATER_TOK:
+        op = (type == VM_STR) ? OP_LTS : (type == VM_FLOAT) ? OP_LTF : (type == VM_UINT) ? OP_LTU : OP_LTI;
+        break;
+    default:
+        op = (type == VM_STR) ? OP_LES : (type == VM_FLOAT) ? OP_LEF : (type == VM_UINT) ? OP_LEU : OP_LEI;
+        break;
+    }
+
+    if (swap)
+    {
+        t = *a;
+        *a = *b;
+        *b = t;
+    }
+    emit_op(op, VM_INT, a, b);
+}
+
+static void bitwise(int tok, operand_t *a, operand_t *b)
+{
+    vm_type_t type = common_type(a->type, b->type);
+    opcode_t op;
+
+    if (type == VM_STR || type == VM_FLOAT || type == VM_OBJ)
+    {
+        type_error("the operand of a bit or logic operator", type);
+        return;
+    }
+    convert(a, type);
+    convert(b, type);
+
+    switch (tok)
+    {
+    case AND_TOK:
+        op = OP_LAND;
+        type = VM_INT;
+        break;
+    case OR_TOK:
+        op = OP_LOR;
+        type = VM_INT;
+        break;
+    case LAND_TOK:
+        op = OP_BAND;
+        break;
+    case LOR_TOK:
+        op = OP_BOR;
+        break;
+    case LXOR_TOK:
+        op = OP_BXOR;
+        break;
+    case LSHL_TOK:
+        op = OP_SHL;
+        break;
+    default:
+        op = (type == VM_UINT) ? OP_SHRU : OP_SHRI;
+        break;
+    }
+    emit_op(op, type, a, b);
+}
+
+static void binary(int tok, operand_t *a, operand_t *b)
+{
+    switch (tok)
+    {
+    case ASSIGN_TOK:
+        if (a->kind == OPND_NAME)
+            not_compiled("%s is not a local variable", a->str);
+        else if (a->kind == OPND_MEMBER)
+            store_field(a, b);
+        else if (!is_local(a))
+        {
+            syntax("the left side of = cannot be assigned to");
+            gen.failed = 1;
+        }
+        else
+            store(a->reg, a->type, a->layout, b);
+        break;
+    case PLUS_TOK:
+    case MINUS_TOK:
+    case MUL_TOK:
+    case DIV_TOK:
+    case MOD_TOK:
+        arith(tok, a, b);
+        break;
+    case EQUAL_TOK:
+    case NEQUAL_TOK:
+    case LESS_TOK:
+    case GREATER_TOK:
+    case LESS_OR_EQUAL_TOK:
+    case GREATER_OR_EQUAL_TOK:
+        compare(tok, a, b);
+        break;
+    default:
+        bitwise(tok, a, b);
+        break;
+    }
+}
+
+/*
+    ++ and -- change a local and give its new value.
+*/
+static void step_local(int tok, operand_t *o)
+{
+    operand_t one = {OPND_CONST, VM_FLOAT, 0, 0, NULL, {.f = 1.0}, NULL};
+    int r;
+
+    if (!is_local(o) || reg_kind(o->type) != VM_INT)
+    {
+        syntax("++ and -- need a local number");
+        gen.failed = 1;
+        return;
+    }
+    if (o->type != VM_FLOAT)
+    {
+        emit(MAKE_ABC(OP_ADDIK, o->reg, o->reg, (tok == INCREMENT_TOK) ? 1 : -1));
+        return;
+    }
+    r = alloc_reg(VM_FLOAT);
+    load_const(r, &one);
+    emit(MAKE_ABC((tok == INCREMENT_TOK) ? OP_ADDF : OP_SUBF, o->reg, o->reg, r));
+    gen.reg_used[r] = 0;
+}
+
+static void prefix(int tok, operand_t *o)
+{
+    int r;
+
+    if (o->kind == OPND_NAME)
+    {
+        not_compiled("%s is not a local variable", o->str);
+        return;
+    }
+
+    switch (tok)
+    {
+    case INCREMENT_TOK:
+    case DECREMENT_TOK:
+        step_local(tok, o);
+        return;
+    case PLUS_TOK:
+        if (o->type == VM_STR || o->type == VM_OBJ)
+            type_error("the operand of +", o->type);
+        return;
+    case MINUS_TOK:
+        if (o->type == VM_STR || o->type == VM_OBJ)
+        {
+            type_error("the operand of -", o->type);
+            return;
+        }
+        if (o->kind == OPND_CONST)
+        {
+            if (o->type == VM_FLOAT)
+                o->val.f = -o->val.f;
+            else
+                o->val.i = -o->val.i;
+            return;
+        }
+        break;
+    default:
+        if (o->type == VM_STR || o->type == VM_FLOAT || o->type == VM_OBJ)
+        {
+            type_error("the operand of a bit or logic operator", o->type);
+            return;
+        }
+        break;
+    }
+
+    load(o);
+    if (gen.failed)
+        return;
+    release(o);
+    r = alloc_reg(o->type);
+    if (tok == MINUS_TOK)
+        emit_dst(MAKE_ABC((o->type == VM_FLOAT) ? OP_NEGF : OP_NEGI, r, o->reg, 0));
+    else
+        emit_dst(MAKE_ABC((tok == NOT_TOK) ? OP_NOT : OP_BNOT, r, o->reg, 0));
+    if (tok == NOT_TOK)
+        o->type = VM_INT;
+    o->reg = r;
+    o->temp = 1;
+}
+
+/*
+    x++ gives the value from before the change, which is copied unless
+    nothing uses it.
+*/
+static void postfix(int tok, operand_t *o, int unused)
+{
+    int r;
+
+    if (o->kind == OPND_NAME)
+    {
+        not_compiled("%s is not a local variable", o->str);
+        return;
+    }
+    if (unused || !is_local(o))
+    {
+        step_local(tok, o);
+        return;
+    }
+    r = alloc_reg(o->type);
+    emit(MAKE_ABC(OP_MOVE, r, o->reg, 0));
+    step_local(tok, o);
+    o->reg = r;
+    o->temp = 1;
+}
+
+/*
+    The type of the first output in a signature.
+*/
+static vm_type_t output_type(const char *sig)
+{
+    const char *out = strchr(sig, ')') + 2;
+    size_t len = strcspn(out, ",)");
+
+    if (len == 0)
+        return VM_NONE;
+    if (len == 3 && !strncmp(out, "int", 3))
+        return VM_INT;
+    if (len == 4 && !strncmp(out, "uint", 4))
+        return VM_UINT;
+    if (len == 5 && !strncmp(out, "float", 5))
+        return VM_FLOAT;
+    if (len == 3 && !strncmp(out, "str", 3))
+        return VM_STR;
+    return VM_OBJ;
+}
+
+/*
+    The class of the first output in a signature, which is found from the
+    class of the function.
+*/
+static const class_layout_t *output_layout(const char *sig, const class_layout_t *from)
+{
+    const char *out = strchr(sig, ')') + 2;
+    const class_layout_t *layout;
+    char *name;
+
+    if (NULL == (name = strndup(out, strcspn(out, ",)"))))
+        FATAL("cannot allocate memory for a class name");
+    layout = get_complex_type(name, from);
+    free(name);
+    return layout;
+}
+
+/*
+    The inputs of a call as they are in a signature, as (int,str,point).
+    Returns 0 if an argument cannot be compiled.
+*/
+static int call_inputs(const operand_t *args, int num_args, buffer_t *inputs)
+{
+    const char *type;
+    int i;
+
+    buffer_add(inputs, "(", 1);
+    for (i = 0; i < num_args; i++)
+    {
+        if (args[i].kind == OPND_NAME)
+        {
+            not_compiled("%s is not a local variable", args[i].str);
+            return 0;
+        }
+        if (i > 0)
+            buffer_add(inputs, ",", 1);
+        type = operand_str(args[i].type, args[i].layout);
+        buffer_add(inputs, type, strlen(type));
+    }
+    buffer_add(inputs, ")", 2);
+    return 1;
+}
+
+/*
+    Set the arguments of a call, then give the register for its output.
+*/
+static void call_args(operand_t *args, int num_args)
+{
+    int i;
+
+    for (i = 0; i < num_args; i++)
+    {
+        load(&args[i]);
+        emit(MAKE_ABC((args[i].type == VM_STR) ? OP_ARGS : (args[i].type == VM_OBJ) ? OP_ARGO : OP_ARG,
+                      args[i].reg, i, 0));
+    }
+    for (i = 0; i < num_args; i++)
+        release(&args[i]);
+}
+
+static void call_result(operand_t *fn, uint32_t ins, vm_type_t type, const class_layout_t *layout)
+{
+    int r;
+
+    if (type == VM_NONE)
+    {
+        emit(ins);
+        fn->kind = OPND_NONE;
+    }
+    else
+    {
+        r = alloc_reg(type);
+        emit_dst(ins | ((uint32_t)r << 8));
+        fn->kind = OPND_REG;
+        fn->reg = r;
+        fn->temp = 1;
+    }
+    fn->type = type;
+    fn->layout = layout;
+}
+
+/*
+    A method that the class inherits is found through the layouts of the
+    classes that it inherits. A private method cannot be called from
+    another class.
+*/
+static const char *inherited_method(const char *fn, const char *inputs, const signature_t **sig)
+{
+    const class_member_t *m;
+    char *key;
+
+    if (NULL == (key = malloc(strlen(fn) + strlen(inputs) + 1)))
+        FATAL("cannot allocate memory for a function name");
+    sprintf(key, "%s%s", fn, inputs);
+    m = find_inherited(gen.cls, key);
+    free(key);
+    if (m == NULL || m->kind != FUNC_SYMBOL || m->scope == PRIVATE_SCOPE)
+        return NULL;
+    *sig = intern_signature(strchr(m->name, '('));
+    return m->sym;
+}
+
+/*
+    Whether the method has been compiled. The method of a class that an
+    imported module defines is in the program of that module.
+*/
+static int method_compiled(const class_member_t *m)
+{
+    const module_t *mod = current_module();
+    const vm_program_t *prog;
+
+    if (m->owner->module == NULL || mod == NULL || !strcmp(m->owner->module, mod->name))
+        return !strcmp(m->sym, gen.name) || find_function(m->sym) >= 0;
+    return NULL != (prog = module_program(m->owner->module)) && find_program_function(prog, m->sym) >= 0;
+}
+
+/*
+    A call of a method of an object. The method is found in the class of
+    the object when it runs, so it can be one that overrides the method of
+    the class of the variable.
+*/
+static void method_call(operand_t *fn, operand_t *args, int num_args)
+{
+    const class_layout_t *layout = NULL;
+    const class_member_t *m;
+    buffer_t key = {0};
+    vm_type_t type;
+    int site;
+
+    if (fn->type != VM_NONE)
+    {
+        syntax("field %s cannot be called", fn->str);
+        gen.failed = 1;
+        return;
+    }
+    buffer_add(&key, fn->str, strlen(fn->str));
+    if (!call_inputs(args, num_args, &key))
+    {
+        buffer_free(&key);
+        return;
+    }
+
+    if (NULL == (m = find_member(fn->layout, key.buf)) || m->kind != FUNC_SYMBOL)
+    {
+        syntax("%s is not a method of class %s", key.buf, fn->layout->name);
+        gen.failed = 1;
+    }
+    else if (can_use(m))
+    {
+        if (!method_compiled(m))
+            not_compiled("%s is not compiled", m->sym);
+        else if ((type = output_type(strchr(m->name, '('))) == VM_OBJ &&
+                 NULL == (layout = output_layout(strchr(m->name, '('), m->owner)))
+            not_compiled("%s has an output that is not supported yet", m->sym);
+        else
+        {
+            site = add_site(SITE_METHOD, type, key.buf);
+            call_args(args, num_args);
+            release(fn);
+            call_result(fn, MAKE_ABC(OP_CALLM, 0, fn->reg, site), type, layout);
+        }
+    }
+    buffer_free(&key);
+}
+
+/*
+    A call of a function of the class or of a class that it inherits. The
+    overload is the one with the types of the arguments as its inputs.
+*/
+static void call(operand_t *fn, operand_t *args, int num_args)
+{
+    const class_layout_t *layout = NULL;
+    const signature_t *sig;
+    const char *name;
+    buffer_t inputs = {0};
+    char *base;
+    int index;
+    vm_type_t type;
+
+    if (fn->kind == OPND_MEMBER)
+    {
+        method_call(fn, args, num_args);
+        return;
+    }
+    if (fn->kind != OPND_NAME)
+    {
+        not_compiled("only the functions of the class can be called");
+        return;
+    }
+    if (!call_inputs(args, num_args, &inputs))
+    {
+        buffer_free(&inputs);
+        return;
+    }
+
+    if (NULL == (base = malloc(strlen(gen.cls) + strlen(fn->str) + 2)))
+        FATAL("cannot allocate memory for a function name");
+    sprintf(base, "%s@%s", gen.cls, fn->str);
+    name = find_overload_inputs(base, inputs.buf, &sig);
+    free(base);
+    if (name == NULL)
+        name = inherited_method(fn->str, inputs.buf, &sig);
+
+    if (name == NULL)
+        not_compiled("%s%s is not defined before it is called", fn->str, inputs.buf);
+    else if ((index = !strcmp(name, gen.name) ? gen.index : find_function(name)) < 0)
+        not_compiled("%s is not compiled", name);
+    else if ((type = output_type(sig->str)) == VM_OBJ && NULL == (layout = output_layout(sig->str, NULL)))
+        not_compiled("%s has an output that is not supported yet", name);
+    else
+    {
+        call_args(args, num_args);
+        call_result(fn, MAKE_ABX(OP_CALL, 0, index), type, layout);
+    }
+    buffer_free(&inputs);
+}
+
+/*
+    Compile the expression and return where its value is. If the value is
+    not used, x++ is compiled as ++x.
+*/
+static operand_t compile(const expr_t *expr, int unused)
+{
+    operand_t none = {OPND_NONE, VM_NONE, 0, 0, NULL, {0}, NULL};
+    operand_t *stack;
+    const expr_node_t *node;
+    uint32_t i;
+    int sp = 0;
+
+    if (expr == NULL || gen.failed)
+        return none;
+
+    gen.expr = expr;
+    gen.stack.len = 0;
+    for (i = 0; i < expr->num_nodes; i++)
+        buffer_add(&gen.stack, &none, sizeof(none));
+    stack = (operand_t *)gen.stack.buf;
+
+    for (i = 0; i < expr->num_nodes && !gen.failed; i++)
+    {
+        node = &expr->nodes[i];
+        switch (node->kind)
+        {
+        case EXPR_VALUE:
+            stack[sp++] = value(node);
+            break;
+        case EXPR_PREFIX:
+            prefix(node->tok, &stack[sp - 1]);
+            break;
+        case EXPR_POSTFIX:
+            postfix(node->tok, &stack[sp - 1], unused && i == expr->num_nodes - 1);
+            break;
+        case EXPR_BINARY:
+            sp--;
+            binary(node->tok, &stack[sp - 1], &stack[sp]);
+            break;
+        case EXPR_CALL:
+            sp -= node->arg;
+            call(&stack[sp - 1], &stack[sp], node->arg);
+            break;
+        case EXPR_MEMBER:
+            member(&stack[sp - 1], &EXPR_STRS(expr)[node->arg]);
+            break;
+        case EXPR_INDEX:
+            not_compiled("indexing is not supported yet");
+            break;
+        }
+    }
+    return gen.failed ? none : stack[0];
+}
+
+/*
+    Compile a test and return the jump that is taken when the test is
+    equal to when, or -1 if the test is a constant that never jumps.
+*/
+static int test(const expr_t *expr, int when)
+{
+    operand_t o = compile(expr, 0);
+
+    if (gen.failed)
+        return -1;
+    if (o.type != VM_INT && o.type != VM_UINT)
+    {
+        type_error("a test", o.type);
+        return -1;
+    }
+    if (o.kind == OPND_CONST)
+        return ((o.val.i != 0) == when) ? emit_jump(OP_JMP, 0) : -1;
+    load(&o);
+    release(&o);
+    return emit_jump(when ? OP_JMPT : OP_JMPF, o.reg);
+}
+
+static expr_t *copy_expr(const expr_t *expr)
+{
+    expr_t *copy;
+
+    if (NULL == (copy = malloc(EXPR_SIZE(expr))))
+        FATAL("cannot allocate memory for an expression");
+    memcpy(copy, expr, EXPR_SIZE(expr));
+    return copy;
+}
+
+static int active(void)
+{
+    return gen.active && !gen.failed;
+}
+
+static ctrl_t *top_ctrl(void)
+{
+    if (gen.ctrls.len == 0)
+    {
+        INTERNAL("there is no statement to end");
+        gen.failed = 1;
+        return NULL;
+    }
+    return &((ctrl_t *)gen.ctrls.buf)[gen.ctrls.len / sizeof(ctrl_t) - 1];
+}
+
+static void push_ctrl(ctrl_kind_t kind)
+{
+    ctrl_t c;
+
+    memset(&c, 0, sizeof(c));
+    c.kind = kind;
+    c.jump = -1;
+    buffer_add(&gen.ctrls, &c, sizeof(c));
+}
+
+static void pop_ctrl(void)
+{
+    ctrl_t *c = top_ctrl();
+
+    if (c == NULL)
+        return;
+    free_ctrl(c);
+    gen.ctrls.len -= sizeof(ctrl_t);
+}
+
+static void add_jump(buffer_t *list, int at)
+{
+    buffer_add(list, &at, sizeof(at));
+}
+
+/*
+    Start the code of a function. The parameters are the locals that are
+    defined already, and the inputs are the first registers.
+*/
+void begin_code(const char *name, const char *cls, const signature_t *sig)
+{
+    int i;
+
+    ENTER();
+    end_code();
+    if (current_module() == NULL || NULL == (pgm = hash_find(programs, current_module()->name)))
+        RET();
+    gen.active = 1;
+    gen.failed = 0;
+    gen.errors = error_count();
+    if (NULL == (gen.name = strdup(name)) || NULL == (gen.cls = strdup(cls)))
+        FATAL("cannot allocate memory for a function name");
+    gen.sig = sig;
+    gen.code.len = gen.scopes.len = gen.ctrls.len = gen.sites.len = gen.site_names.len = 0;
+    gen.last = -1;
+    gen.num_regs = 0;
+    memset(gen.reg_used, 0, sizeof(gen.reg_used));
+    gen.index = pgm->funcs.len / sizeof(vm_func_t);
+    if (gen.index > UINT16_MAX)
+        not_compiled("the program has too many functions");
+
+    for (i = 0; i < num_locals(); i++)
+        gen_local(i);
+    // the outputs start as 0 or ""
+    for (i = sig->num_inputs; i < num_locals(); i++)
+        gen_local_default(i);
+    gen.result_type = VM_NONE;
+    gen.result_layout = NULL;
+    if (sig->num_outputs > 0 && num_locals() > sig->num_inputs)
+    {
+        gen.result = gen.local_regs[sig->num_inputs];
+        gen.result_type = gen.local_types[sig->num_inputs];
+        gen.result_layout = gen.local_layouts[sig->num_inputs];
+    }
+    RET();
+}
+
+static void show_code(const uint32_t *code, uint32_t len)
+{
+    uint32_t i, ins;
+
+    for (i = 0; i < len; i++)
+    {
+        ins = code[i];
+        switch (OPCODE(ins))
+        {
+        case OP_LOADK:
+        case OP_LOADS:
+        case OP_CALL:
+        case OP_NEW:
+            DEBUG(5, "%4u %-6s %3u %5u", i, opcode_names[OPCODE(ins)], ARG_A(ins), ARG_BX(ins));
+            break;
+        case OP_LOADI:
+        case OP_JMP:
+        case OP_JMPF:
+        case OP_JMPT:
+        case OP_TRY:
+            DEBUG(5, "%4u %-6s %3u %5d", i, opcode_names[OPCODE(ins)], ARG_A(ins), ARG_SBX(ins));
+            break;
+        case OP_ADDIK:
+            DEBUG(5, "%4u %-6s %3u %3u %3d", i, opcode_names[OPCODE(ins)], ARG_A(ins), ARG_B(ins), ARG_SC(ins));
+            break;
+        default:
+            DEBUG(5, "%4u %-6s %3u %3u %3u", i, opcode_names[OPCODE(ins)], ARG_A(ins), ARG_B(ins), ARG_C(ins));
+            break;
+        }
+    }
+    (void)ins;
+}
+
+/*
+    Finish the function and put it in the program.
+*/
+void end_code(void)
+{
+    static const vm_cache_t empty; // all 0
+    vm_func_t fn;
+    vm_site_t *site;
+    const char *name;
+    uint8_t reg;
+    int i, kind;
+
+    ENTER();
+    if (!gen.active)
+        RET();
+
+    if (!gen.failed && error_count() != gen.errors)
+        INFO("function %s is not compiled: it has syntax errors", gen.name);
+    else if (!gen.failed)
+    {
+        if (gen.result_type != VM_NONE)
+            emit(MAKE_ABC(OP_RET, gen.result, 0, 0));
+        else
+            emit(MAKE_ABC(OP_RET0, 0, 0, 0));
+    }
+
+    if (!gen.failed && error_count() == gen.errors)
+    {
+        memset(&fn, 0, sizeof(fn));
+        fn.name = pgm->names.len;
+        buffer_add(&pgm->names, gen.name, strlen(gen.name) + 1);
+        fn.code = pgm->code.len / sizeof(uint32_t);
+        fn.code_len = here();
+        buffer_add(&pgm->code, gen.code.buf, gen.code.len);
+        fn.num_inputs = gen.sig->num_inputs;
+        fn.num_regs = gen.num_regs;
+        fn.result = gen.result;
+        fn.result_type = gen.result_type;
+        // the string registers and then the object registers
+        fn.str_regs = pgm->str_regs.len;
+        for (kind = VM_STR; kind <= VM_OBJ; kind++)
+        {
+            for (i = 0; i < gen.num_regs; i++)
+            {
+                if (gen.reg_kind[i] != kind)
+                    continue;
+                reg = i;
+                buffer_add(&pgm->str_regs, &reg, 1);
+                if (kind == VM_STR)
+                    fn.num_str_regs++;
+                else
+                    fn.num_obj_regs++;
+            }
+        }
+        fn.sites = pgm->sites.len / sizeof(vm_site_t);
+        fn.num_sites = gen.sites.len / sizeof(vm_site_t);
+        for (i = 0; i < fn.num_sites; i++)
+        {
+            site = &((vm_site_t *)gen.sites.buf)[i];
+            name = &gen.site_names.buf[site->name];
+            site->name = pgm->names.len;
+            buffer_add(&pgm->names, name, strlen(name) + 1);
+            buffer_add(&pgm->sites, site, sizeof(*site));
+            buffer_add(&pgm->caches, &empty, sizeof(empty));
+        }
+        buffer_add(&pgm->funcs, &fn, sizeof(fn));
+        hash_save(pgm->func_index, gen.name, (void *)(intptr_t)(gen.index + 1));
+        INFO("compiled %s: %u instructions, %u registers", gen.name, fn.code_len, fn.num_regs);
+        show_code((const uint32_t *)gen.code.buf, fn.code_len);
+#ifdef _DEBUGGING
+        if (!verify_function(sync_program(pgm), gen.index))
+            INTERNAL("the code of %s does not verify", gen.name);
+#endif
+    }
+
+    while (gen.ctrls.len > 0)
+        pop_ctrl();
+    free(gen.name);
+    free(gen.cls);
+    gen.name = gen.cls = NULL;
+    gen.active = 0;
+    RET();
+}
+
+/*
+    A local variable gets a register when it is defined.
+*/
+void gen_local(int local)
+{
+    const local_t *loc;
+    vm_type_t type;
+
+    if (!active())
+        return;
+    if (local >= MAX_REGS)
+    {
+        not_compiled("it has too many locals");
+        return;
+    }
+    loc = get_local(local);
+    if (VM_NONE == (type = vm_type(loc->type)))
+    {
+        not_compiled("%s has a type that is not supported yet", local_str(loc->name));
+        return;
+    }
+    gen.local_layouts[local] = NULL;
+    if (type == VM_OBJ && NULL == (gen.local_layouts[local] = get_complex_type(local_str(loc->complex), NULL)))
+    {
+        not_compiled("%s is not a class", local_str(loc->complex));
+        return;
+    }
+    gen.local_regs[local] = alloc_reg(type);
+    gen.local_types[local] = type;
+}
+
+/*
+    A local starts as 0, "" or a new object of its class.
+*/
+void gen_local_default(int local)
+{
+    operand_t zero = {OPND_CONST, VM_INT, 0, 0, "", {0}, NULL};
+
+    if (!active() || local >= MAX_REGS)
+        return;
+    if (gen.local_types[local] == VM_OBJ)
+    {
+        emit(MAKE_ABX(OP_NEW, gen.local_regs[local], add_site(SITE_CLASS, VM_OBJ, gen.local_layouts[local]->name)));
+        return;
+    }
+    zero.type = gen.local_types[local];
+    load_const(gen.local_regs[local], &zero);
+}
+
+void gen_local_value(int local, const expr_t *expr)
+{
+    operand_t o;
+
+    if (!active() || local >= MAX_REGS)
+        return;
+    o = compile(expr, 0);
+    if (!gen.failed)
+        store(gen.local_regs[local], gen.local_types[local], gen.local_layouts[local], &o);
+}
+
+void gen_expr_stmt(const expr_t *expr)
+{
+    operand_t o;
+
+    if (!active())
+        return;
+    o = compile(expr, 1);
+    release(&o);
+}
+
+/*
+    A block frees the registers of its locals at its end.
+*/
+void gen_open_scope(void)
+{
+    int n = num_locals();
+
+    if (active())
+        buffer_add(&gen.scopes, &n, sizeof(n));
+}
+
+void gen_close_scope(void)
+{
+    int i, n;
+
+    if (!active() || gen.scopes.len == 0)
+        return;
+    gen.scopes.len -= sizeof(int);
+    n = *(int *)&gen.scopes.buf[gen.scopes.len];
+    for (i = n; i < num_locals() && i < MAX_REGS; i++)
+        gen.reg_used[gen.local_regs[i]] = 0;
+}
+
+/*
+    The test of an if, a loop, a switch or a case.
+*/
+void gen_condition(const expr_t *expr)
+{
+    ctrl_t *c;
+    operand_t o, value;
+
+    if (!active() || NULL == (c = top_ctrl()))
+        return;
+
+    switch (c->kind)
+    {
+    case CTRL_IF:
+        c->jump = test(expr, 0);
+        break;
+    case CTRL_LOOP:
+        // the test is compiled after the body, a loop without one runs until
+        // it is left
+        if (expr != NULL)
+            c->test = copy_expr(expr);
+        c->jump = emit_jump(OP_JMP, 0);
+        c->top = here();
+        break;
+    case CTRL_SWITCH:
+        o = compile(expr, 0);
+        if (gen.failed)
+            return;
+        if (c->reg < 0)
+        {
+            // the value of the switch
+            if (o.type == VM_NONE)
+            {
+                load(&o);
+                return;
+            }
+            c->type = o.type;
+            c->reg = alloc_reg(o.type);
+            store(c->reg, c->type, o.layout, &o);
+            return;
+        }
+        value.kind = OPND_REG;
+        value.type = c->type;
+        value.reg = c->reg;
+        value.temp = 0;
+        compare(EQUAL_TOK, &value, &o);
+        if (gen.failed)
+            return;
+        release(&value);
+        c->jump = emit_jump(OP_JMPF, value.reg);
+        break;
+    default:
+        break;
+    }
+}
+
+void gen_if(void)
+{
+    if (active())
+        push_ctrl(CTRL_IF);
+}
+
+void gen_else(void)
+{
+    ctrl_t *c;
+
+    if (!active() || NULL == (c = top_ctrl()))
+        return;
+    add_jump(&c->ends, emit_jump(OP_JMP, 0));
+    patch(c->jump, here());
+    c->jump = -1;
+}
+
+void gen_end_if(void)
+{
+    ctrl_t *c;
+
+    if (!active() || NULL == (c = top_ctrl()))
+        return;
+    patch(c->jump, here());
+    patch_list(&c->ends, here());
+    pop_ctrl();
+}
+
+void gen_while(void)
+{
+    if (active())
+        push_ctrl(CTRL_LOOP);
+}
+
+void gen_for(void)
+{
+    if (active())
+        push_ctrl(CTRL_LOOP);
+}
+
+void gen_for_init(const expr_t *expr)
+{
+    gen_expr_stmt(expr);
+}
+
+void gen_for_step(const expr_t *expr)
+{
+    ctrl_t *c;
+
+    if (active() && NULL != (c = top_ctrl()) && expr != NULL)
+        c->step = copy_expr(expr);
+}
+
+/*
+    The end of the body of a loop: the step, then the test that jumps back
+    to the top of the body.
+*/
+void gen_end_loop(void)
+{
+    ctrl_t *c;
+    int jump;
+
+    if (!active() || NULL == (c = top_ctrl()))
+        return;
+    patch_list(&c->conts, here());
+    if (c->step != NULL)
+        gen_expr_stmt(c->step);
+    patch(c->jump, here());
+    jump = (c->test != NULL) ? test(c->test, 1) : emit_jump(OP_JMP, 0);
+    patch(jump, c->top);
+    patch_list(&c->ends, here());
+    pop_ctrl();
+}
+
+void gen_switch(void)
+{
+    ctrl_t *c;
+
+    if (!active())
+        return;
+    push_ctrl(CTRL_SWITCH);
+    c = top_ctrl();
+    c->reg = -1;
+}
+
+void gen_case(void)
+{
+    ctrl_t *c;
+
+    if (!active() || NULL == (c = top_ctrl()))
+        return;
+    patch(c->jump, here());
+    c->jump = -1;
+}
+
+void gen_case_else(void)
+{
+    gen_case();
+}
+
+void gen_end_case(void)
+{
+    ctrl_t *c;
+
+    if (active() && NULL != (c = top_ctrl()))
+        add_jump(&c->ends, emit_jump(OP_JMP, 0));
+}
+
+void gen_end_switch(void)
+{
+    ctrl_t *c;
+
+    if (!active() || NULL == (c = top_ctrl()))
+        return;
+    patch(c->jump, here());
+    patch_list(&c->ends, here());
+    if (c->reg >= 0)
+        gen.reg_used[c->reg] = 0;
+    pop_ctrl();
+}
+
+/*
+    TRY saves the handler that was set in a register and sets the handler
+    to the except block. ENDTRY puts it back, on the way out of the try
+    block and at the start of the except block.
+*/
+void gen_try(void)
+{
+    ctrl_t *c;
+
+    if (!active())
+        return;
+    push_ctrl(CTRL_TRY);
+    c = top_ctrl();
+    c->reg = alloc_reg(VM_INT);
+    c->jump = emit_jump(OP_TRY, c->reg);
+}
+
+void gen_except(void)
+{
+    ctrl_t *c;
+
+    if (!active() || NULL == (c = top_ctrl()))
+        return;
+    emit(MAKE_ABC(OP_ENDTRY, c->reg, 0, 0));
+    add_jump(&c->ends, emit_jump(OP_JMP, 0));
+    patch(c->jump, here());
+    emit(MAKE_ABC(OP_ENDTRY, c->reg, 0, 0));
+}
+
+void gen_end_try(void)
+{
+    ctrl_t *c;
+
+    if (!active() || NULL == (c = top_ctrl()))
+        return;
+    patch_list(&c->ends, here());
+    gen.reg_used[c->reg] = 0;
+    pop_ctrl();
+}
+
+void gen_return(const expr_t *expr)
+{
+    operand_t o;
+
+    if (!active())
+        return;
+    if (expr != NULL)
+    {
+        if (gen.result_type == VM_NONE)
+        {
+            syntax("function %s has no output to return", gen.name);
+            gen.failed = 1;
+            return;
+        }
+        o = compile(expr, 0);
+        if (gen.failed)
+            return;
+        store(gen.result, gen.result_type, gen.result_layout, &o);
+    }
+    if (gen.result_type != VM_NONE)
+        emit(MAKE_ABC(OP_RET, gen.result, 0, 0));
+    else
+        emit(MAKE_ABC(OP_RET0, 0, 0, 0));
+}
+
+/*
+    A jump out of a loop or a switch puts back the handlers of the try
+    blocks that it leaves.
+*/
+static void jump_out(int cont)
+{
+    ctrl_t *ctrls = (ctrl_t *)gen.ctrls.buf;
+    int i, at;
+
+    for (i = gen.ctrls.len / sizeof(ctrl_t) - 1; i >= 0; i--)
+    {
+        if (ctrls[i].kind == CTRL_TRY)
+            emit(MAKE_ABC(OP_ENDTRY, ctrls[i].reg, 0, 0));
+        else if (ctrls[i].kind == CTRL_LOOP || (ctrls[i].kind == CTRL_SWITCH && !cont))
+        {
+            at = emit_jump(OP_JMP, 0);
+            add_jump(cont ? &ctrls[i].conts : &ctrls[i].ends, at);
+            return;
+        }
+    }
+}
+
+void gen_break(void)
+{
+    if (active())
+        jump_out(0);
+}
+
+void gen_continue(void)
+{
+    if (active())
+        jump_out(1);
+}
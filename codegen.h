@@ -0,0 +1,49 @@
+#ifndef _CODEGEN_H_
+#define _CODEGEN_H_
+
+#include <stddef.h>
+
+#include "bytecode.h"
+#include "expr.h"
+#include "signature.h"
+#include "layout.h"
+
+void init_codegen(void);
+void destroy_codegen(void);
+void begin_module_code(const char *module);
+void set_module_program(const char *module, const vm_program_t *prog, void *map, size_t map_size);
+const vm_program_t *module_program(const char *module);
+int find_function(const char *name);
+void forget_class_caches(const class_layout_t *layout);
+
+void begin_code(const char *name, const char *cls, const signature_t *sig);
+void end_code(void);
+
+void gen_local(int local);
+void gen_local_default(int local);
+void gen_local_value(int local, const expr_t *expr);
+void gen_expr_stmt(const expr_t *expr);
+void gen_condition(const expr_t *expr);
+void gen_open_scope(void);
+void gen_close_scope(void);
+void gen_if(void);
+void gen_else(void);
+void gen_end_if(void);
+void gen_while(void);
+void gen_for(void);
+void gen_for_init(const expr_t *expr);
+void gen_for_step(const expr_t *expr);
+void gen_end_loop(void);
+void gen_switch(void);
+void gen_case(void);
+void gen_case_else(void);
+void gen_end_case(void);
+void gen_end_switch(void);
+void gen_try(void);
+void gen_except(void);
+void gen_end_try(void);
+void gen_return(const expr_t *expr);
+void gen_break(void);
+void gen_continue(void);
+
+#endif /* _CODEGEN_H_ */
@@ -6,7 +6,12 @@
     For example, if a class has a method named foo, and the class is named bar, 
     then the context would be @bar@foo. Function names are decorated with 
     their parameters as well, but not by these functions.
+
+    The length of the context is kept, so pushing and popping a name only
+    touches the end of the string. Blocks push and pop an anonymous context
+    for every scope and do not rebuild the string.
 */
+#define LOG_MODULE LOG_MOD_CONTEXT
 #include <stdio.h>
 #include <string.h>
 
@@ -18,25 +23,36 @@
 #define CONTEXT_SIZE 1024 * 2
 #define PAD 2
 
-static char context[CONTEXT_SIZE];
-static char temp_context[CONTEXT_SIZE];
+// each thread compiles in its own context
+static _Thread_local char context[CONTEXT_SIZE];
+static _Thread_local char temp_context[CONTEXT_SIZE];
+static _Thread_local size_t context_len;
+static _Thread_local uint32_t anon_count;
 
 void init_context(void)
 {
     ENTER();
     memset(context, 0, CONTEXT_SIZE);
     context[0] = '@';
+    context_len = 1;
+    anon_count = 0;
     RET();
 }
 
-const char *push_context(const char *symb)
+static void push_name(const char *symb, size_t len)
 {
-    ENTER();
-    if (strlen(symb) + strlen(context) + PAD >= CONTEXT_SIZE)
+    if (len + context_len + PAD >= CONTEXT_SIZE)
         FATAL("symbol context buffer overrun");
 
-    strcat(context, "@");
-    strcat(context, symb);
+    context[context_len] = '@';
+    memcpy(&context[context_len + 1], symb, len + 1);
+    context_len += len + 1;
+}
+
+const char *push_context(const char *symb)
+{
+    ENTER();
+    push_name(symb, strlen(symb));
     INFO("context: %s", context);
     VRET(context);
 }
@@ -44,14 +60,18 @@ const char *push_context(const char *symb)
 const char *pop_context(void)
 {
     ENTER();
-    char *ch = strrchr(context, '@');
-    if (ch == NULL)
-        INTERNAL("symbol context is empty or corrupt");
+    char *ch;
 
-    if (strlen(context) == 0)
+    if (context_len == 0)
         INTERNAL("symbol context is empty");
 
+    for (ch = &context[context_len - 1]; ch > context && *ch != '@'; ch--)
+        ;
+    if (*ch != '@')
+        INTERNAL("symbol context is empty or corrupt");
+
     *ch = 0;
+    context_len = ch - context;
     VRET(context);
 }
 
@@ -62,27 +82,53 @@ const char *pop_context(void)
 const char *make_context(const char *symb)
 {
     ENTER();
-    if (strlen(symb) + strlen(context) + PAD >= CONTEXT_SIZE)
+    size_t len = strlen(symb);
+
+    if (len + context_len + PAD >= CONTEXT_SIZE)
         FATAL("temp symbol context buffer overrun");
 
-    strcpy(temp_context, context);
-    strcat(temp_context, "@");
-    strcat(temp_context, symb);
+    memcpy(temp_context, context, context_len);
+    temp_context[context_len] = '@';
+    memcpy(&temp_context[context_len + 1], symb, len + 1);
     VRET(temp_context);
 }
 
 /*
     An anonymous context is used where there is no name to tie it to, such 
-    as in a while() loop.
+    as in a while() loop. It is named by a count, so two blocks in the same
+    context get different names.
 */
 const char *push_anon_context(void)
 {
     ENTER();
-    uint32_t h = make_hash(context);
-    char buf[17];
+    static const char digits[] = "0123456789ABCDEF";
+    uint32_t n = anon_count++;
+    char buf[9];
+    int i;
+
+    for (i = 7; i >= 0; i--, n >>= 4)
+        buf[i] = digits[n & 15];
+    buf[8] = 0;
+    push_name(buf, 8);
+    INFO("context: %s", context);
+    VRET(context);
+}
 
-    sprintf(buf, "%08X", h);
-    VRET(push_context(buf));
+/*
+    Replace the whole context. This is used to parse an imported module in
+    its own context, regardless of where it was imported from.
+*/
+void set_context(const char *ctx)
+{
+    ENTER();
+    size_t len = strlen(ctx);
+
+    if (len + PAD >= CONTEXT_SIZE)
+        FATAL("symbol context buffer overrun");
+
+    memcpy(context, ctx, len + 1);
+    context_len = len;
+    RET();
 }
 
 const char *get_context(void)
@@ -10,6 +10,7 @@ const char *pop_context(void);
 const char *make_context(const char *symb);
 const char *make_anon_context(const char *symb);
 const char *get_context(void);
+void set_context(const char *ctx);
 uint64_t hash(char *str);
 
 #endif /* _CONTEXT_H_ */
\ No newline at end of file
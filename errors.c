@@ -1,11 +1,27 @@
 /*
     The putpose of this file is to display syntax-like errors and warnings.
+
+    The diagnostics are not printed when they are reported. Every thread
+    keeps the ones for its compile, with the text of each one formatted
+    once into a buffer, and flush_diagnostics() sorts them by file, line and
+    column and prints them with a single write. A diagnostic that is the
+    same as another one at the same place, which happens when the parser
+    reports an error again while it recovers, is only printed once.
+
+    After max_errors errors the rest of the diagnostics are counted but not
+    kept, and too_many_errors() tells the parser to give up on the file.
 */
 #include <stdio.h>
+#include <stdlib.h>
 #include <stdarg.h>
+#include <stdint.h>
+#include <string.h>
 #include "logging.h"
 #include "file_io.h"
 #include "scanner.h"
+#include "hash_table.h"
+#include "buffer.h"
+#include "errors.h"
 
 typedef struct tmgs
 {
@@ -89,24 +105,241 @@ tok_msg_t tok_msg[] = {
     {/* LAST_TOKEN, */ NULL, NULL}};
 const int msg_size = sizeof(tok_msg) / sizeof(tok_msg_t);
 
+typedef struct
+{
+    uint32_t file; // offset of the name in the files pool
+    int line;
+    int index;
+    uint32_t seq;  // the order that it was reported in
+    uint32_t text; // offset of the line in the texts
+} diag_t;
+
+// stop keeping errors after this many, 0 for no limit
+int max_errors = 100;
+
+// each compile runs on its own thread and counts its own errors.
+static _Thread_local int num_errors = 0;
+static _Thread_local int num_dropped = 0;
+static _Thread_local diag_t *diags = NULL;
+static _Thread_local uint32_t num_diags = 0;
+static _Thread_local uint32_t diag_cap = 0;
+static _Thread_local buffer_t files;
+static _Thread_local buffer_t texts;
+static _Thread_local ht_handle_t file_set = NULL;
+// most diagnostics are in the same file as the one before
+static _Thread_local const char *last_fname = NULL;
+static _Thread_local uint32_t last_file = 0;
+
+static void add_diag(const char *type, const char *fname, int line, int index, const char *fmt, va_list args)
+{
+    char buf[1024], *text = buf;
+    va_list copy;
+    diag_t *diag;
+    int len, n;
+
+    if (max_errors > 0 && num_errors > max_errors)
+    {
+        num_dropped++;
+        return;
+    }
+
+    if (file_set == NULL)
+    {
+        file_set = create_hash_table(31);
+    }
+
+    len = snprintf(buf, sizeof(buf), "%s: %s: %d: %d: ", type, fname, line, index);
+    va_copy(copy, args);
+    n = vsnprintf(buf + len, sizeof(buf) - len, fmt, copy);
+    va_end(copy);
+    if (n >= (int)sizeof(buf) - len)
+    {
+        if (NULL == (text = malloc(len + n + 1)))
+            FATAL("cannot allocate memory for a diagnostic");
+        memcpy(text, buf, len);
+        vsnprintf(text + len, n + 1, fmt, args);
+    }
+
+    if (num_diags == diag_cap)
+    {
+        diag_cap = (diag_cap == 0) ? 64 : diag_cap * 2;
+        if (NULL == (diags = realloc(diags, diag_cap * sizeof(diag_t))))
+            FATAL("cannot allocate memory for diagnostics");
+    }
+
+    if (fname != last_fname || num_diags == 0)
+    {
+        last_file = pool_add(&files, file_set, fname);
+        last_fname = fname;
+    }
+
+    diag = &diags[num_diags];
+    diag->file = last_file;
+    diag->line = line;
+    diag->index = index;
+    diag->seq = num_diags++;
+    diag->text = texts.len;
+    buffer_add(&texts, text, strlen(text) + 1);
+    if (text != buf)
+        free(text);
+}
+
+static int compare_place(const diag_t *da, const diag_t *db)
+{
+    if (da->file != db->file)
+        return (da->file < db->file) ? -1 : 1;
+    if (da->line != db->line)
+        return (da->line < db->line) ? -1 : 1;
+    if (da->index != db->index)
+        return (da->index < db->index) ? -1 : 1;
+    return 0;
+}
+
+static int compare_diags(const void *a, const void *b)
+{
+    const diag_t *da = a, *db = b;
+    int cmp = compare_place(da, db);
+
+    if (cmp != 0)
+        return cmp;
+    return (da->seq < db->seq) ? -1 : (da->seq > db->seq);
+}
+
+static void clear_diagnostics(void)
+{
+    num_diags = 0;
+    num_dropped = 0;
+    buffer_free(&files);
+    buffer_free(&texts);
+    if (file_set != NULL)
+    {
+        destroy_hash_table(file_set);
+        file_set = NULL;
+    }
+    last_fname = NULL;
+}
+
+/*
+    Print the diagnostics that have been reported since the last flush, in
+    order of file, line and column. The files are in the order that they
+    first had a diagnostic.
+*/
+void flush_diagnostics(void)
+{
+    buffer_t out = {0};
+    char buf[128];
+    uint32_t i, j, run = 0;
+    const char *text;
+
+    if (num_diags == 0 && num_dropped == 0)
+        return;
+
+    qsort(diags, num_diags, sizeof(diag_t), compare_diags);
+    for (i = 0; i < num_diags; i++)
+    {
+        // the diagnostics at the same place are next to each other
+        if (i == 0 || compare_place(&diags[run], &diags[i]) != 0)
+            run = i;
+
+        text = &texts.buf[diags[i].text];
+        for (j = run; j < i && strcmp(text, &texts.buf[diags[j].text]); j++)
+            ;
+        if (j < i)
+            continue;
+
+        buffer_add(&out, text, strlen(text));
+        buffer_add(&out, "\n", 1);
+    }
+    if (num_dropped > 0)
+    {
+        snprintf(buf, sizeof(buf), "Syntax: too many errors, %d more diagnostics not shown\n", num_dropped);
+        buffer_add(&out, buf, strlen(buf));
+    }
+    else if (too_many_errors())
+    {
+        // the parser stopped before it found any more
+        snprintf(buf, sizeof(buf), "Syntax: too many errors, stopped after %d\n", max_errors);
+        buffer_add(&out, buf, strlen(buf));
+    }
+
+    // keep the order with the log messages that came before
+    flush_logging();
+    flockfile(stdout);
+    fwrite(out.buf, 1, out.len, stdout);
+    fflush(stdout);
+    funlockfile(stdout);
+
+    buffer_free(&out);
+    clear_diagnostics();
+}
+
+/*
+    The parser stops when this is true.
+*/
+int too_many_errors(void)
+{
+    return max_errors > 0 && num_errors >= max_errors;
+}
+
+static void vwarning_at(const char *fname, int line, int index, const char *fmt, va_list args)
+{
+    add_diag("Warning", fname, line, index, fmt, args);
+}
+
+static void vsyntax_at(const char *fname, int line, int index, const char *fmt, va_list args)
+{
+    num_errors++;
+    add_diag("Syntax", fname, line, index, fmt, args);
+}
+
+/*
+    Report a warning or an error at a location other than the current
+    position of the default scanner.
+*/
+void warning_at(const char *fname, int line, int index, const char *fmt, ...)
+{
+    va_list args;
+    va_start(args, fmt);
+    vwarning_at(fname, line, index, fmt, args);
+    va_end(args);
+}
+
+void syntax_at(const char *fname, int line, int index, const char *fmt, ...)
+{
+    va_list args;
+    va_start(args, fmt);
+    vsyntax_at(fname, line, index, fmt, args);
+    va_end(args);
+}
+
 void warning(const char *fmt, ...)
 {
     va_list args;
-    fprintf(stdout, "Warning: %s: %d: %d: ", file_name(), line_number(), line_index());
     va_start(args, fmt);
-    vfprintf(stdout, fmt, args);
+    vwarning_at(file_name(), line_number(), line_index(), fmt, args);
     va_end(args);
-    fprintf(stdout, "\n");
 }
 
 void syntax(const char *fmt, ...)
 {
     va_list args;
-    fprintf(stdout, "Syntax: %s: %d: %d: ", file_name(), line_number(), line_index());
     va_start(args, fmt);
-    vfprintf(stdout, fmt, args);
+    vsyntax_at(file_name(), line_number(), line_index(), fmt, args);
     va_end(args);
-    fprintf(stdout, "\n");
+}
+
+int error_count(void)
+{
+    return num_errors;
+}
+
+/*
+    Start counting again and forget the diagnostics that were not printed.
+*/
+void reset_errors(void)
+{
+    num_errors = 0;
+    clear_diagnostics();
 }
 
 const char *token_to_str(token_t tok)
@@ -4,6 +4,14 @@
 #include "scanner.h"
 void warning(const char *fmt, ...);
 void syntax(const char *fmt, ...);
+void warning_at(const char *fname, int line, int index, const char *fmt, ...);
+void syntax_at(const char *fname, int line, int index, const char *fmt, ...);
+int error_count(void);
+void reset_errors(void);
+void flush_diagnostics(void);
+int too_many_errors(void);
+
+extern int max_errors;
 void expect_token(token_t expect, token_t got, const char* msg);
 const char* token_to_str(token_t tok);
 const char *token_to_msg(token_t tok);
@@ -0,0 +1,366 @@
+/*
+    Expression parser.
+
+    Expressions are parsed with operator precedence in the style of Pratt.
+    Every operator has a binding power to its left and to its right, and an
+    operand belongs to the operator on the side that binds it harder. The
+    powers are in the table below, and the keyword forms of the operators,
+    such as "eq" and "and", are the same tokens as the symbols, so they
+    have the same powers.
+
+    A Pratt parser is usually recursive, one call for every operator that
+    is waiting for its right operand. Here the waiting operators and the
+    open parens are kept on a stack in memory instead, so an expression can
+    be nested as deeply as memory allows. The output is a list of nodes in
+    reverse Polish order, see expr.h.
+
+    The tokens are only read when they are part of the expression, so the
+    token after the expression, or the token that has a syntax error, is
+    the next one to be read by the caller.
+*/
+#define LOG_MODULE LOG_MOD_PARSER
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "logging.h"
+#include "errors.h"
+#include "scanner.h"
+#include "buffer.h"
+#include "expr.h"
+
+// binding powers, from the loosest to the tightest
+enum
+{
+    BP_NONE = 0,
+    BP_ASSIGN = 2,
+    BP_OR = 4,
+    BP_AND = 6,
+    BP_BIT_OR = 8,
+    BP_BIT_XOR = 10,
+    BP_BIT_AND = 12,
+    BP_EQUAL = 14,
+    BP_COMPARE = 16,
+    BP_SHIFT = 18,
+    BP_ADD = 20,
+    BP_MUL = 22,
+    BP_PREFIX = 24,
+    BP_POSTFIX = 26,
+};
+
+typedef struct
+{
+    uint8_t left;   // to the left as an infix or postfix operator, 0 if it is not one
+    uint8_t right;  // to the right as an infix operator
+    uint8_t prefix; // to the right as a prefix operator, 0 if it is not one
+    uint8_t kind;   // the expr_kind_t of the infix or postfix form
+    const char *str;
+} binding_t;
+
+#define LEFT(bp) (bp), (bp) + 1
+#define RIGHT(bp) (bp) + 1, (bp)
+#define BINDING(tok) bindings[(tok) - FIRST_TOK]
+
+static const binding_t bindings[LAST_TOKEN - FIRST_TOK] = {
+    [ASSIGN_TOK - FIRST_TOK] = {RIGHT(BP_ASSIGN), 0, EXPR_BINARY, "="},
+    [OR_TOK - FIRST_TOK] = {LEFT(BP_OR), 0, EXPR_BINARY, "or"},
+    [AND_TOK - FIRST_TOK] = {LEFT(BP_AND), 0, EXPR_BINARY, "and"},
+    [LOR_TOK - FIRST_TOK] = {LEFT(BP_BIT_OR), 0, EXPR_BINARY, "|"},
+    [LXOR_TOK - FIRST_TOK] = {LEFT(BP_BIT_XOR), 0, EXPR_BINARY, "^"},
+    [LAND_TOK - FIRST_TOK] = {LEFT(BP_BIT_AND), 0, EXPR_BINARY, "&"},
+    [EQUAL_TOK - FIRST_TOK] = {LEFT(BP_EQUAL), 0, EXPR_BINARY, "=="},
+    [NEQUAL_TOK - FIRST_TOK] = {LEFT(BP_EQUAL), 0, EXPR_BINARY, "!="},
+    [LESS_TOK - FIRST_TOK] = {LEFT(BP_COMPARE), 0, EXPR_BINARY, "lt"},
+    [GREATER_TOK - FIRST_TOK] = {LEFT(BP_COMPARE), 0, EXPR_BINARY, "gt"},
+    [LESS_OR_EQUAL_TOK - FIRST_TOK] = {LEFT(BP_COMPARE), 0, EXPR_BINARY, "<="},
+    [GREATER_OR_EQUAL_TOK - FIRST_TOK] = {LEFT(BP_COMPARE), 0, EXPR_BINARY, ">="},
+    [LSHL_TOK - FIRST_TOK] = {LEFT(BP_SHIFT), 0, EXPR_BINARY, "shl"},
+    [LSHR_TOK - FIRST_TOK] = {LEFT(BP_SHIFT), 0, EXPR_BINARY, "shr"},
+    [PLUS_TOK - FIRST_TOK] = {LEFT(BP_ADD), BP_PREFIX, EXPR_BINARY, "+"},
+    [MINUS_TOK - FIRST_TOK] = {LEFT(BP_ADD), BP_PREFIX, EXPR_BINARY, "-"},
+    [MUL_TOK - FIRST_TOK] = {LEFT(BP_MUL), 0, EXPR_BINARY, "*"},
+    [DIV_TOK - FIRST_TOK] = {LEFT(BP_MUL), 0, EXPR_BINARY, "/"},
+    [MOD_TOK - FIRST_TOK] = {LEFT(BP_MUL), 0, EXPR_BINARY, "%"},
+    [NOT_TOK - FIRST_TOK] = {BP_NONE, BP_NONE, BP_PREFIX, EXPR_PREFIX, "not"},
+    [LNOT_TOK - FIRST_TOK] = {BP_NONE, BP_NONE, BP_PREFIX, EXPR_PREFIX, "~"},
+    [INCREMENT_TOK - FIRST_TOK] = {BP_POSTFIX, BP_NONE, BP_PREFIX, EXPR_POSTFIX, "++"},
+    [DECREMENT_TOK - FIRST_TOK] = {BP_POSTFIX, BP_NONE, BP_PREFIX, EXPR_POSTFIX, "--"},
+    [OPAREN_TOK - FIRST_TOK] = {BP_POSTFIX, BP_NONE, BP_NONE, EXPR_CALL, "call"},
+    [OSQU_TOK - FIRST_TOK] = {BP_POSTFIX, BP_NONE, BP_NONE, EXPR_INDEX, "[]"},
+    [DOT_TOK - FIRST_TOK] = {BP_POSTFIX, BP_NONE, BP_NONE, EXPR_MEMBER, "."},
+};
+
+// a paren that groups, the other frames are expr_kind_t
+#define FRAME_PAREN 0xff
+
+/*
+    An operator that is waiting for its right operand, or an open paren or
+    bracket that is waiting to be closed.
+*/
+typedef struct
+{
+    uint16_t tok;
+    uint8_t kind;
+    uint8_t right; // the binding power to the right of an operator
+    uint32_t argc; // the arguments of a call that have been read
+} frame_t;
+
+// The buffers are kept for the next expression, so most expressions are
+// parsed without allocating memory.
+static _Thread_local buffer_t nodes;
+static _Thread_local buffer_t strs;
+static _Thread_local buffer_t frames;
+static _Thread_local buffer_t result;
+
+#define TOP_FRAME() ((frame_t *)&frames.buf[frames.len - sizeof(frame_t)])
+
+static inline int is_operand(token_t tok)
+{
+    switch (tok)
+    {
+    case SYMBOL_TOK:
+    case UINT_TOK:
+    case INT_TOK:
+    case FLOAT_TOK:
+    case STRING_TOK:
+    case TRUE_TOK:
+    case FALSE_TOK:
+    case NIL_TOK:
+        return 1;
+    default:
+        return 0;
+    }
+}
+
+static inline void add_node(token_t tok, expr_kind_t kind, uint32_t arg)
+{
+    expr_node_t node = {(uint16_t)tok, (uint16_t)kind, arg};
+
+    buffer_add(&nodes, &node, sizeof(node));
+}
+
+static inline uint32_t add_str(const char *str)
+{
+    uint32_t offset = strs.len;
+
+    buffer_add(&strs, str, strlen(str) + 1);
+    return offset;
+}
+
+static inline void push_frame(token_t tok, int kind, int right)
+{
+    frame_t frame = {(uint16_t)tok, (uint8_t)kind, (uint8_t)right, 0};
+
+    buffer_add(&frames, &frame, sizeof(frame));
+}
+
+/*
+    Output the operators that bind their right operand harder than the
+    next operator binds its left one.
+*/
+static inline void reduce(int left)
+{
+    frame_t *top;
+
+    while (frames.len > 0)
+    {
+        top = TOP_FRAME();
+        if ((top->kind != EXPR_PREFIX && top->kind != EXPR_BINARY) || left >= top->right)
+            break;
+        add_node(top->tok, top->kind, 0);
+        frames.len -= sizeof(frame_t);
+    }
+}
+
+/*
+    Report the paren or the bracket that is not closed.
+*/
+static void unclosed(token_t tok)
+{
+    frame_t *top = TOP_FRAME();
+
+    expect_token((top->kind == EXPR_INDEX) ? CSQU_TOK : CPAREN_TOK, tok, NULL);
+}
+
+/*
+    Parse an expression. Returns the expression, which is kept until the
+    next expression is parsed in this thread, or NULL after a syntax error.
+*/
+expr_t *parse_expression(void)
+{
+    expr_t hdr;
+    frame_t *top;
+    token_t tok;
+    int operand = 1; // an operand is next, not an operator
+
+    ENTER();
+    nodes.len = strs.len = frames.len = 0;
+    while (1)
+    {
+        tok = peek_token();
+        if (operand)
+        {
+            if (is_operand(tok))
+            {
+                get_token();
+                add_node(tok, EXPR_VALUE, add_str(get_token_string()));
+                operand = 0;
+            }
+            else if (tok == OPAREN_TOK)
+            {
+                get_token();
+                push_frame(tok, FRAME_PAREN, BP_NONE);
+            }
+            else if (tok > FIRST_TOK && tok < LAST_TOKEN && BINDING(tok).prefix != BP_NONE)
+            {
+                get_token();
+                push_frame(tok, EXPR_PREFIX, BINDING(tok).prefix);
+            }
+            else
+            {
+                syntax("expected an expression but got %s", token_to_msg(tok));
+                VRET(NULL);
+            }
+            continue;
+        }
+
+        if (tok > FIRST_TOK && tok < LAST_TOKEN && BINDING(tok).left != BP_NONE)
+        {
+            reduce(BINDING(tok).left);
+            get_token();
+            switch (BINDING(tok).kind)
+            {
+            case EXPR_BINARY:
+                push_frame(tok, EXPR_BINARY, BINDING(tok).right);
+                operand = 1;
+                break;
+            case EXPR_POSTFIX:
+                add_node(tok, EXPR_POSTFIX, 0);
+                break;
+            case EXPR_MEMBER:
+                if ((tok = peek_token()) != SYMBOL_TOK)
+                {
+                    syntax("expected the name of a member but got %s", token_to_msg(tok));
+                    VRET(NULL);
+                }
+                get_token();
+                add_node(DOT_TOK, EXPR_MEMBER, add_str(get_token_string()));
+                break;
+            case EXPR_CALL:
+                push_frame(tok, EXPR_CALL, BP_NONE);
+                if (peek_token() == CPAREN_TOK)
+                {
+                    get_token();
+                    add_node(OPAREN_TOK, EXPR_CALL, 0);
+                    frames.len -= sizeof(frame_t);
+                }
+                else
+                    operand = 1;
+                break;
+            case EXPR_INDEX:
+                push_frame(tok, EXPR_INDEX, BP_NONE);
+                operand = 1;
+                break;
+            }
+            continue;
+        }
+
+        // the end of an operand of a paren, a call, an index or the expression
+        reduce(BP_NONE);
+        top = (frames.len > 0) ? TOP_FRAME() : NULL;
+        if (top == NULL)
+            break;
+        else if (tok == CPAREN_TOK && top->kind == FRAME_PAREN)
+            frames.len -= sizeof(frame_t);
+        else if (tok == CPAREN_TOK && top->kind == EXPR_CALL)
+        {
+            add_node(OPAREN_TOK, EXPR_CALL, top->argc + 1);
+            frames.len -= sizeof(frame_t);
+        }
+        else if (tok == COMMA_TOK && top->kind == EXPR_CALL)
+        {
+            top->argc++;
+            operand = 1;
+        }
+        else if (tok == CSQU_TOK && top->kind == EXPR_INDEX)
+        {
+            add_node(OSQU_TOK, EXPR_INDEX, 0);
+            frames.len -= sizeof(frame_t);
+        }
+        else
+        {
+            unclosed(tok);
+            VRET(NULL);
+        }
+        get_token();
+    }
+
+    hdr.num_nodes = nodes.len / sizeof(expr_node_t);
+    hdr.str_size = strs.len;
+    result.len = 0;
+    buffer_add(&result, &hdr, sizeof(hdr));
+    buffer_add(&result, nodes.buf, nodes.len);
+    buffer_add(&result, strs.buf, strs.len);
+    VRET((expr_t *)result.buf);
+}
+
+/*
+    Add the expression to the buffer as text in reverse Polish order, with
+    a space between the nodes. A prefix operator is written with a 'u'
+    after it so it is not taken for the infix operator, and a call is
+    written with the number of its arguments. The text is terminated.
+*/
+void expr_to_str(const expr_t *expr, buffer_t *out)
+{
+    const expr_node_t *node;
+    const char *str;
+    char tmp[32];
+    uint32_t i;
+
+    for (i = 0; i < expr->num_nodes; i++)
+    {
+        node = &expr->nodes[i];
+        if (i > 0)
+            buffer_add(out, " ", 1);
+        switch (node->kind)
+        {
+        case EXPR_VALUE:
+            str = &EXPR_STRS(expr)[node->arg];
+            if (node->tok == STRING_TOK)
+                buffer_add(out, "\"", 1);
+            buffer_add(out, str, strlen(str));
+            if (node->tok == STRING_TOK)
+                buffer_add(out, "\"", 1);
+            break;
+        case EXPR_MEMBER:
+            str = &EXPR_STRS(expr)[node->arg];
+            buffer_add(out, ".", 1);
+            buffer_add(out, str, strlen(str));
+            break;
+        case EXPR_CALL:
+            snprintf(tmp, sizeof(tmp), "call/%u", node->arg);
+            buffer_add(out, tmp, strlen(tmp));
+            break;
+        default:
+            str = BINDING(node->tok).str;
+            buffer_add(out, str, strlen(str));
+            if (node->kind == EXPR_PREFIX)
+                buffer_add(out, "u", 1);
+            break;
+        }
+    }
+    buffer_add(out, "", 1);
+}
+
+/*
+    Free the scratch buffers of the thread.
+*/
+void destroy_expr(void)
+{
+    ENTER();
+    buffer_free(&nodes);
+    buffer_free(&strs);
+    buffer_free(&frames);
+    buffer_free(&result);
+    RET();
+}
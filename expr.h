@@ -0,0 +1,49 @@
+#ifndef _EXPR_H_
+#define _EXPR_H_
+
+#include <stdint.h>
+
+#include "buffer.h"
+#include "scanner.h"
+
+/*
+    A parsed expression is a list of nodes in reverse Polish order. Each
+    node takes its operands from the nodes before it.
+*/
+typedef enum
+{
+    EXPR_VALUE,   // a literal or a symbol, arg is the offset of its text
+    EXPR_MEMBER,  // .name of the operand, arg is the offset of the name
+    EXPR_PREFIX,  // a prefix operator
+    EXPR_POSTFIX, // a postfix operator
+    EXPR_BINARY,  // an infix operator
+    EXPR_CALL,    // a call, arg is the number of arguments after the function
+    EXPR_INDEX,   // a[i]
+} expr_kind_t;
+
+typedef struct
+{
+    uint16_t tok;  // the token_t of the value or the operator
+    uint16_t kind; // an expr_kind_t
+    uint32_t arg;
+} expr_node_t;
+
+/*
+    The nodes are followed by the strings, so an expression has no pointers
+    and can be copied and stored as a symbol attribute.
+*/
+typedef struct
+{
+    uint32_t num_nodes;
+    uint32_t str_size;
+    expr_node_t nodes[];
+} expr_t;
+
+#define EXPR_STRS(e) ((const char *)&(e)->nodes[(e)->num_nodes])
+#define EXPR_SIZE(e) (sizeof(expr_t) + (e)->num_nodes * sizeof(expr_node_t) + (e)->str_size)
+
+expr_t *parse_expression(void);
+void expr_to_str(const expr_t *expr, buffer_t *out);
+void destroy_expr(void);
+
+#endif /* _EXPR_H_ */
@@ -1,167 +1,241 @@
 
+#define LOG_MODULE LOG_MOD_FILE_IO
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <errno.h>
 #include <ctype.h>
+#include <stdint.h>
 
 #include "logging.h"
+#include "xxhash.h"
+#include "stats.h"
+#include "file_io.h"
 
 // TODO:
 // (BUG) Current file needs to remain open until the possibility of
 //       the line or name getting pulled has ended. The file gets closed
 //       when a new character is requested, not when the file actually closes.
 //
-// (ENH) Buffer some amount of text and place tokens in some kind of
-//       buffer to make it quicker to scan them.
-//
 
-static struct file_stack
+// files are read this many bytes at a time
+#define READ_SIZE (1024 * 64)
+
+/*
+    The input state. Every scanner has its own, so several files can be read
+    at the same time. The functions that do not take a file_io_t use a
+    default one that belongs to the thread.
+*/
+struct file_stack
 {
     char *fname;
     FILE *fp;
     int line;
     int index;
+    char *buf;  // the text that has been read and not scanned yet
+    size_t pos;
+    size_t len;
+    char *back; // characters that were pushed back, last one on top
+    int num_back;
+    int cap_back;
     struct file_stack *next;
-} *pfile_stack = NULL;
-static int isinit = 0;
-static int tot_lines = 0;
-static int close_file_flag = 0;
+};
+
+struct file_io_t
+{
+    struct file_stack *stack;
+    int tot_lines;
+    int close_file_flag;
+};
+
+static _Thread_local file_io_t *default_fio = NULL;
 
-static void close_file(void)
+static void close_file(file_io_t *fio)
 {
     //ENTER();
     struct file_stack *tfs;
 
-    if (NULL != pfile_stack)
+    if (NULL != fio->stack)
     {
-        INFO("closing file: %s", pfile_stack->fname);
-        tfs = pfile_stack;
-        pfile_stack = tfs->next;
+        INFO("closing file: %s", fio->stack->fname);
+        tfs = fio->stack;
+        fio->stack = tfs->next;
         fclose(tfs->fp);
         free(tfs->fname);
+        free(tfs->buf);
+        free(tfs->back);
         free(tfs);
-        if (NULL != pfile_stack)
-            INFO("switch to file: %s", pfile_stack->fname);
+        if (NULL != fio->stack)
+            INFO("switch to file: %s", fio->stack->fname);
         else
             INFO("no files are open");
     }
     //RET();
 }
 
-static void close_all_files(void)
+file_io_t *create_file_io(void)
 {
+    file_io_t *fio;
+
     ENTER();
-    while (NULL != pfile_stack)
-        close_file();
-    RET();
+    if (NULL == (fio = calloc(1, sizeof(file_io_t))))
+        FATAL("cannot allocate memory for file io");
+    VRET(fio);
 }
 
-void init_file_io(void)
+void destroy_file_io(file_io_t *fio)
 {
     ENTER();
-    if (!isinit)
+    if (fio != NULL)
     {
-        pfile_stack = NULL;
-        atexit(close_all_files);
-        isinit = 1;
+        fio_close_all(fio);
+        free(fio);
     }
-    else
-        INFO("multiple calls to file init");
+    RET();
+}
 
+void fio_close_all(file_io_t *fio)
+{
+    ENTER();
+    while (NULL != fio->stack)
+        close_file(fio);
+    fio->close_file_flag = 0;
     RET();
 }
 
 /*
     All errors are fatal errors.
 */
-void open_file(const char *fname)
+void fio_open(file_io_t *fio, const char *fname)
 {
     ENTER();
     struct file_stack *tfs;
 
+    // a file that has ended but not been closed yet must be closed now or
+    // get_char() will close the new file instead.
+    if (fio->close_file_flag)
+    {
+        close_file(fio);
+        fio->close_file_flag = 0;
+    }
+
     if (NULL == (tfs = calloc(1, sizeof(struct file_stack))))
         FATAL("Cannot allocate memory file new file stack");
 
     if (NULL == (tfs->fname = strdup(fname)))
         FATAL("Cannot allocate memory file file name: %s", fname);
 
+    PHASE_ENTER(PHASE_FILE_IO);
     if (NULL == (tfs->fp = fopen(fname, "r")))
         FATAL("Cannot open input file: %s: %s", fname, strerror(errno));
+    PHASE_LEAVE();
+
+    if (NULL == (tfs->buf = malloc(READ_SIZE)))
+        FATAL("Cannot allocate memory for file buffer: %s", fname);
+    STAT_COUNT(STAT_FILES, 1);
 
     tfs->line = 1;
     tfs->index = 1;
-    if (NULL != pfile_stack)
-        tfs->next = pfile_stack;
-    pfile_stack = tfs;
+    if (NULL != fio->stack)
+        tfs->next = fio->stack;
+    fio->stack = tfs;
 
     INFO("Opened file: %s", fname);
     RET();
 }
 
+/*
+    Read the next block of the file. Returns EOF at the end of the file.
+*/
+static int read_block(struct file_stack *tfs)
+{
+    PHASE_ENTER(PHASE_FILE_IO);
+    tfs->pos = 0;
+    tfs->len = fread(tfs->buf, 1, READ_SIZE, tfs->fp);
+    STAT_COUNT(STAT_BYTES_READ, tfs->len);
+    PHASE_LEAVE();
+    return (tfs->len > 0) ? (unsigned char)tfs->buf[tfs->pos++] : EOF;
+}
+
 /*
     Returns every  character found in the stream. If it's the end of the
     file, then return 0x01. If it's the end of the input, then return 0x00.
 
     Does not support unicodes.
 */
-int get_char(void)
+int fio_get_char(file_io_t *fio)
 {
+    struct file_stack *tfs;
     int ch;
 
-    if (NULL != pfile_stack)
+    if (NULL != fio->stack)
     {
         // this causes the file to be closed after we are finished
         // with it.
-        if (close_file_flag)
+        if (fio->close_file_flag)
         {
-            close_file();
-            close_file_flag = 0;
-            if (pfile_stack == NULL)
+            close_file(fio);
+            fio->close_file_flag = 0;
+            if (fio->stack == NULL)
                 return 0x00;
             else
-                return get_char();  // recurse to get a character.
+                return fio_get_char(fio);  // recurse to get a character.
         }
 
-        ch = fgetc(pfile_stack->fp);
+        tfs = fio->stack;
+        if (tfs->num_back > 0)
+            ch = (unsigned char)tfs->back[--tfs->num_back];
+        else if (tfs->pos < tfs->len)
+            ch = (unsigned char)tfs->buf[tfs->pos++];
+        else
+            ch = read_block(tfs);
+
         if (ch == EOF)
         {
-            close_file_flag = 1;
+            fio->close_file_flag = 1;
             return 0x01;
         }
         else if (ch == '\n')
         {
-            pfile_stack->line++;
-            pfile_stack->index = 1;
-            tot_lines++;
+            fio->stack->line++;
+            fio->stack->index = 1;
+            fio->tot_lines++;
             return ch;
         }
         else
         {
-            pfile_stack->index++;
+            fio->stack->index++;
             return ch;
         }
     }
     return 0x00;
 }
 
-void unget_char(int ch)
+void fio_unget_char(file_io_t *fio, int ch)
 {
     ENTER();
-    if (NULL != pfile_stack)
+    struct file_stack *tfs = fio->stack;
+
+    if (NULL != tfs)
     {
-        ungetc(ch, pfile_stack->fp);
-        pfile_stack->index--;
+        if (tfs->num_back >= tfs->cap_back)
+        {
+            tfs->cap_back = (tfs->cap_back == 0) ? 64 : tfs->cap_back * 2;
+            if (NULL == (tfs->back = realloc(tfs->back, tfs->cap_back)))
+                FATAL("Cannot allocate memory for pushed back characters");
+        }
+        tfs->back[tfs->num_back++] = ch;
+        tfs->index--;
     }
     RET();
 }
 
-int line_number(void)
+int fio_line_number(file_io_t *fio)
 {
     ENTER();
-    if (NULL != pfile_stack)
+    if (NULL != fio->stack)
     {
-        VRET(pfile_stack->line);
+        VRET(fio->stack->line);
     }
     else
     {
@@ -170,12 +244,12 @@ int line_number(void)
     }
 }
 
-int line_index(void)
+int fio_line_index(file_io_t *fio)
 {
     ENTER();
-    if (NULL != pfile_stack)
+    if (NULL != fio->stack)
     {
-        VRET(pfile_stack->index);
+        VRET(fio->stack->index);
     }
     else
     {
@@ -184,12 +258,12 @@ int line_index(void)
     }
 }
 
-const char *file_name(void)
+const char *fio_file_name(file_io_t *fio)
 {
     ENTER();
-    if (NULL != pfile_stack)
+    if (NULL != fio->stack)
     {
-        VRET(pfile_stack->fname);
+        VRET(fio->stack->fname);
     }
     else
     {
@@ -198,7 +272,111 @@ const char *file_name(void)
     }
 }
 
+int fio_total_lines(file_io_t *fio)
+{
+    return fio->tot_lines;
+}
+
+/*
+    The default file io for the thread.
+*/
+file_io_t *default_file_io(void)
+{
+    if (default_fio == NULL)
+        default_fio = create_file_io();
+    return default_fio;
+}
+
+/*
+    Start a new compile. Any files left open by the last one are closed.
+*/
+void init_file_io(void)
+{
+    ENTER();
+    close_all_files();
+    default_file_io()->tot_lines = 0;
+    RET();
+}
+
+void close_all_files(void)
+{
+    fio_close_all(default_file_io());
+}
+
+void free_file_io(void)
+{
+    destroy_file_io(default_fio);
+    default_fio = NULL;
+}
+
+void open_file(const char *fname)
+{
+    fio_open(default_file_io(), fname);
+}
+
+int get_char(void)
+{
+    return fio_get_char(default_file_io());
+}
+
+void unget_char(int ch)
+{
+    fio_unget_char(default_file_io(), ch);
+}
+
+int line_number(void)
+{
+    return fio_line_number(default_file_io());
+}
+
+int line_index(void)
+{
+    return fio_line_index(default_file_io());
+}
+
+const char *file_name(void)
+{
+    return fio_file_name(default_file_io());
+}
+
 int total_lines(void)
 {
-    return tot_lines;
+    return fio_total_lines(default_file_io());
+}
+
+/*
+    Calculate the XXH64 hash of the contents of a file. This is used to tell
+    if a file has changed since it was last read. Returns 0 on success or -1
+    if the file could not be read.
+*/
+int file_hash(const char *fname, uint64_t *hash)
+{
+    FILE *fp;
+    char buf[1024 * 16];
+    size_t len;
+    XXH64_state_t *state;
+
+    ENTER();
+    if (NULL == (fp = fopen(fname, "rb")))
+    {
+        INFO("cannot open %s for hashing: %s", fname, strerror(errno));
+        VRET(-1);
+    }
+
+    if (NULL == (state = XXH64_createState()))
+        FATAL("cannot allocate memory for hash state");
+
+    PHASE_ENTER(PHASE_FILE_IO);
+    XXH64_reset(state, 0);
+    while ((len = fread(buf, 1, sizeof(buf), fp)) > 0)
+    {
+        XXH64_update(state, buf, len);
+        STAT_COUNT(STAT_BYTES_HASHED, len);
+    }
+    PHASE_LEAVE();
+
+    *hash = XXH64_digest(state);
+    XXH64_freeState(state);
+    fclose(fp);
+    VRET(0);
 }
@@ -1,7 +1,26 @@
 #ifndef _FILE_IO_H_
 #define _FILE_IO_H_
 
+#include <stdint.h>
+
+typedef struct file_io_t file_io_t;
+
+file_io_t *create_file_io(void);
+void destroy_file_io(file_io_t *fio);
+void fio_open(file_io_t *fio, const char *fname);
+void fio_close_all(file_io_t *fio);
+int fio_get_char(file_io_t *fio);
+void fio_unget_char(file_io_t *fio, int ch);
+int fio_line_number(file_io_t *fio);
+int fio_line_index(file_io_t *fio);
+const char *fio_file_name(file_io_t *fio);
+int fio_total_lines(file_io_t *fio);
+
+// these use the default file io of the thread
+file_io_t *default_file_io(void);
 void init_file_io(void);
+void close_all_files(void);
+void free_file_io(void);
 void open_file(const char *fname);
 int get_char(void);
 void unget_char(int ch);
@@ -9,5 +28,6 @@ int line_number(void);
 int line_index(void);
 const char *file_name(void);
 int total_lines(void);
+int file_hash(const char *fname, uint64_t *hash);
 
-#endif /* _FILE_IO_H_ */
\ No newline at end of file
+#endif /* _FILE_IO_H_ */
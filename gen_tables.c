@@ -0,0 +1,656 @@
+/*
+    Parse table generator.
+
+    Reads the grammar in toi.grammar and writes the LL(1) tables that
+    ll_parse() runs. See toi.grammar for the format of the grammar.
+
+    usage: gen_tables grammar header.h tables.c
+
+    The header has the numbers of the rules and the actions and the
+    prototypes of the action functions. The C file has the tables:
+
+        parse_table     the production to use for a rule and the next
+                        token, plus one, or 0 for a syntax error
+        nonterm_info    the name and the message of each rule, how to
+                        recover in it and the production to use when
+                        the table has none
+        prod_syms       the symbols of every production, one after the
+                        other. A rule is its number, an action is
+                        SYM_ACTION plus its number and a token is itself.
+        prod_msgs       the message for each symbol in prod_syms
+        prod_start      where each production starts in prod_syms
+
+    The tokens are written by name, so the generator does not need to know
+    their numbers. It is a host tool and uses nothing from the compiler.
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <stdarg.h>
+
+#define MAX_NAME 64
+#define MAX_SYMBOLS 512
+#define MAX_PRODS 250 // the table entries are one byte
+#define MAX_ITEMS 2048
+#define MAX_MSGS 256
+
+typedef enum
+{
+    SYM_TERM,
+    SYM_RULE,
+    SYM_ACT,
+} sym_kind_t;
+
+typedef struct
+{
+    char name[MAX_NAME];
+    sym_kind_t kind;
+    int index; // the number among the symbols of its kind
+    int defined;
+    int msg;   // the message of a rule
+    int recover;
+    char where[MAX_NAME];
+    char *reads; // the tokens that an action can start with, by index
+} symbol_t;
+
+typedef struct
+{
+    int sym;
+    int msg;
+} item_t;
+
+typedef struct
+{
+    int rule;
+    int start;
+    int len;
+} prod_t;
+
+static symbol_t symbols[MAX_SYMBOLS];
+static int num_symbols = 0;
+static int num_kind[3] = {0, 0, 0};
+static prod_t prods[MAX_PRODS];
+static int num_prods = 0;
+static item_t items[MAX_ITEMS];
+static int num_items = 0;
+static char *msgs[MAX_MSGS] = {NULL}; // 0 is no message
+static int num_msgs = 1;
+
+static const char *grammar_name;
+static FILE *grammar;
+static int line_no = 1;
+
+// the sets are indexed by the number of the rule and the token
+static char *nullable;
+static char **first;
+static char **follow;
+static int **table;
+static int *deflt; // the production to use for any token, plus one
+
+static void fail(const char *fmt, ...)
+{
+    va_list args;
+
+    va_start(args, fmt);
+    fprintf(stderr, "%s: %d: ", grammar_name, line_no);
+    vfprintf(stderr, fmt, args);
+    fprintf(stderr, "\n");
+    va_end(args);
+    exit(1);
+}
+
+static void *alloc(size_t size)
+{
+    void *ptr;
+
+    if (NULL == (ptr = calloc(1, size)))
+        fail("cannot allocate memory");
+    return ptr;
+}
+
+static int find_symbol(const char *name, sym_kind_t kind)
+{
+    int i;
+
+    // the actions are named apart from the rules and the tokens
+    for (i = 0; i < num_symbols; i++)
+        if (!strcmp(symbols[i].name, name) && (symbols[i].kind == SYM_ACT) == (kind == SYM_ACT))
+            return i;
+
+    if (num_symbols == MAX_SYMBOLS)
+        fail("too many symbols");
+    strcpy(symbols[num_symbols].name, name);
+    symbols[num_symbols].kind = kind;
+    symbols[num_symbols].index = num_kind[kind]++;
+    return num_symbols++;
+}
+
+static int add_msg(const char *str)
+{
+    if (num_msgs == MAX_MSGS)
+        fail("too many messages");
+    if (NULL == (msgs[num_msgs] = strdup(str)))
+        fail("cannot allocate memory");
+    return num_msgs++;
+}
+
+/*
+    The words of the grammar file. Returns the first character of the word,
+    or EOF. Names and strings are copied into buf.
+*/
+static int next_word(char *buf)
+{
+    int ch, len = 0;
+
+    while ((ch = fgetc(grammar)) != EOF)
+    {
+        if (ch == '\n')
+            line_no++;
+        else if (ch == '#')
+        {
+            while ((ch = fgetc(grammar)) != EOF && ch != '\n')
+                ;
+            line_no++;
+        }
+        else if (!isspace(ch))
+            break;
+    }
+
+    if (ch == EOF || ch == ':' || ch == '|' || ch == ';')
+        return ch;
+
+    if (ch == '"')
+    {
+        while ((ch = fgetc(grammar)) != EOF && ch != '"' && ch != '\n')
+            if (len < MAX_NAME - 1)
+                buf[len++] = ch;
+        if (ch != '"')
+            fail("string is not terminated");
+        buf[len] = 0;
+        return '"';
+    }
+
+    if (ch != '@' && ch != '%' && !isalpha(ch) && ch != '_')
+        fail("unexpected character '%c'", ch);
+
+    buf[len++] = ch;
+    while ((ch = fgetc(grammar)) != EOF && (isalnum(ch) || ch == '_'))
+        if (len < MAX_NAME - 1)
+            buf[len++] = ch;
+    if (ch != EOF)
+        ungetc(ch, grammar);
+    buf[len] = 0;
+    return buf[0];
+}
+
+static void read_recover(void)
+{
+    char buf[MAX_NAME];
+    int sym;
+
+    if (!isalpha(next_word(buf)) || isupper(buf[0]))
+        fail("expected a rule after %%recover");
+    sym = find_symbol(buf, SYM_RULE);
+
+    next_word(buf);
+    if (!strcmp(buf, "retry"))
+        symbols[sym].recover = 1;
+    else if (!strcmp(buf, "skip"))
+        symbols[sym].recover = 2;
+    else
+        fail("expected retry or skip, got %s", buf);
+
+    if (!isalpha(next_word(buf)))
+        fail("expected where the parser is after %%recover");
+    strcpy(symbols[sym].where, buf);
+}
+
+/*
+    An action that reads input itself, as an expression, is given the
+    tokens that it can start with, so the parser can predict it.
+*/
+static void read_reads(void)
+{
+    char buf[MAX_NAME];
+    int ch, sym;
+
+    if (next_word(buf) != '@')
+        fail("expected an action after %%reads");
+    sym = find_symbol(buf + 1, SYM_ACT);
+    symbols[sym].reads = alloc(MAX_SYMBOLS);
+
+    while ((ch = next_word(buf)) != ';')
+    {
+        if (ch == EOF || !isupper(ch))
+            fail("expected a token or ';' after %%reads");
+        symbols[sym].reads[symbols[find_symbol(buf, SYM_TERM)].index] = 1;
+    }
+}
+
+static void read_grammar(void)
+{
+    char buf[MAX_NAME];
+    int ch, rule, sym, num_defined = 0;
+
+    while ((ch = next_word(buf)) != EOF)
+    {
+        if (ch == '%')
+        {
+            if (!strcmp(buf, "%recover"))
+                read_recover();
+            else if (!strcmp(buf, "%reads"))
+                read_reads();
+            else
+                fail("unknown directive %s", buf);
+            continue;
+        }
+
+        if (!islower(ch))
+            fail("expected the name of a rule, got %s", buf);
+        rule = find_symbol(buf, SYM_RULE);
+        if (symbols[rule].kind != SYM_RULE)
+            fail("%s is not a rule", buf);
+        if (symbols[rule].defined)
+            fail("rule %s is defined twice", buf);
+        symbols[rule].defined = 1;
+        // the rules are numbered in the order that they are defined
+        symbols[rule].index = num_defined++;
+
+        if ((ch = next_word(buf)) == '"')
+        {
+            symbols[rule].msg = add_msg(buf);
+            ch = next_word(buf);
+        }
+        if (ch != ':')
+            fail("expected ':' after the rule %s", symbols[rule].name);
+
+        // the alternatives
+        do
+        {
+            if (num_prods == MAX_PRODS)
+                fail("too many productions");
+            prods[num_prods].rule = rule;
+            prods[num_prods].start = num_items;
+            while ((ch = next_word(buf)) != '|' && ch != ';')
+            {
+                if (ch == EOF)
+                    fail("the rule %s is not terminated", symbols[rule].name);
+                if (num_items == MAX_ITEMS)
+                    fail("too many items");
+
+                if (ch == '"')
+                {
+                    if (num_items == prods[num_prods].start || symbols[items[num_items - 1].sym].kind == SYM_ACT)
+                        fail("a message must follow a token or a rule");
+                    items[num_items - 1].msg = add_msg(buf);
+                    continue;
+                }
+
+                if (ch == '@')
+                    sym = find_symbol(buf + 1, SYM_ACT);
+                else if (isupper(ch))
+                    sym = find_symbol(buf, SYM_TERM);
+                else
+                    sym = find_symbol(buf, SYM_RULE);
+                items[num_items].sym = sym;
+                items[num_items].msg = 0;
+                num_items++;
+            }
+            prods[num_prods].len = num_items - prods[num_prods].start;
+            num_prods++;
+        } while (ch == '|');
+    }
+
+    for (sym = 0; sym < num_symbols; sym++)
+        if (symbols[sym].kind == SYM_RULE && !symbols[sym].defined)
+            fail("rule %s is used but not defined", symbols[sym].name);
+}
+
+static int add_set(char *to, const char *from)
+{
+    int i, changed = 0;
+
+    for (i = 0; i < num_kind[SYM_TERM]; i++)
+    {
+        if (from[i] && !to[i])
+        {
+            to[i] = 1;
+            changed = 1;
+        }
+    }
+    return changed;
+}
+
+/*
+    Add the first tokens of the items to the set. Returns 1 if all of the
+    items can match nothing.
+*/
+static int first_of(int start, int len, char *set)
+{
+    int i, j, sym;
+
+    for (i = start; i < start + len; i++)
+    {
+        sym = items[i].sym;
+        if (symbols[sym].kind == SYM_ACT && symbols[sym].reads != NULL)
+        {
+            add_set(set, symbols[sym].reads);
+            return 0;
+        }
+        if (symbols[sym].kind == SYM_ACT)
+            continue;
+        if (symbols[sym].kind == SYM_TERM)
+        {
+            set[symbols[sym].index] = 1;
+            return 0;
+        }
+        for (j = 0; j < num_kind[SYM_TERM]; j++)
+            set[j] |= first[symbols[sym].index][j];
+        if (!nullable[symbols[sym].index])
+            return 0;
+    }
+    return 1;
+}
+
+static void make_sets(void)
+{
+    char *set;
+    int p, i, r, sym, changed;
+    int num_rules = num_kind[SYM_RULE], num_terms = num_kind[SYM_TERM];
+
+    nullable = alloc(num_rules);
+    first = alloc(num_rules * sizeof(char *));
+    follow = alloc(num_rules * sizeof(char *));
+    for (r = 0; r < num_rules; r++)
+    {
+        first[r] = alloc(num_terms + 1);
+        follow[r] = alloc(num_terms + 1);
+    }
+    set = alloc(num_terms + 1);
+
+    do
+    {
+        changed = 0;
+        for (p = 0; p < num_prods; p++)
+        {
+            r = symbols[prods[p].rule].index;
+            memset(set, 0, num_terms);
+            if (first_of(prods[p].start, prods[p].len, set) && !nullable[r])
+                nullable[r] = changed = 1;
+            changed |= add_set(first[r], set);
+        }
+    } while (changed);
+
+    do
+    {
+        changed = 0;
+        for (p = 0; p < num_prods; p++)
+        {
+            for (i = prods[p].start; i < prods[p].start + prods[p].len; i++)
+            {
+                sym = items[i].sym;
+                if (symbols[sym].kind != SYM_RULE)
+                    continue;
+                memset(set, 0, num_terms);
+                r = symbols[sym].index;
+                if (first_of(i + 1, prods[p].start + prods[p].len - i - 1, set))
+                    add_set(set, follow[symbols[prods[p].rule].index]);
+                changed |= add_set(follow[r], set);
+            }
+        }
+    } while (changed);
+    free(set);
+}
+
+static const char *name_of(sym_kind_t kind, int index)
+{
+    int i;
+
+    for (i = 0; i < num_symbols; i++)
+        if (symbols[i].kind == kind && symbols[i].index == index)
+            return symbols[i].name;
+    return "?";
+}
+
+static void make_table(void)
+{
+    char *set;
+    int p, r, t, count, only = 0, errors = 0;
+    int num_terms = num_kind[SYM_TERM];
+
+    table = alloc(num_kind[SYM_RULE] * sizeof(int *));
+    for (r = 0; r < num_kind[SYM_RULE]; r++)
+        table[r] = alloc(num_terms * sizeof(int));
+    set = alloc(num_terms + 1);
+
+    for (p = 0; p < num_prods; p++)
+    {
+        r = symbols[prods[p].rule].index;
+        memset(set, 0, num_terms);
+        if (first_of(prods[p].start, prods[p].len, set))
+            add_set(set, follow[r]);
+
+        for (t = 0; t < num_terms; t++)
+        {
+            if (!set[t])
+                continue;
+            if (table[r][t] != 0)
+            {
+                fprintf(stderr, "%s: conflict in rule %s on %s\n", grammar_name,
+                        name_of(SYM_RULE, r), name_of(SYM_TERM, t));
+                errors++;
+            }
+            table[r][t] = p + 1;
+        }
+    }
+    free(set);
+
+    if (errors)
+        exit(1);
+
+    // A rule with one production and no message of its own always uses
+    // the production, so a wrong token is reported by the first item of
+    // the production that it does not match.
+    deflt = alloc(num_kind[SYM_RULE] * sizeof(int));
+    for (r = 0; r < num_kind[SYM_RULE]; r++)
+    {
+        for (p = 0, count = 0; p < num_prods; p++)
+        {
+            if (symbols[prods[p].rule].index == r)
+            {
+                only = p;
+                count++;
+            }
+        }
+        if (count == 1 && symbols[prods[only].rule].msg == 0)
+            deflt[r] = only + 1;
+    }
+}
+
+static void upper_name(FILE *fp, const char *prefix, const char *name)
+{
+    fputs(prefix, fp);
+    for (; *name != 0; name++)
+        fputc(toupper((unsigned char)*name), fp);
+}
+
+static void write_header(FILE *fp)
+{
+    int i;
+
+    fprintf(fp, "/* Generated by gen_tables from %s. Do not edit. */\n", grammar_name);
+    fprintf(fp, "#ifndef _PARSE_TABLES_H_\n#define _PARSE_TABLES_H_\n\n");
+
+    fprintf(fp, "typedef enum\n{\n");
+    for (i = 0; i < num_kind[SYM_RULE]; i++)
+    {
+        fputs("    ", fp);
+        upper_name(fp, "NT_", name_of(SYM_RULE, i));
+        fputs(",\n", fp);
+    }
+    fprintf(fp, "    NUM_NONTERMS,\n} nonterm_t;\n\n");
+
+    fprintf(fp, "typedef enum\n{\n");
+    for (i = 0; i < num_kind[SYM_ACT]; i++)
+    {
+        fputs("    ", fp);
+        upper_name(fp, "ACT_", name_of(SYM_ACT, i));
+        fputs(",\n", fp);
+    }
+    fprintf(fp, "    NUM_ACTIONS,\n} action_t;\n\n");
+
+    for (i = 0; i < num_kind[SYM_ACT]; i++)
+        fprintf(fp, "void act_%s(void);\n", name_of(SYM_ACT, i));
+
+    fprintf(fp, "\n#endif /* _PARSE_TABLES_H_ */\n");
+}
+
+static void write_str(FILE *fp, const char *str)
+{
+    if (str == NULL)
+    {
+        fputs("NULL", fp);
+        return;
+    }
+    fputc('"', fp);
+    for (; *str != 0; str++)
+    {
+        if (*str == '"' || *str == '\\')
+            fputc('\\', fp);
+        fputc(*str, fp);
+    }
+    fputc('"', fp);
+}
+
+static void write_symbol(FILE *fp, int sym)
+{
+    switch (symbols[sym].kind)
+    {
+    case SYM_TERM:
+        fputs(symbols[sym].name, fp);
+        break;
+    case SYM_RULE:
+        upper_name(fp, "NT_", symbols[sym].name);
+        break;
+    case SYM_ACT:
+        upper_name(fp, "SYM_ACTION + ACT_", symbols[sym].name);
+        break;
+    }
+}
+
+static void write_tables(FILE *fp, const char *header)
+{
+    int i, p, r, t, sym;
+
+    fprintf(fp, "/* Generated by gen_tables from %s. Do not edit. */\n", grammar_name);
+    fprintf(fp, "#include <stdio.h>\n#include <stdint.h>\n\n");
+    fprintf(fp, "#include \"scanner.h\"\n#include \"parse.h\"\n#include \"%s\"\n#include \"ll_parse.h\"\n\n", header);
+
+    fprintf(fp, "const uint8_t parse_table[NUM_NONTERMS][NUM_TABLE_TOKENS] = {\n");
+    for (r = 0; r < num_kind[SYM_RULE]; r++)
+    {
+        upper_name(fp, "    [NT_", name_of(SYM_RULE, r));
+        fputs("] = {", fp);
+        for (t = 0, i = 0; t < num_kind[SYM_TERM]; t++)
+            if (table[r][t])
+                fprintf(fp, "%s[%s - FIRST_TOK] = %d", (i++ > 0) ? ", " : "", name_of(SYM_TERM, t), table[r][t]);
+        fputs("},\n", fp);
+    }
+    fprintf(fp, "};\n\n");
+
+    fprintf(fp, "const int16_t prod_syms[] = {\n");
+    for (p = 0; p < num_prods; p++)
+    {
+        fprintf(fp, "    /* %d %s */", p, symbols[prods[p].rule].name);
+        for (i = prods[p].start; i < prods[p].start + prods[p].len; i++)
+        {
+            fputc(' ', fp);
+            write_symbol(fp, items[i].sym);
+            fputc(',', fp);
+        }
+        fputc('\n', fp);
+    }
+    fprintf(fp, "    0,\n};\n\n");
+
+    fprintf(fp, "const uint8_t prod_msgs[] = {\n   ");
+    for (i = 0; i < num_items; i++)
+        fprintf(fp, " %d,", items[i].msg);
+    fprintf(fp, " 0,\n};\n\n");
+
+    fprintf(fp, "const uint16_t prod_start[] = {\n   ");
+    for (p = 0; p < num_prods; p++)
+        fprintf(fp, " %d,", prods[p].start);
+    fprintf(fp, " %d,\n};\n\n", num_items);
+
+    fprintf(fp, "const char *const parse_msgs[] = {\n");
+    for (i = 0; i < num_msgs; i++)
+    {
+        fputs("    ", fp);
+        write_str(fp, msgs[i]);
+        fputs(",\n", fp);
+    }
+    fprintf(fp, "};\n\n");
+
+    fprintf(fp, "const nonterm_info_t nonterm_info[NUM_NONTERMS] = {\n");
+    for (r = 0; r < num_kind[SYM_RULE]; r++)
+    {
+        sym = find_symbol(name_of(SYM_RULE, r), SYM_RULE);
+        fputs("    {", fp);
+        write_str(fp, symbols[sym].name);
+        fputs(", ", fp);
+        write_str(fp, msgs[symbols[sym].msg]);
+        fprintf(fp, ", %s, %s, %d},\n",
+                (symbols[sym].recover == 1) ? "RECOVER_RETRY" : (symbols[sym].recover == 2) ? "RECOVER_SKIP" : "RECOVER_NONE",
+                (symbols[sym].recover != 0) ? symbols[sym].where : "RECOVER_TOP", deflt[r]);
+    }
+    fprintf(fp, "};\n\n");
+
+    fprintf(fp, "void (*const parse_actions[NUM_ACTIONS])(void) = {\n");
+    for (i = 0; i < num_kind[SYM_ACT]; i++)
+        fprintf(fp, "    act_%s,\n", name_of(SYM_ACT, i));
+    fprintf(fp, "};\n");
+}
+
+int main(int argc, char **argv)
+{
+    FILE *fp;
+    const char *header;
+
+    if (argc != 4)
+    {
+        fprintf(stderr, "usage: %s grammar header.h tables.c\n", argv[0]);
+        return 1;
+    }
+
+    grammar_name = argv[1];
+    if (NULL == (grammar = fopen(grammar_name, "r")))
+    {
+        perror(grammar_name);
+        return 1;
+    }
+    read_grammar();
+    fclose(grammar);
+
+    make_sets();
+    make_table();
+
+    // the header is included by its name without the directory
+    header = (strrchr(argv[2], '/') != NULL) ? strrchr(argv[2], '/') + 1 : argv[2];
+    if (NULL == (fp = fopen(argv[2], "w")))
+    {
+        perror(argv[2]);
+        return 1;
+    }
+    write_header(fp);
+    fclose(fp);
+
+    if (NULL == (fp = fopen(argv[3], "w")))
+    {
+        perror(argv[3]);
+        return 1;
+    }
+    write_tables(fp, header);
+    fclose(fp);
+    return 0;
+}
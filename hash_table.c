@@ -1,6 +1,7 @@
 /*
     Generic hash table to support the symbol table and symbol attributes.
 */
+#define LOG_MODULE LOG_MOD_HASH
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdint.h>
@@ -10,6 +11,7 @@
 #include "errors.h"
 #include "hash_table.h"
 #include "xxhash.h"
+#include "stats.h"
 
 typedef struct __hte__ {
     char *key;
@@ -57,6 +59,8 @@ void destroy_hash_table(ht_handle_t ht)
                 }
             }
         }
+        free(table->table);
+        free(table);
     }
     RET();
 }
@@ -70,7 +74,9 @@ static inline hash_table_entry_t *find_local(hash_table_t *table, const char *ke
 
     hash_table_entry_t *hte;
 
+    STAT_COUNT(STAT_HASH_LOOKUPS, 1);
     for(hte = table->table[hash]; NULL != hte; hte = hte->next) {
+        STAT_COUNT(STAT_HASH_PROBES, 1);
         if(!strcmp(key, hte->key)) {
             return hte; // found
         }
@@ -85,6 +91,7 @@ int hash_save(ht_handle_t ht, const char *key, void *data)
     int hash;
 
     if(NULL != table) {
+        PHASE_ENTER(PHASE_HASH);
         hash = make_hash(key) % table->slots;
         hte = find_local(table, key, hash);
         if(NULL == hte) {
@@ -97,13 +104,17 @@ int hash_save(ht_handle_t ht, const char *key, void *data)
             hte->data = data;
             hte->next = NULL;
 
-            if(NULL != table->table[hash])
+            if(NULL != table->table[hash]) {
                 hte->next = table->table[hash];
+                STAT_COUNT(STAT_HASH_COLLISIONS, 1);
+            }
             table->table[hash] = hte;
 
+            PHASE_LEAVE();
             return 0;   // success
         }
         else {
+            PHASE_LEAVE();
             return 1;   // symbol already in the table
         }
     }
@@ -118,7 +129,9 @@ void *hash_find(ht_handle_t ht, const char *key)
     hash_table_entry_t *hte;
 
     if(NULL != table) {
+        PHASE_ENTER(PHASE_HASH);
         hte = find_local(table, key, make_hash(key) % table->slots);
+        PHASE_LEAVE();
         if(NULL != hte)
             return hte->data;  // success
         else
@@ -128,3 +141,20 @@ void *hash_find(ht_handle_t ht, const char *key)
         return NULL;    // invalid table
 }
 
+/*
+    Call the function for every entry in the table. The order is not
+    defined. The function must not add or remove entries.
+*/
+void hash_foreach(ht_handle_t ht, void (*func)(const char *key, void *data, void *arg), void *arg)
+{
+    hash_table_t* table = (hash_table_t*)ht;
+    hash_table_entry_t *hte;
+    int i;
+
+    if(NULL != table) {
+        for(i = 0; i < table->slots; i++) {
+            for(hte = table->table[i]; NULL != hte; hte = hte->next)
+                func(hte->key, hte->data, arg);
+        }
+    }
+}
@@ -10,5 +10,6 @@ void destroy_hash_table(ht_handle_t ht);
 int hash_save(ht_handle_t ht, const char *key, void *data);
 void *hash_find(ht_handle_t ht, const char *key);
 uint32_t make_hash(const char *str);
+void hash_foreach(ht_handle_t ht, void (*func)(const char *key, void *data, void *arg), void *arg);
 
 #endif /* _HASH_TABLE_H_ */
\ No newline at end of file
@@ -5,13 +5,30 @@
     that follow is a single symbol that is reduced to a file to read. There
     is a system path that is used to find the files, similar to the way python 
     handles imports. The string ".toi" is appended and the file is opened for 
-    scanning. A new context is also pushed (without the file extention) and the 
+    scanning. See search_path.c. A new context is also pushed (without the file extention) and the 
     symbols in the file are accessed using the context.
 
+    The module is always parsed in its own top level context, so its symbols
+    are the same no matter which module imported it first. A module is only
+    parsed the first time that it is imported. After that,
+    its symbols are already defined under its context and importing it again
+    does nothing. See modules.c.
+
+    If the module has an interface file and a bytecode file that match the
+    source, then the symbols are loaded from the one and the program of the
+    module is mapped from the other, and the module is not parsed at all.
+    See interface.c and bytecode.c.
+
+    Every module remembers the hash of its source and the symbols that it
+    defined. rebuild_modules() parses only the modules that have changed and
+    the modules that depend on them.
+
     Example:
     import file1;
 */
+#define LOG_MODULE LOG_MOD_MODULES
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 
 #include "logging.h"
@@ -20,39 +37,270 @@
 #include "parse.h"
 #include "context.h"
 #include "file_io.h"
+#include "modules.h"
+#include "import_def.h"
+#include "interface.h"
+#include "codegen.h"
+#include "search_path.h"
+#include "stats.h"
+
+/*
+    Parse a module in its own context. The file given on the command line
+    is parsed in the top level context.
+*/
+static void parse_module(module_t *mod)
+{
+    char *saved;
+
+    ENTER();
+    if (NULL == (saved = strdup(get_context())))
+        FATAL("cannot allocate memory for saved context");
+
+    init_context();
+    if (!mod->root)
+        push_context(mod->name);
+    push_module(mod);
+    begin_module_code(mod->name);
+    open_file(mod->fname);
+    PHASE_ENTER(PHASE_PARSER);
+    parse();
+    PHASE_LEAVE();
+    pop_module();
+    set_context(saved);
+    free(saved);
+    mod->parsed = 1;
+    RET();
+}
+
+/*
+    Parse the module and save its interface and its bytecode if there were
+    no errors.
+*/
+static void build_module(module_t *mod)
+{
+    int errors;
+
+    ENTER();
+    errors = error_count();
+    parse_module(mod);
+    mod->errors = error_count() - errors;
+    if (mod->errors == 0)
+    {
+        PHASE_ENTER(PHASE_INTERFACE);
+        save_interface(mod);
+        save_bytecode(mod);
+        PHASE_LEAVE();
+    }
+    mod->state = MODULE_DONE;
+    RET();
+}
 
-#define FNAME_SIZE 1024
+/*
+    Load the module from its interface and bytecode files if they are up to
+    date, or parse it.
+*/
+static void load_module(module_t *mod)
+{
+    int loaded = 0;
 
-static void decorate_import(const char *token, char *buf)
+    ENTER();
+    TRACE_BEGIN(TRACE_MODULE, mod->name);
+    // if the file cannot be read, then parsing it reports the error.
+    if (file_hash(mod->fname, &mod->hash) == 0)
+    {
+        PHASE_ENTER(PHASE_INTERFACE);
+        loaded = load_bytecode(mod) && load_interface(mod);
+        PHASE_LEAVE();
+    }
+
+    if (!loaded)
+        build_module(mod);
+    mod->state = MODULE_DONE;
+    TRACE_END(mod->name);
+    RET();
+}
+
+/*
+    Make the symbols of the named module available and return the module.
+    The module is recorded as an import of the module that is currently
+    being parsed. Returns NULL if the module cannot be found.
+*/
+module_t *import_module(const char *name)
 {
-    // stubbed. just a canned file for testing.
-    strcpy(buf, "tests/");
-    strcat(buf, token);
-    strcat(buf, ".toi");
+    ENTER();
+    const char *fname;
+    module_t *mod;
+
+    mod = find_module(name);
+    if (mod == NULL)
+    {
+        if (NULL == (fname = find_module_file(name)))
+        {
+            syntax("cannot find module %s", name);
+            VRET(NULL);
+        }
+
+        mod = create_module(name, fname);
+        if (current_module() != NULL)
+            add_module_import(current_module(), mod);
+        load_module(mod);
+    }
+    else if (mod->state == MODULE_PARSING)
+        syntax("circular import of module %s", mod->name);
+    else
+    {
+        INFO("module %s is already imported", mod->name);
+        if (current_module() != NULL)
+            add_module_import(current_module(), mod);
+    }
+
+    VRET(mod);
+}
+
+/*
+    Compile the file given on the command line. It is treated as a module
+    whose symbols are in the top level context, so it is only parsed if it
+    or one of its imports has changed.
+*/
+module_t *compile_file(const char *fname)
+{
+    module_t *mod;
+
+    ENTER();
+    mod = find_module(fname);
+    if (mod == NULL)
+    {
+        mod = create_module(fname, fname);
+        mod->root = 1;
+        load_module(mod);
+    }
+    else if (mod->state == MODULE_RELEASED)
+    {
+        mod->state = MODULE_PARSING;
+        load_module(mod);
+    }
+    VRET(mod);
+}
+
+/*
+    Invalidate the symbols of a file that was given on the command line so
+    that another file can be compiled in the top level context. If the file
+    is compiled again, then it is loaded again.
+*/
+void release_file(module_t *mod)
+{
+    ENTER();
+    reset_module(mod);
+    mod->state = MODULE_RELEASED;
+    RET();
+}
+
+/*
+    Parse the dirty modules again, imports first.
+*/
+static void rebuild_walk(module_t *mod, int *count)
+{
+    int i;
+
+    if (mod->mark)
+        return;
+
+    mod->mark = 1;
+    for (i = 0; i < mod->num_imports; i++)
+        rebuild_walk(mod->imports[i], count);
+
+    if (mod->dirty && mod->state != MODULE_RELEASED)
+    {
+        INFO("rebuilding module %s", mod->name);
+        reset_module(mod);
+        TRACE_BEGIN(TRACE_MODULE, mod->name);
+        build_module(mod);
+        TRACE_END(mod->name);
+        mod->dirty = 0;
+        (*count)++;
+    }
+}
+
+/*
+    Hash every module that has been seen again. The modules whose source
+    has changed, and every module that imports them directly or indirectly,
+    have their old symbols invalidated and are parsed again. With retry the
+    modules that had errors are parsed again as well, so that the errors are
+    reported again or an import that was not found can be found. Returns the
+    number of modules that were parsed.
+*/
+int rebuild_modules(int retry)
+{
+    module_t *mod;
+    uint64_t hash;
+    int i, changed, count = 0;
+
+    ENTER();
+    for (mod = first_module(); mod != NULL; mod = mod->next)
+    {
+        mod->mark = 0;
+        mod->dirty = 0;
+        if (mod->state == MODULE_RELEASED)
+            continue;
+        else if (file_hash(mod->fname, &hash) != 0)
+            ERROR("cannot read module %s, keeping the old symbols", mod->fname);
+        else if (hash != mod->hash)
+        {
+            INFO("module %s has changed", mod->name);
+            mod->hash = hash;
+            mod->dirty = 1;
+        }
+        else if (retry && mod->errors > 0)
+            mod->dirty = 1;
+    }
+
+    do
+    {
+        changed = 0;
+        for (mod = first_module(); mod != NULL; mod = mod->next)
+        {
+            for (i = 0; i < mod->num_imports && !mod->dirty; i++)
+            {
+                if (mod->imports[i]->dirty)
+                {
+                    mod->dirty = 1;
+                    changed = 1;
+                }
+            }
+        }
+    } while (changed);
+
+    for (mod = first_module(); mod != NULL; mod = mod->next)
+        rebuild_walk(mod, &count);
+
+    INFO("rebuilt %d modules", count);
+    VRET(count);
 }
 
 void do_import(void)
 {
     ENTER();
     token_t tok;
-    char fname[FNAME_SIZE];
 
     tok = get_token();
     if (tok == SYMBOL_TOK)
     {
-        push_context(get_token_string());
-        decorate_import(get_token_string(), fname);
-        open_file(fname);
-        parse();
+        import_module(get_token_string());
 
         tok = get_token();
         if (tok != SEMI_TOK)
+        {
             expect_token(SEMI_TOK, tok, NULL);
-
-        pop_context();
+            unget_token();
+            recover(RECOVER_TOP);
+        }
     }
     else
+    {
         expect_token(SYMBOL_TOK, tok, "import failed");
+        unget_token();
+        recover(RECOVER_TOP);
+    }
 
     RET();
 }
@@ -1,6 +1,12 @@
 #ifndef _IMPORT_DEF_H_
 #define _IMPORT_DEF_H_
 
+#include "modules.h"
+
 void do_import(void);
+module_t *import_module(const char *name);
+module_t *compile_file(const char *fname);
+void release_file(module_t *mod);
+int rebuild_modules(int retry);
 
 #endif /* _IMPORT_DEF_H_ */
\ No newline at end of file
@@ -0,0 +1,310 @@
+/*
+    Import pre-scan and parallel parsing of imports.
+
+    Before a file is compiled with more than one job, the file and the modules
+    that it imports are scanned for the import statements at their start,
+    without parsing them, to find the import graph. A module whose interface
+    file is up to date is not scanned, the interface lists its imports. Then
+    the modules in the graph that have changed, or that import one that has,
+    are built on a pool of threads, imports first. A module is handed to a
+    thread once every module that it imports has been built, so modules
+    that do not depend on each other are parsed at the same time. Each
+    thread builds its module with its own symbol table and modules, the
+    same as a file given with -j, and the result is the interface and
+    bytecode files of the module. See interface.c and bytecode.c.
+
+    The compile of the file that follows is the ordinary one. It finds the
+    interface of every import up to date and loads its symbols under the
+    context of the module, @@name, so what the threads found is merged into
+    the symbol table of the file without parsing anything again.
+
+    A module that had errors has no interface file, so the compile parses
+    it again and reports the errors in their place. The diagnostics of the
+    threads are dropped. The modules of a circular import never become
+    ready and are left to the compile as well.
+
+    Nothing is built ahead when the interface files are turned off, because
+    there would be no way to hand the symbols over.
+*/
+#define LOG_MODULE LOG_MOD_MODULES
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "logging.h"
+#include "errors.h"
+#include "scanner.h"
+#include "hash_table.h"
+#include "search_path.h"
+#include "interface.h"
+#include "import_scan.h"
+
+/*
+    A module in the import graph.
+*/
+typedef struct
+{
+    char *name;
+    char *fname;
+    int *imports; // the modules that this one imports
+    int num_imports;
+    int cap_imports;
+    int *users; // the modules that import this one
+    int num_users;
+    int cap_users;
+    int waiting; // the imports of the module that are not built yet
+    int stale;   // the module must be built, its source or one of its imports has changed
+} scan_node_t;
+
+typedef struct
+{
+    const char *root;
+    build_import_t build;
+    scan_node_t *nodes;
+    int num_nodes;
+    int cap_nodes;
+    ht_handle_t index; // name to node index + 1
+    int *ready;        // the modules that can be built, in the order that they became ready
+    int head;
+    int tail;
+    int busy; // modules that are being built
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+} import_graph_t;
+
+static void *grow(void *list, int *cap, int first, size_t size)
+{
+    *cap = (*cap == 0) ? first : *cap * 2;
+    if (NULL == (list = realloc(list, *cap * size)))
+        FATAL("cannot allocate memory for import graph");
+    return list;
+}
+
+/*
+    Return the index of the module, adding it to the graph if it's new.
+    Returns -1 if it's not on the search path.
+*/
+static int add_node(import_graph_t *g, const char *name)
+{
+    scan_node_t *node;
+    const char *fname;
+    intptr_t idx;
+
+    if (0 != (idx = (intptr_t)hash_find(g->index, name)))
+        return idx - 1;
+    if (NULL == (fname = find_module_file(name)))
+        return -1;
+
+    if (g->num_nodes >= g->cap_nodes)
+        g->nodes = grow(g->nodes, &g->cap_nodes, 16, sizeof(scan_node_t));
+
+    node = &g->nodes[g->num_nodes];
+    memset(node, 0, sizeof(scan_node_t));
+    if (NULL == (node->name = strdup(name)) || NULL == (node->fname = strdup(fname)))
+        FATAL("cannot allocate memory for import graph");
+    hash_save(g->index, name, (void *)(intptr_t)(g->num_nodes + 1));
+    return g->num_nodes++;
+}
+
+static void add_edge(import_graph_t *g, int user, int imp)
+{
+    scan_node_t *node = &g->nodes[user];
+    int i;
+
+    // a module that is imported twice by the same one only waits once
+    for (i = 0; i < node->num_imports; i++)
+        if (node->imports[i] == imp)
+            return;
+
+    if (node->num_imports >= node->cap_imports)
+        node->imports = grow(node->imports, &node->cap_imports, 4, sizeof(int));
+    node->imports[node->num_imports++] = imp;
+
+    node = &g->nodes[imp];
+    if (node->num_users >= node->cap_users)
+        node->users = grow(node->users, &node->cap_users, 4, sizeof(int));
+    node->users[node->num_users++] = user;
+}
+
+static void add_import(import_graph_t *g, const char *name, int user)
+{
+    int imp;
+
+    if ((imp = add_node(g, name)) >= 0 && user >= 0 && imp != user)
+        add_edge(g, user, imp);
+}
+
+typedef struct
+{
+    import_graph_t *g;
+    int user;
+} scan_arg_t;
+
+static void add_interface_import(const char *name, void *arg)
+{
+    scan_arg_t *sa = (scan_arg_t *)arg;
+
+    add_import(sa->g, name, sa->user);
+}
+
+/*
+    Find the modules that the file imports. If its interface file is up to
+    date they are the ones that the interface lists, and the module only
+    has to be built if one of them is. Otherwise only the import statements
+    at the start of the file are read, the scan stops at the first token
+    that is not part of one. An import that comes later is not in the graph
+    and is parsed where it's found, the same as without the pre-scan. The
+    modules are added to the graph and scanned in turn by find_graph().
+*/
+static void scan_file(import_graph_t *g, const char *fname, int user)
+{
+    scan_arg_t sa;
+    scanner_t *s;
+
+    ENTER();
+    sa.g = g;
+    sa.user = user;
+    if (interface_imports(fname, add_interface_import, &sa))
+        RET();
+
+    if (user >= 0)
+        g->nodes[user].stale = 1;
+    s = create_scanner(fname);
+    while (scanner_next(s) == IMPORT_TOK && scanner_next(s) == SYMBOL_TOK)
+    {
+        add_import(g, scanner_string(s), user);
+        if (scanner_next(s) != SEMI_TOK)
+            break;
+    }
+    destroy_scanner(s);
+    RET();
+}
+
+static void find_graph(import_graph_t *g, const char *fname)
+{
+    int i;
+
+    ENTER();
+    scan_file(g, fname, -1);
+    for (i = 0; i < g->num_nodes; i++)
+        scan_file(g, g->nodes[i].fname, i);
+    // the scanner can complain about the files, the compile complains again
+    reset_errors();
+
+    for (i = 0; i < g->num_nodes; i++)
+        g->nodes[i].waiting = g->nodes[i].num_imports;
+    RET();
+}
+
+static void *build_worker(void *arg)
+{
+    import_graph_t *g = (import_graph_t *)arg;
+    scan_node_t *node;
+    int i, idx;
+
+    pthread_mutex_lock(&g->lock);
+    for (;;)
+    {
+        // nothing more can become ready when no module is being built
+        while (g->head == g->tail && g->busy > 0)
+            pthread_cond_wait(&g->cond, &g->lock);
+        if (g->head == g->tail)
+            break;
+
+        idx = g->ready[g->head++];
+        g->busy++;
+        pthread_mutex_unlock(&g->lock);
+
+        node = &g->nodes[idx];
+        if (node->stale)
+        {
+            INFO("building module %s ahead", node->name);
+            g->build(g->root, node->name);
+        }
+
+        pthread_mutex_lock(&g->lock);
+        g->busy--;
+        for (i = 0; i < node->num_users; i++)
+        {
+            // the interface of a user lists the old version of the module
+            g->nodes[node->users[i]].stale |= node->stale;
+            if (--g->nodes[node->users[i]].waiting == 0)
+                g->ready[g->tail++] = node->users[i];
+        }
+        pthread_cond_broadcast(&g->cond);
+    }
+    pthread_mutex_unlock(&g->lock);
+    return NULL;
+}
+
+static void free_graph(import_graph_t *g)
+{
+    int i;
+
+    for (i = 0; i < g->num_nodes; i++)
+    {
+        free(g->nodes[i].name);
+        free(g->nodes[i].fname);
+        free(g->nodes[i].imports);
+        free(g->nodes[i].users);
+    }
+    free(g->nodes);
+    free(g->ready);
+    destroy_hash_table(g->index);
+    pthread_mutex_destroy(&g->lock);
+    pthread_cond_destroy(&g->cond);
+}
+
+/*
+    Find the modules that the file imports, directly or not, and build the
+    ones that have changed on up to jobs threads with the build function.
+    The search path must already be set up for the file in this thread.
+*/
+void build_imports(const char *fname, int jobs, build_import_t build)
+{
+    import_graph_t g;
+    pthread_t *threads;
+    int i;
+
+    ENTER();
+    if (jobs <= 1 || !interface_files_enabled())
+        RET();
+
+    memset(&g, 0, sizeof(g));
+    g.root = fname;
+    g.build = build;
+    g.index = create_hash_table(127);
+    pthread_mutex_init(&g.lock, NULL);
+    pthread_cond_init(&g.cond, NULL);
+
+    find_graph(&g, fname);
+    INFO("%s imports %d modules", fname, g.num_nodes);
+
+    for (i = 0; i < g.num_nodes && !g.nodes[i].stale; i++)
+        ;
+    // there is nothing to build if every interface is up to date
+    if (i < g.num_nodes)
+    {
+        if (NULL == (g.ready = malloc(g.num_nodes * sizeof(int))))
+            FATAL("cannot allocate memory for import graph");
+        for (i = 0; i < g.num_nodes; i++)
+            if (g.nodes[i].waiting == 0)
+                g.ready[g.tail++] = i;
+
+        if (jobs > g.num_nodes)
+            jobs = g.num_nodes;
+        if (NULL == (threads = calloc(jobs, sizeof(pthread_t))))
+            FATAL("cannot allocate memory for threads");
+        for (i = 0; i < jobs; i++)
+            if (pthread_create(&threads[i], NULL, build_worker, &g) != 0)
+                FATAL("cannot create import thread");
+        for (i = 0; i < jobs; i++)
+            pthread_join(threads[i], NULL);
+        free(threads);
+    }
+
+    free_graph(&g);
+    RET();
+}
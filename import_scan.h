@@ -0,0 +1,9 @@
+#ifndef _IMPORT_SCAN_H_
+#define _IMPORT_SCAN_H_
+
+// builds the named module, imported by the file, with its own compile state
+typedef void (*build_import_t)(const char *fname, const char *name);
+
+void build_imports(const char *fname, int jobs, build_import_t build);
+
+#endif /* _IMPORT_SCAN_H_ */
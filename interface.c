@@ -0,0 +1,412 @@
+/*
+    Module interface files.
+
+    When a module has been parsed without errors, the symbols that it defined
+    are written to an interface file next to the source. The interface file
+    has the same name as the source with the extension replaced by ".tif".
+    The next time that the module is imported, the interface file is mapped
+    into memory and, if the hash of the source matches the one that was
+    saved, the symbols are loaded directly into the symbol table without
+    scanning or parsing the source.
+
+    The hash of every imported module is saved as well. If an import has
+    changed, or had to be parsed again for any reason, then the module that
+    imports it is parsed again too.
+
+    The file is laid out as follows. All offsets are relative to the start of
+    the section that they refer to, so the file can be used wherever it is
+    mapped.
+
+        header
+        imports     iface_import_t[num_imports]
+        symbols     iface_symbol_t[num_symbols]
+        attributes  iface_attr_t[num_attrs]
+        data        the raw attribute data
+        strings     nul terminated strings, each one is stored once
+*/
+#define LOG_MODULE LOG_MOD_MODULES
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "logging.h"
+#include "hash_table.h"
+#include "buffer.h"
+#include "file_io.h"
+#include "symbols.h"
+#include "sym_attrs.h"
+#include "modules.h"
+#include "import_def.h"
+#include "signature.h"
+#include "interface.h"
+
+#define INTERFACE_MAGIC "TOIF"
+#define INTERFACE_VERSION 4
+#define INTERFACE_EXT ".tif"
+#define FNAME_SIZE 1024
+
+typedef struct
+{
+    char magic[4];
+    uint32_t version;
+    uint64_t source_hash;
+    uint32_t name; // string offset of the module name
+    uint32_t num_imports;
+    uint32_t num_symbols;
+    uint32_t num_attrs;
+    uint32_t data_size;
+    uint32_t pool_size;
+} iface_header_t;
+
+typedef struct
+{
+    uint64_t hash; // source hash of the imported module
+    uint32_t name; // string offset of the module name
+    uint32_t reserved;
+} iface_import_t;
+
+typedef struct
+{
+    uint32_t name; // string offset of the decorated symbol name
+    uint32_t first_attr;
+    uint32_t num_attrs;
+} iface_symbol_t;
+
+typedef struct
+{
+    uint32_t type;   // sym_attr_t
+    uint32_t size;   // number of bytes of data
+    uint32_t offset; // offset in the data section
+} iface_attr_t;
+
+static int use_interface_files = 1;
+
+void set_interface_files(int flag)
+{
+    use_interface_files = flag;
+}
+
+int interface_files_enabled(void)
+{
+    return use_interface_files;
+}
+
+static void interface_name(const char *fname, char *buf)
+{
+    char *ext;
+
+    if (strlen(fname) + strlen(INTERFACE_EXT) >= FNAME_SIZE)
+        FATAL("interface file name is too long: %s", fname);
+
+    strcpy(buf, fname);
+    ext = strrchr(buf, '.');
+    if (ext != NULL && strchr(ext, '/') == NULL)
+        *ext = 0;
+    strcat(buf, INTERFACE_EXT);
+}
+
+/*
+    Write the interface file for a module that has been parsed. Failure to
+    write the file is not an error because the module can always be parsed
+    again.
+*/
+void save_interface(module_t *mod)
+{
+    char iname[FNAME_SIZE];
+    char tname[FNAME_SIZE + 8];
+    buffer_t imports = {0}, symbols = {0}, attrs = {0}, data = {0}, pool = {0};
+    ht_handle_t strs;
+    iface_header_t hdr;
+    iface_symbol_t sym;
+    iface_attr_t attr;
+    iface_import_t imp;
+    void *ptr;
+    FILE *fp;
+    int i, type, failed, fd;
+
+    ENTER();
+    if (!use_interface_files)
+        RET();
+
+    strs = create_hash_table(257);
+    memset(&hdr, 0, sizeof(hdr));
+    memcpy(hdr.magic, INTERFACE_MAGIC, sizeof(hdr.magic));
+    hdr.version = INTERFACE_VERSION;
+    hdr.source_hash = mod->hash;
+    hdr.name = pool_add(&pool, strs, mod->name);
+
+    for (i = 0; i < mod->num_imports; i++)
+    {
+        imp.hash = mod->imports[i]->hash;
+        imp.name = pool_add(&pool, strs, mod->imports[i]->name);
+        imp.reserved = 0;
+        buffer_add(&imports, &imp, sizeof(imp));
+    }
+
+    for (i = 0; i < mod->num_symbols; i++)
+    {
+        sym.name = pool_add(&pool, strs, mod->symbols[i]);
+        sym.first_attr = hdr.num_attrs;
+        sym.num_attrs = 0;
+        for (type = 0; type < NUM_SYMBOL_ATTRS; type++)
+        {
+            if (NULL != (ptr = get_symbol_attr(mod->symbols[i], type)))
+            {
+                attr.type = type;
+                attr.size = get_symbol_attr_size(mod->symbols[i], type);
+                attr.offset = data.len;
+                buffer_add(&data, ptr, attr.size);
+                buffer_add(&attrs, &attr, sizeof(attr));
+                sym.num_attrs++;
+                hdr.num_attrs++;
+            }
+        }
+        buffer_add(&symbols, &sym, sizeof(sym));
+    }
+
+    hdr.num_imports = mod->num_imports;
+    hdr.num_symbols = mod->num_symbols;
+    hdr.data_size = data.len;
+    hdr.pool_size = pool.len;
+
+    // write to a temporary file and rename it so that a reader never sees a
+    // partial file. Another thread could be writing the same module.
+    interface_name(mod->fname, iname);
+    sprintf(tname, "%s.XXXXXX", iname);
+    fp = NULL;
+    if ((fd = mkstemp(tname)) >= 0)
+    {
+        fchmod(fd, 0644);
+        if (NULL == (fp = fdopen(fd, "wb")))
+        {
+            close(fd);
+            remove(tname);
+        }
+    }
+
+    if (fp == NULL)
+        ERROR("cannot write interface file %s: %s", tname, strerror(errno));
+    else
+    {
+        fwrite(&hdr, sizeof(hdr), 1, fp);
+        fwrite(imports.buf, 1, imports.len, fp);
+        fwrite(symbols.buf, 1, symbols.len, fp);
+        fwrite(attrs.buf, 1, attrs.len, fp);
+        fwrite(data.buf, 1, data.len, fp);
+        fwrite(pool.buf, 1, pool.len, fp);
+        failed = ferror(fp);
+        if (fclose(fp) != 0)
+            failed = 1;
+
+        if (failed || rename(tname, iname) != 0)
+        {
+            ERROR("cannot write interface file %s: %s", iname, strerror(errno));
+            remove(tname);
+        }
+        else
+            INFO("wrote interface file: %s", iname);
+    }
+
+    buffer_free(&imports);
+    buffer_free(&symbols);
+    buffer_free(&attrs);
+    buffer_free(&data);
+    buffer_free(&pool);
+    destroy_hash_table(strs);
+    RET();
+}
+
+/*
+    Verify that the sections described by the header fit in the file and that
+    every offset in them is in range. The file could be truncated or written
+    by a different version.
+*/
+static int check_interface(const char *base, size_t size)
+{
+    const iface_header_t *hdr = (const iface_header_t *)base;
+    const iface_import_t *imports;
+    const iface_symbol_t *symbols;
+    const iface_attr_t *attrs;
+    size_t need;
+    uint32_t i;
+
+    if (size < sizeof(iface_header_t))
+        return 0;
+
+    if (memcmp(hdr->magic, INTERFACE_MAGIC, sizeof(hdr->magic)) || hdr->version != INTERFACE_VERSION)
+        return 0;
+
+    need = sizeof(iface_header_t) +
+           (size_t)hdr->num_imports * sizeof(iface_import_t) +
+           (size_t)hdr->num_symbols * sizeof(iface_symbol_t) +
+           (size_t)hdr->num_attrs * sizeof(iface_attr_t) +
+           hdr->data_size + hdr->pool_size;
+    if (need != size || hdr->pool_size == 0 || base[size - 1] != 0)
+        return 0;
+
+    imports = (const iface_import_t *)(hdr + 1);
+    symbols = (const iface_symbol_t *)(imports + hdr->num_imports);
+    attrs = (const iface_attr_t *)(symbols + hdr->num_symbols);
+
+    if (hdr->name >= hdr->pool_size)
+        return 0;
+
+    for (i = 0; i < hdr->num_imports; i++)
+        if (imports[i].name >= hdr->pool_size)
+            return 0;
+
+    for (i = 0; i < hdr->num_symbols; i++)
+        if (symbols[i].name >= hdr->pool_size ||
+            symbols[i].first_attr > hdr->num_attrs ||
+            symbols[i].num_attrs > hdr->num_attrs - symbols[i].first_attr)
+            return 0;
+
+    for (i = 0; i < hdr->num_attrs; i++)
+        if (attrs[i].type >= NUM_SYMBOL_ATTRS ||
+            attrs[i].offset > hdr->data_size ||
+            attrs[i].size > hdr->data_size - attrs[i].offset)
+            return 0;
+
+    return 1;
+}
+
+/*
+    Map the interface file of the source into memory. Returns NULL if there
+    is no valid interface file or if it was made from a different source.
+*/
+static const iface_header_t *map_interface(const char *fname, uint64_t hash, size_t *size)
+{
+    char iname[FNAME_SIZE];
+    const iface_header_t *hdr;
+    struct stat st;
+    void *base;
+    int fd;
+
+    interface_name(fname, iname);
+    if ((fd = open(iname, O_RDONLY)) < 0)
+        return NULL;
+
+    if (fstat(fd, &st) < 0 || st.st_size == 0)
+    {
+        close(fd);
+        return NULL;
+    }
+
+    base = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (base == MAP_FAILED)
+        return NULL;
+
+    hdr = (const iface_header_t *)base;
+    if (!check_interface(base, st.st_size))
+    {
+        INFO("interface file %s is not valid", iname);
+        munmap(base, st.st_size);
+        return NULL;
+    }
+
+    if (hdr->source_hash != hash)
+    {
+        INFO("interface file %s is out of date", iname);
+        munmap(base, st.st_size);
+        return NULL;
+    }
+
+    *size = st.st_size;
+    return hdr;
+}
+
+/*
+    Call the function with the name of every module that the source
+    imported when its interface file was written. Returns 1 if the
+    interface file is up to date, or 0 if it's not and the function was not
+    called.
+*/
+int interface_imports(const char *fname, void (*func)(const char *name, void *arg), void *arg)
+{
+    const iface_header_t *hdr;
+    const iface_import_t *imports;
+    const char *pool;
+    uint64_t hash;
+    size_t size;
+    uint32_t i;
+
+    ENTER();
+    if (!use_interface_files || file_hash(fname, &hash) != 0 || NULL == (hdr = map_interface(fname, hash, &size)))
+        VRET(0);
+
+    imports = (const iface_import_t *)(hdr + 1);
+    pool = (const char *)hdr + size - hdr->pool_size;
+    for (i = 0; i < hdr->num_imports; i++)
+        func(&pool[imports[i].name], arg);
+
+    munmap((void *)hdr, size);
+    VRET(1);
+}
+
+/*
+    Load the module's symbols from its interface file. Returns 1 if the
+    symbols were loaded or 0 if the module must be parsed.
+*/
+int load_interface(module_t *mod)
+{
+    const iface_header_t *hdr;
+    const iface_import_t *imports;
+    module_t *imp;
+    const iface_symbol_t *symbols;
+    const iface_attr_t *attrs;
+    const char *data, *pool, *name;
+    size_t size;
+    uint32_t i, j;
+
+    ENTER();
+    if (!use_interface_files || NULL == (hdr = map_interface(mod->fname, mod->hash, &size)))
+        VRET(0);
+
+    imports = (const iface_import_t *)(hdr + 1);
+    symbols = (const iface_symbol_t *)(imports + hdr->num_imports);
+    attrs = (const iface_attr_t *)(symbols + hdr->num_symbols);
+    data = (const char *)(attrs + hdr->num_attrs);
+    pool = data + hdr->data_size;
+
+    INFO("loading module %s from the interface of %s", &pool[hdr->name], mod->fname);
+    push_module(mod);
+
+    // the imports of the module have to be available as well. If any of
+    // them is not the one that the interface was made with, then the module
+    // has to be parsed.
+    for (i = 0; i < hdr->num_imports; i++)
+    {
+        imp = import_module(&pool[imports[i].name]);
+        if (imp == NULL || imp->parsed || imp->hash != imports[i].hash)
+        {
+            INFO("an import of %s has changed", mod->fname);
+            pop_module();
+            munmap((void *)hdr, size);
+            VRET(0);
+        }
+    }
+
+    for (i = 0; i < hdr->num_symbols; i++)
+    {
+        name = &pool[symbols[i].name];
+        add_symbol(name);
+        for (j = symbols[i].first_attr; j < symbols[i].first_attr + symbols[i].num_attrs; j++)
+        {
+            add_symbol_attr(name, attrs[j].type, (void *)&data[attrs[j].offset], attrs[j].size);
+            // the functions of the module can be overloaded like the ones that are parsed
+            if (attrs[j].type == FUNC_SIGNATURE_ATTR)
+                add_overload(name, intern_signature(&data[attrs[j].offset]));
+        }
+    }
+
+    pop_module();
+    munmap((void *)hdr, size);
+    VRET(1);
+}
@@ -0,0 +1,12 @@
+#ifndef _INTERFACE_H_
+#define _INTERFACE_H_
+
+#include "modules.h"
+
+void set_interface_files(int flag);
+int interface_files_enabled(void);
+int load_interface(module_t *mod);
+int interface_imports(const char *fname, void (*func)(const char *name, void *arg), void *arg);
+void save_interface(module_t *mod);
+
+#endif /* _INTERFACE_H_ */
@@ -0,0 +1,513 @@
+/*
+    Class layouts.
+
+    A class is stored as scattered symbols, one for the class and one for
+    each of its members under the context of the class, as in @@shape@x and
+    @@shape@area(float)(float). Finding a member by name that way means
+    building the decorated name under the class, and then under every class
+    that it inherits, and probing the symbol table for each one.
+
+    The layout of a class is made the first time that it is asked for and
+    then it is kept. It lists every class that the class inherits, directly
+    or not, and every member that can be reached through the class, with an
+    index from the key of a member to its place in the list. Each layout
+    also has a number of its own and a set of the numbers of the classes
+    that it inherits, so whether a class inherits another one is one test
+    of a bit. The key of a
+    field is its name and the key of a method is its name and its inputs,
+    as in area(float), which is what a call knows. Fields get offsets in an
+    object, the inherited ones first, and methods get slots in a method
+    table. A method that overrides an inherited one takes its slot. A member
+    that is inherited through more than one base is taken from the first.
+
+    The classes that a class inherits and the names of its own members are
+    attributes of the class symbol, so a layout is made the same way when
+    the class was loaded from an interface file. When the symbol of a class
+    is invalidated, its layout and the layouts of the classes that inherit
+    it are made again the next time that they are needed. A layout keeps its
+    place, so a pointer to it stays good and its version tells whether it
+    was made again. The inline caches of the VM keep pointers to layouts
+    with the slots that they found in them, so those are forgotten when a
+    layout is invalidated. See class_def.c, symbols.c and vm.c.
+
+    A layout also names the imported module that defines its class. The
+    methods of the class are compiled into the program of that module, so
+    that is where a call finds them.
+*/
+#define LOG_MODULE LOG_MOD_SYMBOLS
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "logging.h"
+#include "errors.h"
+#include "hash_table.h"
+#include "buffer.h"
+#include "symbols.h"
+#include "sym_attrs.h"
+#include "context.h"
+#include "modules.h"
+#include "bytecode.h"
+#include "codegen.h"
+#include "layout.h"
+
+// each thread compiles with its own layouts
+static _Thread_local ht_handle_t layouts = NULL;
+static _Thread_local buffer_t found; // the last class that find_class() found
+static _Thread_local uint32_t num_layouts = 0;
+
+void init_layouts(void)
+{
+    layouts = create_hash_table(127);
+    num_layouts = 0;
+}
+
+static void free_member(class_member_t *m)
+{
+    free(m->name);
+    free(m->sym);
+    free(m->complex);
+}
+
+static void free_members(class_layout_t *layout)
+{
+    int i;
+
+    for (i = 0; i < layout->num_members; i++)
+        free_member(&layout->members[i]);
+    free(layout->members);
+    free(layout->methods);
+    free(layout->bases);
+    free(layout->base_set);
+    if (layout->index != NULL)
+        destroy_hash_table(layout->index);
+    layout->members = NULL;
+    layout->methods = NULL;
+    layout->bases = NULL;
+    layout->base_set = NULL;
+    layout->base_words = 0;
+    layout->index = NULL;
+    layout->num_members = layout->num_methods = layout->num_bases = 0;
+    layout->size = 0;
+}
+
+static void free_layout(const char *key, void *data, void *arg)
+{
+    class_layout_t *layout = (class_layout_t *)data;
+
+    (void)key;
+    (void)arg;
+    free_members(layout);
+    free(layout->module);
+    free(layout->name);
+    free(layout);
+}
+
+void destroy_layouts(void)
+{
+    ENTER();
+    hash_foreach(layouts, free_layout, NULL);
+    destroy_hash_table(layouts);
+    layouts = NULL;
+    buffer_free(&found);
+    RET();
+}
+
+static int is_class(const char *sym)
+{
+    const sym_attr_val_t *type = get_symbol_attr(sym, SYMBOL_TYPE_ATTR);
+
+    return type != NULL && *type == CLASS_SYMBOL;
+}
+
+/*
+    The key of a member is its name up to the end of its inputs.
+*/
+static char *member_key(const char *name)
+{
+    const char *end = strchr(name, ')');
+    char *key;
+
+    if (NULL == (key = strndup(name, (end == NULL) ? strlen(name) : (size_t)(end - name + 1))))
+        FATAL("cannot allocate memory for a member key");
+    return key;
+}
+
+static char *copy_str(const char *str)
+{
+    char *copy;
+
+    if (str == NULL)
+        return NULL;
+    if (NULL == (copy = strdup(str)))
+        FATAL("cannot allocate memory for a class member");
+    return copy;
+}
+
+static void copy_member(class_member_t *dst, const class_member_t *src)
+{
+    *dst = *src;
+    dst->name = copy_str(src->name);
+    dst->sym = copy_str(src->sym);
+    dst->complex = copy_str(src->complex);
+}
+
+/*
+    Add a member to the layout. An inherited member is left out if the
+    layout already has one with the same key, and a member of the class
+    itself takes the place of the inherited one.
+*/
+static void add_member(class_layout_t *layout, const class_member_t *m, int own)
+{
+    class_member_t *dst;
+    char *key = member_key(m->name);
+    uintptr_t n = (uintptr_t)hash_find(layout->index, key);
+    uint32_t slot;
+
+    if (n != 0)
+    {
+        dst = &layout->members[n - 1];
+        if (own && dst->owner != layout)
+        {
+            DEBUG(5, "%s overrides %s", m->sym, dst->sym);
+            slot = dst->slot;
+            free_member(dst);
+            copy_member(dst, m);
+            dst->slot = slot;
+        }
+        free(key);
+        return;
+    }
+
+    dst = &layout->members[layout->num_members];
+    copy_member(dst, m);
+    if (m->kind == FUNC_SYMBOL)
+    {
+        dst->slot = layout->num_methods;
+        layout->methods[layout->num_methods++] = layout->num_members;
+    }
+    else
+    {
+        dst->slot = layout->size;
+        layout->size += sizeof(vm_value_t);
+    }
+    layout->num_members++;
+    hash_save(layout->index, key, (void *)(uintptr_t)layout->num_members);
+    free(key);
+}
+
+static void add_base(class_layout_t *layout, class_layout_t *base)
+{
+    if (class_inherits(layout, base))
+        return;
+    layout->base_set[base->id / 64] |= (uint64_t)1 << (base->id % 64);
+    layout->bases[layout->num_bases++] = base;
+}
+
+/*
+    Read a member of the class from its symbol. Returns 0 if the symbol is
+    not defined.
+*/
+static int own_member(const class_layout_t *layout, const char *name, buffer_t *sym, class_member_t *m)
+{
+    const sym_attr_val_t *val;
+
+    sym->len = 0;
+    buffer_add(sym, layout->name, strlen(layout->name));
+    buffer_add(sym, "@", 1);
+    buffer_add(sym, name, strlen(name) + 1);
+    if (NULL == (val = get_symbol_attr(sym->buf, SYMBOL_TYPE_ATTR)))
+        return 0;
+
+    memset(m, 0, sizeof(*m));
+    m->name = (char *)name;
+    m->sym = sym->buf;
+    m->owner = layout;
+    m->kind = *val;
+    m->scope = (NULL == (val = get_symbol_attr(sym->buf, SYMBOL_SCOPE_ATTR))) ? PRIVATE_SCOPE : *val;
+    if (m->kind != FUNC_SYMBOL)
+    {
+        m->type = (NULL == (val = get_symbol_attr(sym->buf, SYM_TYPEOF_ATTR))) ? TYPEOF_INT : *val;
+        m->complex = get_symbol_attr(sym->buf, COMPLEX_TYPEOF_ATTR);
+    }
+    return 1;
+}
+
+/*
+    Return the imported module that defines the class, from the @@name
+    context that the class is in, or NULL if the class is in the file that
+    is compiled.
+*/
+static char *class_module(const char *cls)
+{
+    const module_t *mod;
+    const char *end;
+    char *name;
+
+    if (strncmp(cls, "@@", 2) || NULL == (end = strchr(cls + 2, '@')))
+        return NULL;
+    if (NULL == (name = strndup(cls + 2, end - cls - 2)))
+        FATAL("cannot allocate memory for a class layout");
+    if (NULL == (mod = find_module(name)) || mod->root)
+    {
+        free(name);
+        return NULL;
+    }
+    return name;
+}
+
+static class_layout_t *layout_of(const char *cls);
+
+/*
+    Make the layout of a class from the layouts of the classes that it
+    inherits and its own members. Returns 0 if it is not a class.
+*/
+static int make_layout(class_layout_t *layout)
+{
+    const char *bases, *members, *ptr;
+    unsigned int bases_size, members_size;
+    class_layout_t **direct = NULL;
+    class_member_t m;
+    buffer_t sym = {0};
+    uint32_t words = 0;
+    int i, j, num_direct = 0, max_bases = 0, max_members = 0;
+
+    free_members(layout);
+    if (!is_class(layout->name))
+        return 0;
+
+    layout->building = 1;
+    free(layout->module);
+    layout->module = class_module(layout->name);
+    bases = get_symbol_attr(layout->name, CLASS_BASES_ATTR);
+    bases_size = get_symbol_attr_size(layout->name, CLASS_BASES_ATTR);
+    members = get_symbol_attr(layout->name, CLASS_MEMBERS_ATTR);
+    members_size = get_symbol_attr_size(layout->name, CLASS_MEMBERS_ATTR);
+
+    for (ptr = bases; ptr != NULL && ptr < bases + bases_size; ptr += strlen(ptr) + 1)
+        max_bases++;
+    if (max_bases > 0 && NULL == (direct = calloc(max_bases, sizeof(class_layout_t *))))
+        FATAL("cannot allocate memory for a class layout");
+    for (ptr = bases; ptr != NULL && ptr < bases + bases_size; ptr += strlen(ptr) + 1)
+    {
+        if (NULL == (direct[num_direct] = layout_of(ptr)))
+            continue;
+        max_bases += direct[num_direct]->num_bases;
+        max_members += direct[num_direct]->num_members;
+        // the set has room for the base and for the classes that it inherits
+        if (words <= direct[num_direct]->id / 64)
+            words = direct[num_direct]->id / 64 + 1;
+        if (words < direct[num_direct]->base_words)
+            words = direct[num_direct]->base_words;
+        num_direct++;
+    }
+    for (ptr = members; ptr != NULL && ptr < members + members_size; ptr += strlen(ptr) + 1)
+        max_members++;
+
+    layout->index = create_hash_table(31);
+    if ((max_bases > 0 && NULL == (layout->bases = calloc(max_bases, sizeof(class_layout_t *)))) ||
+        (words > 0 && NULL == (layout->base_set = calloc(words, sizeof(uint64_t)))) ||
+        (max_members > 0 && (NULL == (layout->members = calloc(max_members, sizeof(class_member_t))) ||
+                             NULL == (layout->methods = calloc(max_members, sizeof(uint32_t))))))
+        FATAL("cannot allocate memory for a class layout");
+    layout->base_words = words;
+
+    for (i = 0; i < num_direct; i++)
+    {
+        add_base(layout, direct[i]);
+        for (j = 0; j < direct[i]->num_bases; j++)
+            add_base(layout, direct[i]->bases[j]);
+        for (j = 0; j < direct[i]->num_members; j++)
+            add_member(layout, &direct[i]->members[j], 0);
+    }
+    for (ptr = members; ptr != NULL && ptr < members + members_size; ptr += strlen(ptr) + 1)
+        if (own_member(layout, ptr, &sym, &m))
+            add_member(layout, &m, 1);
+
+    free(direct);
+    buffer_free(&sym);
+    layout->building = 0;
+    layout->version++;
+    INFO("layout of %s: %d bases, %d fields in %u bytes, %d methods", layout->name, layout->num_bases,
+         layout->num_members - layout->num_methods, layout->size, layout->num_methods);
+    return 1;
+}
+
+static class_layout_t *layout_of(const char *cls)
+{
+    class_layout_t *layout;
+
+    if (NULL == (layout = hash_find(layouts, cls)))
+    {
+        if (NULL == (layout = calloc(1, sizeof(class_layout_t))) || NULL == (layout->name = strdup(cls)))
+            FATAL("cannot allocate memory for a class layout");
+        layout->id = num_layouts++;
+        hash_save(layouts, cls, layout);
+    }
+    else if (layout->building)
+    {
+        // a class that was defined twice can inherit itself
+        ERROR("class %s inherits itself", cls);
+        return NULL;
+    }
+
+    if (!layout->valid)
+        layout->valid = make_layout(layout);
+    return layout->valid ? layout : NULL;
+}
+
+/*
+    Return the layout of the class, or NULL if it is not a class.
+*/
+const class_layout_t *get_class_layout(const char *cls)
+{
+    return layout_of(cls);
+}
+
+/*
+    Return the member of the class that has the key, or NULL.
+*/
+const class_member_t *find_member(const class_layout_t *layout, const char *key)
+{
+    uintptr_t n = (uintptr_t)hash_find(layout->index, key);
+
+    return (n == 0) ? NULL : &layout->members[n - 1];
+}
+
+/*
+    Return the member that the class inherits with the key, or NULL. This
+    works while the class is being parsed, since only the classes that it
+    inherits have to be complete.
+*/
+const class_member_t *find_inherited(const char *cls, const char *key)
+{
+    const class_layout_t *base;
+    const class_member_t *m;
+    const char *bases, *ptr;
+    unsigned int size;
+
+    bases = get_symbol_attr(cls, CLASS_BASES_ATTR);
+    size = get_symbol_attr_size(cls, CLASS_BASES_ATTR);
+    for (ptr = bases; ptr != NULL && ptr < bases + size; ptr += strlen(ptr) + 1)
+        if (NULL != (base = layout_of(ptr)) && NULL != (m = find_member(base, key)))
+            return m;
+    return NULL;
+}
+
+/*
+    Whether the class inherits the base, directly or not.
+*/
+int class_inherits(const class_layout_t *layout, const class_layout_t *base)
+{
+    return base->id / 64 < layout->base_words && (layout->base_set[base->id / 64] >> (base->id % 64) & 1);
+}
+
+static int try_class(const char *ctx, size_t len, const char *name)
+{
+    const char *ch;
+
+    found.len = 0;
+    buffer_add(&found, ctx, len);
+    for (ch = name; *ch != 0; ch++)
+    {
+        buffer_add(&found, "@", 1);
+        len = strcspn(ch, ".");
+        buffer_add(&found, ch, len);
+        if (ch[len] == 0)
+            break;
+        ch += len;
+    }
+    buffer_add(&found, "", 1);
+    return is_class(found.buf);
+}
+
+/*
+    Look for the class in the context of len characters and in the
+    contexts that it is in, out to top.
+*/
+static const char *find_class_in(const char *ctx, size_t len, size_t top, const char *name)
+{
+    for (;;)
+    {
+        if (try_class(ctx, len, name))
+            return found.buf;
+        if (len <= top)
+            break;
+        while (len > 1 && ctx[--len] != '@')
+            ;
+    }
+
+    if (strchr(name, '.') != NULL && try_class("@", 1, name))
+        return found.buf;
+    return NULL;
+}
+
+/*
+    Return the class symbol that the name refers to in the current context,
+    or NULL. The name is looked for in the contexts that the current one is
+    in, out to the top of the module, and a name with a '.' in it can start
+    with the name of a module, as in geo.point. The string is good until the
+    next call.
+*/
+const char *find_class(const char *name)
+{
+    const module_t *mod = current_module();
+    const char *ctx = get_context();
+
+    // the module is in @ or in @@name
+    return find_class_in(ctx, strlen(ctx), (mod == NULL || mod->root) ? 1 : strlen(mod->name) + 2, name);
+}
+
+/*
+    Return the layout of a complex type, as it is written in a variable or
+    a signature. The name is found from the class that has the variable or
+    the function, or from the current context if that is NULL.
+*/
+const class_layout_t *get_complex_type(const char *complex, const class_layout_t *from)
+{
+    const char *cls;
+    size_t len;
+
+    if (from == NULL)
+        cls = find_class(complex);
+    else
+    {
+        // the module that the class is in, as @ or @@name
+        len = strrchr(from->name, '@') - from->name;
+        len = (len < 1) ? 1 : len;
+        cls = find_class_in(from->name, len, len, complex);
+    }
+    return (cls == NULL) ? NULL : layout_of(cls);
+}
+
+static void invalidate_derived(const char *key, void *data, void *arg)
+{
+    class_layout_t *layout = (class_layout_t *)data;
+
+    (void)key;
+    if (layout->valid && class_inherits(layout, (const class_layout_t *)arg))
+    {
+        DEBUG(5, "layout of %s is invalid", layout->name);
+        layout->valid = 0;
+        forget_class_caches(layout);
+    }
+}
+
+/*
+    The class is being defined again or taken out. Its layout and the
+    layouts of the classes that inherit it are made again when they are
+    needed.
+*/
+void invalidate_layout(const char *cls)
+{
+    class_layout_t *layout;
+
+    if (layouts == NULL || NULL == (layout = hash_find(layouts, cls)) || !layout->valid)
+        return;
+
+    DEBUG(5, "layout of %s is invalid", cls);
+    layout->valid = 0;
+    forget_class_caches(layout);
+    hash_foreach(layouts, invalidate_derived, layout);
+}
@@ -0,0 +1,63 @@
+#ifndef _LAYOUT_H_
+#define _LAYOUT_H_
+
+#include <stdint.h>
+
+#include "hash_table.h"
+#include "sym_attrs.h"
+
+struct class_layout_t;
+
+/*
+    A field or a method that can be reached through a class, whether the
+    class defines it or inherits it. The slot of a field is its offset in
+    an object, and the slot of a method is its index in the method table.
+*/
+typedef struct
+{
+    char *name;    // the name in the class, as x or area(float)(float)
+    char *sym;     // the symbol that defines it
+    char *complex; // the name of a complex type, or NULL
+    const struct class_layout_t *owner; // the class that defines it
+    sym_attr_val_t kind;  // CLASS_VAR_SYMBOL or FUNC_SYMBOL
+    sym_attr_val_t type;  // the type of a field
+    sym_attr_val_t scope;
+    uint32_t slot;
+} class_member_t;
+
+/*
+    A class with everything that it inherits flattened into it. A layout
+    keeps its place when its class is defined again, and version counts
+    the times that it was made.
+*/
+typedef struct class_layout_t
+{
+    char *name;
+    char *module; // the module that defines the class, or NULL for the file
+    int valid;
+    int building;
+    uint32_t version;
+    uint32_t id;                   // the bit of the class in the base sets
+    struct class_layout_t **bases; // every class that it inherits, nearest first
+    int num_bases;
+    uint64_t *base_set;            // the bits of the classes that it inherits
+    uint32_t base_words;
+    class_member_t *members;       // inherited members first
+    int num_members;
+    uint32_t *methods;             // the member of each method slot
+    int num_methods;
+    uint32_t size;                 // of an object, in bytes
+    ht_handle_t index;             // the member of each key, plus one
+} class_layout_t;
+
+void init_layouts(void);
+void destroy_layouts(void);
+const char *find_class(const char *name);
+const class_layout_t *get_class_layout(const char *cls);
+const class_layout_t *get_complex_type(const char *complex, const class_layout_t *from);
+const class_member_t *find_member(const class_layout_t *layout, const char *key);
+const class_member_t *find_inherited(const char *cls, const char *key);
+int class_inherits(const class_layout_t *layout, const class_layout_t *base);
+void invalidate_layout(const char *cls);
+
+#endif /* _LAYOUT_H_ */
@@ -0,0 +1,174 @@
+/*
+    Table driven LL(1) parser.
+
+    The grammar is in toi.grammar and gen_tables turns it into the tables
+    in parse_tables.c. The parser keeps a stack of the symbols that are
+    still to be matched. A rule on top of the stack is replaced by the
+    production that the table gives for the next token, a token on top is
+    matched with the next token and an action on top is called. Nothing is
+    recursive, so the depth of the input does not matter.
+
+    A token is only read when it matches, so when there is a syntax error
+    the bad token is still the next one, as recover() wants it. The stack
+    is searched from the top for a rule with a %recover in the grammar:
+
+    A retry rule is still on the stack while the parser is in it, because
+    it is a list that ends with itself. After recover() it is parsed again
+    from the token that recover() stopped at, if that token can start it or
+    follow it. If it cannot, the search carries on down the stack.
+
+    A skip rule pushes a mark under its production. After recover() the
+    stack is popped down past the mark, so the rest of the rule is skipped.
+
+    If there is no rule to recover in, the parser returns and the caller
+    carries on from the bad token.
+
+    An action can parse more of the input itself, as the expressions are.
+    If it reports a syntax error, the parser recovers in the same way.
+
+    Every open block of statements leaves the rest of the blocks around it
+    on the stack, so the stack grows when it is full.
+*/
+#define LOG_MODULE LOG_MOD_PARSER
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "logging.h"
+#include "errors.h"
+#include "scanner.h"
+#include "parse.h"
+#include "ll_parse.h"
+
+#define PARSE_STACK_SIZE 256
+
+// a symbol and the message for it when it is not found
+#define STACK_ENTRY(sym, msg) ((uint32_t)(sym) | ((uint32_t)(msg) << 16))
+#define ENTRY_SYM(ent) ((int)((ent) & 0xffff))
+#define ENTRY_MSG(ent) ((int)((ent) >> 16))
+
+static inline int predict(int nt, token_t tok)
+{
+    if (tok > FIRST_TOK && tok < LAST_TOKEN && parse_table[nt][tok - FIRST_TOK] != 0)
+        return parse_table[nt][tok - FIRST_TOK];
+    return nonterm_info[nt].deflt;
+}
+
+static void report(uint32_t ent, token_t tok)
+{
+    int sym = ENTRY_SYM(ent);
+
+    if (sym >= FIRST_TOK)
+    {
+        if (ENTRY_MSG(ent) != 0)
+            syntax("expected %s but got %s", parse_msgs[ENTRY_MSG(ent)], token_to_msg(tok));
+        else
+            expect_token(sym, tok, NULL);
+    }
+    else if (nonterm_info[sym].msg != NULL)
+        syntax("expected %s but got %s", nonterm_info[sym].msg, token_to_msg(tok));
+    else
+        syntax("expected %s but got %s", nonterm_info[sym].name, token_to_msg(tok));
+}
+
+/*
+    Find where to carry on after a syntax error. Returns the new depth of
+    the stack.
+*/
+static int unwind(const uint32_t *stack, int sp)
+{
+    int i, sym;
+
+    ENTER();
+    for (i = sp - 1; i >= 0; i--)
+    {
+        sym = ENTRY_SYM(stack[i]);
+        if (sym < SYM_MARK && nonterm_info[sym].mode == RECOVER_RETRY)
+        {
+            recover(nonterm_info[sym].where);
+            if (predict(sym, peek_token()) != 0)
+                VRET(i + 1);
+        }
+        else if (sym >= SYM_MARK && sym < SYM_ACTION)
+        {
+            recover(nonterm_info[sym - SYM_MARK].where);
+            VRET(i);
+        }
+    }
+    VRET(0);
+}
+
+static uint32_t *grow_stack(uint32_t *stack, const uint32_t *first, int *size)
+{
+    uint32_t *new_stack;
+
+    if (NULL == (new_stack = malloc(*size * 2 * sizeof(uint32_t))))
+        FATAL("cannot allocate memory for the parse stack");
+    memcpy(new_stack, stack, *size * sizeof(uint32_t));
+    if (stack != first)
+        free(stack);
+    *size *= 2;
+    return new_stack;
+}
+
+/*
+    Parse the input from the rule.
+*/
+void ll_parse(nonterm_t start)
+{
+    uint32_t first[PARSE_STACK_SIZE];
+    uint32_t *stack = first;
+    int size = PARSE_STACK_SIZE, sp = 0, sym, prod, i, errors;
+    token_t tok;
+
+    ENTER();
+    stack[sp++] = STACK_ENTRY(start, 0);
+    while (sp > 0 && !too_many_errors())
+    {
+        sym = ENTRY_SYM(stack[sp - 1]);
+        if (sym >= FIRST_TOK)
+        {
+            if ((tok = peek_token()) == (token_t)sym)
+            {
+                get_token();
+                sp--;
+                continue;
+            }
+        }
+        else if (sym >= SYM_ACTION)
+        {
+            sp--;
+            errors = error_count();
+            parse_actions[sym - SYM_ACTION]();
+            // the action found a syntax error and left the bad token
+            if (error_count() != errors)
+                sp = unwind(stack, sp);
+            continue;
+        }
+        else if (sym >= SYM_MARK)
+        {
+            sp--;
+            continue;
+        }
+        else if (0 != (prod = predict(sym, (tok = peek_token()))))
+        {
+            DEBUG(8, "parsing %s", nonterm_info[sym].name);
+            prod--;
+            sp--;
+            while (sp + 1 + prod_start[prod + 1] - prod_start[prod] > size)
+                stack = grow_stack(stack, first, &size);
+            if (nonterm_info[sym].mode == RECOVER_SKIP)
+                stack[sp++] = STACK_ENTRY(SYM_MARK + sym, 0);
+            for (i = prod_start[prod + 1] - 1; i >= prod_start[prod]; i--)
+                stack[sp++] = STACK_ENTRY(prod_syms[i], prod_msgs[i]);
+            continue;
+        }
+
+        report(stack[sp - 1], tok);
+        sp = unwind(stack, sp);
+    }
+    if (stack != first)
+        free(stack);
+    RET();
+}
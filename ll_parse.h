@@ -0,0 +1,46 @@
+#ifndef _LL_PARSE_H_
+#define _LL_PARSE_H_
+
+#include <stdint.h>
+
+#include "scanner.h"
+#include "parse.h"
+#include "parse_tables.h"
+
+/*
+    The symbols in the productions. A rule is its nonterm_t, a token is its
+    token_t and an action is SYM_ACTION plus its action_t. SYM_MARK plus a
+    rule marks where a rule that is skipped on an error ends.
+*/
+#define SYM_MARK 500
+#define SYM_ACTION 1000
+#define NUM_TABLE_TOKENS (LAST_TOKEN - FIRST_TOK)
+
+typedef enum
+{
+    RECOVER_NONE,
+    RECOVER_RETRY, // parse the rule again after recover()
+    RECOVER_SKIP,  // give up on the rule after recover()
+} recover_mode_t;
+
+typedef struct
+{
+    const char *name;
+    const char *msg;     // what is expected, or NULL
+    uint8_t mode;        // a recover_mode_t
+    uint8_t where;       // a recover_t
+    uint8_t deflt;       // the production to use for any token, plus one
+} nonterm_info_t;
+
+// generated from toi.grammar by gen_tables
+extern const uint8_t parse_table[NUM_NONTERMS][NUM_TABLE_TOKENS];
+extern const int16_t prod_syms[];
+extern const uint8_t prod_msgs[];
+extern const uint16_t prod_start[];
+extern const char *const parse_msgs[];
+extern const nonterm_info_t nonterm_info[NUM_NONTERMS];
+extern void (*const parse_actions[NUM_ACTIONS])(void);
+
+void ll_parse(nonterm_t start);
+
+#endif /* _LL_PARSE_H_ */
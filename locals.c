@@ -0,0 +1,202 @@
+/*
+    Local variables.
+
+    The parameters and the local variables of a function are kept in a
+    scratch table of their own instead of the global symbol table. Nothing
+    outside of the function can see them, so they are not named in a
+    context and they are not saved in the interface of the module.
+
+    A local is an index in an array, and the names are in one string
+    buffer. The locals of a scope are always the last ones in the array,
+    so closing a scope drops them by cutting the array and the strings
+    back to where the scope started. The whole table is dropped at the
+    end of the function without freeing anything, and the memory is used
+    again for the next function. The index of a local is where it is in
+    the frame of the function, and max_locals() is the size of the frame.
+
+    A name is found through a small hash table of buckets, each of which
+    is the last local added with that hash. The locals in a bucket are
+    linked from the newest to the oldest, so the innermost local with the
+    name is found first, and a local that is dropped is always the head
+    of its bucket.
+*/
+#define LOG_MODULE LOG_MOD_SYMBOLS
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "logging.h"
+#include "hash_table.h"
+#include "buffer.h"
+#include "locals.h"
+
+#define LOCAL_BUCKETS 256 // a power of 2
+
+typedef struct
+{
+    uint32_t first; // the first local in the scope
+    int flags;
+} scope_t;
+
+typedef struct
+{
+    buffer_t locals; // local_t
+    buffer_t strs;
+    buffer_t scopes; // scope_t
+    int32_t buckets[LOCAL_BUCKETS];
+    int max;
+} locals_state_t;
+
+// each thread compiles with its own locals
+static _Thread_local locals_state_t loc;
+
+#define NUM_LOCALS() ((int)(loc.locals.len / sizeof(local_t)))
+#define LOCAL(i) (&((local_t *)loc.locals.buf)[i])
+#define NUM_SCOPES() ((int)(loc.scopes.len / sizeof(scope_t)))
+#define TOP_SCOPE() (&((scope_t *)loc.scopes.buf)[NUM_SCOPES() - 1])
+
+/*
+    Start the locals of a function. The parameters are in the first scope.
+*/
+void begin_locals(void)
+{
+    ENTER();
+    end_locals();
+    open_local_scope(0);
+    RET();
+}
+
+void end_locals(void)
+{
+    ENTER();
+    loc.locals.len = loc.strs.len = loc.scopes.len = 0;
+    memset(loc.buckets, 0xff, sizeof(loc.buckets));
+    loc.max = 0;
+    RET();
+}
+
+void destroy_locals(void)
+{
+    ENTER();
+    buffer_free(&loc.locals);
+    buffer_free(&loc.strs);
+    buffer_free(&loc.scopes);
+    RET();
+}
+
+void open_local_scope(int flags)
+{
+    scope_t scope;
+
+    scope.first = NUM_LOCALS();
+    scope.flags = flags;
+    if (NUM_SCOPES() > 0)
+        scope.flags |= TOP_SCOPE()->flags;
+    buffer_add(&loc.scopes, &scope, sizeof(scope));
+}
+
+void close_local_scope(void)
+{
+    int i;
+
+    if (NUM_SCOPES() == 0)
+    {
+        INTERNAL("there is no scope of locals to close");
+        return;
+    }
+
+    i = NUM_LOCALS();
+    if ((uint32_t)i > TOP_SCOPE()->first)
+    {
+        for (i--; i >= (int)TOP_SCOPE()->first; i--)
+            loc.buckets[LOCAL(i)->hash & (LOCAL_BUCKETS - 1)] = LOCAL(i)->next;
+        loc.strs.len = LOCAL(TOP_SCOPE()->first)->name;
+        loc.locals.len = TOP_SCOPE()->first * sizeof(local_t);
+    }
+    loc.scopes.len -= sizeof(scope_t);
+}
+
+int local_scope_flags(void)
+{
+    return (NUM_SCOPES() > 0) ? TOP_SCOPE()->flags : 0;
+}
+
+static int find(const char *name, uint32_t hash)
+{
+    int i;
+
+    for (i = loc.buckets[hash & (LOCAL_BUCKETS - 1)]; i >= 0; i = LOCAL(i)->next)
+        if (LOCAL(i)->hash == hash && !strcmp(&loc.strs.buf[LOCAL(i)->name], name))
+            return i;
+    return -1;
+}
+
+/*
+    Add a local to the innermost scope. Returns its index, or -1 if there
+    is already a local with the name in the scope. A local in an outer
+    scope is hidden by it.
+*/
+int add_local(const char *name, sym_attr_val_t type, const char *complex)
+{
+    local_t local;
+    int i;
+
+    if (NUM_SCOPES() == 0)
+    {
+        INTERNAL("local %s is not in a function", name);
+        return -1;
+    }
+
+    local.hash = make_hash(name);
+    if ((i = find(name, local.hash)) >= 0 && (uint32_t)i >= TOP_SCOPE()->first)
+        return -1;
+
+    local.name = loc.strs.len;
+    buffer_add(&loc.strs, name, strlen(name) + 1);
+    local.type = type;
+    local.complex = loc.strs.len;
+    if (type == TYPEOF_COMPLEX && complex != NULL)
+        buffer_add(&loc.strs, complex, strlen(complex) + 1);
+    else
+        buffer_add(&loc.strs, "", 1);
+    local.next = loc.buckets[local.hash & (LOCAL_BUCKETS - 1)];
+
+    i = NUM_LOCALS();
+    loc.buckets[local.hash & (LOCAL_BUCKETS - 1)] = i;
+    buffer_add(&loc.locals, &local, sizeof(local));
+    if (i + 1 > loc.max)
+        loc.max = i + 1;
+    DEBUG(5, "local %s is %d", name, i);
+    return i;
+}
+
+/*
+    Returns the index of the innermost local with the name, or -1.
+*/
+int lookup_local(const char *name)
+{
+    if (NUM_SCOPES() == 0)
+        return -1;
+    return find(name, make_hash(name));
+}
+
+const local_t *get_local(int index)
+{
+    return LOCAL(index);
+}
+
+const char *local_str(uint32_t offset)
+{
+    return &loc.strs.buf[offset];
+}
+
+int num_locals(void)
+{
+    return NUM_LOCALS();
+}
+
+int max_locals(void)
+{
+    return loc.max;
+}
@@ -0,0 +1,37 @@
+#ifndef _LOCALS_H_
+#define _LOCALS_H_
+
+#include <stdint.h>
+
+#include "sym_attrs.h"
+
+/*
+    What can be done in a scope of local variables. A scope has the flags
+    of the scopes that it is in as well as its own.
+*/
+#define SCOPE_BREAK 0x01    // in a loop or a case
+#define SCOPE_CONTINUE 0x02 // in a loop
+
+typedef struct
+{
+    uint32_t name;    // the offset of the name in the strings of the locals
+    uint32_t hash;
+    int32_t next;     // the local before it in the same bucket, or -1
+    sym_attr_val_t type;
+    uint32_t complex; // the offset of the name of a complex type
+} local_t;
+
+void begin_locals(void);
+void end_locals(void);
+void destroy_locals(void);
+void open_local_scope(int flags);
+void close_local_scope(void);
+int local_scope_flags(void);
+int add_local(const char *name, sym_attr_val_t type, const char *complex);
+int lookup_local(const char *name);
+const local_t *get_local(int index);
+const char *local_str(uint32_t offset);
+int num_locals(void);
+int max_locals(void);
+
+#endif /* _LOCALS_H_ */
@@ -0,0 +1,35 @@
+/*
+    toi-logdump: print a log that was written with LOG_BINARY as the text
+    that the compiler would have written. See logging.c.
+
+    usage: toi-logdump [file...]
+
+    The log is read from stdin if no file is given.
+*/
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+
+#include "logging.h"
+
+int main(int argc, char **argv)
+{
+    FILE *fp;
+    int i, status = 0;
+
+    if (argc < 2)
+        return dump_binary_log(stdin, stdout);
+
+    for (i = 1; i < argc; i++)
+    {
+        if (NULL == (fp = fopen(argv[i], "rb")))
+        {
+            fprintf(stderr, "%s: cannot open %s: %s\n", argv[0], argv[i], strerror(errno));
+            status = 1;
+            continue;
+        }
+        status |= dump_binary_log(fp, stdout);
+        fclose(fp);
+    }
+    return status;
+}
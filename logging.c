@@ -6,12 +6,95 @@
 #include <stdint.h>
 #include <errno.h>
 #include <time.h>
+#include <sched.h>
+#include <stddef.h>
+#include <stdatomic.h>
+#include <pthread.h>
 #include "logging.h"
 
-// TODO: add the ability to push and pop debug levels.
+/*
+    With LOG_ASYNC, show_msg() does not format or write anything. It copies
+    the arguments into a record in a ring buffer and a background thread
+    formats and writes the records in order. The ring buffer is a bounded
+    queue with a sequence number in every slot (see Dmitry Vyukov's bounded
+    MPMC queue), so any number of threads can add records without a lock.
+    If the ring is full, the caller waits for room rather than losing a
+    message.
+
+    The arguments are found by reading the format, the same way that printf
+    does. Strings are copied into the record because they could be freed
+    before the record is written, and long ones are cut short. The format,
+    the function name and the strings in type_strs[] are not copied because
+    they are string literals.
+
+    Messages that end the program, and diagnostics printed by errors.c, wait
+    for the records before them to be written with flush_logging() so that
+    the output is in the same order as it is without LOG_ASYNC.
+
+    With LOG_BINARY, the log file is written as records that are not
+    formatted at all and toi-logdump turns them back into text. The first
+    time that a call site writes a message, a site record with the type,
+    function, line and format is written and given a number. After that, a
+    message is the number of its site, a monotonic time stamp and the
+    arguments saved the same way as for LOG_ASYNC. See logdump.c. The
+    messages to stdout and stderr are still text. When the binary log is the
+    only output, the warnings and errors are also written to stderr as text
+    so that they are not lost in the file.
+*/
+#define RING_SIZE 4096 // must be a power of two
+#define RECORD_SIZE 512
+
+typedef struct
+{
+    atomic_size_t seq;
+    typelog_t type;
+    int line;
+    const char *func;
+    const char *fmt;
+    struct timespec when;
+    uint64_t ts; // monotonic nanoseconds, for LOG_BINARY
+    size_t len; // bytes of args used
+    char args[RECORD_SIZE];
+} log_record_t;
+
+#define LEVEL_STACK_SIZE 16
+// a level shows its own messages and every level below it
+#define LEVEL_MASK(lev) (((lev) < 0) ? 0u : ((lev) >= 31) ? ~0u : (2u << (lev)) - 1)
 
 static FILE *outfp[4];
-static int debug_level = 0; // no debugging messages
+static FILE *binfp = NULL; // the log file with LOG_BINARY
+static FILE *errfp = NULL; // stderr for the warnings and errors with only LOG_BINARY
+
+// the levels set on the command line, no debugging messages by default
+static unsigned int module_masks[NUM_LOG_MODULES] = {[0 ... NUM_LOG_MODULES - 1] = LEVEL_MASK(0)};
+static const char *module_names[] = {
+    "main",
+    "file_io",
+    "scanner",
+    "hash",
+    "context",
+    "symbols",
+    "parser",
+    "modules",
+    "vm",
+};
+
+// the levels that the thread has pushed, log_masks points to the top one
+static _Thread_local unsigned int level_stack[LEVEL_STACK_SIZE][NUM_LOG_MODULES];
+static _Thread_local int level_index = -1;
+_Thread_local const unsigned int *log_masks = module_masks;
+// messages are written in pieces, so only one thread can write at a time.
+static pthread_mutex_t log_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static int async_logging = 0;
+static log_record_t *ring = NULL;
+static atomic_size_t ring_head; // next record to add
+static atomic_size_t ring_tail; // next record to write
+static atomic_int writer_stop;
+static atomic_int writer_idle;
+static pthread_t writer_thread;
+static pthread_mutex_t writer_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t writer_cond = PTHREAD_COND_INITIALIZER;
 static const char *type_strs[] = {
     "DEBUG", // debug messages appear at level 2
     "ENTER", // enter and return appear at level 5
@@ -27,9 +110,71 @@ static const char *type_strs[] = {
     "FATAL",
 };
 
+/*
+    Set the level of every module. The levels are shared by all threads and
+    should be set before any thread starts.
+*/
 void set_debug_level(int lev)
 {
-    debug_level = lev;
+    int i;
+
+    for (i = 0; i < NUM_LOG_MODULES; i++)
+        module_masks[i] = LEVEL_MASK(lev);
+}
+
+void set_module_level(log_module_t mod, int lev)
+{
+    if (mod == LOG_ALL_MODULES)
+        set_debug_level(lev);
+    else if (mod < NUM_LOG_MODULES)
+        module_masks[mod] = LEVEL_MASK(lev);
+}
+
+/*
+    Return the module with the name or -1 if there is none.
+*/
+int find_log_module(const char *name)
+{
+    int i;
+
+    if (!strcmp(name, "all"))
+        return LOG_ALL_MODULES;
+
+    for (i = 0; i < NUM_LOG_MODULES; i++)
+        if (!strcmp(name, module_names[i]))
+            return i;
+    return -1;
+}
+
+/*
+    Change the level of a module, or of all of them, for this thread until
+    pop_debug_level() is called. Other threads are not affected.
+*/
+void push_debug_level(log_module_t mod, int lev)
+{
+    int i;
+
+    if (level_index >= LEVEL_STACK_SIZE - 1)
+    {
+        show_msg(FATAL, 0, __func__, __LINE__, "debug levels are pushed too deeply");
+        return;
+    }
+
+    level_index++;
+    memcpy(level_stack[level_index], log_masks, sizeof(level_stack[0]));
+    for (i = 0; i < NUM_LOG_MODULES; i++)
+        if (mod == LOG_ALL_MODULES || (int)mod == i)
+            level_stack[level_index][i] = LEVEL_MASK(lev);
+    log_masks = level_stack[level_index];
+}
+
+void pop_debug_level(void)
+{
+    if (level_index < 0)
+        return;
+
+    level_index--;
+    log_masks = (level_index < 0) ? module_masks : level_stack[level_index];
 }
 
 void write_buffer(const char *buffer, size_t blen)
@@ -60,20 +205,36 @@ void write_str(const char *str, ...)
     write_buffer(buffer, strlen(buffer));
 }
 
-void show_verbose_start(int type, const char *func, int line)
+/*
+    The date and time only change once a second, so they are formatted once
+    a second. Only one thread writes at a time.
+*/
+static int verbose_prefix(char *buf, size_t size, int type, const char *func, int line, time_t ti)
 {
+    static char time_str[32];
+    static time_t last_time = -1;
+    struct tm t;
 
-    time_t ti;
-    struct tm *t;
+    if (ti != last_time)
+    {
+        localtime_r(&ti, &t);
+        snprintf(time_str, sizeof(time_str), "[%02d/%02d/%d %02d:%02d:%02d]",
+                 t.tm_mon, t.tm_mday, t.tm_year + 1900,
+                 (t.tm_hour==0)?12:t.tm_hour,
+                 t.tm_min, t.tm_sec);
+        last_time = ti;
+    }
 
-    time(&ti);
-    t = localtime(&ti);
+    return snprintf(buf, size, "%s %s: %s: %d: ", time_str, type_strs[type], func, line);
+}
+
+void show_verbose_start(int type, const char *func, int line)
+{
+    char buffer[1024];
+    int len;
 
-    write_str("[%02d/%02d/%d %02d:%02d:%02d] %s: %s: %d: ",
-              t->tm_mon, t->tm_mday, t->tm_year + 1900,
-              (t->tm_hour==0)?12:t->tm_hour,
-              t->tm_min, t->tm_sec,
-              type_strs[type], func, line);
+    len = verbose_prefix(buffer, sizeof(buffer), type, func, line, time(NULL));
+    write_buffer(buffer, ((size_t)len < sizeof(buffer)) ? (size_t)len : sizeof(buffer) - 1);
 }
 
 void show_start(int type)
@@ -82,52 +243,837 @@ void show_start(int type)
 }
 
 
-void show_msg(typelog_t type, int lev, const char *func, int line, const char *fmt, ...)
+/*
+    The parts of one conversion in a format.
+*/
+typedef enum
 {
+    LEN_NONE,
+    LEN_HH,
+    LEN_H,
+    LEN_L,
+    LEN_LL,
+    LEN_J,
+    LEN_Z,
+    LEN_T,
+    LEN_LD, // L, a long double
+} spec_len_t;
 
-    va_list args;
+typedef struct
+{
+    const char *flags; // the flags, a pointer into the format
+    int num_flags;
+    int has_width;
+    int width_arg; // the width is an argument, '*'
+    int width;
+    int has_prec;
+    int prec_arg;  // the precision is an argument, '*'
+    int prec;
+    spec_len_t len;
+    char conv;
+} spec_t;
 
-    if (type == DEBUG || type == ENTER || type == RETURN)
+/*
+    Read the conversion that starts after a '%'. Returns a pointer to the
+    character after it.
+*/
+static const char *parse_spec(const char *p, spec_t *spec)
+{
+    memset(spec, 0, sizeof(spec_t));
+    spec->flags = p;
+    while (*p != 0 && strchr("-+ #0'", *p) != NULL)
+        p++;
+    spec->num_flags = p - spec->flags;
+
+    if (*p == '*')
+    {
+        spec->has_width = spec->width_arg = 1;
+        p++;
+    }
+    else if (*p >= '0' && *p <= '9')
     {
-        if (lev <= debug_level)
+        spec->has_width = 1;
+        spec->width = strtol(p, (char **)&p, 10);
+    }
+
+    if (*p == '.')
+    {
+        p++;
+        spec->has_prec = 1;
+        if (*p == '*')
         {
-            show_verbose_start(type, func, line);
-            va_start(args, fmt);
-            write_args(fmt, args);
-            va_end(args);
-            write_str("\n");
+            spec->prec_arg = 1;
+            p++;
         }
+        else
+            spec->prec = strtol(p, (char **)&p, 10);
     }
-    else if (type == INTERNAL)
+
+    switch (*p)
     {
-        show_verbose_start(type, func, line);
-        va_start(args, fmt);
-        write_args(fmt, args);
-        va_end(args);
-        write_str("\n");
+    case 'h':
+        spec->len = (p[1] == 'h') ? LEN_HH : LEN_H;
+        p += (p[1] == 'h') ? 2 : 1;
+        break;
+    case 'l':
+        spec->len = (p[1] == 'l') ? LEN_LL : LEN_L;
+        p += (p[1] == 'l') ? 2 : 1;
+        break;
+    case 'j': spec->len = LEN_J; p++; break;
+    case 'z': spec->len = LEN_Z; p++; break;
+    case 't': spec->len = LEN_T; p++; break;
+    case 'L': spec->len = LEN_LD; p++; break;
+    }
+
+    spec->conv = *p;
+    return (*p != 0) ? p + 1 : p;
+}
+
+static int put_arg(log_record_t *rec, const void *data, size_t size)
+{
+    if (rec->len + size > sizeof(rec->args))
+        return 0;
+    memcpy(&rec->args[rec->len], data, size);
+    rec->len += size;
+    return 1;
+}
+
+static int get_arg(log_record_t *rec, size_t *pos, void *data, size_t size)
+{
+    if (*pos + size > rec->len)
+        return 0;
+    memcpy(data, &rec->args[*pos], size);
+    *pos += size;
+    return 1;
+}
+
+/*
+    Copy the arguments for the format into the record. Integers are stored
+    as long long, floating point as double or long double and strings as
+    the characters. Returns 0 if there is no room for them.
+*/
+static int save_args(log_record_t *rec, const char *fmt, va_list args)
+{
+    const char *p, *str;
+    long long ival;
+    long double lval;
+    double dval;
+    void *ptr;
+    size_t len;
+    spec_t spec;
+    int star;
+
+    for (p = fmt; *p != 0;)
+    {
+        if (*p++ != '%')
+            continue;
+        p = parse_spec(p, &spec);
+
+        if (spec.width_arg)
+        {
+            star = va_arg(args, int);
+            if (!put_arg(rec, &star, sizeof(star)))
+                return 0;
+        }
+        if (spec.prec_arg)
+        {
+            star = va_arg(args, int);
+            if (!put_arg(rec, &star, sizeof(star)))
+                return 0;
+        }
+
+        switch (spec.conv)
+        {
+        case 'd': case 'i': case 'u': case 'o': case 'x': case 'X': case 'c':
+            switch (spec.len)
+            {
+            case LEN_L: ival = va_arg(args, long); break;
+            case LEN_LL: ival = va_arg(args, long long); break;
+            case LEN_J: ival = va_arg(args, intmax_t); break;
+            case LEN_Z: ival = va_arg(args, size_t); break;
+            case LEN_T: ival = va_arg(args, ptrdiff_t); break;
+            default: ival = va_arg(args, int); break;
+            }
+            if (!put_arg(rec, &ival, sizeof(ival)))
+                return 0;
+            break;
+        case 'f': case 'F': case 'e': case 'E': case 'g': case 'G': case 'a': case 'A':
+            if (spec.len == LEN_LD)
+            {
+                lval = va_arg(args, long double);
+                if (!put_arg(rec, &lval, sizeof(lval)))
+                    return 0;
+            }
+            else
+            {
+                dval = va_arg(args, double);
+                if (!put_arg(rec, &dval, sizeof(dval)))
+                    return 0;
+            }
+            break;
+        case 's':
+            if (NULL == (str = va_arg(args, const char *)))
+                str = "(null)";
+            // leave room for the rest of the arguments
+            len = strlen(str);
+            if (len > sizeof(rec->args) / 2)
+                len = sizeof(rec->args) / 2;
+            if (!put_arg(rec, str, len) || !put_arg(rec, "", 1))
+                return 0;
+            break;
+        case 'p':
+        case 'n':
+            ptr = va_arg(args, void *);
+            if (spec.conv == 'p' && !put_arg(rec, &ptr, sizeof(ptr)))
+                return 0;
+            break;
+        }
+    }
+    return 1;
+}
+
+/*
+    Format a record the way that vsnprintf() would have. Every conversion
+    is printed on its own with the value that was saved.
+*/
+static void format_record(log_record_t *rec, char *buf, size_t size)
+{
+    const char *p, *start;
+    char spec_str[64];
+    size_t out = 0, pos = 0;
+    long long ival;
+    long double lval;
+    double dval;
+    void *ptr;
+    int n;
+    spec_t spec;
+
+    buf[0] = 0;
+    for (p = rec->fmt; *p != 0 && out < size - 1;)
+    {
+        if (*p != '%')
+        {
+            buf[out++] = *p++;
+            continue;
+        }
+
+        start = ++p;
+        p = parse_spec(p, &spec);
+        if ((spec.width_arg && !get_arg(rec, &pos, &spec.width, sizeof(spec.width))) ||
+            (spec.prec_arg && !get_arg(rec, &pos, &spec.prec, sizeof(spec.prec))))
+            break;
+
+        // the conversion again, with the numbers in place of '*'. A
+        // negative width is the '-' flag and a negative precision is none.
+        n = snprintf(spec_str, sizeof(spec_str), "%%%.*s", spec.num_flags, spec.flags);
+        if (spec.has_width)
+            n += snprintf(spec_str + n, sizeof(spec_str) - n, "%d", spec.width);
+        if (spec.has_prec && spec.prec >= 0)
+            n += snprintf(spec_str + n, sizeof(spec_str) - n, ".%d", spec.prec);
+
+        n = 0;
+        switch (spec.conv)
+        {
+        case 'd': case 'i': case 'u': case 'o': case 'x': case 'X':
+            if (!get_arg(rec, &pos, &ival, sizeof(ival)))
+                goto done;
+            strncat(spec_str, "ll", sizeof(spec_str) - strlen(spec_str) - 2);
+            strncat(spec_str, &spec.conv, 1);
+            if (spec.len == LEN_HH)
+                ival = (spec.conv == 'd' || spec.conv == 'i') ? (long long)(signed char)ival : (long long)(unsigned char)ival;
+            else if (spec.len == LEN_H)
+                ival = (spec.conv == 'd' || spec.conv == 'i') ? (long long)(short)ival : (long long)(unsigned short)ival;
+            else if (spec.len == LEN_NONE && spec.conv != 'd' && spec.conv != 'i')
+                ival = (unsigned int)ival;
+            n = snprintf(buf + out, size - out, spec_str, ival);
+            break;
+        case 'c':
+            if (!get_arg(rec, &pos, &ival, sizeof(ival)))
+                goto done;
+            strncat(spec_str, "c", sizeof(spec_str) - strlen(spec_str) - 1);
+            n = snprintf(buf + out, size - out, spec_str, (int)ival);
+            break;
+        case 'f': case 'F': case 'e': case 'E': case 'g': case 'G': case 'a': case 'A':
+            if (spec.len == LEN_LD)
+            {
+                if (!get_arg(rec, &pos, &lval, sizeof(lval)))
+                    goto done;
+                strncat(spec_str, "L", sizeof(spec_str) - strlen(spec_str) - 2);
+                strncat(spec_str, &spec.conv, 1);
+                n = snprintf(buf + out, size - out, spec_str, lval);
+            }
+            else
+            {
+                if (!get_arg(rec, &pos, &dval, sizeof(dval)))
+                    goto done;
+                strncat(spec_str, &spec.conv, 1);
+                n = snprintf(buf + out, size - out, spec_str, dval);
+            }
+            break;
+        case 's':
+            if (pos >= rec->len)
+                goto done;
+            strncat(spec_str, "s", sizeof(spec_str) - strlen(spec_str) - 1);
+            n = snprintf(buf + out, size - out, spec_str, &rec->args[pos]);
+            pos += strlen(&rec->args[pos]) + 1;
+            break;
+        case 'p':
+            if (!get_arg(rec, &pos, &ptr, sizeof(ptr)))
+                goto done;
+            strncat(spec_str, "p", sizeof(spec_str) - strlen(spec_str) - 1);
+            n = snprintf(buf + out, size - out, spec_str, ptr);
+            break;
+        case '%':
+            n = snprintf(buf + out, size - out, "%%");
+            break;
+        case 'n':
+            break;
+        default:
+            // not a conversion that printf knows, show it as it is
+            n = snprintf(buf + out, size - out, "%%%.*s", (int)(p - start), start);
+            break;
+        }
+
+        if (n > 0)
+            out += ((size_t)n < size - out) ? (size_t)n : size - out - 1;
+    }
+done:
+    buf[out] = 0;
+}
+
+/*
+    The binary log file. All of the numbers are in the byte order of the
+    machine that wrote it, and the header says what that order is.
+*/
+#define LOG_MAGIC "TOILOG1"
+#define LOG_BYTE_ORDER 0x01020304
+#define LOG_REC_SITE 1
+#define LOG_REC_MSG 2
+
+typedef struct
+{
+    char magic[8];
+    uint32_t byte_order;
+    uint16_t ptr_size;
+    uint16_t ldouble_size;
+    uint64_t real_start; // CLOCK_REALTIME in nanoseconds when the log started
+    uint64_t mono_start; // CLOCK_MONOTONIC at the same time
+} log_header_t;
+
+// followed by the function name and the format, without nuls
+typedef struct
+{
+    uint8_t tag;
+    uint8_t type;
+    uint16_t func_len;
+    uint16_t fmt_len;
+    uint16_t unused;
+    uint32_t id;
+    int32_t line;
+} log_site_t;
+
+// followed by the arguments
+typedef struct
+{
+    uint8_t tag;
+    uint8_t unused;
+    uint16_t len;
+    uint32_t site;
+    uint64_t ts;
+} log_msg_t;
+
+typedef struct
+{
+    const char *func;
+    const char *fmt;
+    int line;
+    uint32_t id; // plus one, 0 for an empty slot
+} log_site_slot_t;
+
+// the call sites that have been written, an open addressing hash table
+static log_site_slot_t *sites = NULL;
+static uint32_t site_cap = 0;
+static uint32_t num_sites = 0;
+
+static inline uint64_t read_clock_ns(clockid_t clk)
+{
+    struct timespec ts;
+
+    clock_gettime(clk, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static inline uint32_t site_hash(const char *func, const char *fmt, int line)
+{
+    uintptr_t h = (uintptr_t)func * 31 + (uintptr_t)fmt * 17 + line;
+
+    return (uint32_t)(h ^ (h >> 15) ^ (h >> 32));
+}
+
+static void grow_sites(void)
+{
+    log_site_slot_t *old = sites;
+    uint32_t old_cap = site_cap, i, h;
+
+    site_cap = (site_cap == 0) ? 1024 : site_cap * 2;
+    if (NULL == (sites = calloc(site_cap, sizeof(log_site_slot_t))))
+    {
+        fprintf(stderr, "FATAL ERROR: Cannot allocate the log sites\n");
         exit(1);
     }
-    else if (type == INFO)
+
+    for (i = 0; i < old_cap; i++)
+    {
+        if (old[i].id == 0)
+            continue;
+        for (h = site_hash(old[i].func, old[i].fmt, old[i].line); sites[h & (site_cap - 1)].id != 0; h++)
+            ;
+        sites[h & (site_cap - 1)] = old[i];
+    }
+    free(old);
+}
+
+/*
+    Return the number of the call site, and write the site to the file the
+    first time that it is seen. The fmt is enough to tell most sites apart,
+    but ENTER() and RET() use the same empty format everywhere.
+*/
+static uint32_t find_site(log_record_t *rec)
+{
+    log_site_slot_t *slot;
+    log_site_t site;
+    uint32_t h;
+
+    if (num_sites * 2 >= site_cap)
+        grow_sites();
+
+    for (h = site_hash(rec->func, rec->fmt, rec->line);; h++)
     {
-        if (lev <= debug_level)
+        slot = &sites[h & (site_cap - 1)];
+        if (slot->id == 0)
+            break;
+        if (slot->fmt == rec->fmt && slot->func == rec->func && slot->line == rec->line)
+            return slot->id - 1;
+    }
+
+    slot->func = rec->func;
+    slot->fmt = rec->fmt;
+    slot->line = rec->line;
+    slot->id = ++num_sites;
+
+    memset(&site, 0, sizeof(site));
+    site.tag = LOG_REC_SITE;
+    site.type = rec->type;
+    site.func_len = strnlen(rec->func, UINT16_MAX);
+    site.fmt_len = strnlen(rec->fmt, UINT16_MAX);
+    site.id = slot->id - 1;
+    site.line = rec->line;
+    fwrite(&site, sizeof(site), 1, binfp);
+    fwrite(rec->func, 1, site.func_len, binfp);
+    fwrite(rec->fmt, 1, site.fmt_len, binfp);
+    return site.id;
+}
+
+static void write_binary(log_record_t *rec)
+{
+    log_msg_t msg;
+
+    msg.tag = LOG_REC_MSG;
+    msg.unused = 0;
+    msg.len = rec->len;
+    msg.site = find_site(rec);
+    msg.ts = rec->ts;
+    fwrite(&msg, sizeof(msg), 1, binfp);
+    fwrite(rec->args, 1, rec->len, binfp);
+}
+
+static void start_binary(FILE *fp)
+{
+    log_header_t head;
+
+    memset(&head, 0, sizeof(head));
+    strcpy(head.magic, LOG_MAGIC);
+    head.byte_order = LOG_BYTE_ORDER;
+    head.ptr_size = sizeof(void *);
+    head.ldouble_size = sizeof(long double);
+    head.real_start = read_clock_ns(CLOCK_REALTIME);
+    head.mono_start = read_clock_ns(CLOCK_MONOTONIC);
+    fwrite(&head, sizeof(head), 1, fp);
+    binfp = fp;
+}
+
+/*
+    Build the text of a record in the buffer and return its length. The
+    buffer is at least 2048 bytes.
+*/
+static size_t render_record(log_record_t *rec, char *buffer, size_t size)
+{
+    size_t len;
+    int n;
+
+    if (rec->type == DEBUG || rec->type == ENTER || rec->type == RETURN || rec->type == INTERNAL)
+        n = verbose_prefix(buffer, 1024, rec->type, rec->func, rec->line, rec->when.tv_sec);
+    else
+        n = snprintf(buffer, 1024, "%s: ", type_strs[rec->type]);
+    len = (n < 1024) ? (size_t)n : 1023;
+
+    format_record(rec, buffer + len, size - len - 1);
+    len += strlen(buffer + len);
+    buffer[len++] = '\n';
+    return len;
+}
+
+/*
+    Turn a binary log back into the text that would have been written.
+    Returns 0 if the whole file was read, or 1 if it is not a log or it
+    ends in the middle of a record.
+*/
+int dump_binary_log(FILE *in, FILE *out)
+{
+    log_header_t head;
+    log_site_t site;
+    log_msg_t msg;
+    log_record_t rec, *known = NULL;
+    char buffer[2048];
+    char *str;
+    uint32_t count = 0, cap = 0;
+    uint64_t real;
+    int tag, retv = 1;
+
+    if (fread(&head, sizeof(head), 1, in) != 1 || memcmp(head.magic, LOG_MAGIC, sizeof(LOG_MAGIC)) ||
+        head.byte_order != LOG_BYTE_ORDER || head.ptr_size != sizeof(void *) ||
+        head.ldouble_size != sizeof(long double))
+    {
+        fprintf(stderr, "not a log written on this kind of machine\n");
+        return 1;
+    }
+
+    // the sites are kept as records without arguments
+    while ((tag = fgetc(in)) != EOF)
+    {
+        ungetc(tag, in);
+        if (tag == LOG_REC_SITE)
         {
-            show_start(type);
-            va_start(args, fmt);
-            write_args(fmt, args);
-            va_end(args);
-            write_str("\n");
+            if (fread(&site, sizeof(site), 1, in) != 1 || site.id != count || site.type > FATAL)
+                break;
+            if (count == cap)
+            {
+                cap = (cap == 0) ? 1024 : cap * 2;
+                if (NULL == (known = realloc(known, cap * sizeof(log_record_t))))
+                {
+                    fprintf(stderr, "cannot allocate memory for the log sites\n");
+                    exit(1);
+                }
+            }
+            if (NULL == (str = malloc(site.func_len + site.fmt_len + 2)))
+            {
+                fprintf(stderr, "cannot allocate memory for the log sites\n");
+                exit(1);
+            }
+            known[count].type = site.type;
+            known[count].line = site.line;
+            known[count].func = str;
+            known[count].fmt = str + site.func_len + 1;
+            count++;
+            if (fread(str, 1, site.func_len, in) != site.func_len ||
+                fread(str + site.func_len + 1, 1, site.fmt_len, in) != site.fmt_len)
+                break;
+            str[site.func_len] = 0;
+            str[site.func_len + 1 + site.fmt_len] = 0;
+        }
+        else if (tag == LOG_REC_MSG)
+        {
+            if (fread(&msg, sizeof(msg), 1, in) != 1 || msg.site >= count || msg.len > sizeof(rec.args) ||
+                fread(rec.args, 1, msg.len, in) != msg.len)
+                break;
+            rec.type = known[msg.site].type;
+            rec.func = known[msg.site].func;
+            rec.fmt = known[msg.site].fmt;
+            rec.line = known[msg.site].line;
+            rec.len = msg.len;
+            real = head.real_start + (msg.ts - head.mono_start);
+            rec.when.tv_sec = real / 1000000000;
+            rec.when.tv_nsec = real % 1000000000;
+            fwrite(buffer, 1, render_record(&rec, buffer, sizeof(buffer)), out);
         }
+        else
+            break;
     }
+
+    if (tag == EOF)
+        retv = 0;
     else
+        fprintf(stderr, "the log is not complete\n");
+
+    while (count > 0)
+        free((char *)known[--count].func);
+    free(known);
+    return retv;
+}
+
+/*
+    The whole line is built in one buffer and written at once.
+*/
+static void write_record(log_record_t *rec)
+{
+    char buffer[2048];
+
+    if (binfp != NULL)
+        write_binary(rec);
+    if (outfp[0] != NULL || outfp[1] != NULL)
+        write_buffer(buffer, render_record(rec, buffer, sizeof(buffer)));
+    if (errfp != NULL && rec->type >= WARN)
+        fwrite(buffer, 1, render_record(rec, buffer, sizeof(buffer)), errfp);
+}
+
+/*
+    The background thread. It writes the records in the order that they
+    were added and sleeps when there are none.
+*/
+static void *log_writer(void *arg)
+{
+    log_record_t *rec;
+    size_t tail;
+    int spins = 0;
+
+    (void)arg;
+    while (1)
     {
-        show_start(type);
+        tail = atomic_load_explicit(&ring_tail, memory_order_relaxed);
+        rec = &ring[tail & (RING_SIZE - 1)];
+        if (atomic_load_explicit(&rec->seq, memory_order_acquire) == tail + 1)
+        {
+            write_record(rec);
+            atomic_store_explicit(&rec->seq, tail + RING_SIZE, memory_order_release);
+            atomic_store_explicit(&ring_tail, tail + 1, memory_order_release);
+            spins = 0;
+            continue;
+        }
+
+        if (atomic_load(&writer_stop))
+            break;
+
+        if (++spins < 100)
+        {
+            sched_yield();
+            continue;
+        }
+
+        // nothing to write, wait to be woken. The timeout covers a wake up
+        // that is sent just before the thread starts to wait.
+        pthread_mutex_lock(&writer_lock);
+        atomic_store(&writer_idle, 1);
+        if (atomic_load(&ring_head) == tail && !atomic_load(&writer_stop))
+        {
+            struct timespec ts;
+            clock_gettime(CLOCK_REALTIME, &ts);
+            ts.tv_nsec += 10 * 1000000;
+            if (ts.tv_nsec >= 1000000000)
+            {
+                ts.tv_sec++;
+                ts.tv_nsec -= 1000000000;
+            }
+            pthread_cond_timedwait(&writer_cond, &writer_lock, &ts);
+        }
+        atomic_store(&writer_idle, 0);
+        pthread_mutex_unlock(&writer_lock);
+        spins = 0;
+    }
+    return NULL;
+}
+
+static void wake_writer(void)
+{
+    if (atomic_load(&writer_idle))
+    {
+        pthread_mutex_lock(&writer_lock);
+        pthread_cond_signal(&writer_cond);
+        pthread_mutex_unlock(&writer_lock);
+    }
+}
+
+static void fill_record(log_record_t *rec, typelog_t type, const char *func, int line, const char *fmt, va_list args)
+{
+    rec->type = type;
+    rec->func = func;
+    rec->line = line;
+    rec->len = 0;
+    if (binfp != NULL)
+        rec->ts = read_clock_ns(CLOCK_MONOTONIC);
+    if ((outfp[0] != NULL || outfp[1] != NULL || (errfp != NULL && type == INTERNAL)) &&
+        (type == DEBUG || type == ENTER || type == RETURN || type == INTERNAL))
+        clock_gettime(CLOCK_REALTIME, &rec->when);
+
+    if (save_args(rec, fmt, args))
+        rec->fmt = fmt;
+    else
+    {
+        rec->len = 0;
+        rec->fmt = "(the arguments for this message are too long to log)";
+    }
+}
+
+/*
+    Add a record to the ring. Waits if the ring is full.
+*/
+static void add_record(typelog_t type, const char *func, int line, const char *fmt, va_list args)
+{
+    log_record_t *rec;
+    size_t pos, seq;
+
+    pos = atomic_load_explicit(&ring_head, memory_order_relaxed);
+    while (1)
+    {
+        rec = &ring[pos & (RING_SIZE - 1)];
+        seq = atomic_load_explicit(&rec->seq, memory_order_acquire);
+        if (seq == pos)
+        {
+            if (atomic_compare_exchange_weak_explicit(&ring_head, &pos, pos + 1,
+                                                      memory_order_relaxed, memory_order_relaxed))
+                break;
+        }
+        else if ((ptrdiff_t)(seq - pos) < 0)
+        {
+            // full
+            wake_writer();
+            sched_yield();
+            pos = atomic_load_explicit(&ring_head, memory_order_relaxed);
+        }
+        else
+            pos = atomic_load_explicit(&ring_head, memory_order_relaxed);
+    }
+
+    fill_record(rec, type, func, line, fmt, args);
+    atomic_store_explicit(&rec->seq, pos + 1, memory_order_release);
+    wake_writer();
+}
+
+/*
+    Wait until every record that has been added so far is written.
+*/
+void flush_logging(void)
+{
+    size_t head;
+
+    if (!async_logging)
+        return;
+
+    head = atomic_load(&ring_head);
+    while (atomic_load(&ring_tail) < head)
+    {
+        wake_writer();
+        sched_yield();
+    }
+
+    pthread_mutex_lock(&log_lock);
+    if (outfp[0] != NULL)
+        fflush(outfp[0]);
+    if (outfp[1] != NULL)
+        fflush(outfp[1]);
+    if (binfp != NULL)
+        fflush(binfp);
+    if (errfp != NULL)
+        fflush(errfp);
+    pthread_mutex_unlock(&log_lock);
+}
+
+static void stop_logging(void)
+{
+    if (!async_logging)
+        return;
+
+    flush_logging();
+    atomic_store(&writer_stop, 1);
+    pthread_mutex_lock(&writer_lock);
+    pthread_cond_signal(&writer_cond);
+    pthread_mutex_unlock(&writer_lock);
+    pthread_join(writer_thread, NULL);
+    async_logging = 0;
+    free(ring);
+    ring = NULL;
+}
+
+static void start_logging(void)
+{
+    size_t i;
+
+    if (NULL == (ring = malloc(RING_SIZE * sizeof(log_record_t))))
+    {
+        fprintf(stderr, "FATAL ERROR: Cannot allocate the log ring\n");
+        exit(1);
+    }
+
+    for (i = 0; i < RING_SIZE; i++)
+        atomic_init(&ring[i].seq, i);
+    atomic_init(&ring_head, 0);
+    atomic_init(&ring_tail, 0);
+    atomic_init(&writer_stop, 0);
+    atomic_init(&writer_idle, 0);
+
+    if (pthread_create(&writer_thread, NULL, log_writer, NULL) != 0)
+    {
+        fprintf(stderr, "FATAL ERROR: Cannot start the log writer\n");
+        exit(1);
+    }
+    async_logging = 1;
+    atexit(stop_logging);
+}
+
+void show_msg(typelog_t type, int lev, const char *func, int line, const char *fmt, ...)
+{
+    log_record_t rec;
+    va_list args;
+
+    // the level has been checked by the macro
+    (void)lev;
+
+    if (async_logging)
+    {
+        va_start(args, fmt);
+        add_record(type, func, line, fmt, args);
+        va_end(args);
+
+        // internal and fatal end the program
+        if (type == INTERNAL || type == FATAL)
+        {
+            flush_logging();
+            exit(1);
+        }
+        return;
+    }
+
+    pthread_mutex_lock(&log_lock);
+    if (binfp != NULL)
+    {
+        va_start(args, fmt);
+        fill_record(&rec, type, func, line, fmt, args);
+        va_end(args);
+        write_binary(&rec);
+        if (errfp != NULL && type >= WARN)
+        {
+            char buffer[2048];
+
+            fwrite(buffer, 1, render_record(&rec, buffer, sizeof(buffer)), errfp);
+        }
+    }
+
+    if (outfp[0] != NULL || outfp[1] != NULL)
+    {
+        if (type == DEBUG || type == ENTER || type == RETURN || type == INTERNAL)
+            show_verbose_start(type, func, line);
+        else
+            show_start(type);
+
         va_start(args, fmt);
         write_args(fmt, args);
         va_end(args);
         write_str("\n");
-        if (type == FATAL)
-            exit(1);
     }
+    pthread_mutex_unlock(&log_lock);
+
+    // internal and fatal end the program
+    if (type == INTERNAL || type == FATAL)
+        exit(1);
 }
 
 void clean_log_file(void)
@@ -138,13 +1084,17 @@ void clean_log_file(void)
 #endif
     if (outfp[1] != NULL)
         fclose(outfp[1]);
+    if (binfp != NULL)
+        fclose(binfp);
 }
 
 void init_logging(logging_flags_t flags, ...)
 {
     va_list args;
+    FILE *fp;
 
     memset(outfp, 0, sizeof(outfp));
+    errfp = NULL;
 
     if (flags & LOG_STDOUT)
         outfp[0] = stdout;
@@ -164,11 +1114,24 @@ void init_logging(logging_flags_t flags, ...)
         else
             mode = "w";
 
-        if (NULL == (outfp[1] = fopen(fname, mode)))
+        if (NULL == (fp = fopen(fname, mode)))
         {
             fprintf(stderr, "FATAL ERROR: Cannot open the logfile \"%s\": %s\n", fname, strerror(errno));
             exit(1);
         }
+
+        if (flags & LOG_BINARY)
+        {
+            start_binary(fp);
+            if (outfp[0] == NULL)
+                errfp = stderr;
+        }
+        else
+            outfp[1] = fp;
         atexit(clean_log_file);
     }
+
+    // started last so that it stops before the log file is closed
+    if (flags & LOG_ASYNC)
+        start_logging();
 }
@@ -1,6 +1,10 @@
 #ifndef _LOGGING_H_
 #define _LOGGING_H_
 
+#include <stdio.h>
+
+#include "trace.h"
+
 typedef enum typelog_t
 {
     DEBUG,
@@ -20,17 +24,55 @@ typedef enum logging_flags_t
     LOG_STDERR = 0x02,
     LOG_FILE = 0x04,
     LOG_APPEND = 0x08,
+    LOG_ASYNC = 0x10, // write the messages on a background thread
+    LOG_BINARY = 0x20, // write the log file as binary records, see toi-logdump
 } logging_flags_t;
 
+/*
+    Every source file belongs to a log module and has its own debug level.
+    A file sets its module by defining LOG_MODULE before it includes any
+    header. The level of each module is kept as a mask with a bit for each
+    level that is shown, and the macros test the bit before they call
+    show_msg(), so a message that is not shown costs a load and a test.
+*/
+typedef enum
+{
+    LOG_MOD_MAIN,
+    LOG_MOD_FILE_IO,
+    LOG_MOD_SCANNER,
+    LOG_MOD_HASH,
+    LOG_MOD_CONTEXT,
+    LOG_MOD_SYMBOLS,
+    LOG_MOD_PARSER,
+    LOG_MOD_MODULES,
+    LOG_MOD_VM,
+    NUM_LOG_MODULES,
+    LOG_ALL_MODULES = NUM_LOG_MODULES,
+} log_module_t;
+
+#ifndef LOG_MODULE
+#define LOG_MODULE LOG_MOD_MAIN
+#endif
+
+extern _Thread_local const unsigned int *log_masks;
+
 void show_msg(typelog_t type, int lev, const char *func, int line, const char *fmt, ...);
 void set_debug_level(int lev);
+void set_module_level(log_module_t mod, int lev);
+int find_log_module(const char *name);
+void push_debug_level(log_module_t mod, int lev);
+void pop_debug_level(void);
 void init_logging(logging_flags_t flags, ...);
+void flush_logging(void);
+int dump_binary_log(FILE *in, FILE *out);
+
+#define LOG_ON(lev) ((log_masks[LOG_MODULE] >> (lev)) & 1u)
 
 #ifdef _DEBUGGING
-#define DEBUG(lev, fmt, ...) show_msg(DEBUG, (lev), __func__, __LINE__, fmt, ##__VA_ARGS__)
-#define ENTER() show_msg(ENTER, 9, __func__, __LINE__, "")
-#define VRET(v) do{show_msg(RETURN, 9, __func__, __LINE__, #v);return((v));}while(0)
-#define RET() do{show_msg(RETURN, 9, __func__, __LINE__, "");return;}while(0)
+#define DEBUG(lev, fmt, ...) do{if(LOG_ON(lev))show_msg(DEBUG, (lev), __func__, __LINE__, fmt, ##__VA_ARGS__);}while(0)
+#define ENTER() do{TRACE_BEGIN(TRACE_FUNC, __func__);if(LOG_ON(9))show_msg(ENTER, 9, __func__, __LINE__, "");}while(0)
+#define VRET(v) do{TRACE_END(__func__);if(LOG_ON(9))show_msg(RETURN, 9, __func__, __LINE__, #v);return((v));}while(0)
+#define RET() do{TRACE_END(__func__);if(LOG_ON(9))show_msg(RETURN, 9, __func__, __LINE__, "");return;}while(0)
 #else
 #define DEBUG(lev, fmt, ...)
 #define ENTER()
@@ -38,7 +80,7 @@ void init_logging(logging_flags_t flags, ...);
 #define RET() return
 #endif
 
-#define INFO(fmt, ...) show_msg(INFO, 1, __func__, __LINE__, fmt, ##__VA_ARGS__)
+#define INFO(fmt, ...) do{if(LOG_ON(1))show_msg(INFO, 1, __func__, __LINE__, fmt, ##__VA_ARGS__);}while(0)
 #define ERROR(fmt, ...) show_msg(ERROR, 0, __func__, __LINE__, fmt, ##__VA_ARGS__)
 #define INTERNAL(fmt, ...) show_msg(INTERNAL, 0, __func__, __LINE__, fmt, ##__VA_ARGS__)
 #define FATAL(fmt, ...) show_msg(FATAL, 0, __func__, __LINE__, fmt, ##__VA_ARGS__)
@@ -0,0 +1,203 @@
+/*
+    Keep track of the modules that have been imported.
+
+    Every module is parsed exactly once. When an import names a module that
+    has already been parsed, its symbols are already defined under the
+    module's context and the import is satisfied without opening the file
+    again. A module that is imported while it is still being parsed is a
+    circular import.
+
+    The edges between the modules are recorded as they are discovered so that
+    the import graph is available after the parse. Each module also records
+    the symbols that it defined, which go into its interface file. See
+    interface.c.
+*/
+#define LOG_MODULE LOG_MOD_MODULES
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "logging.h"
+#include "hash_table.h"
+#include "symbols.h"
+#include "modules.h"
+
+#define MODULE_STACK_SIZE 256
+
+// each thread compiles with its own modules
+static _Thread_local ht_handle_t module_table = NULL;
+static _Thread_local module_t *module_list = NULL;
+static _Thread_local module_t *module_last = NULL;
+static _Thread_local module_t *module_stack[MODULE_STACK_SIZE];
+static _Thread_local int module_stack_index = 0;
+
+void destroy_modules(void)
+{
+    module_t *mod, *next;
+    int i;
+
+    ENTER();
+    for (mod = module_list; mod != NULL; mod = next)
+    {
+        next = mod->next;
+        for (i = 0; i < mod->num_symbols; i++)
+            free(mod->symbols[i]);
+        free(mod->symbols);
+        free(mod->name);
+        free(mod->fname);
+        free(mod->imports);
+        free(mod);
+    }
+    destroy_hash_table(module_table);
+    module_list = module_last = NULL;
+    module_table = NULL;
+    RET();
+}
+
+void init_modules(void)
+{
+    ENTER();
+    if (module_table == NULL)
+    {
+        module_table = create_hash_table(127);
+    }
+    module_stack_index = 0;
+    RET();
+}
+
+module_t *find_module(const char *name)
+{
+    ENTER();
+    VRET((module_t *)hash_find(module_table, name));
+}
+
+/*
+    Create a new module record in the MODULE_PARSING state. The caller is
+    expected to have verified that the module does not exist.
+*/
+module_t *create_module(const char *name, const char *fname)
+{
+    module_t *mod;
+
+    ENTER();
+    if (NULL == (mod = calloc(1, sizeof(module_t))))
+        FATAL("cannot allocate memory for module");
+
+    if (NULL == (mod->name = strdup(name)))
+        FATAL("cannot allocate memory for module name");
+
+    if (NULL == (mod->fname = strdup(fname)))
+        FATAL("cannot allocate memory for module file name");
+
+    mod->state = MODULE_PARSING;
+    if (hash_save(module_table, name, mod) != 0)
+        INTERNAL("module %s is already defined", name);
+
+    if (module_last != NULL)
+        module_last->next = mod;
+    else
+        module_list = mod;
+    module_last = mod;
+
+    INFO("created module: %s (%s)", name, fname);
+    VRET(mod);
+}
+
+/*
+    Record that mod imports imp. Duplicate edges are ignored.
+*/
+void add_module_import(module_t *mod, module_t *imp)
+{
+    int i;
+
+    ENTER();
+    for (i = 0; i < mod->num_imports; i++)
+        if (mod->imports[i] == imp)
+            RET();
+
+    if (mod->num_imports >= mod->cap_imports)
+    {
+        mod->cap_imports = (mod->cap_imports == 0) ? 4 : mod->cap_imports * 2;
+        mod->imports = realloc(mod->imports, mod->cap_imports * sizeof(module_t *));
+        if (mod->imports == NULL)
+            FATAL("cannot allocate memory for module imports");
+    }
+    mod->imports[mod->num_imports++] = imp;
+    RET();
+}
+
+void add_module_symbol(module_t *mod, const char *sym)
+{
+    ENTER();
+    if (mod->num_symbols >= mod->cap_symbols)
+    {
+        mod->cap_symbols = (mod->cap_symbols == 0) ? 16 : mod->cap_symbols * 2;
+        mod->symbols = realloc(mod->symbols, mod->cap_symbols * sizeof(char *));
+        if (mod->symbols == NULL)
+            FATAL("cannot allocate memory for module symbols");
+    }
+
+    if (NULL == (mod->symbols[mod->num_symbols++] = strdup(sym)))
+        FATAL("cannot allocate memory for module symbol name");
+    RET();
+}
+
+/*
+    Invalidate the symbols that the module defined and forget its imports so
+    that it can be parsed again. The symbols keep their places in the symbol
+    table.
+*/
+void reset_module(module_t *mod)
+{
+    int i;
+
+    ENTER();
+    for (i = 0; i < mod->num_symbols; i++)
+    {
+        invalidate_symbol(mod->symbols[i]);
+        free(mod->symbols[i]);
+    }
+    INFO("invalidated %d symbols of module %s", mod->num_symbols, mod->name);
+    mod->num_symbols = 0;
+    mod->num_imports = 0;
+    mod->parsed = 0;
+    mod->state = MODULE_PARSING;
+    RET();
+}
+
+void push_module(module_t *mod)
+{
+    ENTER();
+    if (module_stack_index >= MODULE_STACK_SIZE)
+        FATAL("imports are nested too deeply");
+
+    module_stack[module_stack_index++] = mod;
+    RET();
+}
+
+void pop_module(void)
+{
+    ENTER();
+    if (module_stack_index <= 0)
+        INTERNAL("module stack underflow");
+
+    module_stack_index--;
+    RET();
+}
+
+/*
+    Return the module that is currently being parsed, or NULL for the top
+    level file.
+*/
+module_t *current_module(void)
+{
+    ENTER();
+    if (module_stack_index > 0)
+        VRET(module_stack[module_stack_index - 1]);
+    VRET(NULL);
+}
+
+module_t *first_module(void)
+{
+    return module_list;
+}
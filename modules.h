@@ -0,0 +1,45 @@
+#ifndef _MODULES_H_
+#define _MODULES_H_
+
+#include <stdint.h>
+
+typedef enum
+{
+    MODULE_PARSING, // the module is on the import stack
+    MODULE_DONE,    // the module has been parsed and its symbols are defined
+    MODULE_RELEASED, // the symbols have been invalidated, it must be loaded again
+} module_state_t;
+
+typedef struct module_t
+{
+    char *name;
+    char *fname;
+    module_state_t state;
+    int root;                  // the file given on the command line
+    int parsed;                // parsed from the source, not loaded from an interface
+    int dirty;                 // must be parsed again by rebuild_modules()
+    int mark;                  // scratch flag for walking the import graph
+    int errors;                // errors found the last time it was parsed
+    uint64_t hash;             // XXH64 of the source file
+    struct module_t **imports; // modules that this module imports
+    int num_imports;
+    int cap_imports;
+    char **symbols; // symbols that this module defined
+    int num_symbols;
+    int cap_symbols;
+    struct module_t *next; // list of all modules in the order they were seen
+} module_t;
+
+void init_modules(void);
+void destroy_modules(void);
+module_t *find_module(const char *name);
+module_t *create_module(const char *name, const char *fname);
+void add_module_import(module_t *mod, module_t *imp);
+void add_module_symbol(module_t *mod, const char *sym);
+void reset_module(module_t *mod);
+void push_module(module_t *mod);
+void pop_module(void);
+module_t *current_module(void);
+module_t *first_module(void);
+
+#endif /* _MODULES_H_ */
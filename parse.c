@@ -2,10 +2,16 @@
     Top level parse routine. This is the parser "main" routine.
 
     The top level file should already be open when this is called.
+
+    After a syntax error the parser does not stop. It skips tokens until one
+    where parsing can carry on, so one run reports every error that does
+    not follow from another one. See recover().
 */
+#define LOG_MODULE LOG_MOD_PARSER
 #include <stdio.h>
 
 #include "parse_inc.h"
+#include "parse.h"
 
 void do_end_file(void)
 {
@@ -21,13 +27,81 @@ void do_end_input(void)
     RET();
 }
 
+/*
+    Panic mode error recovery. The token that caused the error should be
+    put back with unget_token() before this is called, in case it is one
+    that parsing can carry on from.
+
+    Tokens are skipped until the end of the statement or the block that
+    has the error. A ';' or a '}' that closes a block that was skipped is
+    read. A keyword that starts a definition, and a '}' that closes the
+    class or the block of statements, are left to be read by the caller. In a parameter list, the ')'
+    is read and the '{' of the class body is left.
+*/
+void recover(recover_t where)
+{
+    token_t tok;
+    int depth = 0;
+
+    ENTER();
+    while (1)
+    {
+        tok = get_token();
+        switch (tok)
+        {
+        case END_OF_FILE:
+        case END_OF_INPUT:
+        case CLASS_TOK:
+        case IMPORT_TOK:
+            unget_token();
+            RET();
+        case FUNC_TOK:
+        case VAR_TOK:
+            if (depth == 0 && where != RECOVER_TOP)
+            {
+                unget_token();
+                RET();
+            }
+            break;
+        case OCURLY_TOK:
+            if (depth == 0 && where == RECOVER_PARAMS)
+            {
+                unget_token();
+                RET();
+            }
+            depth++;
+            break;
+        case CCURLY_TOK:
+            if (depth == 0)
+            {
+                if (where != RECOVER_TOP)
+                    unget_token();
+                RET();
+            }
+            if (--depth == 0)
+                RET();
+            break;
+        case SEMI_TOK:
+            if (depth == 0)
+                RET();
+            break;
+        case CPAREN_TOK:
+            if (depth == 0 && where == RECOVER_PARAMS)
+                RET();
+            break;
+        default:
+            break;
+        }
+    }
+}
+
 void parse(void)
 {
     ENTER();
     int finished = 0;
     token_t tok;
 
-    while (!finished)
+    while (!finished && !too_many_errors())
     {
         tok = get_token();
         switch (tok)
@@ -48,7 +122,8 @@ void parse(void)
             break;
         default:
             syntax("expected an import or class definition, but got \"%s\"", token_to_msg(tok));
-            finished++;
+            unget_token();
+            recover(RECOVER_TOP);
             break;
         }
     }
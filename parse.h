@@ -1,5 +1,17 @@
 #ifndef _PARSE_H_
 #define _PARSE_H_
 
+/*
+    Where the parser is when it recovers from a syntax error. See recover().
+*/
+typedef enum
+{
+    RECOVER_TOP,    // between imports and classes
+    RECOVER_CLASS,  // in the body of a class
+    RECOVER_PARAMS, // in the parameter list of a class
+    RECOVER_BLOCK,  // in a block of statements
+} recover_t;
+
 void parse(void);
+void recover(recover_t where);
 #endif /* _PARSE_H_ */
\ No newline at end of file
@@ -6,14 +6,22 @@
 
     This module wraps functionality from file_io to provide a consistent
     public interface to error handlers.
+
+    Each scanner_t has its own token buffers and its own file_io, so any
+    number of them can be used at once, one per thread or several in one
+    thread. The functions that do not take a scanner_t use a default scanner
+    that belongs to the thread and reads from the default file_io.
 */
+#define LOG_MODULE LOG_MOD_SCANNER
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <ctype.h>
+#include <pthread.h>
 
 #include "logging.h"
 #include "file_io.h"
+#include "stats.h"
 #include "scanner.h"
 #include "errors.h"
 
@@ -30,12 +38,14 @@ typedef enum
     HASH,      // # comment char
     SINGLES,   // [\(\)\{\}\[\]\,\;\:\.]
     WHITESP,   // ' ', '\t', '\n', '\r'
-    OPERATORS, // %^&*-+=/!|<>
+    OPERATORS, // %^&*-+=/!|<>~
     END_INPUT,
     END_FILE,
     CHAR_TABLE_SIZE = 256
 } character_types_t;
+// shared by all threads, it's only written by init_char_table()
 character_types_t char_table[CHAR_TABLE_SIZE];
+static pthread_once_t char_table_once = PTHREAD_ONCE_INIT;
 
 typedef struct
 {
@@ -93,26 +103,64 @@ static const token_map_t keywords_map[] = {
     {"yes", TRUE_TOK}};
 #define MAP_SIZE(m) (sizeof(m) / sizeof(token_map_t))
 #define TOKEN_BUFFER_SIZE 1024 * 64
-#define PREV_CHAR() token_buffer[(token_buffer_index >= 1) ? token_buffer_index - 1 : 0]
-#define CHAR_TYPE(c) char_table[ch]
-static char token_buffer[TOKEN_BUFFER_SIZE];
-static int token_buffer_index = 0;
+#define PREV_CHAR(s) (s)->buffer[((s)->index >= 1) ? (s)->index - 1 : 0]
+#define CHAR_TYPE(c) char_table[(c)]
+
+// errors found by the scanner are reported where the scanner is.
+#define scan_warning(s, fmt, ...) warning_at(fio_file_name((s)->fio), fio_line_number((s)->fio), \
+                                             fio_line_index((s)->fio), fmt, ##__VA_ARGS__)
+#define scan_syntax(s, fmt, ...) syntax_at(fio_file_name((s)->fio), fio_line_number((s)->fio), \
+                                           fio_line_index((s)->fio), fmt, ##__VA_ARGS__)
+
+/*
+    The state of one scanner. The text of a token that has been peeked at is
+    kept in the second buffer so that the text of the current token is not
+    lost. The buffers are swapped when the peeked token is taken.
+*/
+struct scanner_t
+{
+    file_io_t *fio;
+    int owns_fio;
+    char *buffer;
+    int index;
+    char *peek_buffer;
+    int peek_index;
+    token_t peek_tok;
+    int has_peek;
+};
+
+static _Thread_local scanner_t *default_scanner = NULL;
 
-static inline void clear_buffer(void)
+/*
+    The buffer is always kept nul terminated, so only the first character
+    needs to be cleared.
+*/
+static inline void clear_buffer(scanner_t *s)
 {
-    memset(token_buffer, 0, sizeof(token_buffer));
-    token_buffer_index = 0;
+    s->buffer[0] = 0;
+    s->index = 0;
 }
 
-static inline void add_char(int ch)
+static inline void add_char(scanner_t *s, int ch)
 {
-    token_buffer[token_buffer_index] = ch;
-    token_buffer_index++;
-    if (token_buffer_index >= TOKEN_BUFFER_SIZE)
+    if (s->index >= TOKEN_BUFFER_SIZE - 1)
     {
         FATAL("token buffer overrun");
-        clear_buffer();
+        clear_buffer(s);
     }
+    s->buffer[s->index++] = ch;
+    s->buffer[s->index] = 0;
+}
+
+static inline void swap_buffers(scanner_t *s)
+{
+    char *buf = s->buffer;
+    int index = s->index;
+
+    s->buffer = s->peek_buffer;
+    s->index = s->peek_index;
+    s->peek_buffer = buf;
+    s->peek_index = index;
 }
 
 // returns the token if the str is in the keyword list, otherwise, returns 0.
@@ -144,19 +192,11 @@ static token_t check_keyword(const char *str)
     return bfind(keywords_map, MAP_SIZE(keywords_map), str);
 }
 
-/*
-    Public interface
-*/
-void init_scanner(const char *fname)
+static void init_char_table(void)
 {
     int i;
     char *str;
 
-    ENTER();
-    // init the file_io
-    init_file_io();
-
-    // set up the scanner's internal tables
     for (i = 0; i < CHAR_TABLE_SIZE; i++)
         char_table[i] = ILLEGAL;
 
@@ -185,26 +225,111 @@ void init_scanner(const char *fname)
     for (i = 0; str[i] != 0; i++)
         char_table[(int)str[i]] = SINGLES;
 
-    str = "%^&*-+=/!|<>";
+    str = "%^&*-+=/!|<>~";
     for (i = 0; str[i] != 0; i++)
         char_table[(int)str[i]] = OPERATORS;
+}
+
+static scanner_t *make_scanner(file_io_t *fio, int owns_fio)
+{
+    scanner_t *s;
+
+    // set up the scanner's internal tables
+    pthread_once(&char_table_once, init_char_table);
+
+    if (NULL == (s = calloc(1, sizeof(scanner_t))))
+        FATAL("cannot allocate memory for scanner");
+
+    if (NULL == (s->buffer = malloc(TOKEN_BUFFER_SIZE)) ||
+        NULL == (s->peek_buffer = malloc(TOKEN_BUFFER_SIZE)))
+        FATAL("cannot allocate memory for token buffer");
+
+    s->fio = fio;
+    s->owns_fio = owns_fio;
+    s->buffer[0] = 0;
+    s->peek_buffer[0] = 0;
+    return s;
+}
+
+/*
+    Public interface
+*/
+
+/*
+    Create a scanner that reads from its own files. If fname is not NULL,
+    then the file is opened.
+*/
+scanner_t *create_scanner(const char *fname)
+{
+    scanner_t *s;
+
+    ENTER();
+    s = make_scanner(create_file_io(), 1);
+    if (fname != NULL)
+        fio_open(s->fio, fname);
+    VRET(s);
+}
+
+void destroy_scanner(scanner_t *s)
+{
+    ENTER();
+    if (s != NULL)
+    {
+        if (s->owns_fio)
+            destroy_file_io(s->fio);
+        free(s->buffer);
+        free(s->peek_buffer);
+        free(s);
+    }
+    RET();
+}
+
+file_io_t *scanner_file_io(scanner_t *s)
+{
+    return s->fio;
+}
+
+/*
+    Set up the default scanner for the thread. It reads from the default
+    file io, so open_file() adds files to it.
+*/
+void init_scanner(const char *fname)
+{
+    ENTER();
+    // init the file_io
+    init_file_io();
+
+    if (default_scanner == NULL)
+        default_scanner = make_scanner(default_file_io(), 0);
+
+    clear_buffer(default_scanner);
+    default_scanner->has_peek = 0;
 
     if (fname != NULL)
         open_file(fname);
     RET();
 }
 
+void close_scanner(void)
+{
+    ENTER();
+    destroy_scanner(default_scanner);
+    default_scanner = NULL;
+    free_file_io();
+    RET();
+}
+
 /*
     When this is entered, a non-alphanumeric character has been scanned
     and placed in the token buffer. It is not known if it is a single
     character operator or a multi-character operator.
 */
-static token_t get_operator()
+static token_t get_operator(scanner_t *s)
 {
     int ch;
     token_t retv = ERROR_TOK;
 
-    switch (token_buffer[0])
+    switch (s->buffer[0])
     {
         // these are always single characters
     case '*':
@@ -225,116 +350,116 @@ static token_t get_operator()
 
         // these may be 1 or 2 chars long
     case '!':
-        ch = get_char();
+        ch = fio_get_char(s->fio);
         if (ch == '!')
         {
-            add_char(ch);
+            add_char(s, ch);
             retv = NOT_TOK;
         }
         else
         {
-            unget_char(ch);
+            fio_unget_char(s->fio, ch);
             retv = NOT_TOK;
         }
         break;
     case '|':
-        ch = get_char();
+        ch = fio_get_char(s->fio);
         if (ch == '|')
         {
-            add_char(ch);
+            add_char(s, ch);
             retv = OR_TOK;
         }
         else
         {
-            unget_char(ch);
+            fio_unget_char(s->fio, ch);
             retv = LOR_TOK;
         }
         break;
     case '&':
-        ch = get_char();
+        ch = fio_get_char(s->fio);
         if (ch == '&')
         {
-            add_char(ch);
+            add_char(s, ch);
             retv = AND_TOK;
         }
         else
         {
-            unget_char(ch);
+            fio_unget_char(s->fio, ch);
             retv = LAND_TOK;
         }
         break;
     case '>':
-        ch = get_char();
+        ch = fio_get_char(s->fio);
         if (ch == '>')
         {
-            add_char(ch);
+            add_char(s, ch);
             retv = GREATER_TOK;
         }
         else if (ch == '=')
         {
-            add_char(ch);
+            add_char(s, ch);
             retv = GREATER_OR_EQUAL_TOK;
         }
         else
         {
-            unget_char(ch);
+            fio_unget_char(s->fio, ch);
             retv = LSHR_TOK;
         }
         break;
     case '<':
-        ch = get_char();
+        ch = fio_get_char(s->fio);
         if (ch == '<')
         {
-            add_char(ch);
+            add_char(s, ch);
             retv = LESS_TOK;
         }
         else if (ch == '=')
         {
-            add_char(ch);
+            add_char(s, ch);
             retv = LESS_OR_EQUAL_TOK;
         }
         else
         {
-            unget_char(ch);
+            fio_unget_char(s->fio, ch);
             retv = LSHL_TOK;
         }
         break;
     case '+':
-        ch = get_char();
+        ch = fio_get_char(s->fio);
         if (ch == '+')
         {
-            add_char(ch);
+            add_char(s, ch);
             retv = INCREMENT_TOK;
         }
         else
         {
-            unget_char(ch);
+            fio_unget_char(s->fio, ch);
             retv = PLUS_TOK;
         }
         break;
     case '-':
-        ch = get_char();
+        ch = fio_get_char(s->fio);
         if (ch == '-')
         {
-            add_char(ch);
+            add_char(s, ch);
             retv = DECREMENT_TOK;
         }
         else
         {
-            unget_char(ch);
+            fio_unget_char(s->fio, ch);
             retv = MINUS_TOK;
         }
         break;
     case '=':
-        ch = get_char();
+        ch = fio_get_char(s->fio);
         if (ch == '=')
         {
-            add_char(ch);
+            add_char(s, ch);
             retv = EQUAL_TOK;
         }
         else
         {
-            unget_char(ch);
+            fio_unget_char(s->fio, ch);
             retv = ASSIGN_TOK;
         }
         break;
@@ -349,11 +474,11 @@ static token_t get_operator()
     placed in the token buffer. This function simply finds out which one
     and retuns the value.
 */
-static token_t get_single()
+static token_t get_single(scanner_t *s)
 {
     token_t retv = ERROR_TOK;
 
-    switch (token_buffer[0])
+    switch (s->buffer[0])
     {
     case '(':
         retv = OPAREN_TOK;
@@ -394,7 +519,7 @@ static token_t get_single()
 // Read hex digits and put the resulting 2 digit numbers into the string. If
 // the number of hex digits found is odd, then the odd one will be the high
 // order nibble in the word. Any number of digits can be included.
-static void do_hex_escape(void)
+static void do_hex_escape(scanner_t *s)
 {
     int ch;
     int finished = 0;
@@ -406,10 +531,10 @@ static void do_hex_escape(void)
     buf[2] = 0;
     while (!finished)
     {
-        ch = get_char();
+        ch = fio_get_char(s->fio);
         if (ch == END_FILE || ch == END_INPUT)
         {
-            warning("unexpected end of file encountered reading string");
+            scan_warning(s, "unexpected end of file encountered reading string");
             finished++;
         }
         else
@@ -419,7 +544,7 @@ static void do_hex_escape(void)
                 buf[count++] = ch;
                 if (count >= 2)
                 {
-                    add_char((int)strtol(buf, NULL, 16));
+                    add_char(s, (int)strtol(buf, NULL, 16));
                     buf[0] = '0';
                     buf[1] = '0';
                     buf[2] = 0;
@@ -428,58 +553,58 @@ static void do_hex_escape(void)
             }
             else
             {
-                add_char(ch);
+                add_char(s, ch);
                 finished++;
             }
         }
     }
 }
 
-static void do_escape(void)
+static void do_escape(scanner_t *s)
 {
     int ch;
     int finished = 0;
 
-    ch = get_char();
+    ch = fio_get_char(s->fio);
     if (ch == END_FILE || ch == END_INPUT)
     {
-        warning("unexpected end of file encountered reading string");
+        scan_warning(s, "unexpected end of file encountered reading string");
         finished++;
     }
     else
     {
         if (ch == 'x' || ch == 'X')
-            do_hex_escape();
+            do_hex_escape(s);
         else
         {
             switch (ch)
             {
             case 'a':
-                add_char('\a');
+                add_char(s, '\a');
                 break;
             case 'b':
-                add_char('\b');
+                add_char(s, '\b');
                 break;
             case 'e':
-                add_char(0x1b);
+                add_char(s, 0x1b);
                 break;
             case 'f':
-                add_char('\f');
+                add_char(s, '\f');
                 break;
             case 'n':
-                add_char('\n');
+                add_char(s, '\n');
                 break;
             case 'r':
-                add_char('\r');
+                add_char(s, '\r');
                 break;
             case 't':
-                add_char('\t');
+                add_char(s, '\t');
                 break;
             case 'v':
-                add_char('\v');
+                add_char(s, '\v');
                 break;
             default:
-                add_char(ch);
+                add_char(s, ch);
             }
         }
     }
@@ -494,7 +619,7 @@ static void do_escape(void)
     \xNNNN. The escapes that are interpreted are exactly the same as any
     recent version of ANSI C.
 */
-static token_t get_dquote()
+static token_t get_dquote(scanner_t *s)
 {
     int ch;
     int finished = 0;
@@ -503,10 +628,10 @@ static token_t get_dquote()
 
     while (!finished)
     {
-        ch = get_char();
+        ch = fio_get_char(s->fio);
         if (ch == END_FILE || ch == END_INPUT)
         {
-            warning("unexpected end of file encountered reading string");
+            scan_warning(s, "unexpected end of file encountered reading string");
             finished++;
         }
         else
@@ -517,7 +642,7 @@ static token_t get_dquote()
                 if (ch != '\"')
                 {
                     state = 1;
-                    add_char(ch);
+                    add_char(s, ch);
                 }
                 else
                     state = 2;
@@ -525,7 +650,7 @@ static token_t get_dquote()
             case 1: // single line cannot have a '\n'
                 if (ch == '\n')
                 {
-                    syntax("unterminated quoted string");
+                    scan_syntax(s, "unterminated quoted string");
                     finished++;
                 }
                 else if (ch == '\"')
@@ -534,17 +659,17 @@ static token_t get_dquote()
                     finished++;
                 }
                 else if (ch == '\\')
-                    do_escape();
+                    do_escape(s);
                 else
-                    add_char(ch);
+                    add_char(s, ch);
                 break;
             case 2:             // copy a multi-line string
                 if (ch == '\"') // could be the end of the string
                     state = 3;
                 else if (ch == '\\')
-                    do_escape();
+                    do_escape(s);
                 else
-                    add_char(ch);
+                    add_char(s, ch);
                 break;
             case 3:
                 if (ch == '\"') // found the end of the string
@@ -554,13 +679,13 @@ static token_t get_dquote()
                 }
                 else if (ch == '\\')
                 {
-                    add_char('\"'); // else save the quote
-                    do_escape();
+                    add_char(s, '\"'); // else save the quote
+                    do_escape(s);
                 }
                 else
                 {
-                    add_char('\"'); // else save the quote
-                    add_char(ch);   // and the new character
+                    add_char(s, '\"'); // else save the quote
+                    add_char(s, ch);   // and the new character
                     state = 2;      // go back to reading a multi-line string
                 }
                 break;
@@ -581,7 +706,7 @@ static token_t get_dquote()
     without any modifications and no checking is done on what is read from
     the file.
 */
-static token_t get_squote()
+static token_t get_squote(scanner_t *s)
 {
     int ch;
     int finished = 0;
@@ -590,10 +715,10 @@ static token_t get_squote()
 
     while (!finished)
     {
-        ch = get_char();
+        ch = fio_get_char(s->fio);
         if (ch == END_FILE || ch == END_INPUT)
         {
-            warning("unexpected end of file encountered reading string");
+            scan_warning(s, "unexpected end of file encountered reading string");
             finished++;
         }
         else
@@ -604,7 +729,7 @@ static token_t get_squote()
                 if (ch != '\'')
                 {
                     state = 1;
-                    add_char(ch);
+                    add_char(s, ch);
                 }
                 else
                     state = 2;
@@ -612,7 +737,7 @@ static token_t get_squote()
             case 1: // single line cannot have a '\n'
                 if (ch == '\n')
                 {
-                    syntax("unterminated quoted string");
+                    scan_syntax(s, "unterminated quoted string");
                     finished++;
                 }
                 else if (ch == '\'')
@@ -621,13 +746,13 @@ static token_t get_squote()
                     finished++;
                 }
                 else
-                    add_char(ch);
+                    add_char(s, ch);
                 break;
             case 2:             // copy a multi-line string
                 if (ch == '\'') // could be the end of the string
                     state = 3;
                 else
-                    add_char(ch);
+                    add_char(s, ch);
                 break;
             case 3:
                 if (ch == '\'') // found the end of the string
@@ -637,8 +762,8 @@ static token_t get_squote()
                 }
                 else
                 {
-                    add_char('\''); // else save the single quote
-                    add_char(ch);   // and the new character
+                    add_char(s, '\''); // else save the single quote
+                    add_char(s, ch);   // and the new character
                     state = 2;      // go back to reading a multi-line string
                 }
                 break;
@@ -656,7 +781,7 @@ static token_t get_squote()
     the token buffer. It is unknown if the thing being read is a keyword or
     an actual symbol. That is determined at the end of the read.
 */
-static token_t get_symbol()
+static token_t get_symbol(scanner_t *s)
 {
     int ch;
     int finished = 0;
@@ -664,25 +789,25 @@ static token_t get_symbol()
 
     while (!finished)
     {
-        ch = get_char();
+        ch = fio_get_char(s->fio);
         if (ch == END_FILE || ch == END_INPUT)
         {
-            warning("unexpected end of file encountered reading symbol");
+            scan_warning(s, "unexpected end of file encountered reading symbol");
             finished++;
         }
         else
         {
             if (CHAR_TYPE(ch) == SYMCHARS || CHAR_TYPE(ch) == NUMERIC)
-                add_char(ch);
+                add_char(s, ch);
             else
             {
-                unget_char(ch);
+                fio_unget_char(s->fio, ch);
                 finished++;
             }
         }
     }
 
-    retv = check_keyword(token_buffer);
+    retv = check_keyword(s->buffer);
     if (retv == 0)
         retv = SYMBOL_TOK;
     return retv;
@@ -691,7 +816,7 @@ static token_t get_symbol()
 /*
     When this is entered, there is "0x" in the token buffer.
 */
-static token_t get_hex(void)
+static token_t get_hex(scanner_t *s)
 {
     int ch;
     int finished = 0;
@@ -699,17 +824,17 @@ static token_t get_hex(void)
 
     while (!finished)
     {
-        ch = get_char();
+        ch = fio_get_char(s->fio);
         if (ch == END_FILE || ch == END_INPUT)
         {
-            warning("unexpected end of file encountered reading hex number");
+            scan_warning(s, "unexpected end of file encountered reading hex number");
             finished++;
         }
         else if (isxdigit(ch))
-            add_char(ch);
+            add_char(s, ch);
         else
         {
-            unget_char(ch);
+            fio_unget_char(s->fio, ch);
             finished++;
             retv = UINT_TOK;
         }
@@ -720,7 +845,7 @@ static token_t get_hex(void)
 /*
     When this is entered, there are digits and a '.' in the token buffer.
 */
-static token_t get_float(void)
+static token_t get_float(scanner_t *s)
 {
     int ch;
     int finished = 0;
@@ -729,10 +854,10 @@ static token_t get_float(void)
 
     while (!finished)
     {
-        ch = get_char();
+        ch = fio_get_char(s->fio);
         if (ch == END_FILE || ch == END_INPUT)
         {
-            warning("unexpected end of file encountered reading float");
+            scan_warning(s, "unexpected end of file encountered reading float");
             finished++;
         }
         else
@@ -741,15 +866,15 @@ static token_t get_float(void)
             {
             case 0:
                 if (isdigit(ch))
-                    add_char(ch);
+                    add_char(s, ch);
                 else if (ch == 'e' || ch == 'E')
                 {
-                    add_char(ch);
+                    add_char(s, ch);
                     state = 1; // check for a sign
                 }
                 else
                 {
-                    unget_char(ch);
+                    fio_unget_char(s->fio, ch);
                     finished++;
                     retv = FLOAT_TOK;
                 }
@@ -757,36 +882,36 @@ static token_t get_float(void)
             case 1:
                 if (ch == '-' || ch == '+')
                 {
-                    add_char(ch);
+                    add_char(s, ch);
                     state = 2;
                 }
                 else if (isdigit(ch))
                 {
-                    add_char(ch);
+                    add_char(s, ch);
                     state = 2;
                 }
                 else
                 {
-                    syntax("malformed floating point number: %s", token_buffer);
-                    unget_char(ch);
-                    unget_char(PREV_CHAR());
+                    scan_syntax(s, "malformed floating point number: %s", s->buffer);
+                    fio_unget_char(s->fio, ch);
+                    fio_unget_char(s->fio, PREV_CHAR(s));
                     finished++;
                     // retv is ERROR_TOK
                 }
                 break;
             case 2: // read digits until the end
                 if (isdigit(ch))
-                    add_char(ch);
+                    add_char(s, ch);
                 else if (CHAR_TYPE(ch) != OPERATORS && CHAR_TYPE(ch) != SINGLES && CHAR_TYPE(ch) != WHITESP)
                 {
-                    syntax("malformed floating point number: %s", token_buffer);
-                    unget_char(ch);
+                    scan_syntax(s, "malformed floating point number: %s", s->buffer);
+                    fio_unget_char(s->fio, ch);
                     finished++;
                     // retv is ERROR_TOK
                 }
                 else
                 {
-                    unget_char(ch);
+                    fio_unget_char(s->fio, ch);
                     finished++;
                     retv = FLOAT_TOK;
                 }
@@ -802,7 +927,7 @@ static token_t get_float(void)
     to the token buffer. It is unknown if the number is an int, a float, or
     an unsigned. An int is assumed until proven otherwise.
 */
-static token_t get_number(void)
+static token_t get_number(scanner_t *s)
 {
     int ch;
     int finished = 0;
@@ -811,10 +936,10 @@ static token_t get_number(void)
 
     while (!finished)
     {
-        ch = get_char();
+        ch = fio_get_char(s->fio);
         if (ch == END_FILE || ch == END_INPUT)
         {
-            warning("unexpected end of file encountered reading number");
+            scan_warning(s, "unexpected end of file encountered reading number");
             finished++;
         }
         else
@@ -822,56 +947,62 @@ static token_t get_number(void)
             switch (state)
             {
             case 0:
-                if (PREV_CHAR() == '0')
+                if (PREV_CHAR(s) == '0')
                 { // then this must be a hex number or a float. Octals are not supported.
                     if (ch == 'x' || ch == 'X')
                     {
-                        add_char(ch);
-                        retv = get_hex();
+                        add_char(s, ch);
+                        retv = get_hex(s);
                         finished++;
                     }
                     else if (ch == '.')
                     {
-                        add_char(ch);
-                        retv = get_float();
+                        add_char(s, ch);
+                        retv = get_float(s);
                         finished++;
                     }
                     else if (isdigit(ch))
                     { // issue a warning and continue. Leading '0' are ignored.
-                        warning("leading zeros are ignored. Octals are not supported.");
-                        add_char(ch);
+                        scan_warning(s, "leading zeros are ignored. Octals are not supported.");
+                        add_char(s, ch);
+                    }
+                    else
+                    {
+                        fio_unget_char(s->fio, ch); // the number is 0
+                        finished++;
+                        retv = INT_TOK;
                     }
                 }
                 else if (isdigit(ch))
                 {
-                    add_char(ch);
+                    add_char(s, ch);
                     state = 1; // reading an integer.
                 }
                 else if (ch == '.')
                 { // single digit infornt of a '.'
-                    add_char(ch);
-                    retv = get_float();
+                    add_char(s, ch);
+                    retv = get_float(s);
                     finished++;
                 }
                 else
                 {
-                    unget_char(ch); // have a single digit number
+                    fio_unget_char(s->fio, ch); // have a single digit number
                     finished++;
                     retv = INT_TOK;
                 }
                 break;
             case 1: // reading an int
                 if (isdigit(ch))
-                    add_char(ch);
+                    add_char(s, ch);
                 else if (ch == '.')
                 { // single digit infornt of a '.'
-                    add_char(ch);
-                    retv = get_float();
+                    add_char(s, ch);
+                    retv = get_float(s);
                     finished++;
                 }
                 else
                 {
-                    unget_char(ch); // have a single digit number
+                    fio_unget_char(s->fio, ch); // have a single digit number
                     finished++;
                     retv = INT_TOK;
                 }
@@ -899,9 +1030,9 @@ static token_t get_number(void)
         # inside the comment
         #####
 
-    When this is entered, the token_buffer is empty and a "#" has been seen.
+    When this is entered, the s->buffer is empty and a "#" has been seen.
 */
-static void get_comment(void)
+static void get_comment(scanner_t *s)
 {
     int ch;
     int finished = 0;
@@ -909,10 +1040,10 @@ static void get_comment(void)
 
     while (!finished)
     {
-        ch = get_char();
+        ch = fio_get_char(s->fio);
         if (ch == END_FILE || ch == END_INPUT)
         {
-            warning("unexpected end of file encountered reading comment");
+            scan_warning(s, "unexpected end of file encountered reading comment");
             finished++;
         }
         else
@@ -949,7 +1080,7 @@ static void get_comment(void)
             case 5:
                 if (ch != '#')
                 {
-                    unget_char(ch);
+                    fio_unget_char(s->fio, ch);
                     finished++;
                 }
                 break;
@@ -962,68 +1093,76 @@ static void get_comment(void)
 
 /*
  * Unget all of the characters that are in the token buffer, last one first.
+ * If a token has been peeked at, then its characters go back first.
  */
-void unget_token(void) {
+void scanner_unget(scanner_t *s) {
 
     int i;
 
-    INFO("unget symbol: %s", token_buffer);
-    for(i = token_buffer_index-1; i >= 0; i--)
-        unget_char(token_buffer[i]);
-    clear_buffer();
+    INFO("unget symbol: %s", s->buffer);
+    STAT_COUNT(STAT_UNGET_TOKEN, 1);
+    if (s->has_peek) {
+        for(i = s->peek_index-1; i >= 0; i--)
+            fio_unget_char(s->fio, s->peek_buffer[i]);
+        s->has_peek = 0;
+    }
+
+    for(i = s->index-1; i >= 0; i--)
+        fio_unget_char(s->fio, s->buffer[i]);
+    clear_buffer(s);
 }
 
 /*
-    Main entry point to this module. Call this to scan and return a token.
+    Scan the next token from the input into the token buffer.
 */
-token_t get_token(void)
+static token_t scan_token(scanner_t *s)
 {
     ENTER();
     int ch;
     int finished = 0;
     token_t retv;
 
-    clear_buffer();
+    clear_buffer(s);
     while (!finished)
     {
-        ch = get_char();
+        ch = fio_get_char(s->fio);
         switch (CHAR_TYPE(ch))
         {
         case ILLEGAL:
             ERROR("illegal character encountered: 0x%02X. Discarded.", ch);
             break;
         case NUMERIC:
-            add_char(ch);
-            retv = get_number();
+            add_char(s, ch);
+            retv = get_number(s);
             finished++;
             break;
         case SYMCHARS:
-            add_char(ch);
-            retv = get_symbol();
+            add_char(s, ch);
+            retv = get_symbol(s);
             finished++;
             break;
         case SQUOTE:
-            retv = get_squote();
+            retv = get_squote(s);
             finished++;
             break;
         case DQUOTE:
-            retv = get_dquote();
+            retv = get_dquote(s);
             finished++;
             break;
         case HASH:
-            get_comment();
+            get_comment(s);
             break;
         case SINGLES:
-            add_char(ch);
-            retv = get_single();
+            add_char(s, ch);
+            retv = get_single(s);
             finished++;
             break;
         case WHITESP:
             /* do nothing, skip white space */
             break;
         case OPERATORS:
-            add_char(ch);
-            retv = get_operator();
+            add_char(s, ch);
+            retv = get_operator(s);
             finished++;
             break;
         case END_INPUT:
@@ -1039,13 +1178,80 @@ token_t get_token(void)
             break;
         }
     }
-    DEBUG(8, "returning token: %s (%d)", token_buffer, retv);
+    DEBUG(8, "returning token: %s (%d)", s->buffer, retv);
+    STAT_COUNT(STAT_TOKENS, 1);
+    thread_stats.tokens[retv - FIRST_TOK]++;
     VRET(retv);
 }
 
+/*
+    Return the next token. The token that was peeked at, if any, is returned
+    without scanning.
+*/
+token_t scanner_next(scanner_t *s)
+{
+    token_t tok;
+
+    if (s->has_peek)
+    {
+        swap_buffers(s);
+        s->has_peek = 0;
+        return s->peek_tok;
+    }
+
+    PHASE_ENTER(PHASE_SCANNER);
+    tok = scan_token(s);
+    PHASE_LEAVE();
+    return tok;
+}
+
+/*
+    Return the token after the current one without taking it. The string of
+    the current token is not changed.
+*/
+token_t scanner_peek(scanner_t *s)
+{
+    if (!s->has_peek)
+    {
+        swap_buffers(s);
+        PHASE_ENTER(PHASE_SCANNER);
+        s->peek_tok = scan_token(s);
+        PHASE_LEAVE();
+        swap_buffers(s);
+        s->has_peek = 1;
+    }
+    return s->peek_tok;
+}
+
+const char *scanner_string(scanner_t *s)
+{
+    return s->buffer;
+}
+
+/*
+    These use the default scanner of the thread.
+*/
+void unget_token(void)
+{
+    scanner_unget(default_scanner);
+}
+
+/*
+    Main entry point to this module. Call this to scan and return a token.
+*/
+token_t get_token(void)
+{
+    return scanner_next(default_scanner);
+}
+
+token_t peek_token(void)
+{
+    return scanner_peek(default_scanner);
+}
+
 const char *get_token_string(void)
 {
-    return token_buffer;
+    return default_scanner->buffer;
 }
 
 #if _TESTING
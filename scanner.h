@@ -1,6 +1,8 @@
 #ifndef _SCANNER_H_
 #define _SCANNER_H_
 
+#include "file_io.h"
+
 typedef enum
 {
     FIRST_TOK = 2000, // just the number of the first token
@@ -88,10 +90,23 @@ typedef enum
     LAST_TOKEN
 } token_t;
 
+typedef struct scanner_t scanner_t;
+
+// scanner instances, each one reads from its own files
+scanner_t *create_scanner(const char *fname);
+void destroy_scanner(scanner_t *s);
+token_t scanner_next(scanner_t *s);
+token_t scanner_peek(scanner_t *s);
+void scanner_unget(scanner_t *s);
+const char *scanner_string(scanner_t *s);
+file_io_t *scanner_file_io(scanner_t *s);
+
 // must be called before any other scanner function
 void init_scanner(const char *fname);
+void close_scanner(void);
 // These functions are used mostly by the parser
 token_t get_token(void);
+token_t peek_token(void);
 void unget_token(void);
 const char *get_token_string(void);
 
@@ -0,0 +1,330 @@
+/*
+    Find the file for an imported module.
+
+    The module search path is searched in order, similar to the way python
+    handles imports:
+
+        1. the directory of the file that is being compiled
+        2. directories given with -I on the command line
+        3. directories in the TOI_PATH environment variable, separated by ':'
+
+    The first directory that holds a file named after the module with ".toi"
+    appended is used.
+
+    Each directory is read once, the first time that it's searched, and its
+    file names are kept in a table. Finding a module after that does not
+    touch the file system. The directory tables are shared by all of the
+    threads that are compiling. The result of every lookup is also kept,
+    whether the module was found or not, so resolving the same name again in
+    the same compile is a single hash lookup. Call flush_search_path() if the
+    directories may have changed, or refresh_search_path() to read again
+    only the directories whose modification time has changed.
+*/
+#define LOG_MODULE LOG_MOD_MODULES
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <pthread.h>
+
+#include "logging.h"
+#include "hash_table.h"
+#include "search_path.h"
+
+#define FNAME_SIZE 1024
+
+// the directories from the command line and TOI_PATH
+static char **search_dirs = NULL;
+static int num_dirs = 0;
+static int cap_dirs = 0;
+
+/*
+    The file names in a directory that has been read, and the time that the
+    directory was last changed when it was read.
+*/
+typedef struct
+{
+    ht_handle_t files;
+    struct timespec mtime;
+    int stale; // the directory has changed and must be read again
+} dir_entry_t;
+
+// a dir_entry_t for every directory that has been read
+static ht_handle_t dir_cache = NULL;
+static pthread_mutex_t dir_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// the directory of the file being compiled and the modules found for it
+static _Thread_local char *input_dir = NULL;
+static _Thread_local ht_handle_t found = NULL;
+
+// stored in the found table for names that are not on the path
+static char not_found[] = "";
+
+static void free_path(const char *key, void *data, void *arg)
+{
+    (void)key;
+    (void)arg;
+    if (data != not_found)
+        free(data);
+}
+
+static void free_dir(const char *key, void *data, void *arg)
+{
+    dir_entry_t *ent = (dir_entry_t *)data;
+
+    (void)key;
+    (void)arg;
+    destroy_hash_table(ent->files);
+    free(ent);
+}
+
+static void clear_found(void)
+{
+    if (found != NULL)
+    {
+        hash_foreach(found, free_path, NULL);
+        destroy_hash_table(found);
+        found = NULL;
+    }
+}
+
+static void clear_dir_cache(void)
+{
+    pthread_mutex_lock(&dir_lock);
+    if (dir_cache != NULL)
+    {
+        hash_foreach(dir_cache, free_dir, NULL);
+        destroy_hash_table(dir_cache);
+    }
+    dir_cache = create_hash_table(127);
+    pthread_mutex_unlock(&dir_lock);
+}
+
+static void destroy_search_path(void)
+{
+    int i;
+
+    ENTER();
+    for (i = 0; i < num_dirs; i++)
+        free(search_dirs[i]);
+    free(search_dirs);
+    search_dirs = NULL;
+    num_dirs = cap_dirs = 0;
+
+    hash_foreach(dir_cache, free_dir, NULL);
+    destroy_hash_table(dir_cache);
+    dir_cache = NULL;
+    RET();
+}
+
+static void append_dir(const char *dir, int len)
+{
+    if (num_dirs >= cap_dirs)
+    {
+        cap_dirs = (cap_dirs == 0) ? 8 : cap_dirs * 2;
+        if (NULL == (search_dirs = realloc(search_dirs, cap_dirs * sizeof(char *))))
+            FATAL("cannot allocate memory for search path");
+    }
+
+    if (NULL == (search_dirs[num_dirs] = strndup(dir, len)))
+        FATAL("cannot allocate memory for search path");
+
+    INFO("search path: %s", search_dirs[num_dirs]);
+    num_dirs++;
+}
+
+void add_search_path(const char *dir)
+{
+    ENTER();
+    if (*dir != 0)
+        append_dir(dir, strlen(dir));
+    RET();
+}
+
+/*
+    Called once, after the command line has been read and before any
+    compile starts. The contents of TOI_PATH go after the directories given
+    with -I.
+*/
+void init_search_path(void)
+{
+    const char *env, *end;
+
+    ENTER();
+    if (NULL != (env = getenv("TOI_PATH")))
+    {
+        while (*env != 0)
+        {
+            end = strchr(env, ':');
+            if (end == NULL)
+                end = env + strlen(env);
+            if (end > env)
+                append_dir(env, end - env);
+            env = (*end == ':') ? end + 1 : end;
+        }
+    }
+
+    clear_dir_cache();
+    atexit(destroy_search_path);
+    RET();
+}
+
+/*
+    Called at the start of each compile with the name of the file that is
+    being compiled. Its directory is searched first.
+*/
+void init_module_search(const char *fname)
+{
+    const char *end;
+
+    ENTER();
+    destroy_module_search();
+    if (fname != NULL && NULL != (end = strrchr(fname, '/')))
+        input_dir = strndup(fname, (end == fname) ? 1 : end - fname);
+    else
+        input_dir = strdup(".");
+
+    if (input_dir == NULL)
+        FATAL("cannot allocate memory for search path");
+
+    found = create_hash_table(257);
+    RET();
+}
+
+void destroy_module_search(void)
+{
+    ENTER();
+    clear_found();
+    free(input_dir);
+    input_dir = NULL;
+    RET();
+}
+
+/*
+    Return true if the directory has the file. The names of the files in the
+    directory are read the first time. A directory that cannot be read is
+    treated as empty.
+*/
+static int dir_has_file(const char *dir, const char *fname)
+{
+    dir_entry_t *ent;
+    DIR *dp;
+    struct dirent *de;
+    struct stat st;
+    int retv;
+
+    ENTER();
+    pthread_mutex_lock(&dir_lock);
+    if (NULL == (ent = hash_find(dir_cache, dir)))
+    {
+        if (NULL == (ent = calloc(1, sizeof(dir_entry_t))))
+            FATAL("cannot allocate memory for search directory");
+        hash_save(dir_cache, dir, ent);
+        ent->stale = 1;
+    }
+
+    if (ent->stale)
+    {
+        if (ent->files != NULL)
+            destroy_hash_table(ent->files);
+        ent->files = create_hash_table(127);
+        ent->stale = 0;
+        memset(&ent->mtime, 0, sizeof(ent->mtime));
+        if (NULL == (dp = opendir(dir)))
+            INFO("cannot read search directory: %s", dir);
+        else
+        {
+            if (fstat(dirfd(dp), &st) == 0)
+                ent->mtime = st.st_mtim;
+            while (NULL != (de = readdir(dp)))
+                hash_save(ent->files, de->d_name, ent->files);
+            closedir(dp);
+        }
+    }
+
+    retv = (hash_find(ent->files, fname) != NULL);
+    pthread_mutex_unlock(&dir_lock);
+    VRET(retv);
+}
+
+/*
+    Return the name of the file that holds the module or NULL if it's not
+    on the search path.
+*/
+const char *find_module_file(const char *name)
+{
+    char fname[FNAME_SIZE];
+    const char *dir;
+    char *path;
+    int i;
+
+    ENTER();
+    path = hash_find(found, name);
+    if (path != NULL)
+        VRET((path == not_found) ? NULL : path);
+
+    if (strlen(name) + strlen(MODULE_EXT) >= FNAME_SIZE)
+        FATAL("module name is too long: %s", name);
+
+    strcpy(fname, name);
+    strcat(fname, MODULE_EXT);
+    for (i = -1; i < num_dirs; i++)
+    {
+        dir = (i < 0) ? input_dir : search_dirs[i];
+        if (dir_has_file(dir, fname))
+        {
+            if (NULL == (path = malloc(strlen(dir) + strlen(fname) + 2)))
+                FATAL("cannot allocate memory for module file name");
+
+            sprintf(path, "%s/%s", dir, fname);
+            hash_save(found, name, path);
+            INFO("module %s is %s", name, path);
+            VRET(path);
+        }
+    }
+
+    hash_save(found, name, not_found);
+    INFO("module %s is not on the search path", name);
+    VRET(NULL);
+}
+
+/*
+    Forget everything that has been read from the search directories.
+*/
+void flush_search_path(void)
+{
+    ENTER();
+    clear_dir_cache();
+    clear_found();
+    found = create_hash_table(257);
+    RET();
+}
+
+static void check_dir(const char *key, void *data, void *arg)
+{
+    dir_entry_t *ent = (dir_entry_t *)data;
+    struct stat st;
+
+    (void)arg;
+    if (stat(key, &st) != 0 || st.st_mtim.tv_sec != ent->mtime.tv_sec || st.st_mtim.tv_nsec != ent->mtime.tv_nsec)
+    {
+        INFO("search directory %s has changed", key);
+        ent->stale = 1;
+    }
+}
+
+/*
+    Read the directories that have changed since they were read again the
+    next time that they are searched. A file that is added to a directory,
+    removed or renamed changes the time of the directory, so the ones that
+    have not changed stay cached.
+*/
+void refresh_search_path(void)
+{
+    ENTER();
+    pthread_mutex_lock(&dir_lock);
+    hash_foreach(dir_cache, check_dir, NULL);
+    pthread_mutex_unlock(&dir_lock);
+    RET();
+}
@@ -0,0 +1,15 @@
+#ifndef _SEARCH_PATH_H_
+#define _SEARCH_PATH_H_
+
+// the extension of a module source file
+#define MODULE_EXT ".toi"
+
+void init_search_path(void);
+void add_search_path(const char *dir);
+void init_module_search(const char *fname);
+void destroy_module_search(void);
+const char *find_module_file(const char *name);
+void flush_search_path(void);
+void refresh_search_path(void);
+
+#endif /* _SEARCH_PATH_H_ */
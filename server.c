@@ -0,0 +1,305 @@
+/*
+    Compile server.
+
+    Starting the compiler for every file costs more than compiling the file
+    when the imports are large. In server mode the compiler listens on a
+    Unix domain socket and compiles the files that clients send to it. The
+    modules, the symbol table and the search path directories stay in memory
+    between requests, so only the files that have changed since the last
+    request are parsed again. See rebuild_modules(). A search directory is
+    only read again if its modification time has changed, which happens
+    when a module is added to it or removed from it.
+
+    A request is a list of file names, each one terminated by a nul, and the
+    list is terminated by an empty name. The client sends absolute names
+    because the server does not run in the client's directory. The reply is
+    everything that the compiler printed while it compiled the files, then a
+    nul and the exit status as one byte. Diagnostics never contain a nul.
+
+    Requests are handled one at a time in the order that they arrive. The
+    files given in one request are compiled one after the other, the same
+    as the command line without -j. Only one file can use the top level
+    context, so the file that was compiled before is released when a
+    different one is compiled.
+
+    The client falls back to compiling in its own process if the server is
+    not running.
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "logging.h"
+#include "errors.h"
+#include "buffer.h"
+#include "modules.h"
+#include "import_def.h"
+#include "search_path.h"
+#include "server.h"
+
+static volatile sig_atomic_t stop_server = 0;
+
+// the file that owns the top level context
+static module_t *root_module = NULL;
+
+static void on_signal(int sig)
+{
+    (void)sig;
+    stop_server = 1;
+}
+
+static int make_address(const char *path, struct sockaddr_un *addr)
+{
+    memset(addr, 0, sizeof(*addr));
+    addr->sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(addr->sun_path))
+        return -1;
+
+    strcpy(addr->sun_path, path);
+    return 0;
+}
+
+static int write_all(int fd, const void *data, size_t size)
+{
+    const char *ptr = data;
+    ssize_t len;
+
+    while (size > 0)
+    {
+        if ((len = write(fd, ptr, size)) < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+        ptr += len;
+        size -= len;
+    }
+    return 0;
+}
+
+/*
+    Read a request into the buffer. Returns the number of file names or -1
+    if the request is not complete.
+*/
+static int read_request(int fd, buffer_t *req)
+{
+    char buf[4096];
+    ssize_t len;
+    size_t i, start;
+    int count;
+
+    while ((len = read(fd, buf, sizeof(buf))) != 0)
+    {
+        if (len < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+        buffer_add(req, buf, len);
+
+        // the request ends with an empty name
+        count = 0;
+        for (i = start = 0; i < req->len; i++)
+        {
+            if (req->buf[i] == 0)
+            {
+                if (i == start)
+                    return count;
+                count++;
+                start = i + 1;
+            }
+        }
+    }
+    return -1;
+}
+
+/*
+    Compile one file with whatever is already in memory.
+*/
+static void compile_warm(const char *fname)
+{
+    module_t *mod;
+
+    ENTER();
+    init_module_search(fname);
+    mod = find_module(fname);
+    if (root_module != NULL && root_module != mod)
+    {
+        INFO("releasing %s", root_module->name);
+        release_file(root_module);
+    }
+
+    // the errors are reported to every client
+    rebuild_modules(1);
+    root_module = compile_file(fname);
+    RET();
+}
+
+/*
+    Compile the files in the request with stdout sent to the client.
+*/
+static void serve_request(int fd)
+{
+    buffer_t req = {0};
+    const char *fname;
+    char status;
+    int saved_fd, count, i;
+
+    ENTER();
+    if ((count = read_request(fd, &req)) < 0)
+    {
+        INFO("incomplete request");
+        buffer_free(&req);
+        RET();
+    }
+
+    // the log messages so far go to the server's stdout
+    flush_logging();
+    fflush(stdout);
+    saved_fd = dup(STDOUT_FILENO);
+    dup2(fd, STDOUT_FILENO);
+
+    reset_errors();
+    refresh_search_path();
+    for (i = 0, fname = req.buf; i < count; i++, fname += strlen(fname) + 1)
+        compile_warm(fname);
+
+    status = (error_count() > 0) ? 1 : 0;
+    flush_diagnostics();
+    flush_logging();
+    fflush(stdout);
+    dup2(saved_fd, STDOUT_FILENO);
+    close(saved_fd);
+
+    write_all(fd, "", 1);
+    write_all(fd, &status, 1);
+    INFO("compiled %d files with %d errors", count, error_count());
+    buffer_free(&req);
+    RET();
+}
+
+/*
+    Listen on the socket and compile files until the process is told to
+    stop. The per compile state must already be set up in this thread.
+*/
+int run_server(const char *path)
+{
+    struct sockaddr_un addr;
+    struct sigaction sa;
+    int sock, fd;
+
+    ENTER();
+    if (make_address(path, &addr) < 0)
+    {
+        fprintf(stderr, "socket name is too long: %s\n", path);
+        VRET(1);
+    }
+
+    if ((sock = socket(AF_UNIX, SOCK_STREAM, 0)) < 0)
+    {
+        fprintf(stderr, "cannot create socket: %s\n", strerror(errno));
+        VRET(1);
+    }
+
+    // a socket left behind by a server that did not exit cleanly
+    unlink(path);
+    if (bind(sock, (struct sockaddr *)&addr, sizeof(addr)) < 0 || listen(sock, 16) < 0)
+    {
+        fprintf(stderr, "cannot listen on %s: %s\n", path, strerror(errno));
+        close(sock);
+        VRET(1);
+    }
+
+    // accept() has to be interrupted by the signal, so no SA_RESTART
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = on_signal;
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+    // a client that goes away must not end the server
+    signal(SIGPIPE, SIG_IGN);
+
+    INFO("listening on %s", path);
+    while (!stop_server)
+    {
+        if ((fd = accept(sock, NULL, NULL)) < 0)
+        {
+            if (errno != EINTR)
+                ERROR("accept failed: %s", strerror(errno));
+            continue;
+        }
+        serve_request(fd);
+        close(fd);
+    }
+
+    INFO("server stopped");
+    close(sock);
+    unlink(path);
+    VRET(0);
+}
+
+/*
+    Send the files to the server and copy the reply to stdout. Returns the
+    exit status from the server, or -1 if the server cannot be reached.
+*/
+int client_compile(const char *path, char **files, int num_files)
+{
+    struct sockaddr_un addr;
+    char buf[4096], full[PATH_MAX];
+    const char *fname;
+    ssize_t len;
+    int sock, i, status = -1, done = 0;
+
+    if (make_address(path, &addr) < 0)
+        return -1;
+
+    if ((sock = socket(AF_UNIX, SOCK_STREAM, 0)) < 0)
+        return -1;
+
+    if (connect(sock, (struct sockaddr *)&addr, sizeof(addr)) < 0)
+    {
+        close(sock);
+        return -1;
+    }
+
+    for (i = 0; i < num_files; i++)
+    {
+        // a file that does not exist is reported by the server
+        fname = (realpath(files[i], full) != NULL) ? full : files[i];
+        write_all(sock, fname, strlen(fname) + 1);
+    }
+    write_all(sock, "", 1);
+
+    while (status < 0 && (len = read(sock, buf, sizeof(buf))) != 0)
+    {
+        if (len < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            break;
+        }
+
+        for (i = 0; i < len && !done; i++)
+            if (buf[i] == 0)
+                done = 1;
+
+        fwrite(buf, 1, done ? i - 1 : len, stdout);
+        if (done && i < len)
+            status = (unsigned char)buf[i];
+        else if (done && read(sock, buf, 1) == 1)
+            status = (unsigned char)buf[0];
+        else if (done)
+            break;
+    }
+
+    close(sock);
+    // the server went away before it finished
+    return (status < 0) ? 1 : status;
+}
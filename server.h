@@ -0,0 +1,7 @@
+#ifndef _SERVER_H_
+#define _SERVER_H_
+
+int run_server(const char *path);
+int client_compile(const char *path, char **files, int num_files);
+
+#endif /* _SERVER_H_ */
@@ -0,0 +1,197 @@
+/*
+    Function signatures and overloads.
+
+    A function is stored in the symbol table under its name decorated with
+    the types of its inputs and its outputs, as in @@shape@area(float)(float),
+    so functions with the same name and different parameters are different
+    symbols. The decoration is the signature of the function.
+
+    Signatures are interned. The string and its hash are made once and the
+    same signature_t is returned every time that the same signature is
+    interned in the compile, so two signatures are equal if their pointers
+    are equal. The overloads of a function are listed under its undecorated
+    name, and finding the one for a signature is a lookup of the name and a
+    pointer compare for each overload. A call site can intern the signature
+    of its arguments once and never build a decorated name.
+*/
+#define LOG_MODULE LOG_MOD_SYMBOLS
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "logging.h"
+#include "hash_table.h"
+#include "symbols.h"
+#include "signature.h"
+
+typedef struct _overload_t_
+{
+    struct _overload_t_ *next;
+    const signature_t *sig;
+    char *name; // the decorated name of the function
+} overload_t;
+
+// each thread compiles with its own signatures
+static _Thread_local ht_handle_t signatures = NULL;
+static _Thread_local ht_handle_t overloads = NULL;
+
+void init_signatures(void)
+{
+    signatures = create_hash_table(127);
+    overloads = create_hash_table(1223);
+}
+
+static void free_signature(const char *key, void *data, void *arg)
+{
+    signature_t *sig = (signature_t *)data;
+
+    (void)key;
+    (void)arg;
+    free((void *)sig->str);
+    free(sig);
+}
+
+static void free_overloads(const char *key, void *data, void *arg)
+{
+    overload_t *ov, *next;
+
+    (void)key;
+    (void)arg;
+    for (ov = (overload_t *)data; ov != NULL; ov = next)
+    {
+        next = ov->next;
+        free(ov->name);
+        free(ov);
+    }
+}
+
+void destroy_signatures(void)
+{
+    ENTER();
+    hash_foreach(signatures, free_signature, NULL);
+    destroy_hash_table(signatures);
+    hash_foreach(overloads, free_overloads, NULL);
+    destroy_hash_table(overloads);
+    signatures = overloads = NULL;
+    RET();
+}
+
+/*
+    Return the signature for the string, which has the form
+    "(type,type...)(type,type...)".
+*/
+const signature_t *intern_signature(const char *str)
+{
+    signature_t *sig;
+    const char *ptr;
+    int group = 0;
+
+    if (NULL != (sig = hash_find(signatures, str)))
+        return sig;
+
+    if (NULL == (sig = calloc(1, sizeof(signature_t))) || NULL == (sig->str = strdup(str)))
+        FATAL("cannot allocate memory for signature");
+    sig->hash = make_hash(str);
+
+    // a parameter is a type followed by a ',' or a ')'
+    for (ptr = str; *ptr != 0; ptr++)
+    {
+        if (*ptr == '(')
+            group++;
+        else if ((*ptr == ',' || *ptr == ')') && ptr[-1] != '(')
+        {
+            if (group == 1)
+                sig->num_inputs++;
+            else
+                sig->num_outputs++;
+        }
+    }
+
+    hash_save(signatures, str, sig);
+    DEBUG(5, "signature %s hash %08X", sig->str, sig->hash);
+    return sig;
+}
+
+/*
+    Add a function to the overloads of its undecorated name. The name is
+    the decorated name of the function.
+*/
+void add_overload(const char *name, const signature_t *sig)
+{
+    overload_t *ov, *list;
+    size_t len = strlen(name);
+    char *base;
+
+    if (len < strlen(sig->str) || strcmp(&name[len - strlen(sig->str)], sig->str))
+    {
+        INTERNAL("%s is not decorated with %s", name, sig->str);
+        return;
+    }
+
+    if (NULL == (base = strndup(name, len - strlen(sig->str))))
+        FATAL("cannot allocate memory for overload");
+
+    list = hash_find(overloads, base);
+    for (ov = list; ov != NULL; ov = ov->next)
+    {
+        // a module that is parsed again adds its functions again
+        if (ov->sig == sig)
+        {
+            free(base);
+            return;
+        }
+    }
+
+    if (NULL == (ov = calloc(1, sizeof(overload_t))) || NULL == (ov->name = strdup(name)))
+        FATAL("cannot allocate memory for overload");
+    ov->sig = sig;
+    if (list == NULL)
+        hash_save(overloads, base, ov);
+    else
+    {
+        // the head of the list stays in the table
+        ov->next = list->next;
+        list->next = ov;
+    }
+    free(base);
+}
+
+/*
+    Return the decorated name of the overload of the function that has the
+    signature, or NULL if there is none.
+*/
+const char *find_overload(const char *name, const signature_t *sig)
+{
+    overload_t *ov;
+
+    for (ov = hash_find(overloads, name); ov != NULL; ov = ov->next)
+    {
+        // the function is not defined anymore if its module was parsed again
+        // and the function was taken out
+        if (ov->sig == sig)
+            return check_symbol(ov->name) ? ov->name : NULL;
+    }
+    return NULL;
+}
+
+/*
+    Return the decorated name of the overload of the function whose inputs
+    are the types in the string, which has the form "(type,type...)", or
+    NULL if there is none. This is how a call finds the function, since the
+    outputs are not known at the call.
+*/
+const char *find_overload_inputs(const char *name, const char *inputs, const signature_t **sig)
+{
+    overload_t *ov;
+    size_t len = strlen(inputs);
+
+    for (ov = hash_find(overloads, name); ov != NULL; ov = ov->next)
+    {
+        if (!strncmp(ov->sig->str, inputs, len) && ov->sig->str[len] == '(' && check_symbol(ov->name))
+        {
+            *sig = ov->sig;
+            return ov->name;
+        }
+    }
+    return NULL;
+}
@@ -0,0 +1,25 @@
+#ifndef _SIGNATURE_H_
+#define _SIGNATURE_H_
+
+#include <stdint.h>
+
+/*
+    The types of the inputs and the outputs of a function, as in
+    "(int,str)(float)". There is one of each signature in a compile.
+*/
+typedef struct
+{
+    const char *str;
+    uint32_t hash;
+    uint16_t num_inputs;
+    uint16_t num_outputs;
+} signature_t;
+
+void init_signatures(void);
+void destroy_signatures(void);
+const signature_t *intern_signature(const char *str);
+void add_overload(const char *name, const signature_t *sig);
+const char *find_overload(const char *name, const signature_t *sig);
+const char *find_overload_inputs(const char *name, const char *inputs, const signature_t **sig);
+
+#endif /* _SIGNATURE_H_ */
@@ -0,0 +1,412 @@
+/*
+    Symbol table snapshots.
+
+    At the end of a compile the whole symbol table can be written to a
+    snapshot file. Tools open the snapshot with mmap() and look symbols up in
+    place, without running the scanner or the parser and without building a
+    symbol table in memory.
+
+    The file holds no pointers. Every reference is an index or an offset
+    from the start of the section that it refers to, so the file can be
+    mapped at any address.
+
+        header
+        buckets     uint32_t[num_buckets] first symbol in the bucket plus one
+        symbols     snap_symbol_t[num_symbols]
+        attributes  snap_attr_t[num_attrs]
+        data        the raw attribute data, each one aligned to 4 bytes
+        strings     nul terminated strings, each one is stored once
+
+    The buckets are a hash index on the decorated symbol names, using the
+    same hash as the symbol table.
+*/
+#define LOG_MODULE LOG_MOD_MODULES
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "logging.h"
+#include "hash_table.h"
+#include "buffer.h"
+#include "symbols.h"
+#include "sym_attrs.h"
+#include "expr.h"
+#include "snapshot.h"
+
+#define SNAPSHOT_MAGIC "TOIS"
+#define SNAPSHOT_VERSION 2
+
+typedef struct
+{
+    char magic[4];
+    uint32_t version;
+    uint32_t num_buckets;
+    uint32_t num_symbols;
+    uint32_t num_attrs;
+    uint32_t data_size;
+    uint32_t pool_size;
+    uint32_t reserved;
+} snap_header_t;
+
+typedef struct
+{
+    uint32_t name; // string offset of the decorated symbol name
+    uint32_t hash; // make_hash() of the name
+    uint32_t next; // next symbol in the bucket plus one
+    uint32_t first_attr;
+    uint32_t num_attrs;
+} snap_symbol_t;
+
+typedef struct
+{
+    uint32_t type;   // sym_attr_t
+    uint32_t size;   // number of bytes of data
+    uint32_t offset; // offset in the data section
+} snap_attr_t;
+
+struct snapshot_t
+{
+    void *base;
+    size_t size;
+    const snap_header_t *hdr;
+    const uint32_t *buckets;
+    const snap_symbol_t *symbols;
+    const snap_attr_t *attrs;
+    const char *data;
+    const char *pool;
+};
+
+typedef struct
+{
+    buffer_t symbols;
+    buffer_t attrs;
+    buffer_t data;
+    buffer_t pool;
+    ht_handle_t strs;
+    uint32_t num_symbols;
+    uint32_t num_attrs;
+} snap_writer_t;
+
+static void write_symbol(const char *name, void *arg)
+{
+    snap_writer_t *w = (snap_writer_t *)arg;
+    snap_symbol_t sym;
+    snap_attr_t attr;
+    static const char zeros[4] = {0};
+    void *ptr;
+    int type;
+
+    sym.name = pool_add(&w->pool, w->strs, name);
+    sym.hash = make_hash(name);
+    sym.next = 0;
+    sym.first_attr = w->num_attrs;
+    sym.num_attrs = 0;
+    for (type = 0; type < NUM_SYMBOL_ATTRS; type++)
+    {
+        if (NULL != (ptr = get_symbol_attr(name, type)))
+        {
+            attr.type = type;
+            attr.size = get_symbol_attr_size(name, type);
+            attr.offset = w->data.len;
+            buffer_add(&w->data, ptr, attr.size);
+            // the data is read in place, so every attribute is aligned
+            buffer_add(&w->data, zeros, (4 - attr.size % 4) % 4);
+            buffer_add(&w->attrs, &attr, sizeof(attr));
+            sym.num_attrs++;
+            w->num_attrs++;
+        }
+    }
+    buffer_add(&w->symbols, &sym, sizeof(sym));
+    w->num_symbols++;
+}
+
+/*
+    Write the symbol table to a snapshot file. Failure to write the file is
+    reported, but it does not stop the compile.
+*/
+void save_snapshot(const char *fname)
+{
+    char tname[1024 + 8];
+    snap_writer_t w;
+    snap_header_t hdr;
+    snap_symbol_t *syms;
+    uint32_t *buckets;
+    uint32_t i, b;
+    FILE *fp;
+    int failed;
+
+    ENTER();
+    memset(&w, 0, sizeof(w));
+    w.strs = create_hash_table(1223);
+    foreach_symbol(write_symbol, &w);
+
+    // about two symbols per bucket, always odd
+    memset(&hdr, 0, sizeof(hdr));
+    memcpy(hdr.magic, SNAPSHOT_MAGIC, sizeof(hdr.magic));
+    hdr.version = SNAPSHOT_VERSION;
+    hdr.num_buckets = (w.num_symbols / 2) | 1;
+    hdr.num_symbols = w.num_symbols;
+    hdr.num_attrs = w.num_attrs;
+    hdr.data_size = w.data.len;
+    hdr.pool_size = w.pool.len;
+
+    if (NULL == (buckets = calloc(hdr.num_buckets, sizeof(uint32_t))))
+        FATAL("cannot allocate memory for snapshot index");
+
+    syms = (snap_symbol_t *)w.symbols.buf;
+    for (i = 0; i < w.num_symbols; i++)
+    {
+        b = syms[i].hash % hdr.num_buckets;
+        syms[i].next = buckets[b];
+        buckets[b] = i + 1;
+    }
+
+    if (strlen(fname) > 1024)
+        FATAL("snapshot file name is too long: %s", fname);
+
+    sprintf(tname, "%s.tmp", fname);
+    if (NULL == (fp = fopen(tname, "wb")))
+        ERROR("cannot write snapshot file %s: %s", tname, strerror(errno));
+    else
+    {
+        fwrite(&hdr, sizeof(hdr), 1, fp);
+        fwrite(buckets, sizeof(uint32_t), hdr.num_buckets, fp);
+        fwrite(w.symbols.buf, 1, w.symbols.len, fp);
+        fwrite(w.attrs.buf, 1, w.attrs.len, fp);
+        fwrite(w.data.buf, 1, w.data.len, fp);
+        fwrite(w.pool.buf, 1, w.pool.len, fp);
+        failed = ferror(fp);
+        if (fclose(fp) != 0)
+            failed = 1;
+
+        if (failed || rename(tname, fname) != 0)
+        {
+            ERROR("cannot write snapshot file %s: %s", fname, strerror(errno));
+            remove(tname);
+        }
+        else
+            INFO("wrote %u symbols to snapshot %s", w.num_symbols, fname);
+    }
+
+    free(buckets);
+    buffer_free(&w.symbols);
+    buffer_free(&w.attrs);
+    buffer_free(&w.data);
+    buffer_free(&w.pool);
+    destroy_hash_table(w.strs);
+    RET();
+}
+
+/*
+    Verify that every index and offset in the file is in range.
+*/
+static int check_snapshot(snapshot_t *snap)
+{
+    const snap_header_t *hdr = snap->hdr;
+    size_t need;
+    uint32_t i;
+
+    if (snap->size < sizeof(snap_header_t))
+        return 0;
+
+    if (memcmp(hdr->magic, SNAPSHOT_MAGIC, sizeof(hdr->magic)) || hdr->version != SNAPSHOT_VERSION)
+        return 0;
+
+    need = sizeof(snap_header_t) +
+           (size_t)hdr->num_buckets * sizeof(uint32_t) +
+           (size_t)hdr->num_symbols * sizeof(snap_symbol_t) +
+           (size_t)hdr->num_attrs * sizeof(snap_attr_t) +
+           hdr->data_size + hdr->pool_size;
+    if (need != snap->size || hdr->num_buckets == 0)
+        return 0;
+
+    snap->buckets = (const uint32_t *)(hdr + 1);
+    snap->symbols = (const snap_symbol_t *)(snap->buckets + hdr->num_buckets);
+    snap->attrs = (const snap_attr_t *)(snap->symbols + hdr->num_symbols);
+    snap->data = (const char *)(snap->attrs + hdr->num_attrs);
+    snap->pool = snap->data + hdr->data_size;
+
+    if (hdr->pool_size > 0 && snap->pool[hdr->pool_size - 1] != 0)
+        return 0;
+
+    for (i = 0; i < hdr->num_buckets; i++)
+        if (snap->buckets[i] > hdr->num_symbols)
+            return 0;
+
+    for (i = 0; i < hdr->num_symbols; i++)
+        if (snap->symbols[i].name >= hdr->pool_size ||
+            snap->symbols[i].next > hdr->num_symbols ||
+            snap->symbols[i].first_attr > hdr->num_attrs ||
+            snap->symbols[i].num_attrs > hdr->num_attrs - snap->symbols[i].first_attr)
+            return 0;
+
+    for (i = 0; i < hdr->num_attrs; i++)
+        if (snap->attrs[i].type >= NUM_SYMBOL_ATTRS ||
+            snap->attrs[i].offset > hdr->data_size ||
+            snap->attrs[i].size > hdr->data_size - snap->attrs[i].offset)
+            return 0;
+
+    return 1;
+}
+
+/*
+    Map a snapshot into memory. Returns NULL if the file does not exist or
+    is not a valid snapshot.
+*/
+snapshot_t *open_snapshot(const char *fname)
+{
+    snapshot_t *snap;
+    struct stat st;
+    int fd;
+
+    ENTER();
+    if ((fd = open(fname, O_RDONLY)) < 0)
+    {
+        INFO("cannot open snapshot %s: %s", fname, strerror(errno));
+        VRET(NULL);
+    }
+
+    if (fstat(fd, &st) < 0 || st.st_size == 0)
+    {
+        close(fd);
+        VRET(NULL);
+    }
+
+    if (NULL == (snap = calloc(1, sizeof(snapshot_t))))
+        FATAL("cannot allocate memory for snapshot");
+
+    snap->size = st.st_size;
+    snap->base = mmap(NULL, snap->size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (snap->base == MAP_FAILED)
+    {
+        free(snap);
+        VRET(NULL);
+    }
+
+    snap->hdr = (const snap_header_t *)snap->base;
+    if (!check_snapshot(snap))
+    {
+        INFO("snapshot %s is not valid", fname);
+        close_snapshot(snap);
+        VRET(NULL);
+    }
+
+    INFO("opened snapshot %s with %u symbols", fname, snap->hdr->num_symbols);
+    VRET(snap);
+}
+
+void close_snapshot(snapshot_t *snap)
+{
+    ENTER();
+    if (snap != NULL)
+    {
+        munmap(snap->base, snap->size);
+        free(snap);
+    }
+    RET();
+}
+
+int snapshot_num_symbols(snapshot_t *snap)
+{
+    return snap->hdr->num_symbols;
+}
+
+/*
+    Return the index of the symbol or -1 if it's not in the snapshot.
+*/
+int snapshot_find(snapshot_t *snap, const char *sym)
+{
+    uint32_t hash = make_hash(sym);
+    uint32_t idx;
+
+    for (idx = snap->buckets[hash % snap->hdr->num_buckets]; idx != 0; idx = snap->symbols[idx - 1].next)
+    {
+        if (snap->symbols[idx - 1].hash == hash &&
+            !strcmp(sym, &snap->pool[snap->symbols[idx - 1].name]))
+            return idx - 1;
+    }
+    return -1;
+}
+
+const char *snapshot_name(snapshot_t *snap, int idx)
+{
+    return &snap->pool[snap->symbols[idx].name];
+}
+
+/*
+    Return a pointer to the attribute data in the mapped file or NULL if the
+    symbol does not have the attribute.
+*/
+const void *snapshot_attr(snapshot_t *snap, int idx, sym_attr_t type, unsigned int *size)
+{
+    const snap_symbol_t *sym = &snap->symbols[idx];
+    uint32_t i;
+
+    for (i = sym->first_attr; i < sym->first_attr + sym->num_attrs; i++)
+    {
+        if (snap->attrs[i].type == (uint32_t)type)
+        {
+            if (size != NULL)
+                *size = snap->attrs[i].size;
+            return &snap->data[snap->attrs[i].offset];
+        }
+    }
+    return NULL;
+}
+
+static const char *attr_val_str(const void *data)
+{
+    static const char *strs[] = {
+        "class", "func", "class var", "var",
+        "public", "private", "protected",
+        "int", "uint", "float", "str", "complex"};
+    sym_attr_val_t val;
+
+    memcpy(&val, data, sizeof(val));
+    if ((unsigned)val < sizeof(strs) / sizeof(strs[0]))
+        return strs[val];
+    return "unknown";
+}
+
+/*
+    Print the symbol and its attributes on one line.
+*/
+void print_snapshot_symbol(snapshot_t *snap, int idx)
+{
+    const void *data;
+    const char *ptr, *sep;
+    unsigned int size;
+    buffer_t text = {0};
+
+    printf("%s", snapshot_name(snap, idx));
+    if (NULL != (data = snapshot_attr(snap, idx, SYMBOL_TYPE_ATTR, NULL)))
+        printf(" kind=%s", attr_val_str(data));
+    if (NULL != (data = snapshot_attr(snap, idx, SYM_TYPEOF_ATTR, NULL)))
+        printf(" type=%s", attr_val_str(data));
+    if (NULL != (data = snapshot_attr(snap, idx, COMPLEX_TYPEOF_ATTR, NULL)))
+        printf(" typeof=%s", (const char *)data);
+    if (NULL != (data = snapshot_attr(snap, idx, SYMBOL_SCOPE_ATTR, NULL)))
+        printf(" scope=%s", attr_val_str(data));
+    if (NULL != (data = snapshot_attr(snap, idx, FUNC_SIGNATURE_ATTR, NULL)))
+        printf(" signature=%s", (const char *)data);
+    if (NULL != (data = snapshot_attr(snap, idx, CLASS_BASES_ATTR, &size)))
+    {
+        // the names are nul separated
+        for (ptr = data, sep = " inherits="; ptr < (const char *)data + size; ptr += strlen(ptr) + 1, sep = ",")
+            printf("%s%s", sep, ptr);
+    }
+    if (NULL != (data = snapshot_attr(snap, idx, SYMBOL_ASSIGMENT_EXPR_ATTR, NULL)))
+    {
+        expr_to_str((const expr_t *)data, &text);
+        printf(" value=%s", text.buf);
+        buffer_free(&text);
+    }
+    printf("\n");
+}
@@ -0,0 +1,17 @@
+#ifndef _SNAPSHOT_H_
+#define _SNAPSHOT_H_
+
+#include "sym_attrs.h"
+
+typedef struct snapshot_t snapshot_t;
+
+void save_snapshot(const char *fname);
+snapshot_t *open_snapshot(const char *fname);
+void close_snapshot(snapshot_t *snap);
+int snapshot_num_symbols(snapshot_t *snap);
+int snapshot_find(snapshot_t *snap, const char *sym);
+const char *snapshot_name(snapshot_t *snap, int idx);
+const void *snapshot_attr(snapshot_t *snap, int idx, sym_attr_t type, unsigned int *size);
+void print_snapshot_symbol(snapshot_t *snap, int idx);
+
+#endif /* _SNAPSHOT_H_ */
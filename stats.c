@@ -0,0 +1,342 @@
+/*
+    Timers and counters for --stats.
+
+    The time of a compile is split into phases. The phases nest, so the
+    scanner runs inside the parser and file io runs inside the scanner.
+    Every phase is given only the time that was spent in it and not in a
+    phase below it, so the phases add up to the total time.
+
+    There are millions of phase changes in a large compile, and reading the
+    thread's CPU clock is a system call, so the phases are not timed
+    directly. A phase change only pushes or pops the phase stack of the
+    thread. When stats are enabled, two timers interrupt the thread every
+    SAMPLE_USEC microseconds, one of wall time and one of the thread's CPU
+    time, and the phase on top of the stack gets the sample. The wall and
+    CPU time of the whole compile are measured exactly and divided between
+    the phases by their share of the samples. A compile that runs for less
+    than a few milliseconds gets only a few samples.
+
+    The counters are a single add to a thread local variable and are always
+    kept. Every thread keeps its own numbers, and stats_end() adds them to
+    the totals for the program when a compile is finished.
+
+    Allocations are counted by wrapping malloc() and friends at link time
+    with -Wl,--wrap, see the Makefile. Only the allocations made by the
+    compiler itself are counted, not the ones made inside the C library.
+*/
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "logging.h"
+#include "errors.h"
+#include "stats.h"
+
+#define SAMPLE_USEC 100
+
+// older C libraries only have the union member for the thread of a timer
+#ifndef sigev_notify_thread_id
+#define sigev_notify_thread_id _sigev_un._tid
+#endif
+
+int stats_enabled = 0;
+_Thread_local stats_t thread_stats;
+_Thread_local phase_t phase_stack[PHASE_STACK_SIZE];
+_Thread_local int phase_index = 0;
+
+static stats_t total_stats;
+static pthread_mutex_t stats_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_once_t sampler_once = PTHREAD_ONCE_INIT;
+
+static _Thread_local timer_t wall_timer;
+static _Thread_local timer_t cpu_timer;
+static _Thread_local uint64_t start_wall;
+static _Thread_local uint64_t start_cpu;
+
+static const char *phase_names[] = {
+    "other",
+    "file io",
+    "scanner",
+    "hash table",
+    "parser",
+    "interface",
+};
+
+static const char *counter_names[] = {
+    "files",
+    "bytes read",
+    "bytes hashed",
+    "tokens",
+    "unget_token calls",
+    "hash lookups",
+    "hash probes",
+    "hash collisions",
+    "symbols created",
+    "allocations",
+    "allocated bytes",
+    "inline cache hits",
+    "inline cache misses",
+};
+
+static inline uint64_t read_clock(clockid_t clk)
+{
+    struct timespec ts;
+
+    clock_gettime(clk, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/*
+    Give the sample to the phase that is running. The signal is sent to the
+    thread that owns the timer.
+*/
+static void on_sample(int sig, siginfo_t *info, void *ctx)
+{
+    phase_t phase;
+
+    (void)sig;
+    (void)ctx;
+    if (info->si_code != SI_TIMER)
+        return;
+
+    phase = phase_stack[(phase_index < PHASE_STACK_SIZE) ? phase_index : PHASE_STACK_SIZE - 1];
+    if (info->si_value.sival_int)
+        thread_stats.wall_samples[phase]++;
+    else
+        thread_stats.cpu_samples[phase]++;
+}
+
+static void init_sampler(void)
+{
+    struct sigaction sa;
+
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_sigaction = on_sample;
+    // reads and opens that are interrupted by a sample carry on
+    sa.sa_flags = SA_SIGINFO | SA_RESTART;
+    sigemptyset(&sa.sa_mask);
+    sigaction(SIGPROF, &sa, NULL);
+}
+
+static void start_timer(timer_t *timer, clockid_t clk, int is_wall)
+{
+    struct sigevent sev;
+    struct itimerspec its;
+
+    memset(&sev, 0, sizeof(sev));
+    sev.sigev_notify = SIGEV_THREAD_ID;
+    sev.sigev_signo = SIGPROF;
+    sev.sigev_value.sival_int = is_wall;
+    sev.sigev_notify_thread_id = gettid();
+    if (timer_create(clk, &sev, timer) != 0)
+        FATAL("cannot create the stats timer");
+
+    memset(&its, 0, sizeof(its));
+    its.it_interval.tv_nsec = SAMPLE_USEC * 1000;
+    its.it_value.tv_nsec = SAMPLE_USEC * 1000;
+    timer_settime(*timer, 0, &its, NULL);
+}
+
+/*
+    Start the numbers for a compile.
+*/
+void stats_begin(void)
+{
+    memset(&thread_stats, 0, sizeof(thread_stats));
+    phase_index = 0;
+    phase_stack[0] = PHASE_OTHER;
+    if (stats_enabled)
+    {
+        pthread_once(&sampler_once, init_sampler);
+        start_wall = read_clock(CLOCK_MONOTONIC);
+        start_cpu = read_clock(CLOCK_THREAD_CPUTIME_ID);
+        start_timer(&wall_timer, CLOCK_MONOTONIC, 1);
+        start_timer(&cpu_timer, CLOCK_THREAD_CPUTIME_ID, 0);
+    }
+}
+
+/*
+    Divide the time between the phases by their share of the samples. The
+    time goes to PHASE_OTHER if there were no samples.
+*/
+static void divide_time(uint64_t *time, const uint64_t *samples, uint64_t total)
+{
+    uint64_t count = 0;
+    int i;
+
+    for (i = 0; i < NUM_PHASES; i++)
+        count += samples[i];
+
+    for (i = 0; i < NUM_PHASES; i++)
+        time[i] = (count == 0) ? ((i == PHASE_OTHER) ? total : 0) : (uint64_t)((double)total * samples[i] / count);
+}
+
+/*
+    Add the numbers for the compile that has finished to the totals.
+*/
+void stats_end(void)
+{
+    int i;
+
+    if (stats_enabled)
+    {
+        timer_delete(wall_timer);
+        timer_delete(cpu_timer);
+        divide_time(thread_stats.wall, thread_stats.wall_samples, read_clock(CLOCK_MONOTONIC) - start_wall);
+        divide_time(thread_stats.cpu, thread_stats.cpu_samples, read_clock(CLOCK_THREAD_CPUTIME_ID) - start_cpu);
+    }
+
+    pthread_mutex_lock(&stats_lock);
+    for (i = 0; i < NUM_PHASES; i++)
+    {
+        total_stats.wall[i] += thread_stats.wall[i];
+        total_stats.cpu[i] += thread_stats.cpu[i];
+        total_stats.wall_samples[i] += thread_stats.wall_samples[i];
+        total_stats.cpu_samples[i] += thread_stats.cpu_samples[i];
+    }
+    for (i = 0; i < NUM_COUNTERS; i++)
+        total_stats.counters[i] += thread_stats.counters[i];
+    for (i = 0; i < STAT_MAX_TOKENS; i++)
+        total_stats.tokens[i] += thread_stats.tokens[i];
+    pthread_mutex_unlock(&stats_lock);
+}
+
+static const char *token_name(int idx)
+{
+    const char *str = token_to_str(idx + FIRST_TOK);
+
+    return (str != NULL) ? str : "unknown";
+}
+
+static void print_json_str(FILE *fp, const char *str)
+{
+    fputc('"', fp);
+    for (; *str != 0; str++)
+    {
+        if (*str == '"' || *str == '\\')
+            fputc('\\', fp);
+        fputc(*str, fp);
+    }
+    fputc('"', fp);
+}
+
+static void print_json(FILE *fp)
+{
+    int i, first;
+
+    fprintf(fp, "{\n  \"sample_usec\": %d,\n  \"phases\": {", SAMPLE_USEC);
+    for (i = 0; i < NUM_PHASES; i++)
+    {
+        fprintf(fp, "%s\n    ", (i > 0) ? "," : "");
+        print_json_str(fp, phase_names[i]);
+        fprintf(fp, ": {\"wall_ms\": %.3f, \"cpu_ms\": %.3f, \"samples\": %lu}",
+                total_stats.wall[i] / 1e6, total_stats.cpu[i] / 1e6,
+                (unsigned long)total_stats.wall_samples[i]);
+    }
+
+    fprintf(fp, "\n  },\n  \"counters\": {");
+    for (i = 0; i < NUM_COUNTERS; i++)
+    {
+        fprintf(fp, "%s\n    ", (i > 0) ? "," : "");
+        print_json_str(fp, counter_names[i]);
+        fprintf(fp, ": %lu", (unsigned long)total_stats.counters[i]);
+    }
+
+    fprintf(fp, "\n  },\n  \"tokens\": {");
+    for (i = 0, first = 1; i < STAT_MAX_TOKENS; i++)
+    {
+        if (total_stats.tokens[i] == 0)
+            continue;
+        fprintf(fp, "%s\n    ", first ? "" : ",");
+        print_json_str(fp, token_name(i));
+        fprintf(fp, ": %lu", (unsigned long)total_stats.tokens[i]);
+        first = 0;
+    }
+    fprintf(fp, "\n  }\n}\n");
+}
+
+static void print_text(FILE *fp)
+{
+    uint64_t wall = 0, cpu = 0;
+    int i;
+
+    for (i = 0; i < NUM_PHASES; i++)
+    {
+        wall += total_stats.wall[i];
+        cpu += total_stats.cpu[i];
+    }
+
+    fprintf(fp, "%-20s %12s %12s %7s\n", "phase", "wall ms", "cpu ms", "wall %");
+    for (i = 0; i < NUM_PHASES; i++)
+        fprintf(fp, "%-20s %12.3f %12.3f %6.1f%%\n", phase_names[i],
+                total_stats.wall[i] / 1e6, total_stats.cpu[i] / 1e6,
+                wall ? 100.0 * total_stats.wall[i] / wall : 0.0);
+    fprintf(fp, "%-20s %12.3f %12.3f\n", "total", wall / 1e6, cpu / 1e6);
+    fprintf(fp, "the phase times are sampled estimates (%d us SIGPROF sampling)\n\n", SAMPLE_USEC);
+
+    for (i = 0; i < NUM_COUNTERS; i++)
+        fprintf(fp, "%-20s %12lu\n", counter_names[i], (unsigned long)total_stats.counters[i]);
+
+    fprintf(fp, "\n%-20s %12s\n", "token", "count");
+    for (i = 0; i < STAT_MAX_TOKENS; i++)
+        if (total_stats.tokens[i] != 0)
+            fprintf(fp, "%-20s %12lu\n", token_name(i), (unsigned long)total_stats.tokens[i]);
+}
+
+void print_stats(FILE *fp, int json)
+{
+    if (json)
+        print_json(fp);
+    else
+        print_text(fp);
+}
+
+/*
+    The allocation wrappers. The linker sends the calls to malloc() in the
+    compiler here when -Wl,--wrap=malloc is given.
+*/
+void *__real_malloc(size_t size);
+void *__real_calloc(size_t num, size_t size);
+void *__real_realloc(void *ptr, size_t size);
+char *__real_strdup(const char *str);
+char *__real_strndup(const char *str, size_t len);
+
+void *__wrap_malloc(size_t size)
+{
+    STAT_COUNT(STAT_ALLOCS, 1);
+    STAT_COUNT(STAT_ALLOC_BYTES, size);
+    return __real_malloc(size);
+}
+
+void *__wrap_calloc(size_t num, size_t size)
+{
+    STAT_COUNT(STAT_ALLOCS, 1);
+    STAT_COUNT(STAT_ALLOC_BYTES, num * size);
+    return __real_calloc(num, size);
+}
+
+void *__wrap_realloc(void *ptr, size_t size)
+{
+    STAT_COUNT(STAT_ALLOCS, 1);
+    STAT_COUNT(STAT_ALLOC_BYTES, size);
+    return __real_realloc(ptr, size);
+}
+
+char *__wrap_strdup(const char *str)
+{
+    STAT_COUNT(STAT_ALLOCS, 1);
+    STAT_COUNT(STAT_ALLOC_BYTES, strlen(str) + 1);
+    return __real_strdup(str);
+}
+
+char *__wrap_strndup(const char *str, size_t len)
+{
+    STAT_COUNT(STAT_ALLOCS, 1);
+    STAT_COUNT(STAT_ALLOC_BYTES, strnlen(str, len) + 1);
+    return __real_strndup(str, len);
+}
@@ -0,0 +1,67 @@
+#ifndef _STATS_H_
+#define _STATS_H_
+
+#include <stdio.h>
+#include <stdint.h>
+
+#include "scanner.h"
+
+typedef enum
+{
+    PHASE_OTHER, // the driver, modules and anything that is not below
+    PHASE_FILE_IO,
+    PHASE_SCANNER,
+    PHASE_HASH,
+    PHASE_PARSER,
+    PHASE_INTERFACE,
+    NUM_PHASES,
+} phase_t;
+
+typedef enum
+{
+    STAT_FILES,
+    STAT_BYTES_READ,
+    STAT_BYTES_HASHED,
+    STAT_TOKENS,
+    STAT_UNGET_TOKEN,
+    STAT_HASH_LOOKUPS,
+    STAT_HASH_PROBES,
+    STAT_HASH_COLLISIONS,
+    STAT_SYMBOLS,
+    STAT_ALLOCS,
+    STAT_ALLOC_BYTES,
+    STAT_CACHE_HITS,
+    STAT_CACHE_MISSES,
+    NUM_COUNTERS,
+} counter_t;
+
+#define STAT_MAX_TOKENS (LAST_TOKEN - FIRST_TOK)
+
+typedef struct
+{
+    uint64_t wall[NUM_PHASES]; // nanoseconds
+    uint64_t cpu[NUM_PHASES];
+    uint64_t wall_samples[NUM_PHASES];
+    uint64_t cpu_samples[NUM_PHASES];
+    uint64_t counters[NUM_COUNTERS];
+    uint64_t tokens[STAT_MAX_TOKENS];
+} stats_t;
+
+extern int stats_enabled;
+extern _Thread_local stats_t thread_stats;
+extern _Thread_local phase_t phase_stack[];
+extern _Thread_local int phase_index;
+
+void stats_begin(void);
+void stats_end(void);
+void print_stats(FILE *fp, int json);
+
+// deeper phases are counted as the last one that fits
+#define PHASE_STACK_SIZE 1024
+
+// these are cheap enough to keep all of the time, see stats.c
+#define STAT_COUNT(c, n) (thread_stats.counters[(c)] += (n))
+#define PHASE_ENTER(p) do { if (++phase_index < PHASE_STACK_SIZE) phase_stack[phase_index] = (p); } while (0)
+#define PHASE_LEAVE() (phase_index--)
+
+#endif /* _STATS_H_ */
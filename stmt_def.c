@@ -0,0 +1,288 @@
+/*
+    Handle the statements in the body of a function.
+
+    The syntax is in toi.grammar and the statements are handled by the
+    actions here as they are read:
+
+    var name:type = expression;
+    if (expression) {block} else if (expression) {block} else {block}
+    while (expression) {block}
+    for (expression; expression; expression) {block}
+    switch (expression) { case (expression) {block} ... else {block} }
+    try {block} except {block}
+    return expression;
+    break;
+    cont;
+    expression;
+    {block}
+
+    Every block is a scope. It has an anonymous context for anything that
+    is named in it, and the local variables defined in it are dropped at
+    its end. Local variables are not in the symbol table. See locals.c.
+
+    The code of the statements is made by the actions as they go. See
+    codegen.c.
+*/
+#define LOG_MODULE LOG_MOD_PARSER
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "logging.h"
+#include "errors.h"
+#include "context.h"
+#include "sym_attrs.h"
+#include "parse.h"
+#include "ll_parse.h"
+#include "buffer.h"
+#include "expr.h"
+#include "locals.h"
+#include "class_def.h"
+#include "codegen.h"
+#include "stmt_def.h"
+
+/*
+    The statement that is being parsed.
+*/
+typedef struct
+{
+    expr_t *expr;     // the last expression that was read
+    char *local_name; // the local variable that is being defined
+    int local;
+    int depth;        // the number of blocks that are open
+} stmt_state_t;
+
+static _Thread_local stmt_state_t stmt;
+
+static void show_expr(const char *what)
+{
+    buffer_t text = {0};
+
+    if (LOG_ON(1) && stmt.expr != NULL)
+    {
+        expr_to_str(stmt.expr, &text);
+        INFO("%s: %s", what, text.buf);
+        buffer_free(&text);
+    }
+}
+
+static void open_block(int flags)
+{
+    push_anon_context();
+    open_local_scope(flags);
+    gen_open_scope();
+    stmt.depth++;
+}
+
+static void close_block(void)
+{
+    gen_close_scope();
+    close_local_scope();
+    pop_context();
+    stmt.depth--;
+}
+
+/*
+    Close the blocks that are still open at the end of the function. A
+    block that had a syntax error does not get to its end.
+*/
+void end_statements(void)
+{
+    while (stmt.depth > 0)
+        close_block();
+    free(stmt.local_name);
+    stmt.local_name = NULL;
+    stmt.expr = NULL;
+}
+
+/*
+    The actions for the statements in toi.grammar.
+*/
+void act_expression(void)
+{
+    stmt.expr = parse_expression();
+}
+
+void act_expression_stmt(void)
+{
+    show_expr("expression statement");
+    gen_expr_stmt(stmt.expr);
+}
+
+void act_local_name(void)
+{
+    free(stmt.local_name);
+    stmt.local_name = strdup(get_token_string());
+}
+
+void act_local_type(void)
+{
+    const char *complex;
+    sym_attr_val_t type = get_var_type(&complex);
+    int index;
+
+    if ((index = add_local(stmt.local_name, type, complex)) < 0)
+        syntax("variable %s is already defined in this scope", stmt.local_name);
+    else
+    {
+        INFO("local variable %s is %d", stmt.local_name, index);
+        stmt.local = index;
+        gen_local(index);
+    }
+}
+
+void act_local_default(void)
+{
+    gen_local_default(stmt.local);
+}
+
+void act_local_value(void)
+{
+    show_expr("local assignment");
+    gen_local_value(stmt.local, stmt.expr);
+}
+
+void act_if_start(void)
+{
+    INFO("if statement");
+    gen_if();
+}
+
+void act_else_start(void)
+{
+    INFO("else");
+    gen_else();
+}
+
+void act_if_end(void)
+{
+    gen_end_if();
+}
+
+void act_condition(void)
+{
+    show_expr("condition");
+    gen_condition(stmt.expr);
+}
+
+void act_while_start(void)
+{
+    INFO("while loop");
+    gen_while();
+}
+
+void act_for_start(void)
+{
+    INFO("for loop");
+    gen_for();
+}
+
+void act_for_init(void)
+{
+    show_expr("for init");
+    gen_for_init(stmt.expr);
+}
+
+void act_for_step(void)
+{
+    show_expr("for step");
+    gen_for_step(stmt.expr);
+}
+
+void act_loop_end(void)
+{
+    gen_end_loop();
+}
+
+void act_switch_start(void)
+{
+    INFO("switch statement");
+    gen_switch();
+}
+
+void act_case_start(void)
+{
+    INFO("case");
+    gen_case();
+}
+
+void act_case_else(void)
+{
+    INFO("default case");
+    gen_case_else();
+}
+
+void act_case_end(void)
+{
+    gen_end_case();
+}
+
+void act_switch_end(void)
+{
+    gen_end_switch();
+}
+
+void act_try_start(void)
+{
+    INFO("try statement");
+    gen_try();
+}
+
+void act_except_start(void)
+{
+    INFO("except");
+    gen_except();
+}
+
+void act_try_end(void)
+{
+    gen_end_try();
+}
+
+void act_return_value(void)
+{
+    show_expr("return value");
+    gen_return(stmt.expr);
+}
+
+void act_return_nothing(void)
+{
+    INFO("return");
+    gen_return(NULL);
+}
+
+void act_break(void)
+{
+    if (!(local_scope_flags() & SCOPE_BREAK))
+        syntax("break is not in a loop or a case");
+    else
+        gen_break();
+}
+
+void act_continue(void)
+{
+    if (!(local_scope_flags() & SCOPE_CONTINUE))
+        syntax("cont is not in a loop");
+    else
+        gen_continue();
+}
+
+void act_block_start(void)
+{
+    open_block(0);
+}
+
+void act_loop_block_start(void)
+{
+    open_block(SCOPE_BREAK | SCOPE_CONTINUE);
+}
+
+void act_case_block_start(void)
+{
+    open_block(SCOPE_BREAK);
+}
+
+void act_block_end(void)
+{
+    close_block();
+}
@@ -0,0 +1,6 @@
+#ifndef _STMT_DEF_H_
+#define _STMT_DEF_H_
+
+void end_statements(void);
+
+#endif /* _STMT_DEF_H_ */
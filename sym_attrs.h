@@ -8,6 +8,9 @@ typedef enum {
     COMPLEX_TYPEOF_ATTR,
     SYMBOL_SCOPE_ATTR,
     SYMBOL_ASSIGMENT_EXPR_ATTR,
+    FUNC_SIGNATURE_ATTR,
+    CLASS_BASES_ATTR,   // the classes that a class inherits, nul separated
+    CLASS_MEMBERS_ATTR, // the names of the members of a class, nul separated
     NUM_SYMBOL_ATTRS,
 } sym_attr_t;
 
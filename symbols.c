@@ -2,26 +2,65 @@
     Store symbols and their attributes
 */
 
+#define LOG_MODULE LOG_MOD_SYMBOLS
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include "sym_attrs.h"
 #include "errors.h"
 #include "logging.h"
 #include "symbols.h"
 #include "hash_table.h"
+#include "modules.h"
+#include "layout.h"
+#include "stats.h"
 
-typedef void **sattr_table_t;
+/*
+    The size of each attribute is kept with the data so that the attributes
+    can be copied out of the table, such as into a module interface file.
+*/
+typedef struct
+{
+    void *data;
+    unsigned int size;
+} sattr_t;
+
+/*
+    A symbol that has been invalidated keeps its place in the table, but it
+    is not found until it is added again.
+*/
+typedef struct
+{
+    int valid;
+    sattr_t attrs[NUM_SYMBOL_ATTRS];
+} symbol_t;
+
+typedef symbol_t *sattr_table_t;
 typedef ht_handle_t symbol_table_t;
 
-static symbol_table_t symbol_table;
+// each thread compiles with its own symbol table
+static _Thread_local symbol_table_t symbol_table;
 
-static void destroy_symbol_table(void)
+static void destroy_symbol(const char *key, void *data, void *arg)
+{
+    sattr_table_t tab = (sattr_table_t)data;
+    int i;
+
+    (void)key;
+    (void)arg;
+    for (i = 0; i < NUM_SYMBOL_ATTRS; i++)
+        free(tab->attrs[i].data);
+    free(tab);
+}
+
+void destroy_symbol_table(void)
 {
     ENTER();
-    // TODO: destroy all attributes
     // TODO: add functions to destroy all of the symbol attribute types
+    hash_foreach(symbol_table, destroy_symbol, NULL);
     destroy_hash_table(symbol_table);
+    symbol_table = NULL;
     RET();
 }
 
@@ -29,22 +68,81 @@ void init_symbol_table(void)
 {
     // the number 1223 is a prime number of sufficient size.
     symbol_table = create_hash_table(1223);
-    atexit(destroy_symbol_table);
 }
 
+/*
+    Symbols that are created while a module is being parsed are recorded in
+    the module so that they can be found again without searching the table.
+*/
 int add_symbol(const char *sym)
 {
     sattr_table_t tab;
+    int retv;
+
+    tab = hash_find(symbol_table, sym);
+    if (tab != NULL)
+    {
+        if (tab->valid)
+            return 1; // symbol already in the table
+        tab->valid = 1;
+        retv = 0;
+    }
+    else
+    {
+        if (NULL == (tab = (sattr_table_t)calloc(1, sizeof(symbol_t))))
+            FATAL("cannot allocate memry for symbol attribute table");
+
+        tab->valid = 1;
+        retv = hash_save(symbol_table, sym, tab);
+        if (retv != 0)
+            free(tab);
+        else
+            STAT_COUNT(STAT_SYMBOLS, 1);
+    }
 
-    if (NULL == (tab = (sattr_table_t)calloc(NUM_SYMBOL_ATTRS, sizeof(void *))))
-        FATAL("cannot allocate memry for symbol attribute table");
+    if (retv == 0 && current_module() != NULL)
+        add_module_symbol(current_module(), sym);
 
-    return hash_save(symbol_table, sym, tab);
+    return retv;
+}
+
+/*
+    Free the attributes of a symbol and mark it as not defined. This is used
+    when the module that defined the symbol is parsed again. The layout of a
+    class is made again as well, see layout.c.
+*/
+void invalidate_symbol(const char *sym)
+{
+    sattr_table_t tab;
+    int i;
+
+    tab = hash_find(symbol_table, sym);
+    if (tab != NULL)
+    {
+        if (tab->attrs[SYMBOL_TYPE_ATTR].data != NULL &&
+            *(sym_attr_val_t *)tab->attrs[SYMBOL_TYPE_ATTR].data == CLASS_SYMBOL)
+            invalidate_layout(sym);
+        for (i = 0; i < NUM_SYMBOL_ATTRS; i++)
+        {
+            free(tab->attrs[i].data);
+            tab->attrs[i].data = NULL;
+            tab->attrs[i].size = 0;
+        }
+        tab->valid = 0;
+    }
+}
+
+static sattr_table_t find_symbol(const char *sym)
+{
+    sattr_table_t tab;
+
+    tab = hash_find(symbol_table, sym);
+    return (tab != NULL && tab->valid) ? tab : NULL;
 }
 
 int check_symbol(const char *sym)
 {
-    return (hash_find(symbol_table, sym) == NULL) ? 0 : 1;
+    return (find_symbol(sym) == NULL) ? 0 : 1;
 }
 
 void add_symbol_attr(const char *sym, sym_attr_t type, void *data, unsigned int size)
@@ -52,27 +150,66 @@ void add_symbol_attr(const char *sym, sym_attr_t type, void *data, unsigned int
     sattr_table_t tab;
     void *ndat;
 
-    tab = hash_find(symbol_table, sym);
+    tab = find_symbol(sym);
     if (tab == NULL)
     {
         add_symbol(sym);
-        tab = hash_find(symbol_table, sym);
+        tab = find_symbol(sym);
     }
 
     if(NULL == (ndat = calloc(1, size)))
         FATAL("cannot allocate memory for symbol attribute");
 
     memcpy(ndat, data, size);
-    tab[type] = ndat;
+    free(tab->attrs[type].data);
+    tab->attrs[type].data = ndat;
+    tab->attrs[type].size = size;
 }
 
 void *get_symbol_attr(const char *sym, sym_attr_t type)
 {
     sattr_table_t tab;
 
-    tab = hash_find(symbol_table, sym);
+    tab = find_symbol(sym);
     if (tab != NULL)
-        return tab[type]; // could be NULL
+        return tab->attrs[type].data; // could be NULL
     else
         return NULL;
 }
+
+unsigned int get_symbol_attr_size(const char *sym, sym_attr_t type)
+{
+    sattr_table_t tab;
+
+    tab = find_symbol(sym);
+    if (tab != NULL)
+        return tab->attrs[type].size; // zero if the attribute is not set
+    else
+        return 0;
+}
+
+typedef struct
+{
+    void (*func)(const char *sym, void *arg);
+    void *arg;
+} foreach_arg_t;
+
+static void foreach_entry(const char *key, void *data, void *arg)
+{
+    foreach_arg_t *fa = (foreach_arg_t *)arg;
+
+    if (((sattr_table_t)data)->valid)
+        fa->func(key, fa->arg);
+}
+
+/*
+    Call the function with the name of every valid symbol in the table.
+*/
+void foreach_symbol(void (*func)(const char *sym, void *arg), void *arg)
+{
+    foreach_arg_t fa;
+
+    fa.func = func;
+    fa.arg = arg;
+    hash_foreach(symbol_table, foreach_entry, &fa);
+}
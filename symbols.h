@@ -4,9 +4,13 @@
 #include "sym_attrs.h"
 
 void init_symbol_table(void);
+void destroy_symbol_table(void);
 int add_symbol(const char *sym);
 void add_symbol_attr(const char *sym, sym_attr_t type, void *data, unsigned int size);
 int check_symbol(const char *sym);
+void invalidate_symbol(const char *sym);
 void *get_symbol_attr(const char *sym, sym_attr_t type);
+unsigned int get_symbol_attr_size(const char *sym, sym_attr_t type);
+void foreach_symbol(void (*func)(const char *sym, void *arg), void *arg);
 
 #endif /* _SYMBOLS_H_ */
@@ -1,21 +1,429 @@
 /*
     Main program entry.
+
+    Any number of files can be given on the command line. Each one is
+    compiled on its own, with its own symbol table and modules. With -j,
+    the files are compiled on that many worker threads. All of the state of
+    a compile belongs to the thread that runs it, so a worker simply takes
+    the next file from the list until there are none left. The threads that
+    are not needed for the files build the imports of each file ahead of
+    it. See import_scan.c.
+
+    With -S the compiler runs as a server and with -c the files are sent to
+    a server to be compiled. See server.c. With --watch the file is compiled
+    again every time that it or one of its imports is saved. See watch.c.
 */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <pthread.h>
 
 #include "toi.h"
+#include "snapshot.h"
+#include "import_def.h"
+#include "import_scan.h"
+#include "server.h"
+#include "watch.h"
+#include "stats.h"
+#include "trace.h"
+#include "signature.h"
+#include "locals.h"
+#include "class_def.h"
+#include "expr.h"
+#include "codegen.h"
+#include "layout.h"
+#include "vm.h"
+
+typedef struct
+{
+    char **files;
+    int num_files;
+    int next;
+    int errors;
+    const char *sname;
+    int bench;
+    int import_jobs; // threads for the imports of each file
+    pthread_mutex_t lock;
+} work_t;
 
 static void init_toi(const char* fname) {
 
-    init_logging(LOG_STDOUT);
-    set_debug_level(7);
-    init_scanner(fname);
+    init_scanner(NULL);
     init_context();
     init_symbol_table();
+    init_signatures();
+    init_layouts();
+    init_modules();
+    init_codegen();
+    init_module_search(fname);
+    reset_errors();
+}
+
+static void free_toi(void)
+{
+    close_scanner();
+    destroy_modules();
+    destroy_symbol_table();
+    destroy_signatures();
+    destroy_layouts();
+    destroy_locals();
+    destroy_class_def();
+    destroy_expr();
+    destroy_codegen();
+    destroy_vm();
+    destroy_module_search();
+}
+
+/*
+    Build an import of the file on a thread of its own, see import_scan.c.
+    The errors are dropped, the compile of the file reports them.
+*/
+static void build_import(const char *fname, const char *name)
+{
+    stats_begin();
+    init_toi(fname);
+    import_module(name);
+    reset_errors();
+    free_toi();
+    stats_end();
+}
+
+/*
+    Compile one file and return the number of errors. The imports of the
+    file are built ahead on import_jobs threads. With bench the benchmark
+    functions of the file are run after it is compiled.
+*/
+static int compile_one(const char *fname, const char *sname, int bench, int import_jobs)
+{
+    int errors;
+
+    stats_begin();
+    init_toi(fname);
+    build_imports(fname, import_jobs, build_import);
+    compile_file(fname);
+    if (sname != NULL)
+        save_snapshot(sname);
+    flush_diagnostics();
+    errors = error_count();
+    if (bench && errors == 0)
+        run_benchmarks();
+    free_toi();
+    stats_end();
+    return errors;
+}
+
+static void *worker(void *arg)
+{
+    work_t *work = (work_t *)arg;
+    int idx, errors;
+
+    while (1)
+    {
+        pthread_mutex_lock(&work->lock);
+        idx = work->next++;
+        pthread_mutex_unlock(&work->lock);
+        if (idx >= work->num_files)
+            break;
+
+        errors = compile_one(work->files[idx], work->sname, work->bench, work->import_jobs);
+
+        pthread_mutex_lock(&work->lock);
+        work->errors += errors;
+        pthread_mutex_unlock(&work->lock);
+    }
+    return NULL;
+}
+
+/*
+    Compile all of the files on the given number of threads and return the
+    total number of errors.
+*/
+static int compile_all(work_t *work, int jobs)
+{
+    pthread_t *threads;
+    int i;
+
+    if (jobs > work->num_files)
+        jobs = work->num_files;
+
+    if (jobs <= 1)
+    {
+        worker(work);
+        return work->errors;
+    }
+
+    if (NULL == (threads = calloc(jobs, sizeof(pthread_t))))
+        FATAL("cannot allocate memory for threads");
+
+    for (i = 0; i < jobs; i++)
+        if (pthread_create(&threads[i], NULL, worker, work) != 0)
+            FATAL("cannot create worker thread");
+
+    for (i = 0; i < jobs; i++)
+        pthread_join(threads[i], NULL);
+
+    free(threads);
+    return work->errors;
+}
+
+/*
+    Print the symbols in the snapshot that match the name. A name that ends
+    with a '*' matches every symbol that starts with the rest of the name.
+*/
+static int query_snapshot(const char *sname, const char *name)
+{
+    snapshot_t *snap;
+    size_t len;
+    int i, count = 0;
+
+    if (NULL == (snap = open_snapshot(sname)))
+    {
+        fprintf(stderr, "cannot read snapshot %s\n", sname);
+        return 1;
+    }
+
+    len = strlen(name);
+    if (len > 0 && name[len - 1] == '*')
+    {
+        for (i = 0; i < snapshot_num_symbols(snap); i++)
+        {
+            if (!strncmp(name, snapshot_name(snap, i), len - 1))
+            {
+                print_snapshot_symbol(snap, i);
+                count++;
+            }
+        }
+    }
+    else if ((i = snapshot_find(snap, name)) >= 0)
+    {
+        print_snapshot_symbol(snap, i);
+        count++;
+    }
+
+    close_snapshot(snap);
+    return (count > 0) ? 0 : 1;
+}
+
+/*
+    Set the levels of the modules from a list like "scanner=9,hash=0".
+    Returns 0 if the list is not valid.
+*/
+static int set_module_levels(char *list)
+{
+    char *item, *value, *save;
+    int mod;
+
+    for (item = strtok_r(list, ",", &save); item != NULL; item = strtok_r(NULL, ",", &save))
+    {
+        if (NULL == (value = strchr(item, '=')))
+            return 0;
+        *value++ = 0;
+        if ((mod = find_log_module(item)) < 0)
+        {
+            fprintf(stderr, "unknown log module: %s\n", item);
+            return 0;
+        }
+        set_module_level(mod, atoi(value));
+    }
+    return 1;
 }
 
-int main(void)
+static void usage(const char *prog)
 {
-    init_toi("tests/parse1.txt");
-    parse();
-    return 0;
+    fprintf(stderr, "usage: %s [-n] [-j jobs] [-v level] [-V levels] [-L file] [-I dir] [-s snapshot] [file...]\n", prog);
+    fprintf(stderr, "       %s -s snapshot -q name\n", prog);
+    fprintf(stderr, "       %s [-n] [-v level] [-I dir] -S socket\n", prog);
+    fprintf(stderr, "       %s -c socket [file...]\n", prog);
+    fprintf(stderr, "       %s [-n] [-v level] [-I dir] --watch file\n", prog);
+    fprintf(stderr, "  -n       do not read or write module interface and bytecode files\n");
+    fprintf(stderr, "  -j jobs  compile the files on this many threads, and the imports of a file\n");
+    fprintf(stderr, "           that do not depend on each other at the same time\n");
+    fprintf(stderr, "  -v level debug level for messages\n");
+    fprintf(stderr, "  -V module=level[,module=level...]\n");
+    fprintf(stderr, "           debug level for the messages of one module: main, file_io,\n");
+    fprintf(stderr, "           scanner, hash, context, symbols, parser, modules, vm or all\n");
+    fprintf(stderr, "  -L file  write the log messages to the file in binary, see toi-logdump, the\n");
+    fprintf(stderr, "           warnings and errors are still shown on stderr\n");
+    fprintf(stderr, "  -I dir   add dir to the module search path\n");
+    fprintf(stderr, "  -s file  write the symbol table to a snapshot file, one input file only\n");
+    fprintf(stderr, "  -q name  print symbols from the snapshot, a trailing '*' matches a prefix\n");
+    fprintf(stderr, "  -S path  run as a compile server listening on the socket\n");
+    fprintf(stderr, "  -c path  send the files to the compile server, or compile them here if\n");
+    fprintf(stderr, "           the server is not running\n");
+    fprintf(stderr, "  -w, --watch\n");
+    fprintf(stderr, "           compile the file again when it or one of its imports changes\n");
+    fprintf(stderr, "  --stats[=json]\n");
+    fprintf(stderr, "           print the time spent in each phase and other counters to stderr, the\n");
+    fprintf(stderr, "           phase times are sampled estimates (100 us SIGPROF sampling)\n");
+    fprintf(stderr, "  --max-errors=n\n");
+    fprintf(stderr, "           stop a file after n errors, 0 for no limit, 100 by default\n");
+    fprintf(stderr, "  --trace=file\n");
+    fprintf(stderr, "           write a Chrome trace of the functions, modules and classes to the file\n");
+    fprintf(stderr, "  --bench  run the functions of each file that start with \"bench\" and print\n");
+    fprintf(stderr, "           their times\n");
+    fprintf(stderr, "Modules are also searched for in the directories in TOI_PATH.\n");
+}
+
+int main(int argc, char **argv)
+{
+    static char *default_file[] = {"tests/parse1.txt"};
+    static const struct option long_opts[] = {
+        {"watch", no_argument, NULL, 'w'},
+        {"stats", optional_argument, NULL, 'T'},
+        {"trace", required_argument, NULL, 'R'},
+        {"max-errors", required_argument, NULL, 'E'},
+        {"bench", no_argument, NULL, 'B'},
+        {NULL, 0, NULL, 0},
+    };
+    const char *sname = NULL;
+    const char *query = NULL;
+    const char *server = NULL;
+    const char *client = NULL;
+    const char *trace = NULL;
+    const char *log_file = NULL;
+    char *levels = NULL;
+    int level = 7;
+    int jobs = 1;
+    int watch = 0;
+    int stats = 0;
+    int bench = 0;
+    work_t work;
+    int opt, status;
+
+    while ((opt = getopt_long(argc, argv, "nj:v:V:L:I:s:q:S:c:w", long_opts, NULL)) != -1)
+    {
+        switch (opt)
+        {
+        case 'n':
+            set_interface_files(0);
+            set_bytecode_files(0);
+            break;
+        case 'j':
+            jobs = atoi(optarg);
+            break;
+        case 'v':
+            level = atoi(optarg);
+            break;
+        case 'V':
+            levels = optarg;
+            break;
+        case 'L':
+            log_file = optarg;
+            break;
+        case 'I':
+            add_search_path(optarg);
+            break;
+        case 's':
+            sname = optarg;
+            break;
+        case 'q':
+            query = optarg;
+            break;
+        case 'S':
+            server = optarg;
+            break;
+        case 'c':
+            client = optarg;
+            break;
+        case 'w':
+            watch = 1;
+            break;
+        case 'T':
+            if (optarg != NULL && strcmp(optarg, "json") && strcmp(optarg, "text"))
+            {
+                usage(argv[0]);
+                return 1;
+            }
+            stats = (optarg != NULL && !strcmp(optarg, "json")) ? 2 : 1;
+            break;
+        case 'R':
+            trace = optarg;
+            break;
+        case 'E':
+            max_errors = atoi(optarg);
+            break;
+        case 'B':
+            bench = 1;
+            break;
+        default:
+            usage(argv[0]);
+            return 1;
+        }
+    }
+
+    if (query != NULL)
+    {
+        if (sname == NULL)
+        {
+            usage(argv[0]);
+            return 1;
+        }
+        return query_snapshot(sname, query);
+    }
+
+    memset(&work, 0, sizeof(work));
+    pthread_mutex_init(&work.lock, NULL);
+    work.sname = sname;
+    work.bench = bench;
+    if (optind < argc)
+    {
+        work.files = &argv[optind];
+        work.num_files = argc - optind;
+    }
+    else
+    {
+        work.files = default_file;
+        work.num_files = 1;
+    }
+
+    // the threads that are left over from the files go to their imports
+    work.import_jobs = (jobs > work.num_files) ? jobs / work.num_files : 1;
+
+    if ((sname != NULL && work.num_files > 1) ||
+        (server != NULL && (client != NULL || sname != NULL || optind < argc)) ||
+        (watch && (server != NULL || client != NULL || sname != NULL || work.num_files > 1)))
+    {
+        usage(argv[0]);
+        return 1;
+    }
+
+    if (client != NULL && sname == NULL &&
+        (status = client_compile(client, work.files, work.num_files)) >= 0)
+        return status;
+
+    if (log_file != NULL)
+        init_logging(LOG_FILE | LOG_BINARY | LOG_ASYNC, log_file);
+    else
+        init_logging(LOG_STDOUT | LOG_ASYNC);
+    set_debug_level(level);
+    if (levels != NULL && !set_module_levels(levels))
+    {
+        usage(argv[0]);
+        return 1;
+    }
+    if (trace != NULL)
+        start_trace(trace);
+    init_search_path();
+    if (server != NULL)
+    {
+        init_toi(NULL);
+        status = run_server(server);
+        free_toi();
+        return status;
+    }
+
+    if (watch)
+    {
+        init_toi(work.files[0]);
+        status = run_watch(work.files[0]);
+        free_toi();
+        return status;
+    }
+    stats_enabled = (stats != 0);
+    status = (compile_all(&work, jobs) > 0) ? 1 : 0;
+    if (stats)
+        print_stats(stderr, stats == 2);
+    return status;
 }
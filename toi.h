@@ -9,5 +9,8 @@
 #include "symbols.h"
 #include "context.h"
 #include "parse.h"
+#include "modules.h"
+#include "interface.h"
+#include "search_path.h"
 
 #endif /* _TOI_H_ */
\ No newline at end of file
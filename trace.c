@@ -0,0 +1,307 @@
+/*
+    Trace events for a timeline of the compile.
+
+    With --trace=file, every ENTER() and RET() and every module and class
+    that is parsed records a begin or end event in memory, and the events
+    are written as Chrome trace event JSON when the program exits. The file
+    can be opened in chrome://tracing or https://ui.perfetto.dev to see the
+    nested imports and the time spent in each function on a timeline.
+
+    Recording an event is a clock read and a store into a block of events
+    that belongs to the thread, so the threads never wait for each other.
+    The names of functions are static strings and only the pointer is kept.
+    The names of modules and classes are copied because they can be freed
+    before the trace is written.
+
+    ENTER() and RET() are compiled out of the release build, so a release
+    trace only has the modules and the classes.
+
+    A large compile calls the scanner millions of times, and a trace of
+    every call would be gigabytes that no viewer can open. A span that is
+    shorter than MIN_SPAN and has no spans inside it is dropped when it
+    ends, by removing its begin event, so the trace only has the calls that
+    take long enough to see and the ones that lead to them.
+
+    A function that returns without RET(), or returns with RET() without
+    ENTER(), would leave the begin and end events unbalanced, and the
+    viewer would draw everything after it at the wrong depth. Every thread
+    keeps the stack of the spans that it has begun. An end that is not on
+    the stack is ignored, and an end of a span that is below the top also
+    ends the spans above it. The spans that are still open when the trace
+    is written are ended at that time.
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "logging.h"
+#include "buffer.h"
+#include "trace.h"
+
+#define BLOCK_EVENTS 8192
+// deeper spans are not recorded
+#define TRACE_STACK_SIZE 256
+// shorter spans without spans inside are dropped, in nanoseconds
+#define MIN_SPAN 10000
+
+typedef struct
+{
+    uint64_t ts;      // nanoseconds since the trace started
+    const char *name; // a static name or NULL if the name was copied
+    uint32_t copy;    // offset of the copied name in the strings
+    char ph;          // 'B' or 'E'
+    char cat;
+} trace_event_t;
+
+typedef struct _trace_block_t_
+{
+    struct _trace_block_t_ *next;
+    int count;
+    trace_event_t events[BLOCK_EVENTS];
+} trace_block_t;
+
+typedef struct _trace_thread_t_
+{
+    struct _trace_thread_t_ *next;
+    trace_block_t *first;
+    trace_block_t *last;
+    buffer_t strings;
+    const char *stack[TRACE_STACK_SIZE];
+    trace_event_t *begins[TRACE_STACK_SIZE];
+    int depth;
+    int tid;
+} trace_thread_t;
+
+int trace_enabled = 0;
+
+static const char *trace_fname = NULL;
+static uint64_t trace_start;
+static trace_thread_t *threads = NULL;
+static int num_threads = 0;
+static pthread_mutex_t trace_lock = PTHREAD_MUTEX_INITIALIZER;
+static _Thread_local trace_thread_t *this_thread = NULL;
+
+static const char *category_names[] = {
+    "func",
+    "module",
+    "class",
+};
+
+static inline uint64_t trace_clock(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec - trace_start;
+}
+
+/*
+    The events of a thread are kept after the thread has finished, until
+    they are written.
+*/
+static trace_thread_t *add_thread(void)
+{
+    trace_thread_t *th;
+
+    if (NULL == (th = calloc(1, sizeof(trace_thread_t))))
+        FATAL("cannot allocate memory for trace");
+
+    pthread_mutex_lock(&trace_lock);
+    th->tid = ++num_threads;
+    th->next = threads;
+    threads = th;
+    pthread_mutex_unlock(&trace_lock);
+
+    this_thread = th;
+    return th;
+}
+
+static trace_event_t *add_event(trace_thread_t *th)
+{
+    trace_block_t *block = th->last;
+
+    if (block == NULL || block->count == BLOCK_EVENTS)
+    {
+        if (NULL == (block = malloc(sizeof(trace_block_t))))
+            FATAL("cannot allocate memory for trace");
+        block->next = NULL;
+        block->count = 0;
+        if (th->last != NULL)
+            th->last->next = block;
+        else
+            th->first = block;
+        th->last = block;
+    }
+    return &block->events[block->count++];
+}
+
+void trace_begin(trace_category_t cat, const char *name)
+{
+    trace_thread_t *th = this_thread;
+    trace_event_t *ev;
+
+    if (th == NULL)
+        th = add_thread();
+
+    if (th->depth++ >= TRACE_STACK_SIZE)
+        return;
+    ev = add_event(th);
+    th->stack[th->depth - 1] = name;
+    th->begins[th->depth - 1] = ev;
+    ev->ts = trace_clock();
+    ev->ph = 'B';
+    ev->cat = cat;
+    if (cat == TRACE_FUNC)
+    {
+        ev->name = name;
+        ev->copy = 0;
+    }
+    else
+    {
+        ev->name = NULL;
+        ev->copy = th->strings.len;
+        buffer_add(&th->strings, name, strlen(name) + 1);
+    }
+}
+
+/*
+    End the span on top of the stack at the time now.
+*/
+static void end_span(trace_thread_t *th, uint64_t now)
+{
+    trace_event_t *ev;
+
+    th->depth--;
+    ev = th->begins[th->depth];
+    if (th->last->count > 0 && ev == &th->last->events[th->last->count - 1] && now - ev->ts < MIN_SPAN)
+    {
+        // nothing was recorded inside the span, so it is the last event
+        if (ev->name == NULL)
+            th->strings.len = ev->copy;
+        th->last->count--;
+        return;
+    }
+
+    ev = add_event(th);
+    ev->ts = now;
+    ev->ph = 'E';
+}
+
+void trace_end(const char *name)
+{
+    trace_thread_t *th = this_thread;
+    uint64_t now;
+    int i;
+
+    if (th == NULL || th->depth == 0)
+        return;
+
+    if (th->depth > TRACE_STACK_SIZE)
+    {
+        th->depth--;
+        return;
+    }
+
+    for (i = th->depth - 1; i >= 0 && th->stack[i] != name; i--)
+        ;
+    if (i < 0)
+        return;
+
+    // the spans that were begun inside it and not ended end with it
+    now = trace_clock();
+    while (th->depth > i)
+        end_span(th, now);
+}
+
+static void write_json_str(FILE *fp, const char *str)
+{
+    fputc('"', fp);
+    for (; *str != 0; str++)
+    {
+        if (*str == '"' || *str == '\\')
+            fprintf(fp, "\\%c", *str);
+        else if ((unsigned char)*str < 0x20)
+            fprintf(fp, "\\u%04x", *str);
+        else
+            fputc(*str, fp);
+    }
+    fputc('"', fp);
+}
+
+static void write_event(FILE *fp, trace_thread_t *th, const trace_event_t *ev)
+{
+    fprintf(fp, ",\n{\"ph\":\"%c\",\"ts\":%lu.%03lu,\"pid\":1,\"tid\":%d", ev->ph,
+            (unsigned long)(ev->ts / 1000), (unsigned long)(ev->ts % 1000), th->tid);
+    if (ev->ph == 'B')
+    {
+        fprintf(fp, ",\"cat\":\"%s\",\"name\":", category_names[(int)ev->cat]);
+        write_json_str(fp, (ev->name != NULL) ? ev->name : &th->strings.buf[ev->copy]);
+    }
+    fputc('}', fp);
+}
+
+/*
+    Write the events of every thread and free them.
+*/
+static void write_trace(void)
+{
+    trace_thread_t *th, *next_th;
+    trace_block_t *block, *next_block;
+    trace_event_t end = {0};
+    FILE *fp;
+    int i;
+
+    trace_enabled = 0;
+    if (NULL == (fp = fopen(trace_fname, "w")))
+    {
+        fprintf(stderr, "cannot write the trace to %s\n", trace_fname);
+        return;
+    }
+
+    end.ts = trace_clock();
+    end.ph = 'E';
+    fprintf(fp, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+    fprintf(fp, "{\"ph\":\"M\",\"pid\":1,\"name\":\"process_name\",\"args\":{\"name\":\"toi\"}}");
+
+    pthread_mutex_lock(&trace_lock);
+    for (th = threads; th != NULL; th = next_th)
+    {
+        fprintf(fp, ",\n{\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"name\":\"thread_name\",\"args\":{\"name\":\"thread %d\"}}",
+                th->tid, th->tid);
+        for (block = th->first; block != NULL; block = next_block)
+        {
+            for (i = 0; i < block->count; i++)
+                write_event(fp, th, &block->events[i]);
+            next_block = block->next;
+            free(block);
+        }
+
+        for (i = (th->depth < TRACE_STACK_SIZE) ? th->depth : TRACE_STACK_SIZE; i > 0; i--)
+            write_event(fp, th, &end);
+
+        next_th = th->next;
+        buffer_free(&th->strings);
+        free(th);
+    }
+    threads = NULL;
+    pthread_mutex_unlock(&trace_lock);
+
+    fprintf(fp, "\n]}\n");
+    fclose(fp);
+}
+
+/*
+    Start recording events. They are written to the file when the program
+    exits.
+*/
+void start_trace(const char *fname)
+{
+    trace_fname = fname;
+    trace_start = 0;
+    trace_start = trace_clock();
+    trace_enabled = 1;
+    atexit(write_trace);
+}
@@ -0,0 +1,22 @@
+#ifndef _TRACE_H_
+#define _TRACE_H_
+
+typedef enum
+{
+    TRACE_FUNC,   // ENTER() and RET(), the name is __func__
+    TRACE_MODULE, // loading or parsing a module
+    TRACE_CLASS,  // parsing a class definition
+    NUM_TRACE_CATEGORIES,
+} trace_category_t;
+
+extern int trace_enabled;
+
+void start_trace(const char *fname);
+void trace_begin(trace_category_t cat, const char *name);
+void trace_end(const char *name);
+
+// a span is ended by passing the same name pointer that began it
+#define TRACE_BEGIN(cat, name) do{if(trace_enabled)trace_begin((cat), (name));}while(0)
+#define TRACE_END(name) do{if(trace_enabled)trace_end((name));}while(0)
+
+#endif /* _TRACE_H_ */
@@ -0,0 +1,975 @@
+/*
+    Run the bytecode. See bytecode.h for the instructions.
+
+    The registers of all of the calls are in one stack of values. A call
+    starts its registers after the ones of the caller, and the caller puts
+    the arguments there with ARG before the CALL, so nothing is copied when
+    the call starts. The stack always has MAX_REGS values after the
+    registers of the function that is running, for the arguments of its
+    calls.
+
+    The instructions are dispatched with a computed goto where the
+    compiler has one, so each instruction ends with its own jump to the
+    next one instead of all of them going back through one switch.
+
+    A string is counted. A register that is written releases the string
+    that it had, and a call releases the strings in its registers when it
+    returns. A string that only one register has is appended to in place.
+    An object is counted the same way, and it releases its fields when it
+    is freed. Objects that refer to each other in a ring are not freed.
+
+    A field or a method of an object is found by its name, in the layout
+    of the class of the object, by the site of the instruction. The site
+    keeps what it found for each class that it has seen in its inline
+    cache, so the next time that it sees one of them it takes the slot
+    from there without a lookup. Most sites only ever see one class, and
+    that one is checked first, in line. The methods of a class that an
+    imported module defines are in the program of that module, so a call
+    of one runs there, and each frame keeps the program of its function.
+
+    An error, such as a division by zero, goes to the except block of the
+    innermost try in the function. If there is none the call ends and the
+    error goes on to its caller.
+*/
+#define LOG_MODULE LOG_MOD_VM
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <time.h>
+
+#include "logging.h"
+#include "stats.h"
+#include "layout.h"
+#include "codegen.h"
+#include "vm.h"
+
+#define MAX_FRAMES 4096
+
+typedef struct
+{
+    const vm_program_t *prog; // the program that has func
+    const vm_func_t *func;
+    const uint32_t *ret; // where the caller goes on
+    size_t base;         // the first register in the stack
+    int64_t handler;     // the except block in the code plus one, or 0
+    uint8_t dst;         // the register of the caller that gets the result
+} frame_t;
+
+// a string register that has not been written has the empty string
+static vm_str_t empty_str = {-1, 0, 0};
+
+// each thread runs its own calls
+static _Thread_local vm_value_t *stack = NULL;
+static _Thread_local size_t stack_size = 0;
+static _Thread_local frame_t *frames = NULL;
+
+static void grow_stack(size_t size)
+{
+    size_t old = stack_size;
+
+    if (size <= stack_size)
+        return;
+    if (stack_size == 0)
+        stack_size = 4096;
+    while (stack_size < size)
+        stack_size *= 2;
+    if (NULL == (stack = realloc(stack, stack_size * sizeof(vm_value_t))))
+        FATAL("cannot allocate memory for the VM stack");
+    memset(&stack[old], 0, (stack_size - old) * sizeof(vm_value_t));
+}
+
+void destroy_vm(void)
+{
+    free(stack);
+    free(frames);
+    stack = NULL;
+    frames = NULL;
+    stack_size = 0;
+}
+
+const char *vm_status_str(vm_status_t status)
+{
+    switch (status)
+    {
+    case VM_OK:
+        return "ok";
+    case VM_ERR_DIV_ZERO:
+        return "division by zero";
+    case VM_ERR_STACK:
+        return "too many nested calls";
+    case VM_ERR_BAD_FUNC:
+        return "no such function";
+    case VM_ERR_NULL:
+        return "no object";
+    case VM_ERR_MEMBER:
+        return "no such member";
+    case VM_ERR_CLASS:
+        return "no such class";
+    }
+    return "unknown error";
+}
+
+/*
+    The strings.
+*/
+static vm_str_t *new_str(size_t cap)
+{
+    vm_str_t *s;
+
+    if (NULL == (s = malloc(sizeof(vm_str_t) + cap + 1)))
+        FATAL("cannot allocate memory for a string");
+    s->refs = 1;
+    s->len = 0;
+    s->cap = cap;
+    return s;
+}
+
+static inline void retain_str(vm_str_t *s)
+{
+    if (s != NULL && s->refs >= 0)
+        s->refs++;
+}
+
+void release_vm_str(vm_str_t *s)
+{
+    if (s != NULL && s->refs > 0 && --s->refs == 0)
+        free(s);
+}
+
+static inline void set_str(vm_value_t *reg, vm_str_t *s)
+{
+    release_vm_str(reg->s);
+    reg->s = s;
+}
+
+static vm_str_t *format_str(const char *fmt, ...) __attribute__((format(printf, 1, 2)));
+
+static vm_str_t *format_str(const char *fmt, ...)
+{
+    char buf[64];
+    va_list ap;
+    vm_str_t *s;
+    int len;
+
+    va_start(ap, fmt);
+    len = vsnprintf(buf, sizeof(buf), fmt, ap);
+    va_end(ap);
+    s = new_str(len);
+    memcpy(s->data, buf, len + 1);
+    s->len = len;
+    return s;
+}
+
+/*
+    a + b into the register. The string in the register is appended to if
+    nothing else has it.
+*/
+static void concat(vm_value_t *reg, vm_str_t *a, vm_str_t *b)
+{
+    vm_str_t *s;
+    size_t len = (size_t)a->len + b->len;
+    size_t cap;
+
+    if (reg->s == a && a->refs == 1 && a != b)
+    {
+        if (len > a->cap)
+        {
+            cap = (len > 2 * (size_t)a->cap) ? len : 2 * (size_t)a->cap;
+            if (NULL == (s = realloc(a, sizeof(vm_str_t) + cap + 1)))
+                FATAL("cannot allocate memory for a string");
+            s->cap = cap;
+            reg->s = a = s;
+        }
+        memcpy(&a->data[a->len], b->data, b->len);
+        a->len = len;
+        a->data[len] = 0;
+        return;
+    }
+
+    s = new_str(len);
+    memcpy(s->data, a->data, a->len);
+    memcpy(&s->data[a->len], b->data, b->len);
+    s->len = len;
+    s->data[len] = 0;
+    set_str(reg, s);
+}
+
+static int compare_str(const vm_str_t *a, const vm_str_t *b)
+{
+    uint32_t len = (a->len < b->len) ? a->len : b->len;
+    int cmp = memcmp(a->data, b->data, len);
+
+    if (cmp != 0)
+        return cmp;
+    return (a->len > b->len) - (a->len < b->len);
+}
+
+/*
+    The objects. The fields of an object start as 0, the empty string or no
+    object, by the types of the members of its class.
+*/
+static vm_obj_t *new_obj(const class_layout_t *cls)
+{
+    const class_member_t *m;
+    vm_obj_t *o;
+    int i;
+
+    if (NULL == (o = malloc(sizeof(vm_obj_t) + cls->size)))
+        FATAL("cannot allocate memory for an object");
+    o->refs = 1;
+    o->num_fields = cls->size / sizeof(vm_value_t);
+    o->cls = cls;
+    memset(o->fields, 0, cls->size);
+    for (i = 0, m = cls->members; i < cls->num_members; i++, m++)
+        if (m->kind != FUNC_SYMBOL && m->type == TYPEOF_STR)
+            o->fields[m->slot / sizeof(vm_value_t)].s = &empty_str;
+    return o;
+}
+
+static inline void retain_obj(vm_obj_t *o)
+{
+    if (o != NULL)
+        o->refs++;
+}
+
+static void release_obj(vm_obj_t *o)
+{
+    const class_member_t *m;
+    vm_value_t *field;
+    int i;
+
+    if (o == NULL || --o->refs > 0)
+        return;
+    for (i = 0, m = o->cls->members; i < o->cls->num_members; i++, m++)
+    {
+        field = &o->fields[m->slot / sizeof(vm_value_t)];
+        if (m->kind == FUNC_SYMBOL)
+            continue;
+        if (m->type == TYPEOF_STR)
+            release_vm_str(field->s);
+        else if (m->type == TYPEOF_COMPLEX)
+            release_obj(field->o);
+    }
+    free(o);
+}
+
+static inline void set_obj(vm_value_t *reg, vm_obj_t *o)
+{
+    release_obj(reg->o);
+    reg->o = o;
+}
+
+/*
+    The inline caches. The first way of a cache is checked in the
+    instruction and the rest here. A site that has seen CACHE_WAYS classes
+    already looks up every other class each time.
+*/
+static vm_type_t member_type(const class_member_t *m)
+{
+    switch (m->type)
+    {
+    case TYPEOF_INT:
+        return VM_INT;
+    case TYPEOF_UINT:
+        return VM_UINT;
+    case TYPEOF_FLOAT:
+        return VM_FLOAT;
+    case TYPEOF_STR:
+        return VM_STR;
+    default:
+        return VM_OBJ;
+    }
+}
+
+/*
+    Find what the site refers to in the class. The slot of a field is its
+    index in the object and the slot of a method is the index of its
+    function in owner, the program of the module that defines the class
+    that has the method. Returns 0 if it is not there.
+*/
+static int find_site(const vm_program_t *prog, const vm_site_t *site, const class_layout_t *cls, uint32_t *slot,
+                     const vm_program_t **owner)
+{
+    const class_member_t *m;
+    int i;
+
+    *owner = prog;
+    if (NULL == (m = find_member(cls, VM_SITE_NAME(prog, site))))
+        return 0;
+    if (site->kind == SITE_FIELD)
+    {
+        if (m->kind == FUNC_SYMBOL || member_type(m) != site->type)
+            return 0;
+        *slot = m->slot / sizeof(vm_value_t);
+        return 1;
+    }
+    if (m->kind != FUNC_SYMBOL)
+        return 0;
+    if (m->owner->module != NULL && NULL == (*owner = module_program(m->owner->module)))
+        return 0;
+    if ((i = find_program_function(*owner, m->sym)) < 0 || !check_method(*owner, i, prog, site))
+        return 0;
+    *slot = i;
+    return 1;
+}
+
+static int cache_lookup(const vm_program_t *prog, uint32_t index, const class_layout_t *cls, uint32_t *slot,
+                        const vm_program_t **owner)
+{
+    const vm_site_t *site = &prog->sites[index];
+    vm_cache_t *cache = &prog->caches[index];
+    uint32_t i;
+
+    for (i = 1; i < cache->num; i++)
+    {
+        if (cache->cls[i] == cls)
+        {
+            cache->hits++;
+            *slot = cache->slot[i];
+            *owner = cache->prog[i];
+            return 1;
+        }
+    }
+
+    cache->misses++;
+    if (site->kind == SITE_CLASS)
+    {
+        if (NULL == (cls = get_class_layout(VM_SITE_NAME(prog, site))))
+            return 0;
+        *slot = 0;
+        *owner = prog;
+    }
+    else if (!find_site(prog, site, cls, slot, owner))
+        return 0;
+    if (cache->num < CACHE_WAYS)
+    {
+        DEBUG(5, "site %u: %s in %s is %u", index, VM_SITE_NAME(prog, site), cls->name, *slot);
+        cache->cls[cache->num] = cls;
+        cache->prog[cache->num] = *owner;
+        cache->slot[cache->num++] = *slot;
+    }
+    return 1;
+}
+
+/*
+    Add the counts of the caches to the statistics and start them again.
+*/
+static void count_caches(const vm_program_t *prog)
+{
+    vm_cache_t *cache;
+    uint32_t i;
+
+    for (i = 0; i < prog->num_sites; i++)
+    {
+        cache = &prog->caches[i];
+        if (cache->hits + cache->misses == 0)
+            continue;
+        DEBUG(2, "site %u %s: %u classes, %u hits, %u misses", i, VM_SITE_NAME(prog, &prog->sites[i]), cache->num,
+              cache->hits, cache->misses);
+        STAT_COUNT(STAT_CACHE_HITS, cache->hits);
+        STAT_COUNT(STAT_CACHE_MISSES, cache->misses);
+        cache->hits = cache->misses = 0;
+    }
+}
+
+/*
+    The registers of a call start as 0, the empty string and no object. The
+    string registers of a function are listed first and then its object
+    registers.
+*/
+static void clear_regs(const vm_program_t *prog, const vm_func_t *fn, vm_value_t *regs)
+{
+    const uint8_t *str_regs = &prog->str_regs[fn->str_regs];
+    uint16_t i;
+
+    memset(&regs[fn->num_inputs], 0, (fn->num_regs - fn->num_inputs) * sizeof(vm_value_t));
+    for (i = 0; i < fn->num_str_regs; i++)
+        if (str_regs[i] >= fn->num_inputs)
+            regs[str_regs[i]].s = &empty_str;
+}
+
+static void release_regs(const vm_program_t *prog, const frame_t *f)
+{
+    const uint8_t *regs = &prog->str_regs[f->func->str_regs];
+    uint16_t i;
+
+    for (i = 0; i < f->func->num_str_regs; i++)
+    {
+        release_vm_str(stack[f->base + regs[i]].s);
+        stack[f->base + regs[i]].s = NULL;
+    }
+    for (; i < f->func->num_str_regs + f->func->num_obj_regs; i++)
+    {
+        release_obj(stack[f->base + regs[i]].o);
+        stack[f->base + regs[i]].o = NULL;
+    }
+}
+
+static void retain_input(const vm_program_t *prog, const vm_func_t *fn, vm_value_t *reg, uint8_t input)
+{
+    const uint8_t *regs = &prog->str_regs[fn->str_regs];
+    const uint8_t *at = memchr(regs, input, fn->num_str_regs + fn->num_obj_regs);
+
+    if (at == NULL)
+        return;
+    if (at - regs < fn->num_str_regs)
+        retain_str(reg->s);
+    else
+        retain_obj(reg->o);
+}
+
+/*
+    Call the function with the arguments and put its first output in the
+    result. A string or an object in the result belongs to the caller. The
+    number of instructions that ran is added to the count.
+*/
+vm_status_t vm_call(const vm_program_t *prog, int func, const vm_value_t *args, vm_value_t *result,
+                    uint64_t *count)
+{
+#ifdef __GNUC__
+#define LABEL(name) &&L_##name,
+    static const void *const labels[] = {OPCODES(LABEL)};
+#undef LABEL
+#define OP(name) L_##name:
+#define NEXT()                        \
+    do                                \
+    {                                 \
+        ins = *pc++;                  \
+        n++;                          \
+        goto *labels[OPCODE(ins)];    \
+    } while (0)
+#else
+#define OP(name) case OP_##name:
+#define NEXT() goto next
+#endif
+#define RA regs[ARG_A(ins)]
+#define RB regs[ARG_B(ins)]
+#define RC regs[ARG_C(ins)]
+    // the slot of the site C for the class, from the first way of its cache
+    // or from cache_lookup()
+#define FIND(obj, site)                                                        \
+    do                                                                         \
+    {                                                                          \
+        if (NULL == (obj))                                                     \
+            goto no_object;                                                    \
+        cache = &caches[fn->sites + (site)];                                   \
+        if (cache->cls[0] == (obj)->cls)                                       \
+        {                                                                      \
+            cache->hits++;                                                     \
+            slot = cache->slot[0];                                             \
+        }                                                                      \
+        else if (!cache_lookup(prog, fn->sites + (site), (obj)->cls, &slot,    \
+                               &callee))                                       \
+            goto no_member;                                                    \
+    } while (0)
+    // run in the program of the function that a call goes to or returns to
+#define USE_PROGRAM(p)          \
+    do                          \
+    {                           \
+        prog = (p);             \
+        consts = prog->consts;  \
+        caches = prog->caches;  \
+        code = prog->code;      \
+    } while (0)
+
+    const vm_program_t *callee;
+    const vm_value_t *consts = prog->consts;
+    vm_cache_t *caches = prog->caches;
+    vm_cache_t *cache;
+    vm_obj_t *obj;
+    const uint32_t *code = prog->code;
+    const vm_func_t *fn;
+    const uint32_t *pc;
+    vm_value_t *regs;
+    vm_value_t ret;
+    frame_t *f;
+    uint32_t ins, slot;
+    uint64_t n = 0;
+    int num_frames = 0;
+    vm_status_t status;
+    size_t base;
+    int i, type;
+
+    if (func < 0 || (uint32_t)func >= prog->num_funcs)
+        return VM_ERR_BAD_FUNC;
+    if (frames == NULL && NULL == (frames = malloc(MAX_FRAMES * sizeof(frame_t))))
+        FATAL("cannot allocate memory for the VM frames");
+
+    fn = &prog->funcs[func];
+    grow_stack(fn->num_regs + MAX_REGS);
+    regs = stack;
+    clear_regs(prog, fn, regs);
+    for (i = 0; i < fn->num_inputs; i++)
+    {
+        regs[i] = args[i];
+        retain_input(prog, fn, &regs[i], i);
+    }
+    f = &frames[num_frames++];
+    f->prog = prog;
+    f->func = fn;
+    f->ret = NULL;
+    f->base = 0;
+    f->handler = 0;
+    pc = &code[fn->code];
+    memset(result, 0, sizeof(*result));
+
+#ifdef __GNUC__
+    NEXT();
+#else
+next:
+    ins = *pc++;
+    n++;
+    switch (OPCODE(ins))
+    {
+#endif
+
+OP(NOP)
+    NEXT();
+OP(MOVE)
+    RA = RB;
+    NEXT();
+OP(MOVES)
+    retain_str(RB.s);
+    set_str(&RA, RB.s);
+    NEXT();
+OP(MOVEO)
+    retain_obj(RB.o);
+    set_obj(&RA, RB.o);
+    NEXT();
+OP(LOADI)
+    RA.i = ARG_SBX(ins);
+    NEXT();
+OP(LOADK)
+    RA = consts[ARG_BX(ins)];
+    NEXT();
+OP(LOADS)
+    set_str(&RA, VM_STR_CONST(prog, consts[ARG_BX(ins)]));
+    NEXT();
+
+    // int and uint wrap around, so the sums are done unsigned
+OP(ADDI)
+    RA.u = RB.u + RC.u;
+    NEXT();
+OP(SUBI)
+    RA.u = RB.u - RC.u;
+    NEXT();
+OP(MULI)
+    RA.u = RB.u * RC.u;
+    NEXT();
+OP(DIVI)
+    if (RC.i == 0)
+        goto div_zero;
+    RA.i = (RC.i == -1) ? (int64_t)(0 - RB.u) : RB.i / RC.i;
+    NEXT();
+OP(MODI)
+    if (RC.i == 0)
+        goto div_zero;
+    RA.i = (RC.i == -1) ? 0 : RB.i % RC.i;
+    NEXT();
+OP(DIVU)
+    if (RC.u == 0)
+        goto div_zero;
+    RA.u = RB.u / RC.u;
+    NEXT();
+OP(MODU)
+    if (RC.u == 0)
+        goto div_zero;
+    RA.u = RB.u % RC.u;
+    NEXT();
+OP(ADDIK)
+    RA.u = RB.u + (uint64_t)(int64_t)ARG_SC(ins);
+    NEXT();
+OP(ADDF)
+    RA.f = RB.f + RC.f;
+    NEXT();
+OP(SUBF)
+    RA.f = RB.f - RC.f;
+    NEXT();
+OP(MULF)
+    RA.f = RB.f * RC.f;
+    NEXT();
+OP(DIVF)
+    RA.f = RB.f / RC.f;
+    NEXT();
+OP(NEGI)
+    RA.u = 0 - RB.u;
+    NEXT();
+OP(NEGF)
+    RA.f = -RB.f;
+    NEXT();
+OP(NOT)
+    RA.i = (RB.u == 0);
+    NEXT();
+OP(BNOT)
+    RA.u = ~RB.u;
+    NEXT();
+OP(BAND)
+    RA.u = RB.u & RC.u;
+    NEXT();
+OP(BOR)
+    RA.u = RB.u | RC.u;
+    NEXT();
+OP(BXOR)
+    RA.u = RB.u ^ RC.u;
+    NEXT();
+OP(SHL)
+    RA.u = RB.u << (RC.u & 63);
+    NEXT();
+OP(SHRI)
+    RA.i = RB.i >> (RC.u & 63);
+    NEXT();
+OP(SHRU)
+    RA.u = RB.u >> (RC.u & 63);
+    NEXT();
+OP(LAND)
+    RA.i = (RB.u != 0 && RC.u != 0);
+    NEXT();
+OP(LOR)
+    RA.i = (RB.u != 0 || RC.u != 0);
+    NEXT();
+OP(EQI)
+    RA.i = (RB.u == RC.u);
+    NEXT();
+OP(NEI)
+    RA.i = (RB.u != RC.u);
+    NEXT();
+OP(LTI)
+    RA.i = (RB.i < RC.i);
+    NEXT();
+OP(LEI)
+    RA.i = (RB.i <= RC.i);
+    NEXT();
+OP(LTU)
+    RA.i = (RB.u < RC.u);
+    NEXT();
+OP(LEU)
+    RA.i = (RB.u <= RC.u);
+    NEXT();
+OP(EQF)
+    RA.i = (RB.f == RC.f);
+    NEXT();
+OP(NEF)
+    RA.i = (RB.f != RC.f);
+    NEXT();
+OP(LTF)
+    RA.i = (RB.f < RC.f);
+    NEXT();
+OP(LEF)
+    RA.i = (RB.f <= RC.f);
+    NEXT();
+OP(EQS)
+    RA.i = (RB.s->len == RC.s->len && !memcmp(RB.s->data, RC.s->data, RB.s->len));
+    NEXT();
+OP(NES)
+    RA.i = !(RB.s->len == RC.s->len && !memcmp(RB.s->data, RC.s->data, RB.s->len));
+    NEXT();
+OP(LTS)
+    RA.i = (compare_str(RB.s, RC.s) < 0);
+    NEXT();
+OP(LES)
+    RA.i = (compare_str(RB.s, RC.s) <= 0);
+    NEXT();
+OP(ITOF)
+    RA.f = (double)RB.i;
+    NEXT();
+OP(UTOF)
+    RA.f = (double)RB.u;
+    NEXT();
+OP(FTOI)
+    RA.i = (int64_t)RB.f;
+    NEXT();
+OP(ITOS)
+    set_str(&RA, format_str("%lld", (long long)RB.i));
+    NEXT();
+OP(UTOS)
+    set_str(&RA, format_str("%llu", (unsigned long long)RB.u));
+    NEXT();
+OP(FTOS)
+    set_str(&RA, format_str("%g", RB.f));
+    NEXT();
+OP(CONCAT)
+    concat(&RA, RB.s, RC.s);
+    NEXT();
+
+OP(JMP)
+    pc += ARG_SBX(ins);
+    NEXT();
+OP(JMPF)
+    if (RA.u == 0)
+        pc += ARG_SBX(ins);
+    NEXT();
+OP(JMPT)
+    if (RA.u != 0)
+        pc += ARG_SBX(ins);
+    NEXT();
+
+    // the arguments go where the registers of the call will start
+OP(ARG)
+    regs[fn->num_regs + ARG_B(ins)] = RA;
+    NEXT();
+OP(ARGS)
+    retain_str(RA.s);
+    regs[fn->num_regs + ARG_B(ins)] = RA;
+    NEXT();
+OP(ARGO)
+    retain_obj(RA.o);
+    regs[fn->num_regs + ARG_B(ins)] = RA;
+    NEXT();
+OP(CALLM)
+    // the method is found in the class of B, and the call goes on as a CALL
+    // in the program that has the method
+    if (NULL == RB.o)
+        goto no_object;
+    cache = &caches[fn->sites + ARG_C(ins)];
+    if (cache->cls[0] == RB.o->cls)
+    {
+        cache->hits++;
+        slot = cache->slot[0];
+        callee = cache->prog[0];
+    }
+    else if (!cache_lookup(prog, fn->sites + ARG_C(ins), RB.o->cls, &slot, &callee))
+        goto no_member;
+    goto call;
+OP(CALL)
+    slot = ARG_BX(ins);
+    callee = prog;
+call:
+    if (num_frames == MAX_FRAMES)
+    {
+        status = VM_ERR_STACK;
+        goto error;
+    }
+    f->ret = pc;
+    f->dst = ARG_A(ins);
+    base = f->base + fn->num_regs;
+    if (callee != prog)
+        USE_PROGRAM(callee);
+    fn = &prog->funcs[slot];
+    grow_stack(base + fn->num_regs + MAX_REGS);
+    f = &frames[num_frames++];
+    f->prog = prog;
+    f->func = fn;
+    f->base = base;
+    f->handler = 0;
+    regs = &stack[base];
+    clear_regs(prog, fn, regs);
+    pc = &code[fn->code];
+    NEXT();
+OP(NEW)
+    cache = &caches[fn->sites + ARG_BX(ins)];
+    if (cache->num > 0)
+        cache->hits++;
+    else if (!cache_lookup(prog, fn->sites + ARG_BX(ins), NULL, &slot, &callee))
+        goto no_class;
+    set_obj(&RA, new_obj(cache->cls[0]));
+    NEXT();
+OP(GETF)
+    obj = RB.o;
+    FIND(obj, ARG_C(ins));
+    RA = obj->fields[slot];
+    NEXT();
+OP(GETFS)
+    obj = RB.o;
+    FIND(obj, ARG_C(ins));
+    retain_str(obj->fields[slot].s);
+    set_str(&RA, obj->fields[slot].s);
+    NEXT();
+OP(GETFO)
+    obj = RB.o;
+    FIND(obj, ARG_C(ins));
+    retain_obj(obj->fields[slot].o);
+    set_obj(&RA, obj->fields[slot].o);
+    NEXT();
+OP(SETF)
+    obj = RA.o;
+    FIND(obj, ARG_C(ins));
+    obj->fields[slot] = RB;
+    NEXT();
+OP(SETFS)
+    obj = RA.o;
+    FIND(obj, ARG_C(ins));
+    retain_str(RB.s);
+    set_str(&obj->fields[slot], RB.s);
+    NEXT();
+OP(SETFO)
+    obj = RA.o;
+    FIND(obj, ARG_C(ins));
+    retain_obj(RB.o);
+    set_obj(&obj->fields[slot], RB.o);
+    NEXT();
+
+OP(RET)
+    ret = RA;
+    if ((type = fn->result_type) == VM_STR)
+        retain_str(ret.s);
+    else if (type == VM_OBJ)
+        retain_obj(ret.o);
+    release_regs(prog, f);
+    if (--num_frames == 0)
+    {
+        *result = ret;
+        goto done;
+    }
+    f = &frames[num_frames - 1];
+    if (f->prog != prog)
+        USE_PROGRAM(f->prog);
+    fn = f->func;
+    regs = &stack[f->base];
+    pc = f->ret;
+    if (type == VM_STR)
+        set_str(&regs[f->dst], ret.s);
+    else if (type == VM_OBJ)
+        set_obj(&regs[f->dst], ret.o);
+    else
+        regs[f->dst] = ret;
+    NEXT();
+OP(RET0)
+    release_regs(prog, f);
+    if (--num_frames == 0)
+        goto done;
+    f = &frames[num_frames - 1];
+    if (f->prog != prog)
+        USE_PROGRAM(f->prog);
+    fn = f->func;
+    regs = &stack[f->base];
+    pc = f->ret;
+    NEXT();
+
+OP(TRY)
+    RA.i = f->handler;
+    f->handler = (pc - code) + ARG_SBX(ins) + 1;
+    NEXT();
+OP(ENDTRY)
+    f->handler = RA.i;
+    NEXT();
+
+#ifndef __GNUC__
+    }
+#endif
+
+div_zero:
+    status = VM_ERR_DIV_ZERO;
+    goto error;
+no_object:
+    status = VM_ERR_NULL;
+    goto error;
+no_member:
+    status = VM_ERR_MEMBER;
+    goto error;
+no_class:
+    status = VM_ERR_CLASS;
+error:
+    while (num_frames > 0)
+    {
+        f = &frames[num_frames - 1];
+        if (f->prog != prog)
+            USE_PROGRAM(f->prog);
+        fn = f->func;
+        regs = &stack[f->base];
+        // the handler comes from a register, so it is checked
+        if (f->handler > fn->code && f->handler <= fn->code + fn->code_len)
+        {
+            DEBUG(5, "%s: %s is handled", VM_FUNC_NAME(prog, fn), vm_status_str(status));
+            pc = &code[f->handler - 1];
+            NEXT();
+        }
+        release_regs(prog, f);
+        num_frames--;
+    }
+    if (count != NULL)
+        *count += n;
+    return status;
+
+done:
+    if (count != NULL)
+        *count += n;
+    return VM_OK;
+
+#undef OP
+#undef NEXT
+#undef RA
+#undef RB
+#undef RC
+#undef FIND
+#undef USE_PROGRAM
+}
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/*
+    Run each function with no inputs whose name starts with "bench" in the
+    programs of the modules and print how long it took.
+*/
+void run_benchmarks(void)
+{
+    const vm_program_t *prog;
+    const vm_func_t *fn;
+    const module_t *mod;
+    const char *name, *end;
+    vm_value_t result;
+    vm_status_t status;
+    uint64_t count, start, ns;
+    uint32_t i;
+    int len;
+
+    for (mod = first_module(); mod != NULL; mod = mod->next)
+    {
+        if (NULL == (prog = module_program(mod->name)))
+            continue;
+        for (i = 0; i < prog->num_funcs; i++)
+        {
+            fn = &prog->funcs[i];
+            end = strchr(VM_FUNC_NAME(prog, fn), '(');
+            for (name = end; name > VM_FUNC_NAME(prog, fn) && name[-1] != '@'; name--)
+                ;
+            len = end - name;
+            if (fn->num_inputs != 0 || len < 5 || strncmp(name, "bench", 5))
+                continue;
+
+            count = 0;
+            start = now_ns();
+            status = vm_call(prog, i, NULL, &result, &count);
+            ns = now_ns() - start;
+            if (status != VM_OK)
+            {
+                printf("%-20.*s %s\n", len, name, vm_status_str(status));
+                continue;
+            }
+
+            printf("%-20.*s %12llu instructions %9.2f ms %8.1f M/s  ", len, name, (unsigned long long)count,
+                   ns / 1e6, (ns > 0) ? count * 1e3 / ns : 0.0);
+            switch (fn->result_type)
+            {
+            case VM_INT:
+                printf("%lld\n", (long long)result.i);
+                break;
+            case VM_UINT:
+                printf("%llu\n", (unsigned long long)result.u);
+                break;
+            case VM_FLOAT:
+                printf("%g\n", result.f);
+                break;
+            case VM_STR:
+                printf("%u characters\n", result.s->len);
+                release_vm_str(result.s);
+                break;
+            case VM_OBJ:
+                printf("%s\n", (result.o == NULL) ? "no object" : result.o->cls->name);
+                release_obj(result.o);
+                break;
+            default:
+                printf("\n");
+                break;
+            }
+        }
+        count_caches(prog);
+    }
+    fflush(stdout);
+}
@@ -0,0 +1,26 @@
+#ifndef _VM_H_
+#define _VM_H_
+
+#include <stdint.h>
+
+#include "bytecode.h"
+
+typedef enum
+{
+    VM_OK,
+    VM_ERR_DIV_ZERO,
+    VM_ERR_STACK,
+    VM_ERR_BAD_FUNC,
+    VM_ERR_NULL,   // a member of no object
+    VM_ERR_MEMBER, // the class of the object does not have the member
+    VM_ERR_CLASS,  // the class of NEW is not defined
+} vm_status_t;
+
+vm_status_t vm_call(const vm_program_t *prog, int func, const vm_value_t *args, vm_value_t *result,
+                    uint64_t *count);
+const char *vm_status_str(vm_status_t status);
+void release_vm_str(vm_str_t *s);
+void run_benchmarks(void);
+void destroy_vm(void);
+
+#endif /* _VM_H_ */
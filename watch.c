@@ -0,0 +1,234 @@
+/*
+    Watch mode.
+
+    The file given on the command line is compiled once, and then the
+    directories of it and of every module that it imports are watched with
+    inotify. When a file in one of them is written, the modules stay in
+    memory and rebuild_modules() parses only the modules that changed and
+    the modules that import them. The errors for the new source are printed
+    as soon as the parse is done.
+
+    Only the events for module sources count. The interface and bytecode
+    files that a rebuild writes are in the same directories, and reacting to
+    them would rebuild again and again. A module with errors is only parsed
+    again when its source changes, or when a source is added or removed,
+    which could satisfy an import that was not found.
+
+    Directories are watched instead of files because most editors save a
+    file by writing a new one and renaming it over the old one, which would
+    remove a watch on the file. Saving a file usually causes several events,
+    so the events that arrive close together are handled with one rebuild.
+
+    Only one file can be watched because it owns the top level context.
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <poll.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/inotify.h>
+
+#include "logging.h"
+#include "errors.h"
+#include "hash_table.h"
+#include "modules.h"
+#include "import_def.h"
+#include "search_path.h"
+#include "watch.h"
+
+#define WATCH_EVENTS (IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE | IN_DELETE | IN_MOVED_FROM)
+// what read_events() found
+#define WATCH_CHANGED 1
+#define WATCH_ADDED 2
+// how long to wait for more events after the first one, in milliseconds
+#define SETTLE_TIME 5
+
+static volatile sig_atomic_t stop_watch = 0;
+
+static void on_signal(int sig)
+{
+    (void)sig;
+    stop_watch = 1;
+}
+
+static double elapsed_ms(struct timespec *start)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - start->tv_sec) * 1000.0 + (now.tv_nsec - start->tv_nsec) / 1000000.0;
+}
+
+/*
+    Add a watch for the directory of every module that is not watched yet.
+    The dirs table is used as a set.
+*/
+static void watch_modules(int fd, ht_handle_t dirs)
+{
+    module_t *mod;
+    char *dir, *end;
+
+    ENTER();
+    for (mod = first_module(); mod != NULL; mod = mod->next)
+    {
+        if (NULL != (end = strrchr(mod->fname, '/')))
+            dir = strndup(mod->fname, (end == mod->fname) ? 1 : end - mod->fname);
+        else
+            dir = strdup(".");
+
+        if (dir == NULL)
+            FATAL("cannot allocate memory for directory name");
+
+        if (hash_find(dirs, dir) == NULL)
+        {
+            if (inotify_add_watch(fd, dir, WATCH_EVENTS) < 0)
+                ERROR("cannot watch %s: %s", dir, strerror(errno));
+            else
+                INFO("watching %s", dir);
+            hash_save(dirs, dir, dirs);
+        }
+        free(dir);
+    }
+    RET();
+}
+
+/*
+    Return true if the file could be the source of a module: a file with
+    the module extension or the file of a module that is already loaded.
+    The interface and bytecode files that a rebuild writes, the temporary
+    files that they are written to and the backups that editors make are
+    not.
+*/
+static int is_source(const char *name)
+{
+    const module_t *mod;
+    const char *base;
+    size_t len = strlen(name);
+
+    if (name[0] == '.' || name[len - 1] == '~')
+        return 0;
+    if (len > strlen(MODULE_EXT) && !strcmp(&name[len - strlen(MODULE_EXT)], MODULE_EXT))
+        return 1;
+
+    for (mod = first_module(); mod != NULL; mod = mod->next)
+    {
+        base = strrchr(mod->fname, '/');
+        if (!strcmp((base == NULL) ? mod->fname : base + 1, name))
+            return 1;
+    }
+    return 0;
+}
+
+/*
+    Read the events that are waiting. Returns WATCH_CHANGED if the source
+    of a module could have changed, with WATCH_ADDED if a source was added
+    or removed, 0 if nothing happened to a source and -1 if the watch
+    failed.
+*/
+static int read_events(int fd)
+{
+    char buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+    const struct inotify_event *ev;
+    ssize_t len;
+    char *ptr;
+    int retv = 0;
+
+    if ((len = read(fd, buf, sizeof(buf))) < 0)
+        return (errno == EINTR || errno == EAGAIN) ? 0 : -1;
+
+    for (ptr = buf; ptr < buf + len; ptr += sizeof(struct inotify_event) + ev->len)
+    {
+        ev = (const struct inotify_event *)ptr;
+        if (ev->len > 0 && is_source(ev->name))
+        {
+            DEBUG(2, "watch event 0x%x on %s", ev->mask, ev->name);
+            retv |= WATCH_CHANGED;
+            if (ev->mask & (IN_CREATE | IN_MOVED_TO | IN_DELETE | IN_MOVED_FROM))
+                retv |= WATCH_ADDED;
+        }
+    }
+    return retv;
+}
+
+/*
+    Compile the file and recompile it every time that it or one of its
+    imports changes, until the process is told to stop. Returns 1 if there
+    were errors in the last compile. The per compile state must already be
+    set up in this thread.
+*/
+int run_watch(const char *fname)
+{
+    struct pollfd pfd;
+    struct sigaction sa;
+    struct timespec start;
+    ht_handle_t dirs;
+    int fd, changed, count;
+
+    ENTER();
+    if ((fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC)) < 0)
+    {
+        fprintf(stderr, "cannot start inotify: %s\n", strerror(errno));
+        VRET(1);
+    }
+
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = on_signal;
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    compile_file(fname);
+    flush_diagnostics();
+    flush_logging();
+    printf("watch: compiled %s in %.1f ms with %d errors\n", fname, elapsed_ms(&start), error_count());
+    fflush(stdout);
+
+    dirs = create_hash_table(31);
+    watch_modules(fd, dirs);
+
+    pfd.fd = fd;
+    pfd.events = POLLIN;
+    while (!stop_watch)
+    {
+        if (poll(&pfd, 1, -1) <= 0)
+            continue;
+
+        // let the rest of the events for the save arrive
+        changed = 0;
+        do
+        {
+            if ((count = read_events(fd)) < 0)
+            {
+                ERROR("cannot read inotify events: %s", strerror(errno));
+                stop_watch = 1;
+            }
+            else
+                changed |= count;
+        } while (!stop_watch && poll(&pfd, 1, SETTLE_TIME) > 0);
+
+        if (!changed)
+            continue;
+
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        reset_errors();
+        // a new file could satisfy an import that was not found
+        if (changed & WATCH_ADDED)
+            flush_search_path();
+        count = rebuild_modules(changed & WATCH_ADDED);
+        flush_diagnostics();
+        if (count > 0)
+        {
+            flush_logging();
+            printf("watch: rebuilt %d modules in %.1f ms with %d errors\n", count, elapsed_ms(&start), error_count());
+            fflush(stdout);
+        }
+        watch_modules(fd, dirs);
+    }
+
+    destroy_hash_table(dirs);
+    close(fd);
+    VRET(error_count() > 0);
+}